@@ -80,6 +80,7 @@ namespace Orthanc
 
       assert(currentSize_ >= size);
       currentSize_ -= size;
+      evictions_++;
     }
 
     // Post-condition: "currentSize_ <= targetSize"
@@ -88,7 +89,10 @@ namespace Orthanc
 
   MemoryObjectCache::MemoryObjectCache() :
     currentSize_(0),
-    maxSize_(100 * 1024 * 1024)  // 100 MB
+    maxSize_(100 * 1024 * 1024),  // 100 MB
+    hits_(0),
+    misses_(0),
+    evictions_(0)
   {
   }
 
@@ -220,6 +224,20 @@ namespace Orthanc
   }
 
 
+  void MemoryObjectCache::GetStatistics(uint64_t& hits,
+                                        uint64_t& misses,
+                                        uint64_t& evictions)
+  {
+#if !defined(__EMSCRIPTEN__)
+    boost::mutex::scoped_lock lock(cacheMutex_);
+#endif
+
+    hits = hits_;
+    misses = misses_;
+    evictions = evictions_;
+  }
+
+
   MemoryObjectCache::Accessor::Accessor(MemoryObjectCache& cache,
                                         const std::string& key,
                                         bool unique) :
@@ -243,6 +261,11 @@ namespace Orthanc
     if (cache.content_.Contains(key, item_))
     {
       cache.content_.MakeMostRecent(key);
+      cache.hits_++;
+    }
+    else
+    {
+      cache.misses_++;
     }
     
 #if !defined(__EMSCRIPTEN__)
@@ -61,6 +61,11 @@ namespace Orthanc
     size_t maxSize_;
     LeastRecentlyUsedIndex<std::string, Item*>  content_;
 
+    // Statistics about the usage of the cache (new in Orthanc 1.11.2)
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t evictions_;
+
     void Recycle(size_t targetSize);
     
   public:
@@ -81,6 +86,10 @@ namespace Orthanc
 
     void Invalidate(const std::string& key);
 
+    void GetStatistics(uint64_t& hits,
+                       uint64_t& misses,
+                       uint64_t& evictions);
+
     class Accessor : public boost::noncopyable
     {
     private:
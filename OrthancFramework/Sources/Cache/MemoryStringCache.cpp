@@ -24,6 +24,8 @@
 #include "../PrecompiledHeaders.h"
 #include "MemoryStringCache.h"
 
+#include "../OrthancException.h"
+
 namespace Orthanc
 {
   class MemoryStringCache::StringValue : public ICacheable
@@ -96,4 +98,42 @@ namespace Orthanc
       return false;
     }
   }
+
+  bool MemoryStringCache::FetchRange(std::string& value,
+                                     const std::string& key,
+                                     size_t start,
+                                     size_t end)
+  {
+    if (start > end)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    MemoryObjectCache::Accessor reader(cache_, key, false /* multiple readers are allowed */);
+
+    if (reader.IsValid())
+    {
+      const std::string& content = dynamic_cast<StringValue&>(reader.GetValue()).GetContent();
+
+      if (content.size() >= end)
+      {
+        value.assign(content, start, end - start);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  size_t MemoryStringCache::GetCurrentSize()
+  {
+    return cache_.GetCurrentSize();
+  }
+
+  void MemoryStringCache::GetStatistics(uint64_t& hits,
+                                        uint64_t& misses,
+                                        uint64_t& evictions)
+  {
+    cache_.GetStatistics(hits, misses, evictions);
+  }
 }
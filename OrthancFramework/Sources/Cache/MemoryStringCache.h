@@ -56,5 +56,19 @@ namespace Orthanc
 
     bool Fetch(std::string& value,
                const std::string& key);
+
+    // Only copies the bytes in the range [start, end[ of the cached
+    // value. Returns "false" if the value is missing or too short
+    // (new in Orthanc 1.11.2).
+    bool FetchRange(std::string& value,
+                    const std::string& key,
+                    size_t start,
+                    size_t end /* exclusive */);
+
+    size_t GetCurrentSize();
+
+    void GetStatistics(uint64_t& hits,
+                       uint64_t& misses,
+                       uint64_t& evictions);
   };
 }
@@ -188,6 +188,16 @@ namespace Orthanc
     return writer_.GetCompressionLevel();
   }
 
+  void HierarchicalZipWriter::SetCompressionThreads(unsigned int threadsCount)
+  {
+    writer_.SetCompressionThreads(threadsCount);
+  }
+
+  unsigned int HierarchicalZipWriter::GetCompressionThreads() const
+  {
+    return writer_.GetCompressionThreads();
+  }
+
   void HierarchicalZipWriter::SetAppendToExisting(bool append)
   {
     writer_.SetAppendToExisting(append);
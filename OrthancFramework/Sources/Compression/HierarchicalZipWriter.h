@@ -97,6 +97,11 @@ namespace Orthanc
 
     uint8_t GetCompressionLevel() const;
 
+    // New in Orthanc 1.11.2
+    void SetCompressionThreads(unsigned int threadsCount);
+
+    unsigned int GetCompressionThreads() const;
+
     void SetAppendToExisting(bool append);
     
     bool IsAppendToExisting() const;
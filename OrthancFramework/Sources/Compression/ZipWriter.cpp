@@ -29,9 +29,11 @@
 
 #include "ZipWriter.h"
 
+#include <deque>
 #include <limits>
 #include <boost/filesystem.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
 
 #include "../../Resources/ThirdParty/minizip/zip.h"
 #include "../Logging.h"
@@ -423,15 +425,436 @@ namespace Orthanc
   };
   
 
+  /**
+   * Parallel compression of the files of the archive (new in Orthanc
+   * 1.11.2). The files are independent deflate streams, so they can
+   * be compressed concurrently by a pool of worker threads. The
+   * compressed files are then handed to minizip in "raw" mode, in the
+   * order in which they were opened, by the thread that owns the
+   * ZipWriter. The number of files waiting to be written is bounded
+   * so as to limit memory usage.
+   **/
+  class ZipWriter::ParallelCompression : public boost::noncopyable
+  {
+  private:
+    class Entry : public boost::noncopyable
+    {
+    public:
+      std::string   path_;
+      zip_fileinfo  info_;
+      uint8_t       level_;
+      std::string   data_;
+      std::string   compressed_;
+      uLong         crc32_;
+      uint64_t      uncompressedSize_;
+      bool          done_;
+      bool          success_;
+
+      Entry(const char* path,
+            uint8_t level) :
+        path_(path),
+        level_(level),
+        crc32_(0),
+        uncompressedSize_(0),
+        done_(false),
+        success_(false)
+      {
+        PrepareFileInfo(info_);
+      }
+
+      void Compress();
+    };
+
+    boost::mutex                 mutex_;
+    boost::condition_variable    condition_;
+    std::deque<Entry*>           todo_;     // Entries waiting for a worker
+    std::deque<Entry*>           pending_;  // Entries not written yet, in order
+    std::vector<boost::thread*>  workers_;
+    bool                         stopped_;
+    size_t                       maxPending_;
+    std::unique_ptr<Entry>       current_;  // Entry being filled by "Write()"
+
+    static void Worker(ParallelCompression* that);
+
+    void Submit();
+
+    static void WriteEntry(zipFile file,
+                           bool isZip64,
+                           const Entry& entry);
+
+  public:
+    explicit ParallelCompression(unsigned int threadsCount);
+
+    ~ParallelCompression();
+
+    void OpenFile(const char* path,
+                  uint8_t level);
+
+    void Write(const void* data,
+               size_t length);
+
+    void WriteCompleted(zipFile file,
+                        bool isZip64,
+                        bool waitAll);
+
+    void Discard();
+  };
+
+
+  void ZipWriter::ParallelCompression::Entry::Compress()
+  {
+    // Raw deflate stream (negative window bits), as expected by
+    // minizip in "raw" mode
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    if (deflateInit2(&stream, level_, Z_DEFLATED, -MAX_WBITS, 8 /* default memory level */,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      throw OrthancException(ErrorCode_InternalError, "Cannot initialize zlib");
+    }
+
+    // The chunks given to zlib must fit into an "uInt"
+    static const size_t MAX_CHUNK = 1024 * 1024 * 1024;
+
+    compressed_.resize(std::max(static_cast<size_t>(deflateBound(&stream, static_cast<uLong>(data_.size()))),
+                                static_cast<size_t>(64)));
+
+    size_t inputPosition = 0;
+    size_t outputPosition = 0;
+
+    for (;;)
+    {
+      if (stream.avail_in == 0 &&
+          inputPosition < data_.size())
+      {
+        const size_t chunk = std::min(data_.size() - inputPosition, MAX_CHUNK);
+        stream.next_in = reinterpret_cast<Bytef*>(&data_[inputPosition]);
+        stream.avail_in = static_cast<uInt>(chunk);
+        inputPosition += chunk;
+      }
+
+      if (outputPosition == compressed_.size())
+      {
+        compressed_.resize(2 * compressed_.size());
+      }
+
+      const size_t available = std::min(compressed_.size() - outputPosition, MAX_CHUNK);
+      stream.next_out = reinterpret_cast<Bytef*>(&compressed_[outputPosition]);
+      stream.avail_out = static_cast<uInt>(available);
+
+      const int result = deflate(&stream, (inputPosition == data_.size() ? Z_FINISH : Z_NO_FLUSH));
+      outputPosition += available - stream.avail_out;
+
+      if (result == Z_STREAM_END)
+      {
+        break;
+      }
+      else if (result != Z_OK &&
+               result != Z_BUF_ERROR)
+      {
+        deflateEnd(&stream);
+        throw OrthancException(ErrorCode_InternalError, "Error while compressing with zlib");
+      }
+    }
+
+    deflateEnd(&stream);
+    compressed_.resize(outputPosition);
+
+    crc32_ = crc32(0L, Z_NULL, 0);
+    for (size_t i = 0; i < data_.size(); i += MAX_CHUNK)
+    {
+      const size_t chunk = std::min(data_.size() - i, MAX_CHUNK);
+      crc32_ = crc32(crc32_, reinterpret_cast<const Bytef*>(&data_[i]), static_cast<uInt>(chunk));
+    }
+
+    uncompressedSize_ = data_.size();
+
+    // Release the uncompressed data as soon as possible
+    std::string empty;
+    data_.swap(empty);
+  }
+
+
+  void ZipWriter::ParallelCompression::Worker(ParallelCompression* that)
+  {
+    for (;;)
+    {
+      Entry* entry = NULL;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (!that->stopped_ &&
+               that->todo_.empty())
+        {
+          that->condition_.wait(lock);
+        }
+
+        if (that->stopped_)
+        {
+          return;
+        }
+
+        entry = that->todo_.front();
+        that->todo_.pop_front();
+      }
+
+      assert(entry != NULL);
+
+      bool success;
+
+      try
+      {
+        entry->Compress();
+        success = true;
+      }
+      catch (...)
+      {
+        success = false;
+      }
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+        entry->done_ = true;
+        entry->success_ = success;
+        that->condition_.notify_all();
+      }
+    }
+  }
+
+
+  void ZipWriter::ParallelCompression::Submit()
+  {
+    if (current_.get() != NULL)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      pending_.push_back(current_.get());
+      todo_.push_back(current_.release());
+      condition_.notify_all();
+    }
+  }
+
+
+  void ZipWriter::ParallelCompression::WriteEntry(zipFile file,
+                                                  bool isZip64,
+                                                  const Entry& entry)
+  {
+    if (!entry.success_)
+    {
+      throw OrthancException(ErrorCode_CannotWriteFile,
+                             "Cannot compress file inside ZIP archive: " + entry.path_);
+    }
+
+    if (zipOpenNewFileInZip2_64(file, entry.path_.c_str(), &entry.info_,
+                                NULL,   0,
+                                NULL,   0,
+                                "",  // Comment
+                                Z_DEFLATED,
+                                entry.level_,
+                                1 /* raw */,
+                                isZip64 ? 1 : 0) != 0)
+    {
+      throw OrthancException(ErrorCode_CannotWriteFile,
+                             "Cannot add new file inside ZIP archive: " + entry.path_);
+    }
+
+    const size_t maxBytesInAStep = std::numeric_limits<int32_t>::max();
+
+    const char* p = entry.compressed_.c_str();
+    size_t length = entry.compressed_.size();
+
+    while (length > 0)
+    {
+      unsigned int bytes = static_cast<unsigned int>(length <= maxBytesInAStep ? length : maxBytesInAStep);
+
+      if (zipWriteInFileInZip(file, p, bytes))
+      {
+        throw OrthancException(ErrorCode_CannotWriteFile,
+                               "Cannot write data to ZIP archive: " + entry.path_);
+      }
+
+      p += bytes;
+      length -= bytes;
+    }
+
+    if (zipCloseFileInZipRaw64(file, entry.uncompressedSize_, entry.crc32_) != 0)
+    {
+      throw OrthancException(ErrorCode_CannotWriteFile,
+                             "Cannot close file inside ZIP archive: " + entry.path_);
+    }
+  }
+
+
+  ZipWriter::ParallelCompression::ParallelCompression(unsigned int threadsCount) :
+    stopped_(false),
+    maxPending_(2 * threadsCount)
+  {
+    assert(threadsCount > 1);
+
+    for (unsigned int i = 0; i < threadsCount; i++)
+    {
+      workers_.push_back(new boost::thread(Worker, this));
+    }
+  }
+
+
+  ZipWriter::ParallelCompression::~ParallelCompression()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopped_ = true;
+      condition_.notify_all();
+    }
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      assert(workers_[i] != NULL);
+
+      if (workers_[i]->joinable())
+      {
+        workers_[i]->join();
+      }
+
+      delete workers_[i];
+    }
+
+    // No worker is running anymore, "todo_" is a subset of "pending_"
+    for (size_t i = 0; i < pending_.size(); i++)
+    {
+      assert(pending_[i] != NULL);
+      delete pending_[i];
+    }
+  }
+
+
+  void ZipWriter::ParallelCompression::OpenFile(const char* path,
+                                                uint8_t level)
+  {
+    Submit();
+    current_.reset(new Entry(path, level));
+  }
+
+
+  void ZipWriter::ParallelCompression::Write(const void* data,
+                                             size_t length)
+  {
+    if (current_.get() == NULL)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls, "Call first OpenFile()");
+    }
+    else if (length > 0)
+    {
+      current_->data_.append(reinterpret_cast<const char*>(data), length);
+    }
+  }
+
+
+  void ZipWriter::ParallelCompression::WriteCompleted(zipFile file,
+                                                      bool isZip64,
+                                                      bool waitAll)
+  {
+    if (waitAll)
+    {
+      Submit();
+    }
+
+    for (;;)
+    {
+      std::unique_ptr<Entry> entry;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (pending_.empty())
+        {
+          return;
+        }
+
+        if (!pending_.front()->done_)
+        {
+          if (waitAll ||
+              pending_.size() > maxPending_)
+          {
+            while (!pending_.front()->done_)
+            {
+              condition_.wait(lock);
+            }
+          }
+          else
+          {
+            // The next file is not compressed yet, don't block
+            return;
+          }
+        }
+
+        entry.reset(pending_.front());
+        pending_.pop_front();
+      }
+
+      WriteEntry(file, isZip64, *entry);
+    }
+  }
+
+
+  void ZipWriter::ParallelCompression::Discard()
+  {
+    current_.reset(NULL);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // The entries that are being compressed by a worker are not in
+    // "todo_" anymore, and cannot be removed from "pending_" until
+    // they are done
+    for (size_t i = 0; i < todo_.size(); i++)
+    {
+      for (std::deque<Entry*>::iterator it = pending_.begin(); it != pending_.end(); ++it)
+      {
+        if (*it == todo_[i])
+        {
+          pending_.erase(it);
+          break;
+        }
+      }
+
+      delete todo_[i];
+    }
+
+    todo_.clear();
+
+    for (;;)
+    {
+      while (!pending_.empty() &&
+             pending_.front()->done_)
+      {
+        delete pending_.front();
+        pending_.pop_front();
+      }
+
+      if (pending_.empty())
+      {
+        return;
+      }
+      else
+      {
+        condition_.wait(lock);
+      }
+    }
+  }
+
+
   struct ZipWriter::PImpl : public boost::noncopyable
   {
     zipFile file_;
     std::unique_ptr<StreamBuffer> streamBuffer_;
     uint64_t  archiveSize_;
+    unsigned int compressionThreads_;
+    std::unique_ptr<ParallelCompression> parallel_;
 
     PImpl() :
       file_(NULL),
-      archiveSize_(0)
+      archiveSize_(0),
+      compressionThreads_(0)
     {
     }
   };
@@ -461,6 +884,24 @@ namespace Orthanc
   {
     if (IsOpen())
     {
+      std::unique_ptr<OrthancException> error;
+
+      if (pimpl_->parallel_.get() != NULL)
+      {
+        std::unique_ptr<ParallelCompression> parallel(pimpl_->parallel_.release());
+
+        try
+        {
+          // Write the files that are still being compressed
+          parallel->WriteCompleted(pimpl_->file_, isZip64_, true /* wait for all */);
+        }
+        catch (OrthancException& e)
+        {
+          // Close the archive anyway, then report the error
+          error.reset(new OrthancException(e));
+        }
+      }
+
       zipClose(pimpl_->file_, "Created by Orthanc");
       pimpl_->file_ = NULL;
       hasFileInZip_ = false;
@@ -473,6 +914,11 @@ namespace Orthanc
         pimpl_->archiveSize_ = outputStream_->GetArchiveSize();
         outputStream_.reset(NULL);
       }
+
+      if (error.get() != NULL)
+      {
+        throw OrthancException(*error);
+      }
     }
   }
 
@@ -606,6 +1052,23 @@ namespace Orthanc
   {
     Open();
 
+    if (pimpl_->compressionThreads_ > 1)
+    {
+      if (pimpl_->parallel_.get() == NULL)
+      {
+        pimpl_->parallel_.reset(new ParallelCompression(pimpl_->compressionThreads_));
+      }
+
+      pimpl_->parallel_->OpenFile(path, compressionLevel_);
+
+      // Write the files whose compression is over, blocking if too
+      // many files are waiting to be written
+      pimpl_->parallel_->WriteCompleted(pimpl_->file_, isZip64_, false);
+
+      hasFileInZip_ = true;
+      return;
+    }
+
     zip_fileinfo zfi;
     PrepareFileInfo(zfi);
 
@@ -658,6 +1121,12 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadSequenceOfCalls, "Call first OpenFile()");
     }
 
+    if (pimpl_->parallel_.get() != NULL)
+    {
+      pimpl_->parallel_->Write(data, length);
+      return;
+    }
+
     const size_t maxBytesInAStep = std::numeric_limits<int32_t>::max();
 
     const char* p = reinterpret_cast<const char*>(data);
@@ -731,6 +1200,12 @@ namespace Orthanc
     else
     {
       pimpl_->streamBuffer_->Cancel();
+
+      if (pimpl_->parallel_.get() != NULL)
+      {
+        // Don't compress the files that have not been written yet
+        pimpl_->parallel_->Discard();
+      }
     }
   }
 
@@ -751,4 +1226,24 @@ namespace Orthanc
       return SystemToolbox::GetFileSize(path_);
     }
   }
+
+
+  void ZipWriter::SetCompressionThreads(unsigned int threadsCount)
+  {
+    if (hasFileInZip_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls,
+                             "SetCompressionThreads() must be called before OpenFile()");
+    }
+    else
+    {
+      pimpl_->compressionThreads_ = threadsCount;
+    }
+  }
+
+
+  unsigned int ZipWriter::GetCompressionThreads() const
+  {
+    return pimpl_->compressionThreads_;
+  }
 }
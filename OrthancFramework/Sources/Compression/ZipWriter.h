@@ -123,6 +123,7 @@ namespace Orthanc
     
   private:
     class StreamBuffer;
+    class ParallelCompression;
     
     struct PImpl;
     boost::shared_ptr<PImpl> pimpl_;
@@ -180,5 +181,18 @@ namespace Orthanc
     // WARNING: "GetArchiveSize()" only has its final value after
     // "Close()" has been called
     uint64_t GetArchiveSize() const;
+
+    /**
+     * Compress the files of the archive in parallel, using a pool of
+     * "threadsCount" threads (new in Orthanc 1.11.2). The files are
+     * still written to the archive in the order of "OpenFile()". The
+     * content of each file is buffered in memory until it has been
+     * compressed. A value of "0" or "1" disables parallel
+     * compression. This method must be called before the first
+     * "OpenFile()".
+     **/
+    void SetCompressionThreads(unsigned int threadsCount);
+
+    unsigned int GetCompressionThreads() const;
   };
 }
@@ -0,0 +1,451 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "DicomFrameOffsetTable.h"
+
+#include "../OrthancException.h"
+#include "../SerializationToolbox.h"
+#include "../Toolbox.h"
+
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+#include <string.h>
+
+
+namespace Orthanc
+{
+  static const uint32_t UNDEFINED_LENGTH = 0xffffffffu;
+
+  // Decoding byte per byte makes the parsing independent of the endianness of the host
+  static uint16_t ReadUnsignedInteger16(const uint8_t* p)
+  {
+    return static_cast<uint16_t>(p[0]) | (static_cast<uint16_t>(p[1]) << 8);
+  }
+
+
+  static uint32_t ReadUnsignedInteger32(const uint8_t* p)
+  {
+    return (static_cast<uint32_t>(p[0]) |
+            (static_cast<uint32_t>(p[1]) << 8) |
+            (static_cast<uint32_t>(p[2]) << 16) |
+            (static_cast<uint32_t>(p[3]) << 24));
+  }
+
+
+  namespace
+  {
+    struct Fragment
+    {
+      uint64_t  itemOffset_;   // Offset of the item header, relative to the first fragment
+      uint64_t  dataOffset_;   // Offset of the data, relative to the beginning of the file
+      uint64_t  size_;
+    };
+  }
+
+
+  void DicomFrameOffsetTable::CheckFrame(unsigned int frame) const
+  {
+    if (frame >= GetFramesCount())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  DicomFrameOffsetTable::DicomFrameOffsetTable()
+  {
+    Clear();
+  }
+
+
+  void DicomFrameOffsetTable::Clear()
+  {
+    ranges_.clear();
+    firstRange_.clear();
+    firstRange_.push_back(0);
+  }
+
+
+  bool DicomFrameOffsetTable::Parse(const void* dicom,
+                                    size_t size,
+                                    uint64_t pixelDataOffset,
+                                    bool isImplicitVR,
+                                    unsigned int countFrames,
+                                    size_t frameSize)
+  {
+    Clear();
+
+    if (countFrames == 0 ||
+        (size > 0 && dicom == NULL) ||
+        pixelDataOffset + 8 > size)
+    {
+      return false;
+    }
+
+    const uint8_t* buffer = reinterpret_cast<const uint8_t*>(dicom);
+    const uint8_t* tag = buffer + pixelDataOffset;
+
+    if (ReadUnsignedInteger16(tag) != 0x7fe0 ||
+        ReadUnsignedInteger16(tag + 2) != 0x0010)
+    {
+      return false;
+    }
+
+    uint32_t length;
+    uint64_t value;
+
+    if (isImplicitVR)
+    {
+      length = ReadUnsignedInteger32(tag + 4);
+      value = pixelDataOffset + 8;
+    }
+    else
+    {
+      if (pixelDataOffset + 12 > size ||
+          !((tag[4] == 'O' && (tag[5] == 'B' || tag[5] == 'W')) ||
+            (tag[4] == 'U' && tag[5] == 'N')))
+      {
+        return false;
+      }
+
+      length = ReadUnsignedInteger32(tag + 8);
+      value = pixelDataOffset + 12;
+    }
+
+    if (length != UNDEFINED_LENGTH)
+    {
+      // Native pixel data: The frames are stored one after the other
+      if (frameSize == 0 ||
+          static_cast<uint64_t>(countFrames) * static_cast<uint64_t>(frameSize) > length ||
+          value + static_cast<uint64_t>(countFrames) * static_cast<uint64_t>(frameSize) > size)
+      {
+        return false;
+      }
+
+      ranges_.reserve(countFrames);
+      firstRange_.reserve(countFrames + 1);
+
+      for (unsigned int i = 0; i < countFrames; i++)
+      {
+        ranges_.push_back(Range(value + static_cast<uint64_t>(i) * frameSize, frameSize));
+        firstRange_.push_back(ranges_.size());
+      }
+
+      return true;
+    }
+
+    // Encapsulated pixel data: Sequence of items, the first one being the Basic Offset Table
+    std::vector<Fragment> fragments;
+    std::vector<uint32_t> offsetTable;
+    bool isFirstItem = true;
+    uint64_t firstFragment = 0;
+    uint64_t pos = value;
+
+    for (;;)
+    {
+      if (pos + 8 > size)
+      {
+        return false;  // Truncated file
+      }
+
+      const uint8_t* item = buffer + pos;
+      uint16_t group = ReadUnsignedInteger16(item);
+      uint16_t element = ReadUnsignedInteger16(item + 2);
+      uint32_t itemLength = ReadUnsignedInteger32(item + 4);
+
+      if (group == 0xfffe && element == 0xe0dd)
+      {
+        break;  // Sequence delimitation item
+      }
+      else if (group != 0xfffe ||
+               element != 0xe000 ||
+               itemLength == UNDEFINED_LENGTH ||
+               pos + 8 + itemLength > size)
+      {
+        return false;
+      }
+
+      if (isFirstItem)
+      {
+        if (itemLength % 4 != 0)
+        {
+          return false;
+        }
+
+        offsetTable.resize(itemLength / 4);
+        for (size_t i = 0; i < offsetTable.size(); i++)
+        {
+          offsetTable[i] = ReadUnsignedInteger32(item + 8 + 4 * i);
+        }
+
+        isFirstItem = false;
+        firstFragment = pos + 8 + itemLength;
+      }
+      else
+      {
+        Fragment fragment;
+        fragment.itemOffset_ = pos - firstFragment;
+        fragment.dataOffset_ = pos + 8;
+        fragment.size_ = itemLength;
+        fragments.push_back(fragment);
+      }
+
+      pos += 8 + itemLength;
+    }
+
+    if (fragments.size() < countFrames)
+    {
+      return false;
+    }
+
+    ranges_.reserve(fragments.size());
+    firstRange_.reserve(countFrames + 1);
+
+    if (fragments.size() == countFrames)
+    {
+      // One fragment per frame
+      for (size_t i = 0; i < fragments.size(); i++)
+      {
+        ranges_.push_back(Range(fragments[i].dataOffset_, fragments[i].size_));
+        firstRange_.push_back(ranges_.size());
+      }
+    }
+    else if (countFrames == 1)
+    {
+      // All the fragments belong to the single frame
+      for (size_t i = 0; i < fragments.size(); i++)
+      {
+        ranges_.push_back(Range(fragments[i].dataOffset_, fragments[i].size_));
+      }
+      firstRange_.push_back(ranges_.size());
+    }
+    else
+    {
+      // Several fragments per frame: The Basic Offset Table is needed
+      if (offsetTable.size() != countFrames ||
+          offsetTable[0] != 0)
+      {
+        Clear();
+        return false;
+      }
+
+      size_t fragment = 0;
+
+      for (unsigned int frame = 0; frame < countFrames; frame++)
+      {
+        const uint64_t end = (frame + 1 < countFrames ?
+                              static_cast<uint64_t>(offsetTable[frame + 1]) :
+                              pos - firstFragment);
+
+        if (fragment >= fragments.size() ||
+            fragments[fragment].itemOffset_ != offsetTable[frame])
+        {
+          Clear();
+          return false;
+        }
+
+        while (fragment < fragments.size() &&
+               fragments[fragment].itemOffset_ < end)
+        {
+          ranges_.push_back(Range(fragments[fragment].dataOffset_, fragments[fragment].size_));
+          fragment++;
+        }
+
+        firstRange_.push_back(ranges_.size());
+      }
+
+      if (fragment != fragments.size())
+      {
+        Clear();
+        return false;
+      }
+    }
+
+    assert(firstRange_.size() == countFrames + 1);
+    return true;
+  }
+
+
+  unsigned int DicomFrameOffsetTable::GetFramesCount() const
+  {
+    assert(!firstRange_.empty());
+    return static_cast<unsigned int>(firstRange_.size() - 1);
+  }
+
+
+  size_t DicomFrameOffsetTable::GetFrameRangesCount(unsigned int frame) const
+  {
+    CheckFrame(frame);
+    return firstRange_[frame + 1] - firstRange_[frame];
+  }
+
+
+  void DicomFrameOffsetTable::GetFrameRange(uint64_t& offset,
+                                            uint64_t& size,
+                                            unsigned int frame,
+                                            size_t range) const
+  {
+    if (range >= GetFrameRangesCount(frame))
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    const Range& r = ranges_[firstRange_[frame] + range];
+    offset = r.offset_;
+    size = r.size_;
+  }
+
+
+  uint64_t DicomFrameOffsetTable::GetFrameSize(unsigned int frame) const
+  {
+    CheckFrame(frame);
+
+    uint64_t size = 0;
+    for (size_t i = firstRange_[frame]; i < firstRange_[frame + 1]; i++)
+    {
+      size += ranges_[i].size_;
+    }
+
+    return size;
+  }
+
+
+  void DicomFrameOffsetTable::GetFrameExtent(uint64_t& start,
+                                             uint64_t& end,
+                                             unsigned int frame) const
+  {
+    CheckFrame(frame);
+
+    if (firstRange_[frame] == firstRange_[frame + 1])
+    {
+      start = 0;
+      end = 0;
+    }
+    else
+    {
+      const Range& first = ranges_[firstRange_[frame]];
+      const Range& last = ranges_[firstRange_[frame + 1] - 1];
+      start = first.offset_;
+      end = last.offset_ + last.size_;
+    }
+  }
+
+
+  void DicomFrameOffsetTable::ExtractFrame(std::string& target,
+                                           const void* extent,
+                                           size_t extentSize,
+                                           unsigned int frame) const
+  {
+    uint64_t start, end;
+    GetFrameExtent(start, end, frame);
+
+    if (extentSize != end - start)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    target.resize(static_cast<size_t>(GetFrameSize(frame)));
+
+    size_t pos = 0;
+    for (size_t i = firstRange_[frame]; i < firstRange_[frame + 1]; i++)
+    {
+      const Range& r = ranges_[i];
+      if (r.size_ > 0)
+      {
+        memcpy(&target[pos], reinterpret_cast<const uint8_t*>(extent) + (r.offset_ - start),
+               static_cast<size_t>(r.size_));
+        pos += static_cast<size_t>(r.size_);
+      }
+    }
+
+    assert(pos == target.size());
+  }
+
+
+  void DicomFrameOffsetTable::Serialize(std::string& target) const
+  {
+    // Format: "offset:size,offset:size;offset:size" (frames are separated by semicolons)
+    target.clear();
+
+    for (unsigned int frame = 0; frame < GetFramesCount(); frame++)
+    {
+      if (frame > 0)
+      {
+        target += ';';
+      }
+
+      for (size_t i = firstRange_[frame]; i < firstRange_[frame + 1]; i++)
+      {
+        if (i > firstRange_[frame])
+        {
+          target += ',';
+        }
+
+        target += boost::lexical_cast<std::string>(ranges_[i].offset_) + ":" +
+          boost::lexical_cast<std::string>(ranges_[i].size_);
+      }
+    }
+  }
+
+
+  bool DicomFrameOffsetTable::Unserialize(const std::string& source)
+  {
+    Clear();
+
+    if (source.empty())
+    {
+      return false;
+    }
+
+    std::vector<std::string> frames;
+    Toolbox::TokenizeString(frames, source, ';');
+
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+      std::vector<std::string> ranges;
+      Toolbox::TokenizeString(ranges, frames[i], ',');
+
+      for (size_t j = 0; j < ranges.size(); j++)
+      {
+        std::vector<std::string> tokens;
+        Toolbox::TokenizeString(tokens, ranges[j], ':');
+
+        uint64_t offset, size;
+        if (tokens.size() != 2 ||
+            !SerializationToolbox::ParseUnsignedInteger64(offset, tokens[0]) ||
+            !SerializationToolbox::ParseUnsignedInteger64(size, tokens[1]))
+        {
+          Clear();
+          return false;
+        }
+
+        ranges_.push_back(Range(offset, size));
+      }
+
+      firstRange_.push_back(ranges_.size());
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,117 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../OrthancFramework.h"  // For ORTHANC_PUBLIC
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Orthanc
+{
+  /**
+   * This class indexes the byte ranges of the individual frames
+   * inside the pixel data of a DICOM file, so that one single frame
+   * can be read from the storage area without parsing the entire
+   * file. In the case of compressed transfer syntaxes, each frame
+   * corresponds to one or more fragments. The table is built by
+   * scanning the item headers of the pixel data, starting at the
+   * offset that is provided by "DicomStreamReader::LookupPixelDataOffset()".
+   *
+   * Only Little Endian transfer syntaxes are supported.
+   **/
+  class ORTHANC_PUBLIC DicomFrameOffsetTable : public boost::noncopyable
+  {
+  private:
+    struct Range
+    {
+      uint64_t  offset_;
+      uint64_t  size_;
+
+      Range(uint64_t offset,
+            uint64_t size) :
+        offset_(offset),
+        size_(size)
+      {
+      }
+    };
+
+    std::vector<Range>   ranges_;
+    std::vector<size_t>  firstRange_;  // Index of the first range of each frame, plus a sentinel
+
+    void CheckFrame(unsigned int frame) const;
+
+  public:
+    DicomFrameOffsetTable();
+
+    void Clear();
+
+    /**
+     * Returns "false" if the layout of the pixel data is not
+     * supported (e.g. if the offset table of a compressed image is
+     * missing). "frameSize" is only used for uncompressed transfer
+     * syntaxes.
+     **/
+    bool Parse(const void* dicom,
+               size_t size,
+               uint64_t pixelDataOffset,
+               bool isImplicitVR,
+               unsigned int countFrames,
+               size_t frameSize);
+
+    unsigned int GetFramesCount() const;
+
+    size_t GetRangesCount() const
+    {
+      return ranges_.size();
+    }
+
+    size_t GetFrameRangesCount(unsigned int frame) const;
+
+    void GetFrameRange(uint64_t& offset,
+                       uint64_t& size,
+                       unsigned int frame,
+                       size_t range) const;
+
+    uint64_t GetFrameSize(unsigned int frame) const;
+
+    // Byte range of the DICOM file that contains all the ranges of
+    // the frame (including the headers of the fragments)
+    void GetFrameExtent(uint64_t& start,
+                        uint64_t& end /* exclusive */,
+                        unsigned int frame) const;
+
+    // Extracts the frame from a buffer that contains its extent
+    void ExtractFrame(std::string& target,
+                      const void* extent,
+                      size_t extentSize,
+                      unsigned int frame) const;
+
+    void Serialize(std::string& target) const;
+
+    bool Unserialize(const std::string& source);
+  };
+}
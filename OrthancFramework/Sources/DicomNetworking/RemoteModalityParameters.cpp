@@ -49,6 +49,10 @@ static const char* KEY_PORT = "Port";
 static const char* KEY_USE_DICOM_TLS = "UseDicomTls";
 static const char* KEY_LOCAL_AET = "LocalAet";
 static const char* KEY_TIMEOUT = "Timeout";
+static const char* KEY_STORE_ASSOCIATIONS = "StoreAssociations";
+
+// Each parallel association comes with its own thread
+static const uint32_t MAX_STORE_ASSOCIATIONS = 32;
 
 
 namespace Orthanc
@@ -71,6 +75,7 @@ namespace Orthanc
     useDicomTls_ = false;
     localAet_.clear();
     timeout_ = 0;
+    storeAssociations_ = 1;
   }
 
 
@@ -308,6 +313,11 @@ namespace Orthanc
     {
       timeout_ = SerializationToolbox::ReadUnsignedInteger(serialized, KEY_TIMEOUT);
     }
+
+    if (serialized.isMember(KEY_STORE_ASSOCIATIONS))
+    {
+      SetStoreAssociations(SerializationToolbox::ReadUnsignedInteger(serialized, KEY_STORE_ASSOCIATIONS));
+    }
   }
 
 
@@ -400,7 +410,8 @@ namespace Orthanc
             !allowNEventReport_ ||
             !allowTranscoding_ ||
             useDicomTls_ ||
-            HasLocalAet());
+            HasLocalAet() ||
+            storeAssociations_ != 1);
   }
 
   
@@ -427,6 +438,7 @@ namespace Orthanc
       target[KEY_USE_DICOM_TLS] = useDicomTls_;
       target[KEY_LOCAL_AET] = localAet_;
       target[KEY_TIMEOUT] = timeout_;
+      target[KEY_STORE_ASSOCIATIONS] = storeAssociations_;
     }
     else
     {
@@ -521,4 +533,28 @@ namespace Orthanc
   {
     return timeout_ != 0;
   }
+
+  void RemoteModalityParameters::SetStoreAssociations(uint32_t count)
+  {
+    if (count == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "At least one association must be used to send instances to a modality");
+    }
+    else if (count > MAX_STORE_ASSOCIATIONS)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "At most " + boost::lexical_cast<std::string>(MAX_STORE_ASSOCIATIONS) +
+                             " associations can be used to send instances to a modality");
+    }
+    else
+    {
+      storeAssociations_ = count;
+    }
+  }
+
+  uint32_t RemoteModalityParameters::GetStoreAssociations() const
+  {
+    return storeAssociations_;
+  }
 }
@@ -50,6 +50,7 @@ namespace Orthanc
     bool                  useDicomTls_;
     std::string           localAet_;
     uint32_t              timeout_;
+    uint32_t              storeAssociations_;
     
     void Clear();
 
@@ -117,5 +118,11 @@ namespace Orthanc
     uint32_t GetTimeout() const;
 
     bool HasTimeout() const;    
+
+    // Number of parallel associations that are opened to send
+    // instances to this modality (new in Orthanc 1.11.2)
+    void SetStoreAssociations(uint32_t count);
+
+    uint32_t GetStoreAssociations() const;
   };
 }
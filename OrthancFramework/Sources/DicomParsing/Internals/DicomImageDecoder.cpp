@@ -1070,9 +1070,18 @@ namespace Orthanc
                                           ImageExtractionMode mode,
                                           bool invert)
   {
-    ApplyExtractionMode(image, mode, invert);
-
     PngWriter writer;
+    ExtractPngImage(result, image, mode, invert, writer);
+  }
+
+
+  void DicomImageDecoder::ExtractPngImage(std::string& result,
+                                          std::unique_ptr<ImageAccessor>& image,
+                                          ImageExtractionMode mode,
+                                          bool invert,
+                                          PngWriter& writer)
+  {
+    ApplyExtractionMode(image, mode, invert);
     IImageWriter::WriteToMemory(writer, result, *image);
   }
 #endif
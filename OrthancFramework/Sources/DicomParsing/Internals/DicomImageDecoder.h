@@ -53,6 +53,7 @@ class DcmRepresentationParameter;
 namespace Orthanc
 {
   class ParsedDicomFile;
+  class PngWriter;
   
   class ORTHANC_PUBLIC DicomImageDecoder : public boost::noncopyable
   {
@@ -110,6 +111,13 @@ namespace Orthanc
                                 std::unique_ptr<ImageAccessor>& image,
                                 ImageExtractionMode mode,
                                 bool invert);
+
+    // New in Orthanc 1.11.2, to choose the compression options
+    static void ExtractPngImage(std::string& result,
+                                std::unique_ptr<ImageAccessor>& image,
+                                ImageExtractionMode mode,
+                                bool invert,
+                                PngWriter& writer);
 #endif
 
 #if ORTHANC_ENABLE_JPEG == 1
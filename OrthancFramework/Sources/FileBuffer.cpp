@@ -38,10 +38,21 @@ namespace Orthanc
     TemporaryFile                file_;
     boost::filesystem::ofstream  stream_;
     bool                         isWriting_;
+    uint64_t                     size_;
+
+    void CloseWriting()
+    {
+      if (isWriting_)
+      {
+        stream_.close();
+        isWriting_ = false;
+      }
+    }
 
   public:
     PImpl() :
-      isWriting_(true)
+      isWriting_(true),
+      size_(0)
     {
       stream_.open(file_.GetPath(), std::ofstream::out | std::ofstream::binary);
       if (!stream_.good())
@@ -74,19 +85,27 @@ namespace Orthanc
           stream_.close();
           throw OrthancException(ErrorCode_FileStorageCannotWrite);
         }
+
+        size_ += size;
       }
     }
 
     void Read(std::string& target)
     {
-      if (isWriting_)
-      {
-        stream_.close();
-        isWriting_ = false;
-      }
-
+      CloseWriting();
       file_.Read(target);
     }
+
+    uint64_t GetSize() const
+    {
+      return size_;
+    }
+
+    const std::string& GetPath()
+    {
+      CloseWriting();
+      return file_.GetPath();
+    }
   };
 
     
@@ -109,4 +128,18 @@ namespace Orthanc
     assert(pimpl_.get() != NULL);
     pimpl_->Read(target);
   }
+
+
+  uint64_t FileBuffer::GetSize() const
+  {
+    assert(pimpl_.get() != NULL);
+    return pimpl_->GetSize();
+  }
+
+
+  const std::string& FileBuffer::GetPath()
+  {
+    assert(pimpl_.get() != NULL);
+    return pimpl_->GetPath();
+  }
 }
@@ -35,6 +35,8 @@
 
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <stdint.h>
+#include <string>
 
 
 namespace Orthanc
@@ -52,5 +54,11 @@ namespace Orthanc
                 size_t size);
 
     void Read(std::string& target);
+
+    uint64_t GetSize() const;
+
+    // Closes the buffer for writing, and gives access to the
+    // underlying temporary file (new in Orthanc 1.11.2)
+    const std::string& GetPath();
   };
 }
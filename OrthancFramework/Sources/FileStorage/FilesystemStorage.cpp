@@ -28,6 +28,8 @@
 // http://stackoverflow.com/questions/446358/storing-a-large-number-of-images
 
 #include "../Logging.h"
+#include "../MappedFileMemoryBuffer.h"
+#include "../MultiThreading/LeaderFollowersQueue.h"
 #include "../OrthancException.h"
 #include "../StringMemoryBuffer.h"
 #include "../SystemToolbox.h"
@@ -35,6 +37,11 @@
 
 #include <boost/filesystem/fstream.hpp>
 
+#if defined(__linux__)
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
 
 static std::string ToString(const boost::filesystem::path& p)
 {
@@ -48,6 +55,59 @@ static std::string ToString(const boost::filesystem::path& p)
 
 namespace Orthanc
 {
+#if defined(__linux__)
+  /**
+   * Batched flush to the disk (new in Orthanc 1.11.2). The threads
+   * that have just written a file are grouped by a
+   * "LeaderFollowersQueue". The leader calls "syncfs()" once on the
+   * filesystem of the storage area, which makes all the files of the
+   * batch durable.
+   **/
+  class FilesystemStorage::BatchedSync : public LeaderFollowersQueue::IBatchHandler
+  {
+  private:
+    LeaderFollowersQueue  queue_;
+    int                   rootFd_;
+
+  public:
+    BatchedSync(const boost::filesystem::path& root,
+                unsigned int maxBatchSize,
+                unsigned int windowMilliseconds) :
+      queue_(maxBatchSize, windowMilliseconds)
+    {
+      rootFd_ = ::open(root.string().c_str(), O_RDONLY | O_DIRECTORY);
+      if (rootFd_ < 0)
+      {
+        throw OrthancException(ErrorCode_FileStorageCannotWrite,
+                               "Cannot open the storage directory: " + root.string());
+      }
+    }
+
+    ~BatchedSync()
+    {
+      ::close(rootFd_);
+    }
+
+    virtual bool HandleBatch(const std::vector<LeaderFollowersQueue::Item*>& batch) ORTHANC_OVERRIDE
+    {
+      const bool success = (::syncfs(rootFd_) == 0);
+      LOG(TRACE) << "Batched flush of " << batch.size() << " files to the storage area";
+      return success;
+    }
+
+    void WaitDurable()
+    {
+      LeaderFollowersQueue::Item file;
+
+      if (!queue_.Submit(file, *this))
+      {
+        throw OrthancException(ErrorCode_CannotWriteFile, "Cannot force flush to disk");
+      }
+    }
+  };
+#endif
+
+
   boost::filesystem::path FilesystemStorage::GetPath(const std::string& uuid) const
   {
     namespace fs = boost::filesystem;
@@ -93,6 +153,28 @@ namespace Orthanc
 
 
 
+  void FilesystemStorage::SetBatchedSync(unsigned int maxBatchSize,
+                                         unsigned int windowMilliseconds)
+  {
+    if (maxBatchSize <= 1 ||
+        !fsyncOnWrite_)
+    {
+      batchedSync_.reset();
+    }
+    else
+    {
+#if defined(__linux__)
+      batchedSync_.reset(new BatchedSync(root_, maxBatchSize, windowMilliseconds));
+      LOG(WARNING) << "Batched flush to the storage area is enabled: Up to " << maxBatchSize
+                   << " files written within " << windowMilliseconds << "ms are flushed together";
+#else
+      LOG(WARNING) << "Batched flush to the storage area is only available on Linux, "
+                   << "each file will be flushed separately";
+#endif
+    }
+  }
+
+
   static const char* GetDescriptionInternal(FileContentType content)
   {
     // This function is for logging only (internal use), a more
@@ -111,6 +193,9 @@ namespace Orthanc
       case FileContentType_DicomUntilPixelData:
         return "DICOM until pixel data";
 
+      case FileContentType_Thumbnail:
+        return "Thumbnail";
+
       default:
         return "User-defined";
     }
@@ -151,6 +236,15 @@ namespace Orthanc
       }
     }
 
+#if defined(__linux__)
+    if (batchedSync_.get() != NULL)
+    {
+      SystemToolbox::WriteFile(content, size, path.string(), false /* no fsync */);
+      batchedSync_->WaitDurable();
+      return;
+    }
+#endif
+
     SystemToolbox::WriteFile(content, size, path.string(), fsyncOnWrite_);
   }
 
@@ -190,6 +284,16 @@ namespace Orthanc
   }
 
 
+  IMemoryBuffer* FilesystemStorage::ReadMapped(const std::string& uuid,
+                                               FileContentType type)
+  {
+    LOG(INFO) << "Mapping attachment \"" << uuid << "\" of \"" << GetDescriptionInternal(type) 
+              << "\" content type into memory";
+
+    return new MappedFileMemoryBuffer(GetPath(uuid).string());
+  }
+
+
   uintmax_t FilesystemStorage::GetSize(const std::string& uuid) const
   {
     boost::filesystem::path path = GetPath(uuid);
@@ -38,6 +38,7 @@
 
 #include <stdint.h>
 #include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
 #include <set>
 
 namespace Orthanc
@@ -49,8 +50,11 @@ namespace Orthanc
     friend class FileStorageAccessor;
 
   private:
-    boost::filesystem::path root_;
-    bool                    fsyncOnWrite_;
+    class BatchedSync;
+
+    boost::filesystem::path         root_;
+    bool                            fsyncOnWrite_;
+    boost::shared_ptr<BatchedSync>  batchedSync_;
 
     boost::filesystem::path GetPath(const std::string& uuid) const;
 
@@ -74,6 +78,17 @@ namespace Orthanc
     FilesystemStorage(const std::string& root,
                       bool fsyncOnWrite);
 
+    /**
+     * If "fsyncOnWrite" is true, batch the flushes to the disk of the
+     * files that are concurrently written by different threads (new
+     * in Orthanc 1.11.2). "Create()" still only returns once the file
+     * is durably written. A "maxBatchSize" <= 1 disables batching.
+     * Batching is only available on Linux, where one "syncfs()" covers
+     * the whole batch.
+     **/
+    void SetBatchedSync(unsigned int maxBatchSize,
+                        unsigned int windowMilliseconds);
+
     virtual void Create(const std::string& uuid,
                         const void* content, 
                         size_t size,
@@ -89,6 +104,11 @@ namespace Orthanc
 
     virtual bool HasReadRange() const ORTHANC_OVERRIDE;
 
+    // Maps the file into memory instead of copying it to the heap
+    // (new in Orthanc 1.11.2)
+    IMemoryBuffer* ReadMapped(const std::string& uuid,
+                              FileContentType type);
+
     virtual void Remove(const std::string& uuid,
                         FileContentType type) ORTHANC_OVERRIDE;
 
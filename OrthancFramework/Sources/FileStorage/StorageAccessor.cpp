@@ -35,6 +35,8 @@
 
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
 #  include "../HttpServer/HttpStreamTranscoder.h"
+#  include "../HttpServer/MemoryBufferHttpSender.h"
+#  include "FilesystemStorage.h"
 #endif
 
 
@@ -164,8 +166,16 @@ namespace Orthanc
   void StorageAccessor::Read(std::string& content,
                              const FileInfo& info)
   {
-    if (cache_ == NULL ||
-        !cache_->Fetch(content, info.GetUuid(), info.GetContentType()))
+    // If another thread is already reading the same attachment, wait
+    // for its result instead of reading the storage area again
+    std::unique_ptr<StorageCache::Accessor> cacheAccessor;
+    if (cache_ != NULL)
+    {
+      cacheAccessor.reset(new StorageCache::Accessor(*cache_));
+    }
+
+    if (cacheAccessor.get() == NULL ||
+        !cacheAccessor->Fetch(content, info.GetUuid(), info.GetContentType()))
     {
       switch (info.GetCompressionType())
       {
@@ -201,9 +211,9 @@ namespace Orthanc
       }
 
       // always store the uncompressed data in cache
-      if (cache_ != NULL)
+      if (cacheAccessor.get() != NULL)
       {
-        cache_->Add(info.GetUuid(), info.GetContentType(), content);
+        cacheAccessor->Add(info.GetUuid(), info.GetContentType(), content);
       }
     }
 
@@ -249,39 +259,107 @@ namespace Orthanc
                                        FileContentType contentType,
                                        uint64_t end /* exclusive */)
   {
-    if (cache_ == NULL || !cache_->FetchStartRange(target, fileUuid, contentType, end))
+    std::unique_ptr<StorageCache::Accessor> cacheAccessor;
+    if (cache_ != NULL)
+    {
+      cacheAccessor.reset(new StorageCache::Accessor(*cache_));
+    }
+
+    if (cacheAccessor.get() == NULL ||
+        !cacheAccessor->FetchStartRange(target, fileUuid, contentType, end))
     {
       MetricsTimer timer(*this, METRICS_READ);
       std::unique_ptr<IMemoryBuffer> buffer(area_.ReadRange(fileUuid, contentType, 0, end));
       assert(buffer->GetSize() == end);
       buffer->MoveToString(target);
 
-      if (cache_ != NULL)
+      if (cacheAccessor.get() != NULL)
       {
-        cache_->AddStartRange(fileUuid, contentType, target);
+        cacheAccessor->AddStartRange(fileUuid, contentType, target);
       }
     }
   }
 
 
-#if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
-  void StorageAccessor::SetupSender(BufferHttpSender& sender,
-                                    const FileInfo& info,
-                                    const std::string& mime)
+  void StorageAccessor::ReadRange(std::string& target,
+                                  const FileInfo& info,
+                                  uint64_t start,
+                                  uint64_t end /* exclusive */)
   {
-    if (cache_ == NULL || !cache_->Fetch(sender.GetBuffer(), info.GetUuid(), info.GetContentType()))
+    if (info.GetCompressionType() != CompressionType_None ||
+        start > end ||
+        end > info.GetUncompressedSize())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (cache_ != NULL &&
+        cache_->FetchRange(target, info.GetUuid(), info.GetContentType(), start, end))
+    {
+      // Only the requested range has been copied from the cache
+    }
+    else if (start == end)
+    {
+      target.clear();
+    }
+    else
     {
       MetricsTimer timer(*this, METRICS_READ);
-      std::unique_ptr<IMemoryBuffer> buffer(area_.Read(info.GetUuid(), info.GetContentType()));
-      buffer->MoveToString(sender.GetBuffer());
+      std::unique_ptr<IMemoryBuffer> buffer(area_.ReadRange(info.GetUuid(), info.GetContentType(), start, end));
+      assert(buffer->GetSize() == end - start);
+      buffer->MoveToString(target);
+    }
+  }
+
 
-      if (cache_ != NULL)
+#if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
+  HttpFileSender* StorageAccessor::CreateSender(const FileInfo& info,
+                                                const std::string& mime)
+  {
+    std::unique_ptr<HttpFileSender> sender;
+
+    std::string cached;
+    if (cache_ != NULL &&
+        cache_->Fetch(cached, info.GetUuid(), info.GetContentType()))
+    {
+      std::unique_ptr<BufferHttpSender> buffer(new BufferHttpSender);
+      buffer->GetBuffer().swap(cached);
+      sender.reset(buffer.release());
+    }
+    else
+    {
+      FilesystemStorage* filesystem = dynamic_cast<FilesystemStorage*>(&area_);
+
+      if (filesystem != NULL &&
+          info.GetCompressionType() == CompressionType_None)
       {
-        cache_->Add(info.GetUuid(), info.GetContentType(), sender.GetBuffer());
+        // Fast path (new in Orthanc 1.11.2): Map the uncompressed
+        // file into memory, and send it without any copy to the heap.
+        // The cache is not filled, as the pages of the file are kept
+        // in the page cache of the operating system.
+        MetricsTimer timer(*this, METRICS_READ);
+        sender.reset(new MemoryBufferHttpSender(filesystem->ReadMapped(info.GetUuid(), info.GetContentType())));
+      }
+      else
+      {
+        std::unique_ptr<BufferHttpSender> buffer(new BufferHttpSender);
+
+        {
+          MetricsTimer timer(*this, METRICS_READ);
+          std::unique_ptr<IMemoryBuffer> content(area_.Read(info.GetUuid(), info.GetContentType()));
+          content->MoveToString(buffer->GetBuffer());
+        }
+
+        if (cache_ != NULL)
+        {
+          cache_->Add(info.GetUuid(), info.GetContentType(), buffer->GetBuffer());
+        }
+
+        sender.reset(buffer.release());
       }
     }
 
-    sender.SetContentType(mime);
+    sender->SetContentType(mime);
 
     const char* extension;
     switch (info.GetContentType())
@@ -295,12 +373,18 @@ namespace Orthanc
         extension = ".json";
         break;
 
+      case FileContentType_Thumbnail:
+        extension = ".jpg";
+        break;
+
       default:
         // Non-standard content type
         extension = "";
     }
 
-    sender.SetContentFilename(info.GetUuid() + std::string(extension));
+    sender->SetContentFilename(info.GetUuid() + std::string(extension));
+
+    return sender.release();
   }
 #endif
 
@@ -320,10 +404,9 @@ namespace Orthanc
                                    const FileInfo& info,
                                    const std::string& mime)
   {
-    BufferHttpSender sender;
-    SetupSender(sender, info, mime);
+    std::unique_ptr<HttpFileSender> sender(CreateSender(info, mime));
   
-    HttpStreamTranscoder transcoder(sender, info.GetCompressionType());
+    HttpStreamTranscoder transcoder(*sender, info.GetCompressionType());
     output.Answer(transcoder);
   }
 #endif
@@ -344,10 +427,9 @@ namespace Orthanc
                                    const FileInfo& info,
                                    const std::string& mime)
   {
-    BufferHttpSender sender;
-    SetupSender(sender, info, mime);
+    std::unique_ptr<HttpFileSender> sender(CreateSender(info, mime));
   
-    HttpStreamTranscoder transcoder(sender, info.GetCompressionType());
+    HttpStreamTranscoder transcoder(*sender, info.GetCompressionType());
     output.AnswerStream(transcoder);
   }
 #endif
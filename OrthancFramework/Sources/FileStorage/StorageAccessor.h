@@ -72,9 +72,8 @@ namespace Orthanc
     MetricsRegistry*  metrics_;
 
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
-    void SetupSender(BufferHttpSender& sender,
-                     const FileInfo& info,
-                     const std::string& mime);
+    HttpFileSender* CreateSender(const FileInfo& info,
+                                 const std::string& mime);
 #endif
 
   public:
@@ -107,6 +106,13 @@ namespace Orthanc
                         FileContentType fullFileContentType,
                         uint64_t end /* exclusive */);
 
+    // Reads a range of an uncompressed attachment, without filling
+    // the cache (new in Orthanc 1.11.2)
+    void ReadRange(std::string& target,
+                   const FileInfo& info,
+                   uint64_t start,
+                   uint64_t end /* exclusive */);
+
     void Remove(const std::string& fileUuid,
                 FileContentType type);
 
@@ -26,9 +26,11 @@
 
 #include "../Compatibility.h"
 #include "../Logging.h"
+#include "../MetricsRegistry.h"
 #include "../OrthancException.h"
 
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
 
 
 namespace Orthanc
@@ -45,9 +47,187 @@ namespace Orthanc
     return uuid + ":" + boost::lexical_cast<std::string>(contentType) + ":0";
   }
   
+  class StorageCache::PendingLoad : public boost::noncopyable
+  {
+  private:
+    bool          done_;
+    bool          success_;
+    unsigned int  waiters_;
+    std::string   value_;
+
+  public:
+    PendingLoad() :
+      done_(false),
+      success_(false),
+      waiters_(0)
+    {
+    }
+
+    bool IsDone() const
+    {
+      return done_;
+    }
+
+    bool IsSuccess() const
+    {
+      return success_;
+    }
+
+    const std::string& GetValue() const
+    {
+      return value_;
+    }
+
+    void AddWaiter()
+    {
+      waiters_++;
+    }
+
+    void SetSuccess(const std::string& value)
+    {
+      if (waiters_ > 0)
+      {
+        // Only copy the value if some thread is waiting for it
+        value_ = value;
+      }
+
+      done_ = true;
+      success_ = true;
+    }
+
+    void SetFailure()
+    {
+      done_ = true;
+      success_ = false;
+    }
+  };
+
+
+  MemoryStringCache& StorageCache::GetShard(const std::string& uuid)
+  {
+    assert(!shards_.empty());
+
+    if (shards_.size() == 1)
+    {
+      return *shards_[0];
+    }
+    else
+    {
+      // FNV-1a hash of the UUID, so that the full file and the start
+      // range of one attachment are always stored in the same shard
+      uint32_t hash = 2166136261u;
+      for (size_t i = 0; i < uuid.size(); i++)
+      {
+        hash = (hash ^ static_cast<uint8_t>(uuid[i])) * 16777619u;
+      }
+
+      return *shards_[hash % shards_.size()];
+    }
+  }
+
+
+  void StorageCache::ClearShards()
+  {
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      assert(shards_[i] != NULL);
+      delete shards_[i];
+    }
+
+    shards_.clear();
+  }
+
+
+  StorageCache::StorageCache() :
+    maximumSize_(100 * 1024 * 1024)  // 100 MB
+  {
+    SetShardsCount(1);
+  }
+
+
+  StorageCache::~StorageCache()
+  {
+    ClearShards();
+  }
+
+
   void StorageCache::SetMaximumSize(size_t size)
   {
-    cache_.SetMaximumSize(size);
+    if (size == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    // Each shard receives an equal share of the total budget
+    const size_t shardSize = std::max(static_cast<size_t>(1), size / shards_.size());
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      shards_[i]->SetMaximumSize(shardSize);
+    }
+
+    maximumSize_ = size;
+  }
+
+
+  void StorageCache::SetShardsCount(size_t count)
+  {
+    if (count == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    if (count != shards_.size())
+    {
+      // The content of the cache is lost if the number of shards changes
+      ClearShards();
+
+      shards_.reserve(count);
+      for (size_t i = 0; i < count; i++)
+      {
+        shards_.push_back(new MemoryStringCache);
+      }
+
+      SetMaximumSize(maximumSize_);
+    }
+  }
+
+
+  void StorageCache::PublishMetrics(MetricsRegistry& registry)
+  {
+    static const float MEGA_BYTES = 1024 * 1024;
+
+    size_t totalSize = 0;
+    uint64_t totalHits = 0;
+    uint64_t totalMisses = 0;
+    uint64_t totalEvictions = 0;
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      const size_t size = shards_[i]->GetCurrentSize();
+
+      uint64_t hits, misses, evictions;
+      shards_[i]->GetStatistics(hits, misses, evictions);
+
+      if (shards_.size() > 1)
+      {
+        const std::string prefix = "orthanc_storage_cache_shard_" + boost::lexical_cast<std::string>(i);
+        registry.SetValue(prefix + "_size_mb", static_cast<float>(size) / MEGA_BYTES);
+        registry.SetValue(prefix + "_hits", static_cast<float>(hits));
+        registry.SetValue(prefix + "_misses", static_cast<float>(misses));
+        registry.SetValue(prefix + "_evictions", static_cast<float>(evictions));
+      }
+
+      totalSize += size;
+      totalHits += hits;
+      totalMisses += misses;
+      totalEvictions += evictions;
+    }
+
+    registry.SetValue("orthanc_storage_cache_size_mb", static_cast<float>(totalSize) / MEGA_BYTES);
+    registry.SetValue("orthanc_storage_cache_hits", static_cast<float>(totalHits));
+    registry.SetValue("orthanc_storage_cache_misses", static_cast<float>(totalMisses));
+    registry.SetValue("orthanc_storage_cache_evictions", static_cast<float>(totalEvictions));
   }
   
 
@@ -56,7 +236,7 @@ namespace Orthanc
                          const std::string& value)
   {
     const std::string key = GetCacheKeyFullFile(uuid, contentType);
-    cache_.Add(key, value);
+    GetShard(uuid).Add(key, value);
   }
   
 
@@ -66,7 +246,7 @@ namespace Orthanc
                          size_t size)
   {
     const std::string key = GetCacheKeyFullFile(uuid, contentType);
-    cache_.Add(key, buffer, size);
+    GetShard(uuid).Add(key, buffer, size);
   }
 
 
@@ -75,7 +255,7 @@ namespace Orthanc
                                    const std::string& value)
   {
     const std::string key = GetCacheKeyStartRange(uuid, contentType);
-    cache_.Add(key, value);
+    GetShard(uuid).Add(key, value);
   }
 
 
@@ -83,11 +263,13 @@ namespace Orthanc
                                 FileContentType contentType)
   {
     // invalidate both full file + start range file
+    MemoryStringCache& shard = GetShard(uuid);
+
     const std::string keyFullFile = GetCacheKeyFullFile(uuid, contentType);
-    cache_.Invalidate(keyFullFile);
+    shard.Invalidate(keyFullFile);
 
     const std::string keyPartialFile = GetCacheKeyStartRange(uuid, contentType);
-    cache_.Invalidate(keyPartialFile);
+    shard.Invalidate(keyPartialFile);
   }
   
 
@@ -96,7 +278,7 @@ namespace Orthanc
                            FileContentType contentType)
   {
     const std::string key = GetCacheKeyFullFile(uuid, contentType);
-    if (cache_.Fetch(value, key))
+    if (GetShard(uuid).Fetch(value, key))
     {
       LOG(INFO) << "Read attachment \"" << uuid << "\" with content type "
                 << boost::lexical_cast<std::string>(contentType) << " from cache";
@@ -115,7 +297,7 @@ namespace Orthanc
   {
     // first try to get the start of file only from cache
     const std::string keyPartialFile = GetCacheKeyStartRange(uuid, contentType);
-    if (cache_.Fetch(value, keyPartialFile) && value.size() >= end)
+    if (GetShard(uuid).Fetch(value, keyPartialFile) && value.size() >= end)
     {
       if (value.size() > end)  // the start range that has been cached is larger than the requested value
       {
@@ -128,21 +310,199 @@ namespace Orthanc
     }
     else
     {
-      // try to get the full file from cache
-      if (Fetch(value, uuid, contentType))
+      // try to get the start of the full file from cache
+      const std::string keyFullFile = GetCacheKeyFullFile(uuid, contentType);
+      return GetShard(uuid).FetchRange(value, keyFullFile, 0, static_cast<size_t>(end));
+    }
+  }
+
+
+  bool StorageCache::FetchRange(std::string& value, 
+                                const std::string& uuid,
+                                FileContentType contentType,
+                                uint64_t start,
+                                uint64_t end)
+  {
+    if (start > end ||
+        static_cast<uint64_t>(static_cast<size_t>(end)) != end)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    MemoryStringCache& shard = GetShard(uuid);
+
+    if (shard.FetchRange(value, GetCacheKeyFullFile(uuid, contentType),
+                         static_cast<size_t>(start), static_cast<size_t>(end)) ||
+        shard.FetchRange(value, GetCacheKeyStartRange(uuid, contentType),
+                         static_cast<size_t>(start), static_cast<size_t>(end)))
+    {
+      LOG(INFO) << "Read range of attachment \"" << uuid << "\" with content type "
+                << boost::lexical_cast<std::string>(contentType) << " from cache";
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  bool StorageCache::Accessor::FetchInternal(std::string& value,
+                                             const std::string& uuid,
+                                             FileContentType contentType,
+                                             bool isStartRange,
+                                             uint64_t end)
+  {
+    if (load_.get() != NULL)
+    {
+      // Only one attachment can be loaded at once by an accessor
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (isStartRange ?
+        cache_.FetchStartRange(value, uuid, contentType, end) :
+        cache_.Fetch(value, uuid, contentType))
+    {
+      return true;
+    }
+
+    const std::string key = (isStartRange ?
+                             GetCacheKeyStartRange(uuid, contentType) :
+                             GetCacheKeyFullFile(uuid, contentType));
+
+    boost::mutex::scoped_lock lock(cache_.pendingMutex_);
+
+    PendingLoads::iterator found = cache_.pendingLoads_.find(key);
+    if (found == cache_.pendingLoads_.end())
+    {
+      // Check the cache again, as a concurrent load might have
+      // completed since the first lookup
+      if (isStartRange ?
+          cache_.FetchStartRange(value, uuid, contentType, end) :
+          cache_.Fetch(value, uuid, contentType))
       {
-        if (value.size() < end)
-        {
-          throw OrthancException(ErrorCode_CorruptedFile);
-        }
+        return true;
+      }
+      else
+      {
+        // This accessor is now in charge of loading the attachment
+        load_.reset(new PendingLoad);
+        key_ = key;
+        cache_.pendingLoads_[key] = load_;
+        return false;
+      }
+    }
+    else
+    {
+      boost::shared_ptr<PendingLoad> load = found->second;
+      assert(load.get() != NULL);
 
-        value.resize(end);
+      load->AddWaiter();
+
+      while (!load->IsDone())
+      {
+        cache_.pendingCondition_.wait(lock);
+      }
+
+      if (!load->IsSuccess())
+      {
+        // The other thread has failed, the caller will read the
+        // attachment by itself
+        return false;
+      }
+      else if (!isStartRange)
+      {
+        value = load->GetValue();
+        return true;
+      }
+      else if (load->GetValue().size() >= end)
+      {
+        value.assign(load->GetValue(), 0, static_cast<size_t>(end));
         return true;
       }
       else
       {
+        // The range that was loaded by the other thread is too short
         return false;
       }
     }
   }
+
+
+  void StorageCache::Accessor::Complete(const std::string& value)
+  {
+    if (load_.get() != NULL)
+    {
+      boost::mutex::scoped_lock lock(cache_.pendingMutex_);
+      load_->SetSuccess(value);
+      cache_.pendingLoads_.erase(key_);
+      load_.reset();
+      cache_.pendingCondition_.notify_all();
+    }
+  }
+
+
+  StorageCache::Accessor::Accessor(StorageCache& cache) :
+    cache_(cache)
+  {
+  }
+
+
+  StorageCache::Accessor::~Accessor()
+  {
+    if (load_.get() != NULL)
+    {
+      // The attachment was not provided to "Add()", wake up the
+      // threads that are waiting for it
+      boost::mutex::scoped_lock lock(cache_.pendingMutex_);
+      load_->SetFailure();
+      cache_.pendingLoads_.erase(key_);
+      cache_.pendingCondition_.notify_all();
+    }
+  }
+
+
+  bool StorageCache::Accessor::Fetch(std::string& value,
+                                     const std::string& uuid,
+                                     FileContentType contentType)
+  {
+    return FetchInternal(value, uuid, contentType, false /* full file */, 0);
+  }
+
+
+  bool StorageCache::Accessor::FetchStartRange(std::string& value,
+                                               const std::string& uuid,
+                                               FileContentType contentType,
+                                               uint64_t end)
+  {
+    return FetchInternal(value, uuid, contentType, true /* start range */, end);
+  }
+
+
+  void StorageCache::Accessor::Add(const std::string& uuid,
+                                   FileContentType contentType,
+                                   const std::string& value)
+  {
+    cache_.Add(uuid, contentType, value);
+
+    if (load_.get() != NULL &&
+        key_ == GetCacheKeyFullFile(uuid, contentType))
+    {
+      Complete(value);
+    }
+  }
+
+
+  void StorageCache::Accessor::AddStartRange(const std::string& uuid,
+                                             FileContentType contentType,
+                                             const std::string& value)
+  {
+    cache_.AddStartRange(uuid, contentType, value);
+
+    if (load_.get() != NULL &&
+        key_ == GetCacheKeyStartRange(uuid, contentType))
+    {
+      Complete(value);
+    }
+  }
 }
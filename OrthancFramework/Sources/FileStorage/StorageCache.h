@@ -27,22 +27,66 @@
 
 #include "../Compatibility.h"  // For ORTHANC_OVERRIDE
 
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <map>
+#include <vector>
 
 namespace Orthanc
 {
+  class MetricsRegistry;
+
    /**
-   *  Note: this class is thread safe
+   * The storage cache can be split into several independent shards,
+   * each one having its own LRU index, its own lock and its own share
+   * of the maximum size. The shard of an attachment is chosen from
+   * the hash of its UUID. This reduces the contention on the mutex of
+   * the cache if many threads are reading attachments concurrently
+   * (new in Orthanc 1.11.2).
+   *
+   *  Note: this class is thread safe, except "SetShardsCount()"
    **/
    class ORTHANC_PUBLIC StorageCache : public boost::noncopyable
     {
     private:
-      MemoryStringCache   cache_;
-      
+      class PendingLoad;
+
+      typedef std::map<std::string, boost::shared_ptr<PendingLoad> >  PendingLoads;
+
+      std::vector<MemoryStringCache*>  shards_;
+      size_t                           maximumSize_;
+
+      // Attachments that are currently being read from the storage
+      // area by some thread (new in Orthanc 1.11.2)
+      boost::mutex                     pendingMutex_;
+      boost::condition_variable        pendingCondition_;
+      PendingLoads                     pendingLoads_;
+
+      MemoryStringCache& GetShard(const std::string& uuid);
+
+      void ClearShards();
+
     public:
+      StorageCache();
+
+      ~StorageCache();
+
       void SetMaximumSize(size_t size);
 
+      // This method must only be called at the initialization of
+      // Orthanc, before the cache is accessed by other threads
+      // (new in Orthanc 1.11.2)
+      void SetShardsCount(size_t count);
+
+      size_t GetShardsCount() const
+      {
+        return shards_.size();
+      }
+
+      // New in Orthanc 1.11.2
+      void PublishMetrics(MetricsRegistry& registry);
+
       void Add(const std::string& uuid, 
                FileContentType contentType,
                const std::string& value);
@@ -68,5 +112,61 @@ namespace Orthanc
                            FileContentType contentType,
                            uint64_t end /* exclusive */);
 
+      // Copies one range of a cached attachment, without copying the
+      // full attachment (new in Orthanc 1.11.2)
+      bool FetchRange(std::string& value, 
+                      const std::string& uuid,
+                      FileContentType contentType,
+                      uint64_t start,
+                      uint64_t end /* exclusive */);
+
+
+      /**
+       * Single-flight access to the cache (new in Orthanc 1.11.2). If
+       * "Fetch()" misses, the accessor becomes responsible for loading
+       * the attachment, and must provide it to "Add()". Meanwhile, the
+       * other accessors that miss the same attachment wait for this
+       * load to complete and share its result, instead of reading the
+       * same file from the storage area. If the accessor is destroyed
+       * before "Add()" is called (e.g. because of an exception), the
+       * waiting accessors are woken up and load the file by themselves.
+       **/
+      class ORTHANC_PUBLIC Accessor : public boost::noncopyable
+      {
+      private:
+        StorageCache&                   cache_;
+        std::string                     key_;
+        boost::shared_ptr<PendingLoad>  load_;
+
+        bool FetchInternal(std::string& value,
+                           const std::string& uuid,
+                           FileContentType contentType,
+                           bool isStartRange,
+                           uint64_t end);
+
+        void Complete(const std::string& value);
+
+      public:
+        explicit Accessor(StorageCache& cache);
+
+        ~Accessor();
+
+        bool Fetch(std::string& value,
+                   const std::string& uuid,
+                   FileContentType contentType);
+
+        bool FetchStartRange(std::string& value,
+                             const std::string& uuid,
+                             FileContentType contentType,
+                             uint64_t end /* exclusive */);
+
+        void Add(const std::string& uuid,
+                 FileContentType contentType,
+                 const std::string& value);
+
+        void AddStartRange(const std::string& uuid,
+                           FileContentType contentType,
+                           const std::string& value);
+      };
     };
 }
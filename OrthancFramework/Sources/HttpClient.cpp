@@ -34,6 +34,7 @@
 #include <curl/curl.h>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/thread/mutex.hpp>
+#include <list>
 
 // Default timeout = 60 seconds (in Orthanc <= 1.5.6, it was 10 seconds)
 static const unsigned int DEFAULT_HTTP_TIMEOUT = 60;
@@ -538,9 +539,255 @@ namespace Orthanc
   };
 
 
+  /**
+   * Process-wide pool of the idle cURL handles (new in Orthanc
+   * 1.11.2). A cURL handle keeps its own cache of live connections,
+   * so handing an idle handle to the next client that targets the
+   * same endpoint avoids redoing the TCP and TLS handshakes. The DNS
+   * cache and the TLS sessions are additionally shared between all
+   * the handles. The connection cache itself is not shared, as
+   * libcurl does not support sharing it between concurrent threads.
+   **/
+  class HttpClient::HandlesPool : public boost::noncopyable
+  {
+  private:
+    typedef std::list<CURL*>                 Handles;
+    typedef std::map<std::string, Handles*>  Content;
+
+    boost::mutex    mutex_;
+    Content         content_;
+    unsigned int    maxIdlePerEndpoint_;
+    bool            http2_;
+    CURLSH*         share_;
+    uint64_t        countCreated_;
+    uint64_t        countReused_;
+    unsigned int    countIdle_;
+    unsigned int    countActive_;
+    boost::mutex    shareMutexes_[CURL_LOCK_DATA_LAST];
+
+    static void LockShare(CURL* handle,
+                          curl_lock_data data,
+                          curl_lock_access access,
+                          void* payload)
+    {
+      assert(payload != NULL && data < CURL_LOCK_DATA_LAST);
+      reinterpret_cast<HandlesPool*>(payload)->shareMutexes_[data].lock();
+    }
+
+    static void UnlockShare(CURL* handle,
+                            curl_lock_data data,
+                            void* payload)
+    {
+      assert(payload != NULL && data < CURL_LOCK_DATA_LAST);
+      reinterpret_cast<HandlesPool*>(payload)->shareMutexes_[data].unlock();
+    }
+
+    void CreateShare()
+    {
+      // Mutex must be locked
+      assert(share_ == NULL);
+
+      share_ = curl_share_init();
+      if (share_ == NULL)
+      {
+        throw OrthancException(ErrorCode_NotEnoughMemory);
+      }
+
+      if (curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, LockShare) != CURLSHE_OK ||
+          curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, UnlockShare) != CURLSHE_OK ||
+          curl_share_setopt(share_, CURLSHOPT_USERDATA, this) != CURLSHE_OK ||
+          curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK ||
+          curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK)
+      {
+        curl_share_cleanup(share_);
+        share_ = NULL;
+        throw OrthancException(ErrorCode_InternalError, "Cannot setup the cURL share interface");
+      }
+    }
+
+    HandlesPool() :
+      maxIdlePerEndpoint_(4),
+      http2_(false),
+      share_(NULL),
+      countCreated_(0),
+      countReused_(0),
+      countIdle_(0),
+      countActive_(0)
+    {
+    }
+
+  public:
+    // Singleton pattern
+    static HandlesPool& GetInstance()
+    {
+      static HandlesPool pool;
+      return pool;
+    }
+
+    ~HandlesPool()
+    {
+      Finalize();
+    }
+
+    void SetMaxIdlePerEndpoint(unsigned int count)
+    {
+      CLOG(INFO, HTTP) << "Setting the size of the pool of HTTP client connections: "
+                       << count << " idle connection(s) per endpoint";
+
+      boost::mutex::scoped_lock lock(mutex_);
+      maxIdlePerEndpoint_ = count;
+
+      // Drop the handles in excess
+      for (Content::iterator it = content_.begin(); it != content_.end(); ++it)
+      {
+        assert(it->second != NULL);
+        while (it->second->size() > count)
+        {
+          curl_easy_cleanup(it->second->back());
+          it->second->pop_back();
+          countIdle_--;
+        }
+      }
+    }
+
+    void SetHttp2Enabled(bool enabled)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      http2_ = enabled;
+    }
+
+    bool IsHttp2Enabled()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return http2_;
+    }
+
+    CURL* Acquire(const std::string& endpoint)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Content::iterator found = content_.find(endpoint);
+      if (found != content_.end() &&
+          !found->second->empty())
+      {
+        // Reuse the most recently released handle, as its
+        // connections are the most likely to be still alive
+        CURL* handle = found->second->front();
+        found->second->pop_front();
+        countIdle_--;
+        countReused_++;
+        countActive_++;
+        return handle;
+      }
+
+      if (share_ == NULL)
+      {
+        CreateShare();
+      }
+
+      CURL* handle = curl_easy_init();
+      if (handle == NULL)
+      {
+        throw OrthancException(ErrorCode_NotEnoughMemory);
+      }
+
+      if (curl_easy_setopt(handle, CURLOPT_SHARE, share_) != CURLE_OK)
+      {
+        curl_easy_cleanup(handle);
+        throw OrthancException(ErrorCode_InternalError, "Cannot setup the cURL share interface");
+      }
+
+      countCreated_++;
+      countActive_++;
+      return handle;
+    }
+
+    void Release(const std::string& endpoint,
+                 CURL* handle)
+    {
+      assert(handle != NULL);
+
+      /**
+       * "curl_easy_reset()" restores the default options, which
+       * notably forgets the credentials and the client certificates
+       * of the previous request. Live connections, the DNS cache, the
+       * TLS sessions and the share are preserved by libcurl.
+       **/
+      curl_easy_reset(handle);
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      assert(countActive_ > 0);
+      countActive_--;
+
+      if (maxIdlePerEndpoint_ == 0)
+      {
+        curl_easy_cleanup(handle);
+        return;
+      }
+
+      Content::iterator found = content_.find(endpoint);
+      if (found == content_.end())
+      {
+        found = content_.insert(std::make_pair(endpoint, new Handles)).first;
+      }
+
+      found->second->push_front(handle);
+      countIdle_++;
+
+      if (found->second->size() > maxIdlePerEndpoint_)
+      {
+        curl_easy_cleanup(found->second->back());
+        found->second->pop_back();
+        countIdle_--;
+      }
+    }
+
+    void Finalize()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (Content::iterator it = content_.begin(); it != content_.end(); ++it)
+      {
+        assert(it->second != NULL);
+        for (Handles::iterator handle = it->second->begin(); handle != it->second->end(); ++handle)
+        {
+          curl_easy_cleanup(*handle);
+        }
+
+        delete it->second;
+      }
+
+      content_.clear();
+      countIdle_ = 0;
+
+      // The share cannot be released while some handle still uses it
+      if (share_ != NULL &&
+          countActive_ == 0)
+      {
+        curl_share_cleanup(share_);
+        share_ = NULL;
+      }
+    }
+
+    void GetStatistics(uint64_t& countCreated,
+                       uint64_t& countReused,
+                       unsigned int& countIdle,
+                       unsigned int& countActive)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      countCreated = countCreated_;
+      countReused = countReused_;
+      countIdle = countIdle_;
+      countActive = countActive_;
+    }
+  };
+
+
   struct HttpClient::PImpl
   {
     CURL* curl_;
+    std::string endpoint_;  // Key of "curl_" in the pool of handles
     CurlHeaders defaultPostHeaders_;
     CurlHeaders defaultChunkedHeaders_;
     CurlHeaders userHeaders_;
@@ -604,17 +851,9 @@ namespace Orthanc
     pimpl_->defaultChunkedHeaders_.AddHeader("Expect", "");
     pimpl_->defaultChunkedHeaders_.AddHeader("Transfer-Encoding", "chunked");
 
-    pimpl_->curl_ = curl_easy_init();
-
-    CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_HEADERFUNCTION, &CurlAnswer::HeaderCallback));
-    CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_WRITEFUNCTION, &CurlAnswer::BodyCallback));
-    CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_HEADER, 0));
-    CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_FOLLOWLOCATION, 1));
-
-    // This fixes the "longjmp causes uninitialized stack frame" crash
-    // that happens on modern Linux versions.
-    // http://stackoverflow.com/questions/9191668/error-longjmp-causes-uninitialized-stack-frame
-    CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_NOSIGNAL, 1));
+    // Since Orthanc 1.11.2, the cURL handle is only taken from the
+    // pool by "ApplyInternal()", once the target endpoint is known
+    pimpl_->curl_ = NULL;
 
     url_ = "";
     method_ = HttpMethod_Get;
@@ -684,7 +923,72 @@ namespace Orthanc
 
   HttpClient::~HttpClient()
   {
-    curl_easy_cleanup(pimpl_->curl_);
+    ReleaseHandle();
+  }
+
+
+  void HttpClient::ReleaseHandle()
+  {
+    if (pimpl_->curl_ != NULL)
+    {
+      HandlesPool::GetInstance().Release(pimpl_->endpoint_, pimpl_->curl_);
+      pimpl_->curl_ = NULL;
+    }
+  }
+
+
+  std::string HttpClient::GetPoolEndpoint() const
+  {
+    // The handles are pooled per scheme, host and port, and per
+    // authentication parameters, so that a live connection is only
+    // reused by the requests that would have opened the same one
+    std::string endpoint;
+
+    size_t scheme = url_.find("://");
+    if (scheme == std::string::npos)
+    {
+      endpoint = url_;
+    }
+    else
+    {
+      endpoint = url_.substr(0, url_.find('/', scheme + 3));
+    }
+
+    return (endpoint + "\n" + credentials_ + "\n" + proxy_ + "\n" +
+            clientCertificateFile_ + "\n" + clientCertificateKeyFile_ + "\n" +
+            (pkcs11Enabled_ ? "pkcs11" : ""));
+  }
+
+
+  void HttpClient::AcquireHandle()
+  {
+    const std::string endpoint = GetPoolEndpoint();
+
+    if (pimpl_->curl_ != NULL &&
+        pimpl_->endpoint_ == endpoint)
+    {
+      return;  // The current handle can be reused
+    }
+
+    ReleaseHandle();
+
+    pimpl_->curl_ = HandlesPool::GetInstance().Acquire(endpoint);
+    pimpl_->endpoint_ = endpoint;
+
+    CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_HEADERFUNCTION, &CurlAnswer::HeaderCallback));
+    CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_WRITEFUNCTION, &CurlAnswer::BodyCallback));
+    CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_HEADER, 0));
+
+    // This fixes the "longjmp causes uninitialized stack frame" crash
+    // that happens on modern Linux versions.
+    // http://stackoverflow.com/questions/9191668/error-longjmp-causes-uninitialized-stack-frame
+    CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_NOSIGNAL, 1));
+
+    if (HandlesPool::GetInstance().IsHttp2Enabled())
+    {
+      // Negotiate HTTP/2 through ALPN for HTTPS, keep HTTP/1.1 for plain HTTP
+      CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS));
+    }
   }
 
   void HttpClient::SetUrl(const char *url)
@@ -792,16 +1096,6 @@ namespace Orthanc
   void HttpClient::SetVerbose(bool isVerbose)
   {
     isVerbose_ = isVerbose;
-
-    if (isVerbose_)
-    {
-      CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_VERBOSE, 1));
-      //CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_DEBUGFUNCTION, &CurlDebugCallback));
-    }
-    else
-    {
-      CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_VERBOSE, 0));
-    }
   }
 
   bool HttpClient::IsVerbose() const
@@ -834,7 +1128,19 @@ namespace Orthanc
   {
     CLOG(INFO, HTTP) << "New HTTP request to: " << url_ << " (timeout: "
                      << boost::lexical_cast<std::string>(timeout_ <= 0 ? DEFAULT_HTTP_TIMEOUT : timeout_) << "s)";
-    
+
+    AcquireHandle();
+
+    if (isVerbose_)
+    {
+      CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_VERBOSE, 1));
+      //CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_DEBUGFUNCTION, &CurlDebugCallback));
+    }
+    else
+    {
+      CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_VERBOSE, 0));
+    }
+
     CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_URL, url_.c_str()));
     CheckCode(curl_easy_setopt(pimpl_->curl_, CURLOPT_HEADERDATA, &answer));
 
@@ -1200,6 +1506,7 @@ namespace Orthanc
 
   void HttpClient::GlobalFinalize()
   {
+    HandlesPool::GetInstance().Finalize();
     curl_global_cleanup();
 
 #if ORTHANC_ENABLE_PKCS11 == 1
@@ -1226,6 +1533,35 @@ namespace Orthanc
   }
 
 
+  void HttpClient::SetConnectionPoolSize(unsigned int size)
+  {
+    HandlesPool::GetInstance().SetMaxIdlePerEndpoint(size);
+  }
+
+
+  void HttpClient::SetHttp2Enabled(bool enabled)
+  {
+    if (enabled &&
+        !(curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2))
+    {
+      LOG(WARNING) << "This version of libcurl does not support HTTP/2, "
+                   << "HTTP client connections will use HTTP/1.1";
+      enabled = false;
+    }
+
+    HandlesPool::GetInstance().SetHttp2Enabled(enabled);
+  }
+
+
+  void HttpClient::GetConnectionPoolStatistics(uint64_t& countCreated,
+                                               uint64_t& countReused,
+                                               unsigned int& countIdle,
+                                               unsigned int& countActive)
+  {
+    HandlesPool::GetInstance().GetStatistics(countCreated, countReused, countIdle, countActive);
+  }
+
+
   bool HttpClient::Apply(IAnswer& answer)
   {
     CurlAnswer wrapper(answer, headersToLowerCase_);
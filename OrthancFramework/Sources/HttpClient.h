@@ -27,6 +27,7 @@
 #include "OrthancFramework.h"
 #include "WebServiceParameters.h"
 
+#include <stdint.h>
 #include <string>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
@@ -86,6 +87,7 @@ namespace Orthanc
     class CurlAnswer;
     class DefaultAnswer;
     class GlobalParameters;
+    class HandlesPool;
 
     struct PImpl;
     boost::shared_ptr<PImpl> pimpl_;
@@ -114,6 +116,12 @@ namespace Orthanc
 
     void Setup();
 
+    std::string GetPoolEndpoint() const;
+
+    void AcquireHandle();
+
+    void ReleaseHandle();
+
     void operator= (const HttpClient&);  // Assignment forbidden
     HttpClient(const HttpClient& base);  // Copy forbidden
 
@@ -238,6 +246,19 @@ namespace Orthanc
 
     static void SetDefaultTimeout(long timeout);
 
+    // New in Orthanc 1.11.2: Maximum number of idle cURL handles
+    // (hence of warm connections) kept per endpoint, "0" disables pooling
+    static void SetConnectionPoolSize(unsigned int size);
+
+    // New in Orthanc 1.11.2
+    static void SetHttp2Enabled(bool enabled);
+
+    // New in Orthanc 1.11.2
+    static void GetConnectionPoolStatistics(uint64_t& countCreated,
+                                            uint64_t& countReused,
+                                            unsigned int& countIdle,
+                                            unsigned int& countActive);
+
     void ApplyAndThrowException(IAnswer& answer);
 
     void ApplyAndThrowException(std::string& answerBody);
@@ -323,9 +323,9 @@ namespace Orthanc
   private:
     IHttpHandler&         handler_;
     ChunkStore&           chunkStore_;
-    const std::string&    remoteIp_;
-    const std::string&    username_;
-    const UriComponents&  uri_;
+    std::string           remoteIp_;
+    std::string           username_;
+    UriComponents         uri_;
     bool                  isJQueryUploadChunk_;
     std::string           jqueryUploadFileName_;
     size_t                jqueryUploadFileSize_;
@@ -446,19 +446,48 @@ namespace Orthanc
   };
 
 
-  void HttpServer::ProcessMultipartFormData(const std::string& remoteIp,
-                                            const std::string& username,
-                                            const UriComponents& uri,
-                                            const std::map<std::string, std::string>& headers,
-                                            const std::string& body,
-                                            const std::string& boundary)
+  class HttpServer::MultipartFormDataReader : public IHttpHandler::IChunkedRequestReader
   {
-    MultipartFormDataHandler handler(GetHandler(), pimpl_->chunkStore_, remoteIp, username, uri, headers);
-          
-    MultipartStreamReader reader(boundary);
-    reader.SetHandler(handler);
-    reader.AddChunk(body);        
-    reader.CloseStream();
+  private:
+    MultipartFormDataHandler  handler_;
+    MultipartStreamReader     reader_;
+
+  public:
+    MultipartFormDataReader(IHttpHandler& handler,
+                            ChunkStore& chunkStore,
+                            const std::string& remoteIp,
+                            const std::string& username,
+                            const UriComponents& uri,
+                            const MultipartStreamReader::HttpHeaders& headers,
+                            const std::string& boundary) :
+      handler_(handler, chunkStore, remoteIp, username, uri, headers),
+      reader_(boundary)
+    {
+      reader_.SetHandler(handler_);
+    }
+
+    virtual void AddBodyChunk(const void* data,
+                              size_t size) ORTHANC_OVERRIDE
+    {
+      reader_.AddChunk(data, size);
+    }
+
+    virtual void Execute(HttpOutput& output) ORTHANC_OVERRIDE
+    {
+      reader_.CloseStream();
+      output.SendStatus(HttpStatus_200_Ok);
+    }
+  };
+
+
+  IHttpHandler::IChunkedRequestReader* HttpServer::CreateMultipartFormDataReader(
+    const std::string& remoteIp,
+    const std::string& username,
+    const UriComponents& uri,
+    const std::map<std::string, std::string>& headers,
+    const std::string& boundary)
+  {
+    return new MultipartFormDataReader(GetHandler(), pimpl_->chunkStore_, remoteIp, username, uri, headers, boundary);
   }
   
 
@@ -555,28 +584,57 @@ namespace Orthanc
 
   static PostDataStatus ReadBodyToStream(IHttpHandler::IChunkedRequestReader& stream,
                                          struct mg_connection *connection,
-                                         const HttpToolbox::Arguments& headers)
+                                         const HttpToolbox::Arguments& headers,
+                                         size_t chunkSize)
   {
+    assert(chunkSize > 0);
+    
     HttpToolbox::Arguments::const_iterator contentLength = headers.find("content-length");
 
     if (contentLength != headers.end())
     {
-      // "Content-Length" is available
-      std::string body;
-      PostDataStatus status = ReadBodyWithContentLength(body, connection, contentLength->second);
+      // "Content-Length" is available. Forward the body to the
+      // stream by chunks, so that the full body is never stored in
+      // RAM (new in Orthanc 1.11.2).
+      uint64_t remaining;
+      try
+      {
+        int64_t tmp = boost::lexical_cast<int64_t>(contentLength->second);
+        if (tmp < 0)
+        {
+          return PostDataStatus_NoLength;
+        }
 
-      if (status == PostDataStatus_Success &&
-          !body.empty())
+        remaining = static_cast<uint64_t>(tmp);
+      }
+      catch (boost::bad_lexical_cast&)
       {
-        stream.AddBodyChunk(body.c_str(), body.size());
+        return PostDataStatus_NoLength;
+      }
+
+      std::string tmp(static_cast<size_t>(std::min(remaining, static_cast<uint64_t>(chunkSize))), 0);
+
+      while (remaining > 0)
+      {
+        size_t toRead = static_cast<size_t>(std::min(remaining, static_cast<uint64_t>(tmp.size())));
+        
+        int r = mg_read(connection, &tmp[0], toRead);
+        if (r <= 0)
+        {
+          return PostDataStatus_Failure;
+        }
+
+        assert(static_cast<size_t>(r) <= toRead);
+        stream.AddBodyChunk(tmp.c_str(), r);
+        remaining -= r;
       }
 
-      return status;
+      return PostDataStatus_Success;
     }
     else
     {
       // No Content-Length: This is a chunked transfer. Stream the HTTP connection.
-      std::string tmp(1024 * 1024, 0);
+      std::string tmp(chunkSize, 0);
       
       for (;;)
       {
@@ -1337,11 +1395,13 @@ namespace Orthanc
          **/
         isMultipartForm = true;
 
-        status = ReadBodyToString(body, connection, headers);
+        std::unique_ptr<IHttpHandler::IChunkedRequestReader> stream(
+          server.CreateMultipartFormDataReader(remoteIp, username, uri, headers, boundary));
+
+        status = ReadBodyToStream(*stream, connection, headers, server.GetRequestBodyChunkSize());
         if (status == PostDataStatus_Success)
         {
-          server.ProcessMultipartFormData(remoteIp, username, uri, headers, body, boundary);
-          output.SendStatus(HttpStatus_200_Ok);
+          stream->Execute(output);
           return;
         }
       }
@@ -1363,7 +1423,7 @@ namespace Orthanc
             throw OrthancException(ErrorCode_InternalError);
           }
 
-          status = ReadBodyToStream(*stream, connection, headers);
+          status = ReadBodyToStream(*stream, connection, headers, server.GetRequestBodyChunkSize());
 
           if (status == PostDataStatus_Success)
           {
@@ -1575,7 +1635,8 @@ namespace Orthanc
     realm_(ORTHANC_REALM),
     threadsCount_(50),  // Default value in mongoose/civetweb
     tcpNoDelay_(true),
-    requestTimeout_(30)  // Default value in mongoose/civetweb (30 seconds)
+    requestTimeout_(30),  // Default value in mongoose/civetweb (30 seconds)
+    requestBodyChunkSize_(1024 * 1024)  // 1MB
   {
 #if ORTHANC_ENABLE_MONGOOSE == 1
     CLOG(INFO, HTTP) << "This Orthanc server uses Mongoose as its embedded HTTP server";
@@ -2113,6 +2174,24 @@ namespace Orthanc
   }
 
 
+  void HttpServer::SetRequestBodyChunkSize(size_t size)
+  {
+    if (size == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "The size of the chunks of the HTTP request bodies must be strictly positive");
+    }
+
+    requestBodyChunkSize_ = size;
+    CLOG(INFO, HTTP) << "The bodies of the HTTP requests are streamed by chunks of " << size << " bytes";
+  }
+
+  size_t HttpServer::GetRequestBodyChunkSize() const
+  {
+    return requestBodyChunkSize_;
+  }
+
+
 #if ORTHANC_ENABLE_PUGIXML == 1
   HttpServer::WebDavBuckets& HttpServer::GetWebDavBuckets()
   {
@@ -48,6 +48,7 @@
 #endif
 
 
+#include "IHttpHandler.h"
 #include "IIncomingHttpRequestFilter.h"
 
 #include <list>
@@ -88,6 +89,7 @@ namespace Orthanc
 
     class ChunkStore;
     class MultipartFormDataHandler;
+    class MultipartFormDataReader;
 
     IHttpHandler *handler_;
 
@@ -112,6 +114,7 @@ namespace Orthanc
     unsigned int threadsCount_;
     bool tcpNoDelay_;
     unsigned int requestTimeout_;  // In seconds
+    size_t requestBodyChunkSize_;  // In bytes
 
 #if ORTHANC_ENABLE_PUGIXML == 1
     WebDavBuckets webDavBuckets_;
@@ -204,6 +207,12 @@ namespace Orthanc
 
     unsigned int GetRequestTimeout() const;
 
+    // New in Orthanc 1.11.2: Size of the chunks that are read from
+    // the socket when streaming the body of POST/PUT requests
+    void SetRequestBodyChunkSize(size_t size);
+
+    size_t GetRequestBodyChunkSize() const;
+
 #if ORTHANC_ENABLE_PUGIXML == 1
     WebDavBuckets& GetWebDavBuckets();
 #endif
@@ -214,11 +223,10 @@ namespace Orthanc
 #endif
 
     ORTHANC_LOCAL
-    void ProcessMultipartFormData(const std::string& remoteIp,
-                                  const std::string& username,
-                                  const UriComponents& uri,
-                                  const std::map<std::string, std::string>& headers,
-                                  const std::string& body,
-                                  const std::string& boundary);
+    IHttpHandler::IChunkedRequestReader* CreateMultipartFormDataReader(const std::string& remoteIp,
+                                                                       const std::string& username,
+                                                                       const UriComponents& uri,
+                                                                       const std::map<std::string, std::string>& headers,
+                                                                       const std::string& boundary);
   };
 }
@@ -0,0 +1,69 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+#include "../PrecompiledHeaders.h"
+#include "MemoryBufferHttpSender.h"
+
+#include "../OrthancException.h"
+
+namespace Orthanc
+{
+  MemoryBufferHttpSender::MemoryBufferHttpSender(IMemoryBuffer* buffer) :
+    buffer_(buffer),
+    done_(false)
+  {
+    if (buffer == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+  }
+
+  uint64_t MemoryBufferHttpSender::GetContentLength()
+  {
+    return buffer_->GetSize();
+  }
+
+  bool MemoryBufferHttpSender::ReadNextChunk()
+  {
+    if (done_ ||
+        buffer_->GetSize() == 0)
+    {
+      return false;
+    }
+    else
+    {
+      // The entire buffer is sent at once
+      done_ = true;
+      return true;
+    }
+  }
+
+  const char* MemoryBufferHttpSender::GetChunkContent()
+  {
+    return reinterpret_cast<const char*>(buffer_->GetData());
+  }
+
+  size_t MemoryBufferHttpSender::GetChunkSize()
+  {
+    return buffer_->GetSize();
+  }
+}
@@ -0,0 +1,57 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "HttpFileSender.h"
+#include "../IMemoryBuffer.h"
+
+namespace Orthanc
+{
+  /**
+   * Sends the content of a memory buffer without copying it, which
+   * is notably useful for files that are mapped into memory (new in
+   * Orthanc 1.11.2).
+   **/
+  class ORTHANC_PUBLIC MemoryBufferHttpSender : public HttpFileSender
+  {
+  private:
+    std::unique_ptr<IMemoryBuffer>  buffer_;
+    bool                            done_;
+
+  public:
+    // Takes the ownership of the buffer
+    explicit MemoryBufferHttpSender(IMemoryBuffer* buffer);
+
+    /**
+     * Implementation of the IHttpStreamAnswer interface.
+     **/
+
+    virtual uint64_t GetContentLength() ORTHANC_OVERRIDE;
+
+    virtual bool ReadNextChunk() ORTHANC_OVERRIDE;
+
+    virtual const char* GetChunkContent() ORTHANC_OVERRIDE;
+
+    virtual size_t GetChunkSize() ORTHANC_OVERRIDE;
+  };
+}
@@ -25,6 +25,7 @@
 #include "ImageProcessing.h"
 
 #include "Image.h"
+#include "ImageProcessingSimd.h"
 #include "ImageTraits.h"
 #include "PixelTraits.h"
 #include "../OrthancException.h"
@@ -40,8 +41,14 @@
 #pragma GCC diagnostic ignored "-Wimplicit-int-float-conversion"
 #endif 
 
+#include <boost/math/constants/constants.hpp>
 #include <boost/math/special_functions/round.hpp>
 
+#if ORTHANC_SANDBOXED != 1
+#  include "../MultiThreading/RunnableWorkersPool.h"
+#  include <boost/thread.hpp>
+#endif
+
 #include <algorithm>
 #include <cassert>
 #include <limits>
@@ -111,7 +118,11 @@ namespace Orthanc
       TargetType* t = reinterpret_cast<TargetType*>(target.GetRow(y));
       const SourceType* s = reinterpret_cast<const SourceType*>(source.GetConstRow(y));
 
-      for (unsigned int x = 0; x < width; x++, t++, s++)
+      unsigned int x = ImageProcessingSimd::Convert(t, s, width);
+      t += x;
+      s += x;
+
+      for (; x < width; x++, t++, s++)
       {
         if (static_cast<int32_t>(*s) < static_cast<int32_t>(minValue))
         {
@@ -292,7 +303,10 @@ namespace Orthanc
     {
       const PixelType* p = reinterpret_cast<const PixelType*>(source.GetConstRow(y));
 
-      for (unsigned int x = 0; x < width; x++, p++)
+      unsigned int x = ImageProcessingSimd::GetMinMax(minValue, maxValue, p, width);
+      p += x;
+
+      for (; x < width; x++, p++)
       {
         if (*p < minValue)
         {
@@ -447,7 +461,11 @@ namespace Orthanc
       TargetType* p = reinterpret_cast<TargetType*>(target.GetRow(y));
       const SourceType* q = reinterpret_cast<const SourceType*>(source.GetConstRow(y));
 
-      for (unsigned int x = 0; x < width; x++, p++, q++)
+      unsigned int x = ImageProcessingSimd::ShiftScale(p, q, width, a, b, UseRound, Invert);
+      p += x;
+      q += x;
+
+      for (; x < width; x++, p++, q++)
       {
         float v = a * static_cast<float>(*q) + b;
 
@@ -1604,7 +1622,10 @@ namespace Orthanc
         {
           uint16_t* p = reinterpret_cast<uint16_t*>(image.GetRow(y));
 
-          for (unsigned int x = 0; x < width; x++, p++)
+          unsigned int x = ImageProcessingSimd::Invert(p, width, maxValueUint16);
+          p += x;
+
+          for (; x < width; x++, p++)
           {
             *p = maxValueUint16 - (*p);
           }
@@ -1620,7 +1641,10 @@ namespace Orthanc
         {
           uint8_t* p = reinterpret_cast<uint8_t*>(image.GetRow(y));
 
-          for (unsigned int x = 0; x < width; x++, p++)
+          unsigned int x = ImageProcessingSimd::Invert(p, width, maxValueUint8);
+          p += x;
+
+          for (; x < width; x++, p++)
           {
             *p = maxValueUint8 - (*p);
           }
@@ -1635,6 +1659,24 @@ namespace Orthanc
 
   }
 
+  void ImageProcessing::SetSimdEnabled(bool enabled)
+  {
+    ImageProcessingSimd::SetEnabled(enabled);
+  }
+
+
+  bool ImageProcessing::IsSimdEnabled()
+  {
+    return ImageProcessingSimd::IsEnabled();
+  }
+
+
+  const char* ImageProcessing::GetSimdInstructionSet()
+  {
+    return ImageProcessingSimd::EnumerationToString(ImageProcessingSimd::GetInstructionSet());
+  }
+
+
   void ImageProcessing::Invert(ImageAccessor& image)
   {
     switch (image.GetFormat())
@@ -2280,95 +2322,766 @@ namespace Orthanc
   }
 
 
-  template <PixelFormat Format>
-  static void ResizeInternal(ImageAccessor& target,
-                             const ImageAccessor& source)
+  namespace
   {
-    assert(target.GetFormat() == source.GetFormat() &&
-           target.GetFormat() == Format);
-      
-    const unsigned int sourceWidth = source.GetWidth();
-    const unsigned int sourceHeight = source.GetHeight();
-    const unsigned int targetWidth = target.GetWidth();
-    const unsigned int targetHeight = target.GetHeight();
+    // Processes a band of rows of an image. The implementations can
+    // run in a separate thread, whose exceptions are reported to the
+    // caller of "ProcessRows()".
+    class IRowsProcessor : public boost::noncopyable
+    {
+    public:
+      virtual ~IRowsProcessor()
+      {
+      }
 
-    if (targetWidth == 0 || targetHeight == 0)
+      virtual void Process(unsigned int startRow,
+                           unsigned int endRow) = 0;
+    };
+  }
+
+
+#if ORTHANC_SANDBOXED != 1
+  namespace
+  {
+    // Counts the bands of rows that are still processed by the
+    // workers, and keeps the first error of the workers
+    class RowsBarrier : public boost::noncopyable
     {
-      return;
-    }
+    private:
+      boost::mutex                       mutex_;
+      boost::condition_variable          done_;
+      unsigned int                       pending_;
+      std::unique_ptr<OrthancException>  error_;
+
+    public:
+      RowsBarrier() :
+        pending_(0)
+      {
+      }
+
+      void Add()
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        pending_++;
+      }
+
+      void Signal()
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        assert(pending_ > 0);
+        pending_--;
+
+        if (pending_ == 0)
+        {
+          done_.notify_all();
+        }
+      }
+
+      void SetError(const OrthancException& error)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (error_.get() == NULL)
+        {
+          error_.reset(new OrthancException(error));
+        }
+      }
+
+      void Wait()
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        while (pending_ > 0)
+        {
+          done_.wait(lock);
+        }
+      }
+
+      // Must be called after "Wait()"
+      void CheckError()
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (error_.get() != NULL)
+        {
+          throw OrthancException(*error_);
+        }
+      }
+    };
+
 
-    if (sourceWidth == 0 || sourceHeight == 0)
+    class RowsBand : public IRunnableBySteps
     {
-      // Avoids division by zero below
-      ImageProcessing::Set(target, 0);
-      return;
-    }
-      
-    const float scaleX = static_cast<float>(sourceWidth) / static_cast<float>(targetWidth);
-    const float scaleY = static_cast<float>(sourceHeight) / static_cast<float>(targetHeight);
+    private:
+      IRowsProcessor&  processor_;
+      unsigned int     startRow_;
+      unsigned int     endRow_;
+      RowsBarrier&     barrier_;
+      bool             signaled_;
+
+      void Signal()
+      {
+        if (!signaled_)
+        {
+          signaled_ = true;
+          barrier_.Signal();
+        }
+      }
+
+    public:
+      RowsBand(IRowsProcessor& processor,
+               unsigned int startRow,
+               unsigned int endRow,
+               RowsBarrier& barrier) :
+        processor_(processor),
+        startRow_(startRow),
+        endRow_(endRow),
+        barrier_(barrier),
+        signaled_(false)
+      {
+      }
+
+      virtual ~RowsBand()
+      {
+        // The band is discarded without being processed if the pool is stopped
+        if (!signaled_)
+        {
+          barrier_.SetError(OrthancException(ErrorCode_InternalError, "The band of rows was not processed"));
+          Signal();
+        }
+      }
+
+      // Exceptions must not escape, as "RunnableWorkersPool" would
+      // swallow them without signaling the barrier
+      virtual bool Step() ORTHANC_OVERRIDE
+      {
+        try
+        {
+          processor_.Process(startRow_, endRow_);
+        }
+        catch (OrthancException& e)
+        {
+          barrier_.SetError(e);
+        }
+        catch (std::bad_alloc&)
+        {
+          barrier_.SetError(OrthancException(ErrorCode_NotEnoughMemory));
+        }
+        catch (std::exception& e)
+        {
+          barrier_.SetError(OrthancException(ErrorCode_InternalError, e.what()));
+        }
+        catch (...)
+        {
+          barrier_.SetError(OrthancException(ErrorCode_InternalError));
+        }
+
+        Signal();
+        return false;
+      }
+    };
 
 
     /**
-     * Create two lookup tables to quickly know the (x,y) position
-     * in the source image, given the (x,y) position in the target
-     * image.
+     * The workers are shared by all the calls to "ProcessRows()", so
+     * that no thread is started by the passes of a resampling, and so
+     * that concurrent resamplings cannot start more threads than the
+     * number of cores. The pool is only created on the first
+     * multi-threaded resampling.
      **/
-      
-    std::vector<unsigned int>  lookupX(targetWidth);
-      
-    for (unsigned int x = 0; x < targetWidth; x++)
+    class RowsWorkers : public boost::noncopyable
     {
-      int sourceX = static_cast<int>(std::floor((static_cast<float>(x) + 0.5f) * scaleX));
-      if (sourceX < 0)
+    private:
+      boost::mutex                          mutex_;
+      std::unique_ptr<RunnableWorkersPool>  pool_;
+      unsigned int                          size_;
+
+    public:
+      RowsWorkers() :
+        size_(0)
+      {
+      }
+
+      // Returns the number of workers, that excludes the calling thread
+      RunnableWorkersPool& GetPool(unsigned int& size)
       {
-        sourceX = 0;  // Should never happen
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (pool_.get() == NULL)
+        {
+          const unsigned int cores = boost::thread::hardware_concurrency();
+          size_ = (cores > 2 ? cores - 1 : 1);
+          pool_.reset(new RunnableWorkersPool(size_));
+        }
+
+        size = size_;
+        return *pool_;
       }
-      else if (sourceX >= static_cast<int>(sourceWidth))
+    };
+  }
+
+  static RowsWorkers rowsWorkers_;
+#endif
+
+
+  static void ProcessRows(IRowsProcessor& processor,
+                          unsigned int rowsCount,
+                          unsigned int threadsCount)
+  {
+#if ORTHANC_SANDBOXED == 1
+    processor.Process(0, rowsCount);
+#else
+    // Dispatching a band costs more than processing a few rows
+    static const unsigned int MIN_ROWS_PER_THREAD = 32;
+
+    if (threadsCount > rowsCount / MIN_ROWS_PER_THREAD)
+    {
+      threadsCount = rowsCount / MIN_ROWS_PER_THREAD;
+    }
+
+    if (threadsCount <= 1)
+    {
+      processor.Process(0, rowsCount);
+      return;
+    }
+
+    unsigned int workersCount;
+    RunnableWorkersPool& pool = rowsWorkers_.GetPool(workersCount);
+
+    if (threadsCount > workersCount + 1)
+    {
+      threadsCount = workersCount + 1;
+    }
+
+    // The calling thread processes the first band of rows
+    const unsigned int bandSize = rowsCount / threadsCount;
+    RowsBarrier barrier;
+
+    try
+    {
+      for (unsigned int i = 1; i < threadsCount; i++)
       {
-        sourceX = sourceWidth - 1;
+        const unsigned int endRow = (i == threadsCount - 1 ? rowsCount : (i + 1) * bandSize);
+        barrier.Add();
+
+        try
+        {
+          pool.Add(new RowsBand(processor, i * bandSize, endRow, barrier));
+        }
+        catch (...)
+        {
+          barrier.Signal();
+          throw;
+        }
       }
+    }
+    catch (...)
+    {
+      barrier.Wait();
+      throw;
+    }
 
-      lookupX[x] = static_cast<unsigned int>(sourceX);
+    try
+    {
+      processor.Process(0, bandSize);
     }
-      
-    std::vector<unsigned int>  lookupY(targetHeight);
-      
-    for (unsigned int y = 0; y < targetHeight; y++)
+    catch (...)
+    {
+      // The workers still reference "processor" and "barrier"
+      barrier.Wait();
+      throw;
+    }
+
+    barrier.Wait();
+    barrier.CheckError();
+#endif
+  }
+
+
+  namespace
+  {
+    class NearestNeighborProcessor : public IRowsProcessor
+    {
+    private:
+      ImageAccessor&              target_;
+      const ImageAccessor&        source_;
+      size_t                      bytesPerPixel_;
+      std::vector<unsigned int>   lookupX_;
+      std::vector<unsigned int>   lookupY_;
+
+      /**
+       * Create a lookup table to quickly know the position in the
+       * source image, given the position in the target image.
+       **/
+      static void CreateLookup(std::vector<unsigned int>& lookup,
+                               unsigned int sourceSize,
+                               unsigned int targetSize)
+      {
+        const float scale = static_cast<float>(sourceSize) / static_cast<float>(targetSize);
+
+        lookup.resize(targetSize);
+
+        for (unsigned int i = 0; i < targetSize; i++)
+        {
+          int source = static_cast<int>(std::floor((static_cast<float>(i) + 0.5f) * scale));
+          if (source < 0)
+          {
+            source = 0;  // Should never happen
+          }
+          else if (source >= static_cast<int>(sourceSize))
+          {
+            source = sourceSize - 1;
+          }
+
+          lookup[i] = static_cast<unsigned int>(source);
+        }
+      }
+
+    public:
+      NearestNeighborProcessor(ImageAccessor& target,
+                               const ImageAccessor& source) :
+        target_(target),
+        source_(source),
+        bytesPerPixel_(source.GetBytesPerPixel())
+      {
+        CreateLookup(lookupX_, source.GetWidth(), target.GetWidth());
+        CreateLookup(lookupY_, source.GetHeight(), target.GetHeight());
+      }
+
+      virtual void Process(unsigned int startRow,
+                           unsigned int endRow) ORTHANC_OVERRIDE
+      {
+        for (unsigned int y = startRow; y < endRow; y++)
+        {
+          const uint8_t* s = reinterpret_cast<const uint8_t*>(source_.GetConstRow(lookupY_[y]));
+          uint8_t* t = reinterpret_cast<uint8_t*>(target_.GetRow(y));
+
+          for (size_t x = 0; x < lookupX_.size(); x++, t += bytesPerPixel_)
+          {
+            memcpy(t, s + lookupX_[x] * bytesPerPixel_, bytesPerPixel_);
+          }
+        }
+      }
+    };
+
+
+    // Precomputed, normalized weights of a 1D resampling filter
+    class ResamplingWeights : public boost::noncopyable
     {
-      int sourceY = static_cast<int>(std::floor((static_cast<float>(y) + 0.5f) * scaleY));
-      if (sourceY < 0)
+    private:
+      std::vector<unsigned int>  first_;
+      std::vector<unsigned int>  count_;
+      std::vector<float>         weights_;
+      size_t                     stride_;
+
+      static float GetSupport(ImageProcessing::ResamplingFilter filter)
+      {
+        switch (filter)
+        {
+          case ImageProcessing::ResamplingFilter_Box:
+            return 0.5f;
+
+          case ImageProcessing::ResamplingFilter_Bilinear:
+            return 1.0f;
+
+          case ImageProcessing::ResamplingFilter_Lanczos3:
+            return 3.0f;
+
+          default:
+            throw OrthancException(ErrorCode_ParameterOutOfRange);
+        }
+      }
+
+      static float Sinc(float x)
       {
-        sourceY = 0;  // Should never happen
+        if (std::abs(x) < std::numeric_limits<float>::epsilon())
+        {
+          return 1.0f;
+        }
+        else
+        {
+          const float y = static_cast<float>(boost::math::constants::pi<float>()) * x;
+          return std::sin(y) / y;
+        }
       }
-      else if (sourceY >= static_cast<int>(sourceHeight))
+
+      static float Evaluate(ImageProcessing::ResamplingFilter filter,
+                            float x)
       {
-        sourceY = sourceHeight - 1;
+        switch (filter)
+        {
+          case ImageProcessing::ResamplingFilter_Box:
+            return (x >= -0.5f && x < 0.5f) ? 1.0f : 0.0f;
+
+          case ImageProcessing::ResamplingFilter_Bilinear:
+            return std::max(0.0f, 1.0f - std::abs(x));
+
+          case ImageProcessing::ResamplingFilter_Lanczos3:
+            return (x > -3.0f && x < 3.0f) ? Sinc(x) * Sinc(x / 3.0f) : 0.0f;
+
+          default:
+            throw OrthancException(ErrorCode_ParameterOutOfRange);
+        }
       }
 
-      lookupY[y] = static_cast<unsigned int>(sourceY);
+    public:
+      ResamplingWeights(unsigned int sourceSize,
+                        unsigned int targetSize,
+                        ImageProcessing::ResamplingFilter filter)
+      {
+        assert(sourceSize > 0 && targetSize > 0);
+
+        const float scale = static_cast<float>(sourceSize) / static_cast<float>(targetSize);
+
+        // If downsampling, the filter is stretched to cover all the
+        // source pixels that contribute to one target pixel
+        const float filterScale = std::max(1.0f, scale);
+        const float support = GetSupport(filter) * filterScale;
+
+        stride_ = 2 * static_cast<size_t>(std::ceil(support)) + 1;
+        first_.resize(targetSize);
+        count_.resize(targetSize);
+        weights_.resize(targetSize * stride_);
+
+        for (unsigned int i = 0; i < targetSize; i++)
+        {
+          const float center = (static_cast<float>(i) + 0.5f) * scale;
+
+          const int start = std::max(0, static_cast<int>(std::floor(center - support + 0.5f)));
+          const int end = std::min(std::min(static_cast<int>(sourceSize),
+                                            static_cast<int>(std::floor(center + support + 0.5f))),
+                                   start + static_cast<int>(stride_));
+
+          float* w = &weights_[i * stride_];
+          float sum = 0;
+
+          for (int x = start; x < end; x++)
+          {
+            w[x - start] = Evaluate(filter, (static_cast<float>(x) + 0.5f - center) / filterScale);
+            sum += w[x - start];
+          }
+
+          if (sum > std::numeric_limits<float>::epsilon())
+          {
+            first_[i] = static_cast<unsigned int>(start);
+            count_[i] = static_cast<unsigned int>(end - start);
+
+            for (unsigned int k = 0; k < count_[i]; k++)
+            {
+              w[k] /= sum;
+            }
+          }
+          else
+          {
+            // Degenerate case, fallback to the nearest neighbor
+            first_[i] = std::min(static_cast<unsigned int>(center), sourceSize - 1);
+            count_[i] = 1;
+            w[0] = 1.0f;
+          }
+        }
+      }
+
+      size_t GetTargetSize() const
+      {
+        return first_.size();
+      }
+
+      unsigned int GetFirst(size_t i) const
+      {
+        assert(i < first_.size());
+        return first_[i];
+      }
+
+      unsigned int GetCount(size_t i) const
+      {
+        assert(i < count_.size());
+        return count_[i];
+      }
+
+      const float* GetWeights(size_t i) const
+      {
+        assert(i < first_.size());
+        return &weights_[i * stride_];
+      }
+    };
+
+
+    template <typename RawPixel>
+    RawPixel SaturateResampled(float value)
+    {
+      if (value <= static_cast<float>(std::numeric_limits<RawPixel>::min()))
+      {
+        return std::numeric_limits<RawPixel>::min();
+      }
+      else if (value >= static_cast<float>(std::numeric_limits<RawPixel>::max()))
+      {
+        return std::numeric_limits<RawPixel>::max();
+      }
+      else
+      {
+        return static_cast<RawPixel>(std::floor(value + 0.5f));
+      }
     }
 
 
-    /**
-     * Actual resizing
-     **/
-      
-    for (unsigned int targetY = 0; targetY < targetHeight; targetY++)
+    template <>
+    float SaturateResampled<float>(float value)
+    {
+      return value;
+    }
+
+
+    // Mipmap-style reduction: Averages blocks of "factorX * factorY"
+    // pixels into a Float32 image
+    template <typename RawPixel, unsigned int ChannelsCount>
+    class BlockReductionProcessor : public IRowsProcessor
+    {
+    private:
+      ImageAccessor&        target_;
+      const ImageAccessor&  source_;
+      unsigned int          factorX_;
+      unsigned int          factorY_;
+
+    public:
+      BlockReductionProcessor(ImageAccessor& target,
+                              const ImageAccessor& source,
+                              unsigned int factorX,
+                              unsigned int factorY) :
+        target_(target),
+        source_(source),
+        factorX_(factorX),
+        factorY_(factorY)
+      {
+        assert(target.GetFormat() == PixelFormat_Float32);
+      }
+
+      virtual void Process(unsigned int startRow,
+                           unsigned int endRow) ORTHANC_OVERRIDE
+      {
+        const unsigned int width = target_.GetWidth() / ChannelsCount;
+
+        for (unsigned int y = startRow; y < endRow; y++)
+        {
+          float* t = reinterpret_cast<float*>(target_.GetRow(y));
+          std::fill(t, t + width * ChannelsCount, 0.0f);
+
+          const unsigned int sourceStartY = y * factorY_;
+          const unsigned int sourceEndY = std::min(sourceStartY + factorY_, source_.GetHeight());
+
+          for (unsigned int sourceY = sourceStartY; sourceY < sourceEndY; sourceY++)
+          {
+            const RawPixel* s = reinterpret_cast<const RawPixel*>(source_.GetConstRow(sourceY));
+
+            for (unsigned int x = 0; x < width; x++)
+            {
+              const unsigned int sourceStartX = x * factorX_;
+              const unsigned int sourceEndX = std::min(sourceStartX + factorX_, source_.GetWidth());
+
+              for (unsigned int sourceX = sourceStartX; sourceX < sourceEndX; sourceX++)
+              {
+                for (unsigned int c = 0; c < ChannelsCount; c++)
+                {
+                  t[x * ChannelsCount + c] += static_cast<float>(s[sourceX * ChannelsCount + c]);
+                }
+              }
+            }
+          }
+
+          for (unsigned int x = 0; x < width; x++)
+          {
+            // The blocks are smaller on the right and bottom borders
+            const unsigned int countX = std::min((x + 1) * factorX_, source_.GetWidth()) - x * factorX_;
+            const float normalization = 1.0f / static_cast<float>(countX * (sourceEndY - sourceStartY));
+
+            for (unsigned int c = 0; c < ChannelsCount; c++)
+            {
+              t[x * ChannelsCount + c] *= normalization;
+            }
+          }
+        }
+      }
+    };
+
+
+    // Horizontal pass, from "InputType" to an intermediate Float32 image
+    template <typename InputType, unsigned int ChannelsCount>
+    class HorizontalResamplingProcessor : public IRowsProcessor
     {
-      unsigned int sourceY = lookupY[targetY];
+    private:
+      ImageAccessor&            target_;
+      const ImageAccessor&      source_;
+      const ResamplingWeights&  weights_;
 
-      for (unsigned int targetX = 0; targetX < targetWidth; targetX++)
+    public:
+      HorizontalResamplingProcessor(ImageAccessor& target,
+                                    const ImageAccessor& source,
+                                    const ResamplingWeights& weights) :
+        target_(target),
+        source_(source),
+        weights_(weights)
       {
-        unsigned int sourceX = lookupX[targetX];
+        assert(target.GetFormat() == PixelFormat_Float32);
+      }
+
+      virtual void Process(unsigned int startRow,
+                           unsigned int endRow) ORTHANC_OVERRIDE
+      {
+        for (unsigned int y = startRow; y < endRow; y++)
+        {
+          const InputType* s = reinterpret_cast<const InputType*>(source_.GetConstRow(y));
+          float* t = reinterpret_cast<float*>(target_.GetRow(y));
+
+          for (size_t x = 0; x < weights_.GetTargetSize(); x++)
+          {
+            const InputType* p = s + weights_.GetFirst(x) * ChannelsCount;
+            const float* w = weights_.GetWeights(x);
+            const unsigned int count = weights_.GetCount(x);
+
+            float accumulator[ChannelsCount];
+            for (unsigned int c = 0; c < ChannelsCount; c++)
+            {
+              accumulator[c] = 0;
+            }
+
+            for (unsigned int k = 0; k < count; k++, p += ChannelsCount)
+            {
+              for (unsigned int c = 0; c < ChannelsCount; c++)
+              {
+                accumulator[c] += w[k] * static_cast<float>(p[c]);
+              }
+            }
+
+            for (unsigned int c = 0; c < ChannelsCount; c++, t++)
+            {
+              *t = accumulator[c];
+            }
+          }
+        }
+      }
+    };
+
 
-        typename ImageTraits<Format>::PixelType pixel;
-        ImageTraits<Format>::GetPixel(pixel, source, sourceX, sourceY);
-        ImageTraits<Format>::SetPixel(target, pixel, targetX, targetY);
+    // Vertical pass, from the intermediate Float32 image to the target
+    template <typename RawPixel, unsigned int ChannelsCount>
+    class VerticalResamplingProcessor : public IRowsProcessor
+    {
+    private:
+      ImageAccessor&            target_;
+      const ImageAccessor&      source_;
+      const ResamplingWeights&  weights_;
+
+    public:
+      VerticalResamplingProcessor(ImageAccessor& target,
+                                  const ImageAccessor& source,
+                                  const ResamplingWeights& weights) :
+        target_(target),
+        source_(source),
+        weights_(weights)
+      {
+        assert(source.GetFormat() == PixelFormat_Float32);
       }
-    }            
+
+      virtual void Process(unsigned int startRow,
+                           unsigned int endRow) ORTHANC_OVERRIDE
+      {
+        const size_t rowSize = ChannelsCount * target_.GetWidth();
+        std::vector<float> accumulator(rowSize);
+
+        for (unsigned int y = startRow; y < endRow; y++)
+        {
+          std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+
+          const float* w = weights_.GetWeights(y);
+          const unsigned int first = weights_.GetFirst(y);
+          const unsigned int count = weights_.GetCount(y);
+
+          // Scan the source rows in order, for the cache
+          for (unsigned int k = 0; k < count; k++)
+          {
+            const float* s = reinterpret_cast<const float*>(source_.GetConstRow(first + k));
+
+            for (size_t i = 0; i < rowSize; i++)
+            {
+              accumulator[i] += w[k] * s[i];
+            }
+          }
+
+          RawPixel* t = reinterpret_cast<RawPixel*>(target_.GetRow(y));
+
+          for (size_t i = 0; i < rowSize; i++)
+          {
+            t[i] = SaturateResampled<RawPixel>(accumulator[i]);
+          }
+        }
+      }
+    };
+  }
+
+
+  // Largest power of two such that the remaining reduction factor
+  // after averaging blocks of that size is still at least 2, which
+  // leaves enough samples for the filter
+  static unsigned int GetBlockReductionFactor(unsigned int sourceSize,
+                                              unsigned int targetSize)
+  {
+    unsigned int factor = 1;
+
+    while (sourceSize / (factor * 2) >= targetSize * 2)
+    {
+      factor *= 2;
+    }
+
+    return factor;
   }
 
 
+  template <typename RawPixel, unsigned int ChannelsCount>
+  static void ResampleInternal(ImageAccessor& target,
+                               const ImageAccessor& source,
+                               ImageProcessing::ResamplingFilter filter,
+                               unsigned int threadsCount)
+  {
+    const unsigned int factorX = GetBlockReductionFactor(source.GetWidth(), target.GetWidth());
+    const unsigned int factorY = GetBlockReductionFactor(source.GetHeight(), target.GetHeight());
+
+    std::unique_ptr<Image> reduced;
+
+    if (factorX > 1 ||
+        factorY > 1)
+    {
+      reduced.reset(new Image(PixelFormat_Float32,
+                              ChannelsCount * ((source.GetWidth() + factorX - 1) / factorX),
+                              (source.GetHeight() + factorY - 1) / factorY, false));
+
+      BlockReductionProcessor<RawPixel, ChannelsCount> processor(*reduced, source, factorX, factorY);
+      ProcessRows(processor, reduced->GetHeight(), threadsCount);
+    }
+
+    const unsigned int inputWidth = (reduced.get() == NULL ? source.GetWidth() : reduced->GetWidth() / ChannelsCount);
+    const unsigned int inputHeight = (reduced.get() == NULL ? source.GetHeight() : reduced->GetHeight());
+
+    ResamplingWeights horizontal(inputWidth, target.GetWidth(), filter);
+    ResamplingWeights vertical(inputHeight, target.GetHeight(), filter);
+
+    Image tmp(PixelFormat_Float32, ChannelsCount * target.GetWidth(), inputHeight, false);
+
+    if (reduced.get() == NULL)
+    {
+      HorizontalResamplingProcessor<RawPixel, ChannelsCount> processor(tmp, source, horizontal);
+      ProcessRows(processor, inputHeight, threadsCount);
+    }
+    else
+    {
+      HorizontalResamplingProcessor<float, ChannelsCount> processor(tmp, *reduced, horizontal);
+      ProcessRows(processor, inputHeight, threadsCount);
+    }
+
+    {
+      VerticalResamplingProcessor<RawPixel, ChannelsCount> processor(target, tmp, vertical);
+      ProcessRows(processor, target.GetHeight(), threadsCount);
+    }
+  }
+
 
   void ImageProcessing::Resize(ImageAccessor& target,
                                const ImageAccessor& source)
@@ -2388,15 +3101,92 @@ namespace Orthanc
     switch (source.GetFormat())
     {
       case PixelFormat_Grayscale8:
-        ResizeInternal<PixelFormat_Grayscale8>(target, source);
+      case PixelFormat_Float32:
+      case PixelFormat_RGB24:
+        Resample(target, source, ResamplingFilter_NearestNeighbor, 1);
+        break;
+
+      default:
+        throw OrthancException(ErrorCode_NotImplemented);
+    }
+  }
+
+
+  void ImageProcessing::Resample(ImageAccessor& target,
+                                 const ImageAccessor& source,
+                                 ResamplingFilter filter,
+                                 unsigned int threadsCount)
+  {
+    if (source.GetFormat() != target.GetFormat())
+    {
+      throw OrthancException(ErrorCode_IncompatibleImageFormat);
+    }
+
+    if (source.GetWidth() == target.GetWidth() &&
+        source.GetHeight() == target.GetHeight())
+    {
+      Copy(target, source);
+      return;
+    }
+
+    if (target.GetWidth() == 0 ||
+        target.GetHeight() == 0)
+    {
+      return;
+    }
+
+    if (source.GetWidth() == 0 ||
+        source.GetHeight() == 0)
+    {
+      // Avoids division by zero below
+      for (unsigned int y = 0; y < target.GetHeight(); y++)
+      {
+        memset(target.GetRow(y), 0, target.GetWidth() * target.GetBytesPerPixel());
+      }
+
+      return;
+    }
+
+    if (filter == ResamplingFilter_NearestNeighbor)
+    {
+      NearestNeighborProcessor processor(target, source);
+      ProcessRows(processor, target.GetHeight(), threadsCount);
+      return;
+    }
+
+    switch (source.GetFormat())
+    {
+      case PixelFormat_Grayscale8:
+        ResampleInternal<uint8_t, 1u>(target, source, filter, threadsCount);
+        break;
+
+      case PixelFormat_Grayscale16:
+        ResampleInternal<uint16_t, 1u>(target, source, filter, threadsCount);
+        break;
+
+      case PixelFormat_SignedGrayscale16:
+        ResampleInternal<int16_t, 1u>(target, source, filter, threadsCount);
         break;
 
       case PixelFormat_Float32:
-        ResizeInternal<PixelFormat_Float32>(target, source);
+        ResampleInternal<float, 1u>(target, source, filter, threadsCount);
         break;
 
       case PixelFormat_RGB24:
-        ResizeInternal<PixelFormat_RGB24>(target, source);
+        ResampleInternal<uint8_t, 3u>(target, source, filter, threadsCount);
+        break;
+
+      case PixelFormat_RGBA32:
+      case PixelFormat_BGRA32:
+        ResampleInternal<uint8_t, 4u>(target, source, filter, threadsCount);
+        break;
+
+      case PixelFormat_RGB48:
+        ResampleInternal<uint16_t, 3u>(target, source, filter, threadsCount);
+        break;
+
+      case PixelFormat_RGBA64:
+        ResampleInternal<uint16_t, 4u>(target, source, filter, threadsCount);
         break;
 
       default:
@@ -2790,6 +3580,15 @@ namespace Orthanc
 
   void ImageProcessing::FitSize(ImageAccessor& target,
                                 const ImageAccessor& source)
+  {
+    FitSize(target, source, ResamplingFilter_NearestNeighbor, 1);
+  }
+
+
+  void ImageProcessing::FitSize(ImageAccessor& target,
+                                const ImageAccessor& source,
+                                ResamplingFilter filter,
+                                unsigned int threadsCount)
   {
     if (target.GetWidth() == 0 ||
         target.GetHeight() == 0)
@@ -2817,9 +3616,7 @@ namespace Orthanc
     unsigned int sh = std::min(static_cast<unsigned int>(boost::math::iround(ch * r)), target.GetHeight());
 
     Image resized(target.GetFormat(), sw, sh, false);
-  
-    //ImageProcessing::SmoothGaussian5x5(source);
-    ImageProcessing::Resize(resized, source);
+    ImageProcessing::Resample(resized, source, filter, threadsCount);
 
     assert(target.GetWidth() >= resized.GetWidth() &&
            target.GetHeight() >= resized.GetHeight());
@@ -2835,9 +3632,19 @@ namespace Orthanc
   ImageAccessor* ImageProcessing::FitSize(const ImageAccessor& source,
                                           unsigned int width,
                                           unsigned int height)
+  {
+    return FitSize(source, width, height, ResamplingFilter_NearestNeighbor, 1);
+  }
+
+
+  ImageAccessor* ImageProcessing::FitSize(const ImageAccessor& source,
+                                          unsigned int width,
+                                          unsigned int height,
+                                          ResamplingFilter filter,
+                                          unsigned int threadsCount)
   {
     std::unique_ptr<ImageAccessor> target(new Image(source.GetFormat(), width, height, false));
-    FitSize(*target, source);
+    FitSize(*target, source, filter, threadsCount);
     return target.release();
   }
 
@@ -2845,6 +3652,16 @@ namespace Orthanc
   ImageAccessor* ImageProcessing::FitSizeKeepAspectRatio(const ImageAccessor& source,
                                                          unsigned int width,
                                                          unsigned int height)
+  {
+    return FitSizeKeepAspectRatio(source, width, height, ResamplingFilter_NearestNeighbor, 1);
+  }
+
+
+  ImageAccessor* ImageProcessing::FitSizeKeepAspectRatio(const ImageAccessor& source,
+                                                         unsigned int width,
+                                                         unsigned int height,
+                                                         ResamplingFilter filter,
+                                                         unsigned int threadsCount)
   {
     std::unique_ptr<ImageAccessor> target(new Image(source.GetFormat(), width, height, false));
     Set(*target, 0);
@@ -2863,7 +3680,7 @@ namespace Orthanc
       unsigned int resizedHeight = static_cast<unsigned int>(
         boost::math::iround(ratio * static_cast<float>(source.GetHeight())));
 
-      std::unique_ptr<ImageAccessor> resized(FitSize(source, resizedWidth, resizedHeight));
+      std::unique_ptr<ImageAccessor> resized(FitSize(source, resizedWidth, resizedHeight, filter, threadsCount));
 
       ImageAccessor region;
       target->GetRegion(region, (width - resizedWidth) / 2,
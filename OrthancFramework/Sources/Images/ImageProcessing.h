@@ -76,6 +76,15 @@ namespace Orthanc
                         int x2) = 0;
     };
 
+    // New in Orthanc 1.11.2
+    enum ResamplingFilter
+    {
+      ResamplingFilter_NearestNeighbor,  // Same as "Resize()"
+      ResamplingFilter_Box,
+      ResamplingFilter_Bilinear,
+      ResamplingFilter_Lanczos3
+    };
+
     static void Copy(ImageAccessor& target,
                      const ImageAccessor& source);
 
@@ -182,6 +191,15 @@ namespace Orthanc
     static void Resize(ImageAccessor& target,
                        const ImageAccessor& source);
 
+    // New in Orthanc 1.11.2: Separable resampling. If downsampling,
+    // the filter is widened to avoid aliasing, and large reduction
+    // factors are first handled by averaging blocks of pixels
+    // (mipmap-style). The rows are split among "threadsCount" threads.
+    static void Resample(ImageAccessor& target,
+                         const ImageAccessor& source,
+                         ResamplingFilter filter,
+                         unsigned int threadsCount);
+
     static ImageAccessor* Halve(const ImageAccessor& source,
                                 bool forceMinimalPitch);
 
@@ -202,18 +220,38 @@ namespace Orthanc
     static void FitSize(ImageAccessor& target,
                         const ImageAccessor& source);
 
+    // New in Orthanc 1.11.2
+    static void FitSize(ImageAccessor& target,
+                        const ImageAccessor& source,
+                        ResamplingFilter filter,
+                        unsigned int threadsCount);
+
     // Resize the image to the given width/height. The resized image
     // occupies the entire canvas (aspect ratio is not preserved).
     static ImageAccessor* FitSize(const ImageAccessor& source,
                                   unsigned int width,
                                   unsigned int height);
 
+    // New in Orthanc 1.11.2
+    static ImageAccessor* FitSize(const ImageAccessor& source,
+                                  unsigned int width,
+                                  unsigned int height,
+                                  ResamplingFilter filter,
+                                  unsigned int threadsCount);
+
     // Resize an image, but keeps its original aspect ratio. Zeros are
     // added around the image to reach the specified size.
     static ImageAccessor* FitSizeKeepAspectRatio(const ImageAccessor& source,
                                                  unsigned int width,
                                                  unsigned int height);
 
+    // New in Orthanc 1.11.2
+    static ImageAccessor* FitSizeKeepAspectRatio(const ImageAccessor& source,
+                                                 unsigned int width,
+                                                 unsigned int height,
+                                                 ResamplingFilter filter,
+                                                 unsigned int threadsCount);
+
     // https://en.wikipedia.org/wiki/YCbCr#JPEG_conversion
     static void ConvertJpegYCbCrToRgb(ImageAccessor& image /* inplace */);
 
@@ -221,5 +259,16 @@ namespace Orthanc
 
     static void Maximum(ImageAccessor& image /* inout */,
                         const ImageAccessor& other);
+
+    // New in Orthanc 1.11.2: "Convert()", "GetMinMaxIntegerValue()",
+    // "ShiftScale2()", "ApplyWindowing_Deprecated()" and "Invert()"
+    // use SSE2/AVX2 if available on the CPU. Disabling SIMD is only
+    // useful for testing and benchmarking, and is not thread-safe.
+    static void SetSimdEnabled(bool enabled);
+
+    static bool IsSimdEnabled();
+
+    // Returns "None", "SSE2" or "AVX2"
+    static const char* GetSimdInstructionSet();
   };
 }
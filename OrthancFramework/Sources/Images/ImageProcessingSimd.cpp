@@ -0,0 +1,853 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "ImageProcessingSimd.h"
+
+#include "../OrthancException.h"
+
+#include <limits>
+
+
+#if defined(__EMSCRIPTEN__)
+#  define ORTHANC_SIMD_SSE2  0
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define ORTHANC_SIMD_SSE2  1
+#else
+#  define ORTHANC_SIMD_SSE2  0
+#endif
+
+
+/**
+ * AVX2 is not part of the baseline of x86_64, so the AVX2 kernels are
+ * compiled using the "target" attribute of GCC/clang, and are only
+ * called if the CPU supports them. This avoids the need for a
+ * dedicated compiler flag.
+ **/
+#if (ORTHANC_SIMD_SSE2 == 1 &&                                 \
+     (defined(__x86_64__) || defined(__i386__)) &&              \
+     (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)))
+#  define ORTHANC_SIMD_AVX2  1
+#  define ORTHANC_TARGET_AVX2  __attribute__((target("avx2")))
+#else
+#  define ORTHANC_SIMD_AVX2  0
+#endif
+
+
+#if ORTHANC_SIMD_SSE2 == 1
+#  include <emmintrin.h>
+#endif
+
+#if ORTHANC_SIMD_AVX2 == 1
+#  include <immintrin.h>
+#endif
+
+
+namespace Orthanc
+{
+  static bool simdEnabled_ = true;  // Only modified by tests and benchmarks
+
+
+  static ImageProcessingSimd::InstructionSet DetectInstructionSet()
+  {
+#if ORTHANC_SIMD_AVX2 == 1
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+      return ImageProcessingSimd::InstructionSet_AVX2;
+    }
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1
+    // SSE2 is guaranteed to be available, as it was enabled at compile time
+    return ImageProcessingSimd::InstructionSet_SSE2;
+#else
+    return ImageProcessingSimd::InstructionSet_None;
+#endif
+  }
+
+
+  template <typename PixelType>
+  static void ReduceMinMax(PixelType& minValue,
+                           PixelType& maxValue,
+                           const PixelType* mins,
+                           const PixelType* maxs,
+                           unsigned int count)
+  {
+    for (unsigned int i = 0; i < count; i++)
+    {
+      if (mins[i] < minValue)
+      {
+        minValue = mins[i];
+      }
+
+      if (maxs[i] > maxValue)
+      {
+        maxValue = maxs[i];
+      }
+    }
+  }
+
+
+#if ORTHANC_SIMD_SSE2 == 1
+  static unsigned int GetMinMaxSse2(uint8_t& minValue,
+                                    uint8_t& maxValue,
+                                    const uint8_t* row,
+                                    unsigned int width)
+  {
+    const unsigned int count = width - width % 16;
+
+    __m128i vmin = _mm_set1_epi8(static_cast<char>(minValue));
+    __m128i vmax = _mm_set1_epi8(static_cast<char>(maxValue));
+
+    for (unsigned int x = 0; x < count; x += 16)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+      vmin = _mm_min_epu8(vmin, v);
+      vmax = _mm_max_epu8(vmax, v);
+    }
+
+    uint8_t mins[16], maxs[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mins), vmin);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(maxs), vmax);
+    ReduceMinMax(minValue, maxValue, mins, maxs, 16);
+
+    return count;
+  }
+
+
+  static unsigned int GetMinMaxSse2(uint16_t& minValue,
+                                    uint16_t& maxValue,
+                                    const uint16_t* row,
+                                    unsigned int width)
+  {
+    // SSE2 has no unsigned 16bit comparison: Flip the sign bit to
+    // use the signed comparison instead
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+    const unsigned int count = width - width % 8;
+
+    __m128i vmin = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(minValue)), bias);
+    __m128i vmax = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(maxValue)), bias);
+
+    for (unsigned int x = 0; x < count; x += 8)
+    {
+      const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), bias);
+      vmin = _mm_min_epi16(vmin, v);
+      vmax = _mm_max_epi16(vmax, v);
+    }
+
+    uint16_t mins[8], maxs[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mins), _mm_xor_si128(vmin, bias));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(maxs), _mm_xor_si128(vmax, bias));
+    ReduceMinMax(minValue, maxValue, mins, maxs, 8);
+
+    return count;
+  }
+
+
+  static unsigned int GetMinMaxSse2(int16_t& minValue,
+                                    int16_t& maxValue,
+                                    const int16_t* row,
+                                    unsigned int width)
+  {
+    const unsigned int count = width - width % 8;
+
+    __m128i vmin = _mm_set1_epi16(minValue);
+    __m128i vmax = _mm_set1_epi16(maxValue);
+
+    for (unsigned int x = 0; x < count; x += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+      vmin = _mm_min_epi16(vmin, v);
+      vmax = _mm_max_epi16(vmax, v);
+    }
+
+    int16_t mins[8], maxs[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mins), vmin);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(maxs), vmax);
+    ReduceMinMax(minValue, maxValue, mins, maxs, 8);
+
+    return count;
+  }
+
+
+  static unsigned int ConvertSse2(uint16_t* target,
+                                  const uint8_t* source,
+                                  unsigned int width)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const unsigned int count = width - width % 16;
+
+    for (unsigned int x = 0; x < count; x += 16)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), _mm_unpacklo_epi8(v, zero));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x + 8), _mm_unpackhi_epi8(v, zero));
+    }
+
+    return count;
+  }
+
+
+  static unsigned int ConvertSse2(int16_t* target,
+                                  const uint8_t* source,
+                                  unsigned int width)
+  {
+    return ConvertSse2(reinterpret_cast<uint16_t*>(target), source, width);
+  }
+
+
+  static unsigned int ConvertSse2(uint8_t* target,
+                                  const uint16_t* source,
+                                  unsigned int width)
+  {
+    // "v - subs(v, 255)" computes "min(v, 255)" on unsigned 16bit values
+    const __m128i limit = _mm_set1_epi16(255);
+    const unsigned int count = width - width % 16;
+
+    for (unsigned int x = 0; x < count; x += 16)
+    {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x + 8));
+      a = _mm_sub_epi16(a, _mm_subs_epu16(a, limit));
+      b = _mm_sub_epi16(b, _mm_subs_epu16(b, limit));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), _mm_packus_epi16(a, b));
+    }
+
+    return count;
+  }
+
+
+  static unsigned int ConvertSse2(int16_t* target,
+                                  const uint16_t* source,
+                                  unsigned int width)
+  {
+    const __m128i limit = _mm_set1_epi16(0x7fff);
+    const unsigned int count = width - width % 8;
+
+    for (unsigned int x = 0; x < count; x += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), _mm_sub_epi16(v, _mm_subs_epu16(v, limit)));
+    }
+
+    return count;
+  }
+
+
+  static unsigned int ConvertSse2(uint8_t* target,
+                                  const int16_t* source,
+                                  unsigned int width)
+  {
+    const unsigned int count = width - width % 16;
+
+    for (unsigned int x = 0; x < count; x += 16)
+    {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x + 8));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), _mm_packus_epi16(a, b));
+    }
+
+    return count;
+  }
+
+
+  static unsigned int ConvertSse2(uint16_t* target,
+                                  const int16_t* source,
+                                  unsigned int width)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const unsigned int count = width - width % 8;
+
+    for (unsigned int x = 0; x < count; x += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), _mm_max_epi16(v, zero));
+    }
+
+    return count;
+  }
+
+
+  static inline void LoadSse2(__m128& low,
+                              __m128& high,
+                              const uint8_t* source)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source)), zero);
+    low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+    high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+  }
+
+
+  static inline void LoadSse2(__m128& low,
+                              __m128& high,
+                              const uint16_t* source)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+    low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+    high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+  }
+
+
+  static inline void LoadSse2(__m128& low,
+                              __m128& high,
+                              const int16_t* source)
+  {
+    // Sign extension by duplicating the 16bit values, then shifting
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+    low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+  }
+
+
+  static inline void LoadSse2(__m128& low,
+                              __m128& high,
+                              const float* source)
+  {
+    low = _mm_loadu_ps(source);
+    high = _mm_loadu_ps(source + 4);
+  }
+
+
+  // The values must already be clamped to the range of the target type
+  static inline void StoreSse2(uint8_t* target,
+                               __m128i low,
+                               __m128i high)
+  {
+    const __m128i v = _mm_packs_epi32(low, high);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(target), _mm_packus_epi16(v, v));
+  }
+
+
+  static inline void StoreSse2(uint16_t* target,
+                               __m128i low,
+                               __m128i high)
+  {
+    // SSE2 has no unsigned saturation from 32bit to 16bit
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i v = _mm_packs_epi32(_mm_sub_epi32(low, bias32), _mm_sub_epi32(high, bias32));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target), _mm_xor_si128(v, bias16));
+  }
+
+
+  static inline void StoreSse2(int16_t* target,
+                               __m128i low,
+                               __m128i high)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target), _mm_packs_epi32(low, high));
+  }
+
+
+  static inline __m128i RoundSse2(__m128 v,
+                                  bool useRound)
+  {
+    __m128i t = _mm_cvttps_epi32(v);
+    const __m128 fraction = _mm_sub_ps(v, _mm_cvtepi32_ps(t));
+
+    // The comparisons produce -1 in the lanes where they hold
+    if (useRound)
+    {
+      // Halfway cases away from zero, like "boost::math::iround()"
+      t = _mm_sub_epi32(t, _mm_castps_si128(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f))));
+      t = _mm_add_epi32(t, _mm_castps_si128(_mm_cmple_ps(fraction, _mm_set1_ps(-0.5f))));
+    }
+    else
+    {
+      // Like "std::floor()"
+      t = _mm_add_epi32(t, _mm_castps_si128(_mm_cmplt_ps(fraction, _mm_setzero_ps())));
+    }
+
+    return t;
+  }
+
+
+  template <typename TargetType,
+            typename SourceType>
+  static unsigned int ShiftScaleSse2(TargetType* target,
+                                     const SourceType* source,
+                                     unsigned int width,
+                                     float a,
+                                     float b,
+                                     bool useRound,
+                                     bool invert)
+  {
+    const TargetType maxPixelValue = std::numeric_limits<TargetType>::max();
+    const __m128 va = _mm_set1_ps(a);
+    const __m128 vb = _mm_set1_ps(b);
+    const __m128 vmin = _mm_set1_ps(static_cast<float>(std::numeric_limits<TargetType>::min()));
+    const __m128 vmax = _mm_set1_ps(static_cast<float>(maxPixelValue));
+    const __m128i vinvert = _mm_set1_epi32(maxPixelValue);
+    const unsigned int count = width - width % 8;
+
+    for (unsigned int x = 0; x < count; x += 8)
+    {
+      __m128 low, high;
+      LoadSse2(low, high, source + x);
+
+      low = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(va, low), vb), vmin), vmax);
+      high = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(va, high), vb), vmin), vmax);
+
+      __m128i p = RoundSse2(low, useRound);
+      __m128i q = RoundSse2(high, useRound);
+
+      if (invert)
+      {
+        p = _mm_sub_epi32(vinvert, p);
+        q = _mm_sub_epi32(vinvert, q);
+      }
+
+      StoreSse2(target + x, p, q);
+    }
+
+    return count;
+  }
+
+
+  static unsigned int InvertSse2(uint8_t* row,
+                                 unsigned int width,
+                                 uint8_t maxValue)
+  {
+    const __m128i vmax = _mm_set1_epi8(static_cast<char>(maxValue));
+    const unsigned int count = width - width % 16;
+
+    for (unsigned int x = 0; x < count; x += 16)
+    {
+      __m128i* p = reinterpret_cast<__m128i*>(row + x);
+      _mm_storeu_si128(p, _mm_sub_epi8(vmax, _mm_loadu_si128(p)));
+    }
+
+    return count;
+  }
+
+
+  static unsigned int InvertSse2(uint16_t* row,
+                                 unsigned int width,
+                                 uint16_t maxValue)
+  {
+    const __m128i vmax = _mm_set1_epi16(static_cast<short>(maxValue));
+    const unsigned int count = width - width % 8;
+
+    for (unsigned int x = 0; x < count; x += 8)
+    {
+      __m128i* p = reinterpret_cast<__m128i*>(row + x);
+      _mm_storeu_si128(p, _mm_sub_epi16(vmax, _mm_loadu_si128(p)));
+    }
+
+    return count;
+  }
+#endif
+
+
+#if ORTHANC_SIMD_AVX2 == 1
+  ORTHANC_TARGET_AVX2
+  static unsigned int GetMinMaxAvx2(uint8_t& minValue,
+                                    uint8_t& maxValue,
+                                    const uint8_t* row,
+                                    unsigned int width)
+  {
+    const unsigned int count = width - width % 32;
+
+    __m256i vmin = _mm256_set1_epi8(static_cast<char>(minValue));
+    __m256i vmax = _mm256_set1_epi8(static_cast<char>(maxValue));
+
+    for (unsigned int x = 0; x < count; x += 32)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+      vmin = _mm256_min_epu8(vmin, v);
+      vmax = _mm256_max_epu8(vmax, v);
+    }
+
+    uint8_t mins[32], maxs[32];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(mins), vmin);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(maxs), vmax);
+    ReduceMinMax(minValue, maxValue, mins, maxs, 32);
+
+    return count;
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static unsigned int GetMinMaxAvx2(uint16_t& minValue,
+                                    uint16_t& maxValue,
+                                    const uint16_t* row,
+                                    unsigned int width)
+  {
+    const unsigned int count = width - width % 16;
+
+    __m256i vmin = _mm256_set1_epi16(static_cast<short>(minValue));
+    __m256i vmax = _mm256_set1_epi16(static_cast<short>(maxValue));
+
+    for (unsigned int x = 0; x < count; x += 16)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+      vmin = _mm256_min_epu16(vmin, v);
+      vmax = _mm256_max_epu16(vmax, v);
+    }
+
+    uint16_t mins[16], maxs[16];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(mins), vmin);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(maxs), vmax);
+    ReduceMinMax(minValue, maxValue, mins, maxs, 16);
+
+    return count;
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static unsigned int GetMinMaxAvx2(int16_t& minValue,
+                                    int16_t& maxValue,
+                                    const int16_t* row,
+                                    unsigned int width)
+  {
+    const unsigned int count = width - width % 16;
+
+    __m256i vmin = _mm256_set1_epi16(minValue);
+    __m256i vmax = _mm256_set1_epi16(maxValue);
+
+    for (unsigned int x = 0; x < count; x += 16)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+      vmin = _mm256_min_epi16(vmin, v);
+      vmax = _mm256_max_epi16(vmax, v);
+    }
+
+    int16_t mins[16], maxs[16];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(mins), vmin);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(maxs), vmax);
+    ReduceMinMax(minValue, maxValue, mins, maxs, 16);
+
+    return count;
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static inline __m256 LoadAvx2(const uint8_t* source)
+  {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source))));
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static inline __m256 LoadAvx2(const uint16_t* source)
+  {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source))));
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static inline __m256 LoadAvx2(const int16_t* source)
+  {
+    return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source))));
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static inline __m256 LoadAvx2(const float* source)
+  {
+    return _mm256_loadu_ps(source);
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static inline void StoreAvx2(uint8_t* target,
+                               __m256i v)
+  {
+    const __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(target), _mm_packus_epi16(w, w));
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static inline void StoreAvx2(uint16_t* target,
+                               __m256i v)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target),
+                     _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static inline void StoreAvx2(int16_t* target,
+                               __m256i v)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target),
+                     _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+  }
+
+
+  ORTHANC_TARGET_AVX2
+  static inline __m256i RoundAvx2(__m256 v,
+                                  bool useRound)
+  {
+    __m256i t = _mm256_cvttps_epi32(v);
+    const __m256 fraction = _mm256_sub_ps(v, _mm256_cvtepi32_ps(t));
+
+    if (useRound)
+    {
+      t = _mm256_sub_epi32(t, _mm256_castps_si256(_mm256_cmp_ps(fraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ)));
+      t = _mm256_add_epi32(t, _mm256_castps_si256(_mm256_cmp_ps(fraction, _mm256_set1_ps(-0.5f), _CMP_LE_OQ)));
+    }
+    else
+    {
+      t = _mm256_add_epi32(t, _mm256_castps_si256(_mm256_cmp_ps(fraction, _mm256_setzero_ps(), _CMP_LT_OQ)));
+    }
+
+    return t;
+  }
+
+
+  template <typename TargetType,
+            typename SourceType>
+  ORTHANC_TARGET_AVX2
+  static unsigned int ShiftScaleAvx2(TargetType* target,
+                                     const SourceType* source,
+                                     unsigned int width,
+                                     float a,
+                                     float b,
+                                     bool useRound,
+                                     bool invert)
+  {
+    const TargetType maxPixelValue = std::numeric_limits<TargetType>::max();
+    const __m256 va = _mm256_set1_ps(a);
+    const __m256 vb = _mm256_set1_ps(b);
+    const __m256 vmin = _mm256_set1_ps(static_cast<float>(std::numeric_limits<TargetType>::min()));
+    const __m256 vmax = _mm256_set1_ps(static_cast<float>(maxPixelValue));
+    const __m256i vinvert = _mm256_set1_epi32(maxPixelValue);
+    const unsigned int count = width - width % 8;
+
+    for (unsigned int x = 0; x < count; x += 8)
+    {
+      // No FMA, in order to get the same results as the scalar implementation
+      const __m256 v = _mm256_add_ps(_mm256_mul_ps(va, LoadAvx2(source + x)), vb);
+      __m256i p = RoundAvx2(_mm256_min_ps(_mm256_max_ps(v, vmin), vmax), useRound);
+
+      if (invert)
+      {
+        p = _mm256_sub_epi32(vinvert, p);
+      }
+
+      StoreAvx2(target + x, p);
+    }
+
+    return count;
+  }
+#endif
+
+
+  ImageProcessingSimd::InstructionSet ImageProcessingSimd::GetInstructionSet()
+  {
+    static const InstructionSet available = DetectInstructionSet();
+
+    if (simdEnabled_)
+    {
+      return available;
+    }
+    else
+    {
+      return InstructionSet_None;
+    }
+  }
+
+
+  void ImageProcessingSimd::SetEnabled(bool enabled)
+  {
+    simdEnabled_ = enabled;
+  }
+
+
+  bool ImageProcessingSimd::IsEnabled()
+  {
+    return simdEnabled_;
+  }
+
+
+  const char* ImageProcessingSimd::EnumerationToString(InstructionSet instructionSet)
+  {
+    switch (instructionSet)
+    {
+      case InstructionSet_None:
+        return "None";
+
+      case InstructionSet_SSE2:
+        return "SSE2";
+
+      case InstructionSet_AVX2:
+        return "AVX2";
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  template <typename PixelType>
+  static unsigned int GetMinMaxDispatch(PixelType& minValue,
+                                        PixelType& maxValue,
+                                        const PixelType* row,
+                                        unsigned int width)
+  {
+    switch (ImageProcessingSimd::GetInstructionSet())
+    {
+#if ORTHANC_SIMD_AVX2 == 1
+      case ImageProcessingSimd::InstructionSet_AVX2:
+        return GetMinMaxAvx2(minValue, maxValue, row, width);
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1
+      case ImageProcessingSimd::InstructionSet_SSE2:
+        return GetMinMaxSse2(minValue, maxValue, row, width);
+#endif
+
+      default:
+        return 0;
+    }
+  }
+
+
+  unsigned int ImageProcessingSimd::GetMinMax(uint8_t& minValue,
+                                              uint8_t& maxValue,
+                                              const uint8_t* row,
+                                              unsigned int width)
+  {
+    return GetMinMaxDispatch(minValue, maxValue, row, width);
+  }
+
+
+  unsigned int ImageProcessingSimd::GetMinMax(uint16_t& minValue,
+                                              uint16_t& maxValue,
+                                              const uint16_t* row,
+                                              unsigned int width)
+  {
+    return GetMinMaxDispatch(minValue, maxValue, row, width);
+  }
+
+
+  unsigned int ImageProcessingSimd::GetMinMax(int16_t& minValue,
+                                              int16_t& maxValue,
+                                              const int16_t* row,
+                                              unsigned int width)
+  {
+    return GetMinMaxDispatch(minValue, maxValue, row, width);
+  }
+
+
+  template <typename TargetType,
+            typename SourceType>
+  unsigned int ImageProcessingSimd::Convert(TargetType* target,
+                                            const SourceType* source,
+                                            unsigned int width)
+  {
+    // These conversions are memory-bound: SSE2 is enough
+#if ORTHANC_SIMD_SSE2 == 1
+    if (GetInstructionSet() != InstructionSet_None)
+    {
+      return ConvertSse2(target, source, width);
+    }
+#endif
+
+    return 0;
+  }
+
+
+  template <typename TargetType,
+            typename SourceType>
+  unsigned int ImageProcessingSimd::ShiftScale(TargetType* target,
+                                               const SourceType* source,
+                                               unsigned int width,
+                                               float a,
+                                               float b,
+                                               bool useRound,
+                                               bool invert)
+  {
+    switch (GetInstructionSet())
+    {
+#if ORTHANC_SIMD_AVX2 == 1
+      case InstructionSet_AVX2:
+        return ShiftScaleAvx2(target, source, width, a, b, useRound, invert);
+#endif
+
+#if ORTHANC_SIMD_SSE2 == 1
+      case InstructionSet_SSE2:
+        return ShiftScaleSse2(target, source, width, a, b, useRound, invert);
+#endif
+
+      default:
+        return 0;
+    }
+  }
+
+
+  unsigned int ImageProcessingSimd::Invert(uint8_t* row,
+                                           unsigned int width,
+                                           uint8_t maxValue)
+  {
+#if ORTHANC_SIMD_SSE2 == 1
+    if (GetInstructionSet() != InstructionSet_None)
+    {
+      return InvertSse2(row, width, maxValue);
+    }
+#endif
+
+    return 0;
+  }
+
+
+  unsigned int ImageProcessingSimd::Invert(uint16_t* row,
+                                           unsigned int width,
+                                           uint16_t maxValue)
+  {
+#if ORTHANC_SIMD_SSE2 == 1
+    if (GetInstructionSet() != InstructionSet_None)
+    {
+      return InvertSse2(row, width, maxValue);
+    }
+#endif
+
+    return 0;
+  }
+
+
+  // Explicit instantiations for all the combinations that are
+  // documented in "ImageProcessingSimd.h"
+  template unsigned int ImageProcessingSimd::Convert<uint16_t, uint8_t>(uint16_t*, const uint8_t*, unsigned int);
+  template unsigned int ImageProcessingSimd::Convert<int16_t, uint8_t>(int16_t*, const uint8_t*, unsigned int);
+  template unsigned int ImageProcessingSimd::Convert<uint8_t, uint16_t>(uint8_t*, const uint16_t*, unsigned int);
+  template unsigned int ImageProcessingSimd::Convert<int16_t, uint16_t>(int16_t*, const uint16_t*, unsigned int);
+  template unsigned int ImageProcessingSimd::Convert<uint8_t, int16_t>(uint8_t*, const int16_t*, unsigned int);
+  template unsigned int ImageProcessingSimd::Convert<uint16_t, int16_t>(uint16_t*, const int16_t*, unsigned int);
+
+#define ORTHANC_INSTANTIATE_SHIFT_SCALE(TargetType)                     \
+  template unsigned int ImageProcessingSimd::ShiftScale<TargetType, uint8_t>(TargetType*, const uint8_t*, unsigned int, float, float, bool, bool); \
+  template unsigned int ImageProcessingSimd::ShiftScale<TargetType, uint16_t>(TargetType*, const uint16_t*, unsigned int, float, float, bool, bool); \
+  template unsigned int ImageProcessingSimd::ShiftScale<TargetType, int16_t>(TargetType*, const int16_t*, unsigned int, float, float, bool, bool); \
+  template unsigned int ImageProcessingSimd::ShiftScale<TargetType, float>(TargetType*, const float*, unsigned int, float, float, bool, bool);
+
+  ORTHANC_INSTANTIATE_SHIFT_SCALE(uint8_t)
+  ORTHANC_INSTANTIATE_SHIFT_SCALE(uint16_t)
+  ORTHANC_INSTANTIATE_SHIFT_SCALE(int16_t)
+
+#undef ORTHANC_INSTANTIATE_SHIFT_SCALE
+}
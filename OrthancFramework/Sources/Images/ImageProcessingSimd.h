@@ -0,0 +1,123 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+
+namespace Orthanc
+{
+  /**
+   * Internal helper of "ImageProcessing" that provides vectorized
+   * (SSE2/AVX2) implementations of the hottest pixel kernels (new in
+   * Orthanc 1.11.2). The instruction set is selected once at runtime,
+   * depending on the capabilities of the CPU.
+   *
+   * Each method only processes a prefix of the row, and returns the
+   * number of pixels that were processed: The caller is responsible
+   * for processing the remaining pixels with its scalar loop, which
+   * must implement exactly the same arithmetic. The methods return 0
+   * if no vectorized implementation is available.
+   **/
+  class ImageProcessingSimd : public boost::noncopyable
+  {
+  public:
+    enum InstructionSet
+    {
+      InstructionSet_None,
+      InstructionSet_SSE2,
+      InstructionSet_AVX2
+    };
+
+    // Returns "InstructionSet_None" if SIMD has been disabled
+    static InstructionSet GetInstructionSet();
+
+    static void SetEnabled(bool enabled);
+
+    static bool IsEnabled();
+
+    static const char* EnumerationToString(InstructionSet instructionSet);
+
+    // "minValue" and "maxValue" must be initialized by the caller
+    static unsigned int GetMinMax(uint8_t& minValue,
+                                  uint8_t& maxValue,
+                                  const uint8_t* row,
+                                  unsigned int width);
+
+    static unsigned int GetMinMax(uint16_t& minValue,
+                                  uint16_t& maxValue,
+                                  const uint16_t* row,
+                                  unsigned int width);
+
+    static unsigned int GetMinMax(int16_t& minValue,
+                                  int16_t& maxValue,
+                                  const int16_t* row,
+                                  unsigned int width);
+
+    template <typename PixelType>
+    static unsigned int GetMinMax(PixelType& /* minValue */,
+                                  PixelType& /* maxValue */,
+                                  const PixelType* /* row */,
+                                  unsigned int /* width */)
+    {
+      return 0;
+    }
+
+    // Saturated conversion between 8bpp and 16bpp grayscale
+    // pixels. Available for all the combinations of "uint8_t",
+    // "uint16_t" and "int16_t", and for no other type.
+    template <typename TargetType,
+              typename SourceType>
+    static unsigned int Convert(TargetType* target,
+                                const SourceType* source,
+                                unsigned int width);
+
+    // Computes "a * x + b", clamped to the range of "TargetType". The
+    // result is rounded to the nearest integer (halfway cases away
+    // from zero) if "useRound" is "true", or floored otherwise. If
+    // "invert" is "true", the result is subtracted from the maximum
+    // value of "TargetType". "TargetType" must be one of "uint8_t",
+    // "uint16_t" or "int16_t", and "SourceType" must be one of
+    // "uint8_t", "uint16_t", "int16_t" or "float". Can be applied
+    // inplace if both types are the same.
+    template <typename TargetType,
+              typename SourceType>
+    static unsigned int ShiftScale(TargetType* target,
+                                   const SourceType* source,
+                                   unsigned int width,
+                                   float a,
+                                   float b,
+                                   bool useRound,
+                                   bool invert);
+
+    // Computes "maxValue - x" inplace
+    static unsigned int Invert(uint8_t* row,
+                               unsigned int width,
+                               uint8_t maxValue);
+
+    static unsigned int Invert(uint16_t* row,
+                               unsigned int width,
+                               uint16_t maxValue);
+  };
+}
@@ -30,8 +30,12 @@
 
 #if ORTHANC_SANDBOXED == 0
 #  include "../SystemToolbox.h"
+#  include <boost/thread/tss.hpp>
 #endif
 
+#include <boost/noncopyable.hpp>
+#include <vector>
+
 
 namespace Orthanc
 {
@@ -63,9 +67,6 @@ namespace Orthanc
 
     unsigned int pitch = cinfo.output_width * cinfo.output_components;
 
-    /* Make a one-row-high sample array that will go away when done with image */
-    JSAMPARRAY buffer = (*cinfo.mem->alloc_sarray) ((j_common_ptr) &cinfo, JPOOL_IMAGE, pitch, 1);
-
     try
     {
       content.resize(pitch * cinfo.output_height);
@@ -78,12 +79,17 @@ namespace Orthanc
     accessor.AssignWritable(format, cinfo.output_width, cinfo.output_height, pitch, 
                             content.empty() ? NULL : &content[0]);
 
-    uint8_t* target = reinterpret_cast<uint8_t*>(&content[0]);
+    // Decode the scanlines directly into the target image, without
+    // an intermediate one-row buffer (new in Orthanc 1.11.2)
+    std::vector<JSAMPROW> rows(cinfo.output_height);
+    for (unsigned int y = 0; y < cinfo.output_height; y++)
+    {
+      rows[y] = reinterpret_cast<JSAMPROW>(&content[0]) + static_cast<size_t>(y) * static_cast<size_t>(pitch);
+    }
+
     while (cinfo.output_scanline < cinfo.output_height) 
     {
-      jpeg_read_scanlines(&cinfo, buffer, 1);
-      memcpy(target, buffer[0], pitch);
-      target += pitch;
+      jpeg_read_scanlines(&cinfo, &rows[cinfo.output_scanline], cinfo.output_height - cinfo.output_scanline);
     }
 
     // Everything went fine, "setjmp()" didn't get called
@@ -92,6 +98,70 @@ namespace Orthanc
   }
 
 
+  namespace
+  {
+    /**
+     * libjpeg decompression object that can be reused across images,
+     * which avoids the setup and the teardown of the libjpeg memory
+     * manager for each image.
+     **/
+    class DecompressContext : public boost::noncopyable
+    {
+    private:
+      struct jpeg_decompress_struct  cinfo_;
+      Internals::JpegErrorManager    jerr_;
+
+    public:
+      DecompressContext()
+      {
+        memset(&cinfo_, 0, sizeof(struct jpeg_decompress_struct));
+        cinfo_.err = jerr_.GetPublic();
+
+        if (setjmp(jerr_.GetJumpBuffer()))
+        {
+          jpeg_destroy_decompress(&cinfo_);
+          throw OrthancException(ErrorCode_InternalError,
+                                 "Cannot initialize the JPEG decoder: " + jerr_.GetMessage());
+        }
+
+        jpeg_create_decompress(&cinfo_);
+      }
+
+      ~DecompressContext()
+      {
+        jpeg_destroy_decompress(&cinfo_);
+      }
+
+      void Uncompress(std::string& content,
+                      ImageAccessor& accessor,
+                      const void* buffer,
+                      size_t size)
+      {
+        if (setjmp(jerr_.GetJumpBuffer())) 
+        {
+          jpeg_abort_decompress(&cinfo_);
+          throw OrthancException(ErrorCode_InternalError,
+                                 "Error during JPEG decoding: " + jerr_.GetMessage());
+        }
+
+        // Below this line, we are under the scope of a "setjmp"
+        jpeg_mem_src(&cinfo_, 
+                     const_cast<unsigned char*>(
+                       reinterpret_cast<const unsigned char*>(buffer)),
+                     static_cast<unsigned long>(size));
+
+        Orthanc::Uncompress(cinfo_, content, accessor);
+      }
+    };
+  }
+
+
+#if ORTHANC_SANDBOXED == 0
+  // One decompression object per thread (new in Orthanc 1.11.2)
+  static boost::thread_specific_ptr<DecompressContext>  decompressContext_;
+#endif
+
+
 #if ORTHANC_SANDBOXED == 0
   void JpegReader::ReadFromFile(const std::string& filename)
   {
@@ -141,37 +211,24 @@ namespace Orthanc
   void JpegReader::ReadFromMemory(const void* buffer,
                                   size_t size)
   {
-    struct jpeg_decompress_struct cinfo;
-    memset(&cinfo, 0, sizeof(struct jpeg_decompress_struct));
-
-    Internals::JpegErrorManager jerr;
-    cinfo.err = jerr.GetPublic();
-    
-    if (setjmp(jerr.GetJumpBuffer())) 
-    {
-      jpeg_destroy_decompress(&cinfo);
-      throw OrthancException(ErrorCode_InternalError,
-        "Error during JPEG decoding: " + jerr.GetMessage());
-    }
+    std::unique_ptr<DecompressContext> context;
 
-    // Below this line, we are under the scope of a "setjmp"
-    jpeg_create_decompress(&cinfo);
-    jpeg_mem_src(&cinfo, 
-      const_cast<unsigned char*>(
-        reinterpret_cast<const unsigned char*>(buffer)),
-      static_cast<unsigned long>(size));
+#if ORTHANC_SANDBOXED == 0
+    // Take the decompression object of this thread, if any. It is
+    // discarded if an exception is thrown.
+    context.reset(decompressContext_.release());
+#endif
 
-    try
+    if (context.get() == NULL)
     {
-      Uncompress(cinfo, content_, *this);
-    }
-    catch (OrthancException&)
-    {
-      jpeg_destroy_decompress(&cinfo);
-      throw;
+      context.reset(new DecompressContext);
     }
 
-    jpeg_destroy_decompress(&cinfo);
+    context->Uncompress(content_, *this, buffer, size);
+
+#if ORTHANC_SANDBOXED == 0
+    decompressContext_.reset(context.release());
+#endif
   }
 
 
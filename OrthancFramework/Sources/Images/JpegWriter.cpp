@@ -30,8 +30,10 @@
 
 #if ORTHANC_SANDBOXED == 0
 #  include "../SystemToolbox.h"
+#  include <boost/thread/tss.hpp>
 #endif
 
+#include <boost/noncopyable.hpp>
 #include <stdlib.h>
 #include <vector>
 
@@ -64,7 +66,7 @@ namespace Orthanc
                        unsigned int width,
                        unsigned int height,
                        PixelFormat format,
-                       uint8_t quality)
+                       const JpegWriter& options)
   {
     cinfo.image_width = width;
     cinfo.image_height = height;
@@ -89,20 +91,198 @@ namespace Orthanc
 
     // The "static_cast" is necessary on OS X:
     // https://github.com/simonfuhrmann/mve/issues/371
-    jpeg_set_quality(&cinfo, quality, static_cast<boolean>(true));
+    jpeg_set_quality(&cinfo, options.GetQuality(), static_cast<boolean>(true));
+
+    if (options.IsFastDct())
+    {
+      cinfo.dct_method = JDCT_IFAST;
+    }
+
+    if (format == PixelFormat_RGB24)
+    {
+      // Sampling factors of the luminance, the chrominance being
+      // kept at full resolution in each direction
+      assert(cinfo.num_components == 3);
+
+      switch (options.GetChromaSubsampling())
+      {
+        case JpegWriter::ChromaSubsampling_420:
+          cinfo.comp_info[0].h_samp_factor = 2;
+          cinfo.comp_info[0].v_samp_factor = 2;
+          break;
+
+        case JpegWriter::ChromaSubsampling_422:
+          cinfo.comp_info[0].h_samp_factor = 2;
+          cinfo.comp_info[0].v_samp_factor = 1;
+          break;
+
+        case JpegWriter::ChromaSubsampling_444:
+          cinfo.comp_info[0].h_samp_factor = 1;
+          cinfo.comp_info[0].v_samp_factor = 1;
+          break;
+
+        default:
+          throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    if (options.IsProgressive())
+    {
+      jpeg_simple_progression(&cinfo);
+    }
+
     jpeg_start_compress(&cinfo, static_cast<boolean>(true));
     
     jpeg_write_scanlines(&cinfo, &lines[0], height);
     jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
   }
-                       
 
-  JpegWriter::JpegWriter() : quality_(90)
+
+  namespace
   {
+    // libjpeg destination manager that directly writes the compressed
+    // data into a "std::string", which avoids the copy of the buffer
+    // that is allocated by "jpeg_mem_dest()"
+    struct StringDestination
+    {
+      struct jpeg_destination_mgr  pub;  // Must be the first member
+      std::string*                 target;
+
+      static void Initialize(j_compress_ptr cinfo)
+      {
+        StringDestination& that = *reinterpret_cast<StringDestination*>(cinfo->dest);
+        assert(that.target != NULL);
+
+        that.target->resize(16384);
+        that.pub.next_output_byte = reinterpret_cast<JOCTET*>(&(*that.target) [0]);
+        that.pub.free_in_buffer = that.target->size();
+      }
+
+      static boolean EmptyOutputBuffer(j_compress_ptr cinfo)
+      {
+        StringDestination& that = *reinterpret_cast<StringDestination*>(cinfo->dest);
+        assert(that.target != NULL);
+
+        // Contrarily to "pub.free_in_buffer", the buffer is full
+        const size_t size = that.target->size();
+        that.target->resize(2 * size);
+        that.pub.next_output_byte = reinterpret_cast<JOCTET*>(&(*that.target) [size]);
+        that.pub.free_in_buffer = size;
+
+        return static_cast<boolean>(true);
+      }
+
+      static void Terminate(j_compress_ptr cinfo)
+      {
+        StringDestination& that = *reinterpret_cast<StringDestination*>(cinfo->dest);
+        assert(that.target != NULL &&
+               that.target->size() >= that.pub.free_in_buffer);
+
+        that.target->resize(that.target->size() - that.pub.free_in_buffer);
+      }
+    };
+
+
+    /**
+     * libjpeg compression object that can be reused across images,
+     * which avoids the setup and the teardown of the libjpeg memory
+     * manager for each image.
+     **/
+    class CompressContext : public boost::noncopyable
+    {
+    private:
+      struct jpeg_compress_struct  cinfo_;
+      Internals::JpegErrorManager  jerr_;
+      StringDestination            destination_;
+      std::vector<uint8_t*>        lines_;
+      bool                         reusable_;
+
+    public:
+      CompressContext() :
+        reusable_(true)
+      {
+        memset(&cinfo_, 0, sizeof(struct jpeg_compress_struct));
+        memset(&destination_, 0, sizeof(StringDestination));
+        cinfo_.err = jerr_.GetPublic();
+
+        if (setjmp(jerr_.GetJumpBuffer()))
+        {
+          jpeg_destroy_compress(&cinfo_);
+          throw OrthancException(ErrorCode_InternalError,
+                                 "Cannot initialize the JPEG encoder: " + jerr_.GetMessage());
+        }
+
+        jpeg_create_compress(&cinfo_);
+
+        destination_.pub.init_destination = StringDestination::Initialize;
+        destination_.pub.empty_output_buffer = StringDestination::EmptyOutputBuffer;
+        destination_.pub.term_destination = StringDestination::Terminate;
+        cinfo_.dest = &destination_.pub;
+      }
+
+      ~CompressContext()
+      {
+        jpeg_destroy_compress(&cinfo_);
+      }
+
+      void Compress(std::string& jpeg,
+                    unsigned int width,
+                    unsigned int height,
+                    unsigned int pitch,
+                    PixelFormat format,
+                    const void* buffer,
+                    const JpegWriter& options)
+      {
+        GetLines(lines_, height, pitch, format, buffer);
+        destination_.target = &jpeg;
+
+        if (setjmp(jerr_.GetJumpBuffer())) 
+        {
+          jpeg_abort_compress(&cinfo_);
+          jpeg.clear();
+          throw OrthancException(ErrorCode_InternalError,
+                                 "Error during JPEG encoding: " + jerr_.GetMessage());
+        }
+
+        // Do not allocate data on the stack below this line!
+
+        Orthanc::Compress(cinfo_, lines_, width, height, format, options);
+
+        // Everything went fine, "setjmp()" didn't get called
+
+        if (options.IsProgressive())
+        {
+          /**
+           * Progressive mode computes optimized Huffman tables that
+           * are stored in the compression object, and that
+           * "jpeg_set_defaults()" of libjpeg-turbo does not reset.
+           **/
+          reusable_ = false;
+        }
+      }
+
+      bool IsReusable() const
+      {
+        return reusable_;
+      }
+    };
   }
 
 
+#if ORTHANC_SANDBOXED == 0
+  // One compression object per thread (new in Orthanc 1.11.2)
+  static boost::thread_specific_ptr<CompressContext>  compressContext_;
+#endif
+
+
+  JpegWriter::JpegWriter() :
+    quality_(90),
+    fastDct_(false),
+    subsampling_(ChromaSubsampling_420),
+    progressive_(false)
+  {
+  }
+
   void JpegWriter::SetQuality(uint8_t quality)
   {
     if (quality == 0 || quality > 100)
@@ -152,7 +332,8 @@ namespace Orthanc
 
     jpeg_create_compress(&cinfo);
     jpeg_stdio_dest(&cinfo, fp);
-    Compress(cinfo, lines, width, height, format, quality_);
+    Compress(cinfo, lines, width, height, format, *this);
+    jpeg_destroy_compress(&cinfo);
 
     // Everything went fine, "setjmp()" didn't get called
 
@@ -168,44 +349,30 @@ namespace Orthanc
                                          PixelFormat format,
                                          const void* buffer)
   {
-    std::vector<uint8_t*> lines;
-    GetLines(lines, height, pitch, format, buffer);
-
-    struct jpeg_compress_struct cinfo;
-    memset(&cinfo, 0, sizeof(struct jpeg_compress_struct));
-
-    Internals::JpegErrorManager jerr;
+    std::unique_ptr<CompressContext> context;
 
-    unsigned char* data = NULL;
-    unsigned long size;
+#if ORTHANC_SANDBOXED == 0
+    // Take the compression object of this thread, if any. It is
+    // discarded if an exception is thrown.
+    context.reset(compressContext_.release());
+#endif
 
-    if (setjmp(jerr.GetJumpBuffer())) 
+    if (context.get() == NULL)
     {
-      jpeg_destroy_compress(&cinfo);
-
-      if (data != NULL)
-      {
-        free(data);
-      }
-
-      throw OrthancException(ErrorCode_InternalError,
-                             "Error during JPEG encoding: " + jerr.GetMessage());
+      context.reset(new CompressContext);
     }
 
-    // Do not allocate data on the stack below this line!
-
-    jpeg_create_compress(&cinfo);
-    cinfo.err = jerr.GetPublic();
-    jpeg_mem_dest(&cinfo, &data, &size);
-
-    Compress(cinfo, lines, width, height, format, quality_);
-
-    // Everything went fine, "setjmp()" didn't get called
+    context->Compress(jpeg, width, height, pitch, format, buffer, *this);
 
-    jpeg.assign(reinterpret_cast<const char*>(data), size);
-    free(data);
+#if ORTHANC_SANDBOXED == 0
+    if (context->IsReusable())
+    {
+      compressContext_.reset(context.release());
+    }
+#endif
   }
 
+
   uint8_t JpegWriter::GetQuality() const
   {
     return quality_;
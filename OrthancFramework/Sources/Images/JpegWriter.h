@@ -55,8 +55,20 @@ namespace Orthanc
                                        PixelFormat format,
                                        const void* buffer) ORTHANC_OVERRIDE;
 
+  public:
+    // New in Orthanc 1.11.2
+    enum ChromaSubsampling
+    {
+      ChromaSubsampling_420,  // Default of libjpeg
+      ChromaSubsampling_422,
+      ChromaSubsampling_444   // No subsampling
+    };
+
   private:
-    uint8_t  quality_;
+    uint8_t            quality_;
+    bool               fastDct_;
+    ChromaSubsampling  subsampling_;
+    bool               progressive_;
 
   public:
     JpegWriter();
@@ -64,5 +76,38 @@ namespace Orthanc
     void SetQuality(uint8_t quality);
 
     uint8_t GetQuality() const;
+
+    // Use the fast, but less accurate, integer DCT (new in Orthanc 1.11.2)
+    void SetFastDct(bool fast)
+    {
+      fastDct_ = fast;
+    }
+
+    bool IsFastDct() const
+    {
+      return fastDct_;
+    }
+
+    // Only applies to color images (new in Orthanc 1.11.2)
+    void SetChromaSubsampling(ChromaSubsampling subsampling)
+    {
+      subsampling_ = subsampling;
+    }
+
+    ChromaSubsampling GetChromaSubsampling() const
+    {
+      return subsampling_;
+    }
+
+    // Progressive JPEG, disabled by default (new in Orthanc 1.11.2)
+    void SetProgressive(bool progressive)
+    {
+      progressive_ = progressive;
+    }
+
+    bool IsProgressive() const
+    {
+      return progressive_;
+    }
   };
 }
@@ -27,8 +27,8 @@
 #include <vector>
 #include <stdint.h>
 #include <png.h>
+#include <zlib.h>  // For the Z_* compression strategies
 #include "../OrthancException.h"
-#include "../ChunkedBuffer.h"
 #include "../Toolbox.h"
 
 #if ORTHANC_SANDBOXED == 0
@@ -179,9 +179,63 @@ namespace Orthanc
     
     void Compress(unsigned int width,
                   unsigned int height,
-                  unsigned int pitch,
-                  PixelFormat format)
+                  const PngWriter& options)
     {
+      if (options.compressionLevel_ != -1)
+      {
+        png_set_compression_level(png_, options.compressionLevel_);
+      }
+
+      switch (options.filter_)
+      {
+        case Filter_Adaptive:
+          break;  // Keep the default of libpng
+
+        case Filter_None:
+          png_set_filter(png_, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+          break;
+
+        case Filter_Sub:
+          png_set_filter(png_, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+          break;
+
+        case Filter_Up:
+          png_set_filter(png_, PNG_FILTER_TYPE_BASE, PNG_FILTER_UP);
+          break;
+
+        case Filter_Average:
+          png_set_filter(png_, PNG_FILTER_TYPE_BASE, PNG_FILTER_AVG);
+          break;
+
+        case Filter_Paeth:
+          png_set_filter(png_, PNG_FILTER_TYPE_BASE, PNG_FILTER_PAETH);
+          break;
+
+        default:
+          throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      switch (options.strategy_)
+      {
+        case CompressionStrategy_Default:
+          break;  // Keep the default of libpng
+
+        case CompressionStrategy_Filtered:
+          png_set_compression_strategy(png_, Z_FILTERED);
+          break;
+
+        case CompressionStrategy_HuffmanOnly:
+          png_set_compression_strategy(png_, Z_HUFFMAN_ONLY);
+          break;
+
+        case CompressionStrategy_Rle:
+          png_set_compression_strategy(png_, Z_RLE);
+          break;
+
+        default:
+          throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
       png_set_IHDR(png_, info_, width, height,
                    bitDepth_, colorType_, PNG_INTERLACE_NONE,
                    PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
@@ -190,27 +244,19 @@ namespace Orthanc
 
       if (height > 0)
       {
-        switch (format)
+        /**
+         * The rows are directly read from the source buffer. PNG
+         * stores 16bpp samples as big-endian: libpng swaps the bytes
+         * of each row in its own row buffer, that it anyway has to
+         * fill to apply the filters, which avoids copying the image.
+         **/
+        if (bitDepth_ == 16 &&
+            Toolbox::DetectEndianness() == Endianness_Little)
         {
-          case PixelFormat_Grayscale16:
-          case PixelFormat_SignedGrayscale16:
-          case PixelFormat_RGBA64:
-          {
-            int transforms = 0;
-            if (Toolbox::DetectEndianness() == Endianness_Little)
-            {
-              transforms = PNG_TRANSFORM_SWAP_ENDIAN;
-            }
-
-            png_set_rows(png_, info_, &rows_[0]);
-            png_write_png(png_, info_, transforms, NULL);
-
-            break;
-          }
-
-          default:
-            png_write_image(png_, &rows_[0]);
+          png_set_swap(png_);
         }
+
+        png_write_image(png_, &rows_[0]);
       }
 
       png_write_end(png_, NULL);
@@ -244,7 +290,7 @@ namespace Orthanc
       throw OrthancException(ErrorCode_CannotWriteFile);      
     }
 
-    context.Compress(width, height, pitch, format);
+    context.Compress(width, height, *this);
 
     fclose(fp);
   }
@@ -255,8 +301,53 @@ namespace Orthanc
                              png_bytep data, 
                              png_size_t size)
   {
-    ChunkedBuffer* buffer = reinterpret_cast<ChunkedBuffer*>(png_get_io_ptr(png_ptr));
-    buffer->AddChunk(data, size);
+    // Append to the target string, whose capacity grows geometrically
+    std::string* target = reinterpret_cast<std::string*>(png_get_io_ptr(png_ptr));
+    target->append(reinterpret_cast<const char*>(data), size);
+  }
+
+
+  PngWriter::PngWriter() :
+    compressionLevel_(-1),
+    filter_(Filter_Adaptive),
+    strategy_(CompressionStrategy_Default)
+  {
+  }
+
+
+  void PngWriter::SetCompressionLevel(unsigned int level)
+  {
+    if (level > 9)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "The PNG compression level must be between 0 and 9");
+    }
+    else
+    {
+      compressionLevel_ = static_cast<int>(level);
+    }
+  }
+
+
+  unsigned int PngWriter::GetCompressionLevel() const
+  {
+    if (compressionLevel_ == -1)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls,
+                             "The default compression level of zlib is used");
+    }
+    else
+    {
+      return static_cast<unsigned int>(compressionLevel_);
+    }
+  }
+
+
+  void PngWriter::SetSpeedProfile()
+  {
+    SetCompressionLevel(1);
+    SetFilter(Filter_None);
+    SetCompressionStrategy(CompressionStrategy_Default);
   }
 
 
@@ -268,8 +359,13 @@ namespace Orthanc
                                         const void* buffer)
   {
     Context context;
-    
-    ChunkedBuffer chunks;
+
+    /**
+     * The PNG stream is directly written into the target string,
+     * instead of going through a "ChunkedBuffer" that would have to
+     * be flattened (i.e. copied) at the end (new in Orthanc 1.11.2)
+     **/
+    png.clear();
 
     context.Prepare(width, height, pitch, format, buffer);
 
@@ -279,10 +375,8 @@ namespace Orthanc
       throw OrthancException(ErrorCode_InternalError);      
     }
 
-    png_set_write_fn(context.GetObject(), &chunks, MemoryCallback, NULL);
-
-    context.Compress(width, height, pitch, format);
+    png_set_write_fn(context.GetObject(), &png, MemoryCallback, NULL);
 
-    chunks.Flatten(png);
+    context.Compress(width, height, *this);
   }
 }
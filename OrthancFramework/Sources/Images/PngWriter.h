@@ -59,5 +59,74 @@ namespace Orthanc
                                        unsigned int pitch,
                                        PixelFormat format,
                                        const void* buffer) ORTHANC_OVERRIDE;
+
+  public:
+    // New in Orthanc 1.11.2
+    enum Filter
+    {
+      Filter_Adaptive,  // Default of libpng, chooses the filter row by row
+      Filter_None,
+      Filter_Sub,
+      Filter_Up,
+      Filter_Average,
+      Filter_Paeth
+    };
+
+    // Strategy of the zlib deflate compressor (new in Orthanc 1.11.2)
+    enum CompressionStrategy
+    {
+      CompressionStrategy_Default,
+      CompressionStrategy_Filtered,
+      CompressionStrategy_HuffmanOnly,
+      CompressionStrategy_Rle
+    };
+
+  private:
+    int                  compressionLevel_;
+    Filter               filter_;
+    CompressionStrategy  strategy_;
+
+  public:
+    PngWriter();
+
+    // Between 0 (no compression) and 9 (best compression)
+    void SetCompressionLevel(unsigned int level);
+
+    // Go back to the default compression level of zlib
+    void ResetCompressionLevel()
+    {
+      compressionLevel_ = -1;
+    }
+
+    bool HasCompressionLevel() const
+    {
+      return compressionLevel_ != -1;
+    }
+
+    unsigned int GetCompressionLevel() const;
+
+    void SetFilter(Filter filter)
+    {
+      filter_ = filter;
+    }
+
+    Filter GetFilter() const
+    {
+      return filter_;
+    }
+
+    void SetCompressionStrategy(CompressionStrategy strategy)
+    {
+      strategy_ = strategy;
+    }
+
+    CompressionStrategy GetCompressionStrategy() const
+    {
+      return strategy_;
+    }
+
+    // Favor encoding speed over the size of the PNG file, which is
+    // suitable for interactive viewers
+    void SetSpeedProfile();
   };
 }
@@ -61,7 +61,15 @@ namespace Orthanc
 
     try
     {
-      result = running.GetJob().Step(running.GetId());
+      if (metrics_ != NULL)
+      {
+        MetricsRegistry::Timer timer(*metrics_, "orthanc_jobs_step_duration_ms", MetricsType_MaxOver10Seconds);
+        result = running.GetJob().Step(running.GetId());
+      }
+      else
+      {
+        result = running.GetJob().Step(running.GetId());
+      }
     }
     catch (OrthancException& e)
     {
@@ -106,6 +114,24 @@ namespace Orthanc
   }
 
     
+  bool JobsEngine::IsYieldNeeded(JobsRegistry::RunningJob& running,
+                                 const boost::posix_time::ptime& start)
+  {
+    if (timeSlice_ == 0)
+    {
+      return false;
+    }
+    else
+    {
+      const bool isSliceElapsed = (boost::posix_time::microsec_clock::universal_time() - start >=
+                                   boost::posix_time::milliseconds(timeSlice_));
+
+      // Before the end of the time slice, only give way to jobs with a higher priority
+      return running.HasWaitingJob(!isSliceElapsed /* higher priority only */);
+    }
+  }
+
+    
   void JobsEngine::RetryHandler(JobsEngine* engine)
   {
     assert(engine != NULL);
@@ -134,12 +160,27 @@ namespace Orthanc
         CLOG(INFO, JOBS) << "Executing job with priority " << running.GetPriority()
                          << " in worker thread " << workerIndex << ": " << running.GetId();
 
+        if (engine->metrics_ != NULL)
+        {
+          engine->metrics_->SetValue("orthanc_jobs_queue_wait_ms",
+                                     static_cast<float>(running.GetQueueWait().total_milliseconds()),
+                                     MetricsType_MaxOver1Minute);
+        }
+
+        const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
         while (engine->IsRunning())
         {
           if (!engine->ExecuteStep(running, workerIndex))
           {
             break;
           }
+
+          if (engine->IsYieldNeeded(running, start))
+          {
+            running.MarkYield();
+            break;
+          }
         }
       }
     }      
@@ -150,7 +191,9 @@ namespace Orthanc
     state_(State_Setup),
     registry_(new JobsRegistry(maxCompletedJobs)),
     threadSleep_(200),
-    workers_(1)
+    workers_(1),
+    timeSlice_(0),
+    metrics_(NULL)
   {
   }
 
@@ -237,6 +280,34 @@ namespace Orthanc
   }
 
 
+  void JobsEngine::SetTimeSlice(unsigned int timeSlice)
+  {
+    boost::mutex::scoped_lock lock(stateMutex_);
+      
+    if (state_ != State_Setup)
+    {
+      // Can only be invoked before calling "Start()"
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    timeSlice_ = timeSlice;
+  }
+
+
+  void JobsEngine::SetMetricsRegistry(MetricsRegistry& metrics)
+  {
+    boost::mutex::scoped_lock lock(stateMutex_);
+      
+    if (state_ != State_Setup)
+    {
+      // Can only be invoked before calling "Start()"
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    metrics_ = &metrics;
+  }
+
+
   void JobsEngine::Start()
   {
     boost::mutex::scoped_lock lock(stateMutex_);
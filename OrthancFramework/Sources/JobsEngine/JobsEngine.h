@@ -26,6 +26,7 @@
 #include "JobsRegistry.h"
 
 #include "../Compatibility.h"
+#include "../MetricsRegistry.h"
 
 #include <boost/thread.hpp>
 
@@ -48,11 +49,16 @@ namespace Orthanc
     boost::thread                retryHandler_;
     unsigned int                 threadSleep_;
     std::vector<boost::thread*>  workers_;
+    unsigned int                 timeSlice_;  // New in Orthanc 1.11.2
+    MetricsRegistry*             metrics_;    // New in Orthanc 1.11.2
 
     bool IsRunning();
     
     bool ExecuteStep(JobsRegistry::RunningJob& running,
                      size_t workerIndex);
+
+    bool IsYieldNeeded(JobsRegistry::RunningJob& running,
+                       const boost::posix_time::ptime& start);
     
     static void RetryHandler(JobsEngine* engine);
 
@@ -76,6 +82,20 @@ namespace Orthanc
 
     void SetThreadSleep(unsigned int sleep);
 
+    /**
+     * If "timeSlice" is not zero, a running job gives back its worker
+     * thread as soon as a job with a higher priority is pending, or
+     * after having run for "timeSlice" milliseconds if a job with the
+     * same priority is pending. The job is then put back in the queue
+     * of the pending jobs, without calling "IJob::Stop()". If
+     * "timeSlice" is zero (default), jobs run until completion. New
+     * in Orthanc 1.11.2.
+     **/
+    void SetTimeSlice(unsigned int timeSlice);
+
+    // The metrics registry must outlive the calls to "Stop()"
+    void SetMetricsRegistry(MetricsRegistry& metrics);
+
     void Start();
 
     void Stop();
@@ -59,6 +59,9 @@ namespace Orthanc
     bool                              pauseScheduled_;
     bool                              cancelScheduled_;
     JobStatus                         lastStatus_;
+    uint64_t                          pendingSequence_;
+    boost::posix_time::ptime          pendingTime_;
+    bool                              yielded_;
 
     void Touch()
     {
@@ -77,6 +80,7 @@ namespace Orthanc
       state_ = state;
       pauseScheduled_ = false;
       cancelScheduled_ = false;
+      yielded_ = false;
       Touch();
     }
 
@@ -92,7 +96,10 @@ namespace Orthanc
       runtime_(boost::posix_time::milliseconds(0)),
       retryTime_(creationTime_),
       pauseScheduled_(false),
-      cancelScheduled_(false)
+      cancelScheduled_(false),
+      pendingSequence_(0),
+      pendingTime_(creationTime_),
+      yielded_(false)
     {
       if (job == NULL)
       {
@@ -195,6 +202,31 @@ namespace Orthanc
       return cancelScheduled_;
     }
 
+    void MarkYielded()
+    {
+      if (state_ == JobState_Pending)
+      {
+        yielded_ = true;
+      }
+      else
+      {
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+    }
+
+    void StopIfYielded(JobStopReason reason)
+    {
+      // A job that has yielded its worker thread has not been
+      // stopped, and might still own resources (e.g. network
+      // connections) that must be released before leaving the
+      // "pending" state for another reason than being resumed
+      if (yielded_)
+      {
+        yielded_ = false;
+        job_->Stop(reason);
+      }
+    }
+
     bool IsRetryReady(const boost::posix_time::ptime& now) const
     {
       if (state_ != JobState_Retry)
@@ -212,6 +244,22 @@ namespace Orthanc
       return creationTime_;
     }
 
+    void SetPendingSequence(uint64_t sequence)
+    {
+      pendingSequence_ = sequence;
+      pendingTime_ = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    uint64_t GetPendingSequence() const
+    {
+      return pendingSequence_;
+    }
+
+    const boost::posix_time::ptime& GetPendingTime() const
+    {
+      return pendingTime_;
+    }
+
     const boost::posix_time::ptime& GetLastStateChangeTime() const
     {
       return lastStateChangeTime_;
@@ -344,7 +392,15 @@ namespace Orthanc
   bool JobsRegistry::PriorityComparator::operator() (JobHandler* const& a,
                                                      JobHandler* const& b) const
   {
-    return a->GetPriority() < b->GetPriority();
+    if (a->GetPriority() != b->GetPriority())
+    {
+      return a->GetPriority() < b->GetPriority();
+    }
+    else
+    {
+      // Same priority: The job that was queued first is on the top
+      return a->GetPendingSequence() > b->GetPendingSequence();
+    }
   }
 
 
@@ -561,6 +617,43 @@ namespace Orthanc
   }
 
 
+  void JobsRegistry::MarkRunningAsPending(JobHandler& job)
+  {
+    CheckInvariants();
+    assert(job.GetState() == JobState_Running);
+
+    if (job.IsCancelScheduled())
+    {
+      // Cancel was requested after the last step
+      job.GetJob().Stop(JobStopReason_Canceled);
+      MarkRunningAsCompleted(job, CompletedReason_Canceled);
+    }
+    else if (job.IsPauseScheduled())
+    {
+      job.GetJob().Stop(JobStopReason_Paused);
+      MarkRunningAsPaused(job);
+    }
+    else
+    {
+      LOG(INFO) << "Job yields its worker thread: " << job.GetId();
+      job.SetState(JobState_Pending);
+      job.MarkYielded();
+      AddPendingJob(job);
+      CheckInvariants();
+    }
+  }
+
+
+  void JobsRegistry::AddPendingJob(JobHandler& job)
+  {
+    // The mutex must be locked
+    assert(job.GetState() == JobState_Pending);
+    job.SetPendingSequence(pendingSequence_++);
+    pendingJobs_.push(&job);
+    pendingJobAvailable_.notify_one();
+  }
+
+
   bool JobsRegistry::GetStateInternal(JobState& state,
                                       const std::string& id)
   {
@@ -705,8 +798,7 @@ namespace Orthanc
         case JobState_Retry:
         case JobState_Running:
           handler->SetState(JobState_Pending);
-          pendingJobs_.push(handler);
-          pendingJobAvailable_.notify_one();
+          AddPendingJob(*handler);
           break;
 
         case JobState_Success:
@@ -743,6 +835,7 @@ namespace Orthanc
 
   JobsRegistry::JobsRegistry(size_t maxCompletedJobs) :
     maxCompletedJobs_(maxCompletedJobs),
+    pendingSequence_(0),
     observer_(NULL)
   {
   }
@@ -925,6 +1018,7 @@ namespace Orthanc
       {
         case JobState_Pending:
           RemovePendingJob(id);
+          found->second->StopIfYielded(JobStopReason_Paused);
           found->second->SetState(JobState_Paused);
           break;
 
@@ -973,6 +1067,7 @@ namespace Orthanc
       {
         case JobState_Pending:
           RemovePendingJob(id);
+          found->second->StopIfYielded(JobStopReason_Canceled);
           SetCompletedJob(*found->second, false);
           found->second->SetLastErrorCode(ErrorCode_CanceledJob);
           break;
@@ -1032,8 +1127,7 @@ namespace Orthanc
     else
     {
       found->second->SetState(JobState_Pending);
-      pendingJobs_.push(found->second);
-      pendingJobAvailable_.notify_one();
+      AddPendingJob(*found->second);
       CheckInvariants();
       return true;
     }
@@ -1080,8 +1174,7 @@ namespace Orthanc
 
       found->second->ResetRuntime();
       found->second->SetState(JobState_Pending);
-      pendingJobs_.push(found->second);
-      pendingJobAvailable_.notify_one();
+      AddPendingJob(*found->second);
 
       CheckInvariants();
       return true;
@@ -1106,8 +1199,7 @@ namespace Orthanc
       {
         LOG(INFO) << "Retrying job: " << (*it)->GetId();
         (*it)->SetState(JobState_Pending);
-        pendingJobs_.push(*it);
-        pendingJobAvailable_.notify_one();
+        AddPendingJob(**it);
       }
       else
       {
@@ -1147,7 +1239,8 @@ namespace Orthanc
     handler_(NULL),
     targetState_(JobState_Failure),
     targetRetryTimeout_(0),
-    canceled_(false)
+    canceled_(false),
+    queueWait_(boost::posix_time::milliseconds(0))
   {
     {
       boost::mutex::scoped_lock lock(registry_.mutex_);
@@ -1173,6 +1266,8 @@ namespace Orthanc
       handler_ = registry_.pendingJobs_.top();
       registry_.pendingJobs_.pop();
 
+      queueWait_ = (boost::posix_time::microsec_clock::universal_time() - handler_->GetPendingTime());
+
       assert(handler_->GetState() == JobState_Pending);
       handler_->SetState(JobState_Running);
       handler_->SetLastErrorCode(ErrorCode_Success);
@@ -1209,6 +1304,10 @@ namespace Orthanc
           registry_.MarkRunningAsRetry(*handler_, targetRetryTimeout_);
           break;
 
+        case JobState_Pending:
+          registry_.MarkRunningAsPending(*handler_);
+          break;
+
         default:
           assert(0);
       }
@@ -1363,6 +1462,58 @@ namespace Orthanc
   }
 
 
+  void JobsRegistry::RunningJob::MarkYield()
+  {
+    if (!IsValid())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      targetState_ = JobState_Pending;
+    }
+  }
+
+
+  const boost::posix_time::time_duration& JobsRegistry::RunningJob::GetQueueWait() const
+  {
+    if (!IsValid())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return queueWait_;
+    }
+  }
+
+
+  bool JobsRegistry::RunningJob::HasWaitingJob(bool higherPriorityOnly)
+  {
+    if (!IsValid())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      boost::mutex::scoped_lock lock(registry_.mutex_);
+
+      if (registry_.pendingJobs_.empty())
+      {
+        return false;
+      }
+      else if (higherPriorityOnly)
+      {
+        return registry_.pendingJobs_.top()->GetPriority() > priority_;
+      }
+      else
+      {
+        return registry_.pendingJobs_.top()->GetPriority() >= priority_;
+      }
+    }
+  }
+
+
   void JobsRegistry::RunningJob::UpdateStatus(ErrorCode code,
                                               const std::string& details)
   {
@@ -1409,6 +1560,7 @@ namespace Orthanc
                              const Json::Value& s,
                              size_t maxCompletedJobs) :
     maxCompletedJobs_(maxCompletedJobs),
+    pendingSequence_(0),
     observer_(NULL)
   {
     if (SerializationToolbox::ReadString(s, TYPE) != JOBS_REGISTRY ||
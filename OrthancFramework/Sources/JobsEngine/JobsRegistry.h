@@ -92,6 +92,7 @@ namespace Orthanc
     boost::condition_variable  pendingJobAvailable_;
     boost::condition_variable  someJobComplete_;
     size_t                     maxCompletedJobs_;
+    uint64_t                   pendingSequence_;  // To run the jobs with the same priority in FIFO order
 
     IObserver*                 observer_;
 
@@ -119,6 +120,10 @@ namespace Orthanc
 
     void MarkRunningAsPaused(JobHandler& job);
 
+    void MarkRunningAsPending(JobHandler& job);
+
+    void AddPendingJob(JobHandler& job);
+
     bool GetStateInternal(JobState& state,
                           const std::string& id);
 
@@ -206,6 +211,7 @@ namespace Orthanc
       JobState       targetState_;
       unsigned int   targetRetryTimeout_;
       bool           canceled_;
+      boost::posix_time::time_duration  queueWait_;
 
     public:
       RunningJob(JobsRegistry& registry,
@@ -235,8 +241,22 @@ namespace Orthanc
 
       void MarkRetry(unsigned int timeout);
 
+      // Give back the worker thread, putting the job back into the
+      // queue of the pending jobs (new in Orthanc 1.11.2)
+      void MarkYield();
+
       void UpdateStatus(ErrorCode code,
                         const std::string& details);
+
+      // Time spent by the job in the queue of the pending jobs
+      // before being started by this object (new in Orthanc 1.11.2)
+      const boost::posix_time::time_duration& GetQueueWait() const;
+
+      // Whether another job is waiting for a worker thread, either
+      // with a priority that is at least the one of this job, or
+      // strictly above if "higherPriorityOnly" is "true" (new in
+      // Orthanc 1.11.2)
+      bool HasWaitingJob(bool higherPriorityOnly);
     };
   };
 }
@@ -63,6 +63,12 @@ namespace Orthanc
     size_t                  position_;
     std::string             description_;
 
+  protected:
+    // Marks the "count" commands after the current position as
+    // handled, for subclasses that override "Step()" to handle
+    // several commands at once (new in Orthanc 1.11.2)
+    JobStepResult AdvancePosition(size_t count);
+
   public:
     SetOfCommandsJob();
 
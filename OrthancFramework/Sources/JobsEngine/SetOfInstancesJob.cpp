@@ -135,6 +135,12 @@ namespace Orthanc
   }
 
 
+  void SetOfInstancesJob::AddFailedInstance(const std::string& instance)
+  {
+    failedInstances_.insert(instance);
+  }
+
+
   void SetOfInstancesJob::AddInstance(const std::string& instance)
   {
     AddCommand(new InstanceCommand(*this, instance));
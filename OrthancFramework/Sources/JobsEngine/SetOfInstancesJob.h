@@ -49,6 +49,10 @@ namespace Orthanc
     // Hiding this method, use AddInstance() instead
     using SetOfCommandsJob::AddCommand;
 
+    // For subclasses that handle several instances at once in
+    // "Step()", bypassing "HandleInstance()" (new in Orthanc 1.11.2)
+    void AddFailedInstance(const std::string& instance);
+
   public:
     SetOfInstancesJob();
 
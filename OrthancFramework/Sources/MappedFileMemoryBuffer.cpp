@@ -0,0 +1,143 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeaders.h"
+#include "MappedFileMemoryBuffer.h"
+
+#include "OrthancException.h"
+#include "SystemToolbox.h"
+
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+
+namespace Orthanc
+{
+  void MappedFileMemoryBuffer::Unmap()
+  {
+#if !defined(_WIN32)
+    if (data_ != NULL)
+    {
+      ::munmap(data_, size_);
+    }
+#endif
+
+    data_ = NULL;
+    size_ = 0;
+    fallback_.clear();
+  }
+
+
+  MappedFileMemoryBuffer::MappedFileMemoryBuffer(const std::string& path) :
+    data_(NULL),
+    size_(0)
+  {
+#if defined(_WIN32)
+    SystemToolbox::ReadFile(fallback_, path);
+    size_ = fallback_.size();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw OrthancException(ErrorCode_InexistentFile, "Cannot open file: " + path);
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0)
+    {
+      ::close(fd);
+      throw OrthancException(ErrorCode_InexistentFile, "Cannot stat file: " + path);
+    }
+
+    if (static_cast<uint64_t>(static_cast<size_t>(info.st_size)) != static_cast<uint64_t>(info.st_size))
+    {
+      ::close(fd);
+      throw OrthancException(ErrorCode_InternalError, "File larger than 4GB, which is too large for Orthanc running in 32bits");
+    }
+
+    size_ = static_cast<size_t>(info.st_size);
+
+    if (size_ > 0)
+    {
+      void* data = ::mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+      {
+        ::close(fd);
+        throw OrthancException(ErrorCode_NotEnoughMemory, "Cannot map file into memory: " + path);
+      }
+
+      data_ = data;
+
+      // The file is typically read sequentially, from start to end
+      ::madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+
+    // The mapping remains valid after the file descriptor is closed
+    ::close(fd);
+#endif
+  }
+
+
+  MappedFileMemoryBuffer::~MappedFileMemoryBuffer()
+  {
+    Unmap();
+  }
+
+
+  void MappedFileMemoryBuffer::MoveToString(std::string& target)
+  {
+    if (data_ == NULL)
+    {
+      target.swap(fallback_);
+      fallback_.clear();
+    }
+    else
+    {
+      target.assign(reinterpret_cast<const char*>(data_), size_);
+    }
+
+    Unmap();
+  }
+
+
+  const void* MappedFileMemoryBuffer::GetData() const
+  {
+    if (data_ != NULL)
+    {
+      return data_;
+    }
+    else if (fallback_.empty())
+    {
+      return NULL;
+    }
+    else
+    {
+      return fallback_.c_str();
+    }
+  }
+}
@@ -0,0 +1,71 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "OrthancFramework.h"
+
+#if !defined(ORTHANC_SANDBOXED)
+#  error The macro ORTHANC_SANDBOXED must be defined
+#endif
+
+#if ORTHANC_SANDBOXED == 1
+#  error The class MappedFileMemoryBuffer cannot be used in sandboxed environments
+#endif
+
+#include "IMemoryBuffer.h"
+#include "Compatibility.h"
+
+namespace Orthanc
+{
+  /**
+   * Read-only memory buffer that maps the content of a file into
+   * memory, instead of copying it to the heap (new in Orthanc
+   * 1.11.2). The pages of the file are directly served from the
+   * page cache of the operating system. On systems without "mmap()",
+   * the file is read into memory.
+   **/
+  class ORTHANC_PUBLIC MappedFileMemoryBuffer : public IMemoryBuffer
+  {
+  private:
+    void*        data_;
+    size_t       size_;
+    std::string  fallback_;
+
+    void Unmap();
+
+  public:
+    explicit MappedFileMemoryBuffer(const std::string& path);
+
+    virtual ~MappedFileMemoryBuffer();
+
+    virtual void MoveToString(std::string& target) ORTHANC_OVERRIDE;
+
+    virtual const void* GetData() const ORTHANC_OVERRIDE;
+
+    virtual size_t GetSize() const ORTHANC_OVERRIDE
+    {
+      return size_;
+    }
+  };
+}
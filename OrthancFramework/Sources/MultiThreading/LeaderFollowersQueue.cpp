@@ -0,0 +1,178 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "LeaderFollowersQueue.h"
+
+#include "../Logging.h"
+#include "../OrthancException.h"
+
+#include <boost/thread/thread_time.hpp>
+#include <algorithm>
+#include <cassert>
+
+
+namespace Orthanc
+{
+  struct LeaderFollowersQueue::PendingItem
+  {
+    enum State
+    {
+      State_Pending,
+      State_Success,
+      State_Failure
+    };
+
+    Item*  item_;
+    State  state_;
+
+    explicit PendingItem(Item& item) :
+      item_(&item),
+      state_(State_Pending)
+    {
+    }
+  };
+
+
+  LeaderFollowersQueue::LeaderFollowersQueue(unsigned int maxBatchSize,
+                                             unsigned int windowMilliseconds) :
+    hasLeader_(false),
+    maxBatchSize_(maxBatchSize),
+    windowMilliseconds_(windowMilliseconds)
+  {
+  }
+
+
+  void LeaderFollowersQueue::SetParameters(unsigned int maxBatchSize,
+                                           unsigned int windowMilliseconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxBatchSize_ = maxBatchSize;
+    windowMilliseconds_ = windowMilliseconds;
+  }
+
+
+  unsigned int LeaderFollowersQueue::GetMaxBatchSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxBatchSize_;
+  }
+
+
+  bool LeaderFollowersQueue::Submit(Item& item,
+                                    IBatchHandler& handler)
+  {
+    PendingItem pending(item);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    queue_.push_back(&pending);
+    condition_.notify_all();
+
+    while (pending.state_ == PendingItem::State_Pending)
+    {
+      if (hasLeader_)
+      {
+        // Another thread is handling a batch, wait for its completion
+        condition_.wait(lock);
+        continue;
+      }
+
+      // Become the leader, and wait for other threads to join the
+      // batch if some of them are already queued
+      hasLeader_ = true;
+
+      const size_t maxBatchSize = std::max(1u, maxBatchSize_);
+
+      if (queue_.size() > 1)
+      {
+        const boost::system_time timeout = (boost::get_system_time() +
+                                            boost::posix_time::milliseconds(windowMilliseconds_));
+
+        while (queue_.size() < maxBatchSize &&
+               condition_.timed_wait(lock, timeout))
+        {
+        }
+      }
+
+      std::vector<PendingItem*> batch;
+      batch.reserve(std::min(queue_.size(), maxBatchSize));
+
+      while (!queue_.empty() &&
+             batch.size() < maxBatchSize)
+      {
+        batch.push_back(queue_.front());
+        queue_.pop_front();
+      }
+
+      assert(!batch.empty());
+
+      std::vector<Item*> items(batch.size());
+      for (size_t i = 0; i < batch.size(); i++)
+      {
+        items[i] = batch[i]->item_;
+      }
+
+      // If the item of the leader is alone, it is handled while
+      // keeping the role of leader, so that the threads that show
+      // up meanwhile form the next batch
+      const bool isAlone = (batch.size() == 1 &&
+                            batch[0] == &pending);
+
+      bool success = false;
+
+      lock.unlock();
+
+      try
+      {
+        success = handler.HandleBatch(items);
+      }
+      catch (...)
+      {
+        if (isAlone)
+        {
+          lock.lock();
+          hasLeader_ = false;
+          condition_.notify_all();
+          throw;
+        }
+        else
+        {
+          LOG(INFO) << "Exception while handling a batch of " << batch.size() << " items";
+        }
+      }
+
+      lock.lock();
+
+      for (size_t i = 0; i < batch.size(); i++)
+      {
+        batch[i]->state_ = (success ? PendingItem::State_Success : PendingItem::State_Failure);
+      }
+
+      hasLeader_ = false;
+      condition_.notify_all();
+    }
+
+    return (pending.state_ == PendingItem::State_Success);
+  }
+}
@@ -0,0 +1,96 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../OrthancFramework.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <vector>
+
+namespace Orthanc
+{
+  /**
+   * Coalesces the items that are submitted concurrently by several
+   * threads into batches (new in Orthanc 1.11.2). The first thread
+   * to submit an item becomes the "leader" that handles the batch on
+   * behalf of the other threads (the "followers"), then wakes them
+   * up. The leader only waits for the time window if followers are
+   * already queued: A lone item is handled at once, and the items
+   * that show up meanwhile form the next batch.
+   **/
+  class ORTHANC_PUBLIC LeaderFollowersQueue : public boost::noncopyable
+  {
+  public:
+    class ORTHANC_PUBLIC Item : public boost::noncopyable
+    {
+    public:
+      virtual ~Item()
+      {
+      }
+    };
+
+    class ORTHANC_PUBLIC IBatchHandler : public boost::noncopyable
+    {
+    public:
+      virtual ~IBatchHandler()
+      {
+      }
+
+      // Invoked by the leader, out of the lock of the queue. Must
+      // return "false" if the batch has failed.
+      virtual bool HandleBatch(const std::vector<Item*>& batch) = 0;
+    };
+
+  private:
+    struct PendingItem;
+
+    boost::mutex                mutex_;
+    boost::condition_variable   condition_;
+    std::list<PendingItem*>     queue_;
+    bool                        hasLeader_;
+    unsigned int                maxBatchSize_;
+    unsigned int                windowMilliseconds_;
+
+  public:
+    LeaderFollowersQueue(unsigned int maxBatchSize,
+                         unsigned int windowMilliseconds);
+
+    void SetParameters(unsigned int maxBatchSize,
+                       unsigned int windowMilliseconds);
+
+    unsigned int GetMaxBatchSize();
+
+    /**
+     * Returns "true" iff the batch that contains "item" has been
+     * successfully handled, by the "handler" of the leader. If "item"
+     * is alone in its batch, the exceptions of "handler" are
+     * propagated to the caller. Otherwise, they make the batch fail.
+     **/
+    bool Submit(Item& item,
+                IBatchHandler& handler);
+  };
+}
@@ -34,6 +34,7 @@
 
 #include "../Sources/Compatibility.h"
 #include "../Sources/OrthancException.h"
+#include "../Sources/DicomFormat/DicomFrameOffsetTable.h"
 #include "../Sources/DicomFormat/DicomMap.h"
 #include "../Sources/DicomFormat/DicomStreamReader.h"
 #include "../Sources/DicomParsing/FromDcmtkBridge.h"
@@ -1056,6 +1057,188 @@ TEST(ParsedDicomFile, canIncludeXsVrTags)
 }
 
 
+static void AddUnsignedInteger16(std::string& target,
+                                 uint16_t value)
+{
+  target.push_back(static_cast<char>(value & 0xff));
+  target.push_back(static_cast<char>(value >> 8));
+}
+
+static void AddUnsignedInteger32(std::string& target,
+                                 uint32_t value)
+{
+  AddUnsignedInteger16(target, static_cast<uint16_t>(value & 0xffff));
+  AddUnsignedInteger16(target, static_cast<uint16_t>(value >> 16));
+}
+
+static void AddItem(std::string& target,
+                    const std::string& content)
+{
+  AddUnsignedInteger16(target, 0xfffe);
+  AddUnsignedInteger16(target, 0xe000);
+  AddUnsignedInteger32(target, static_cast<uint32_t>(content.size()));
+  target += content;
+}
+
+static std::string ExtractFrame(const std::string& dicom,
+                                const DicomFrameOffsetTable& table,
+                                unsigned int frame)
+{
+  uint64_t start, end;
+  table.GetFrameExtent(start, end, frame);
+
+  std::string extent = dicom.substr(static_cast<size_t>(start), static_cast<size_t>(end - start));
+
+  std::string result;
+  table.ExtractFrame(result, extent.empty() ? NULL : extent.c_str(), extent.size(), frame);
+  return result;
+}
+
+TEST(DicomFrameOffsetTable, Native)
+{
+  // Explicit VR Little Endian, 3 frames of 4 bytes
+  std::string dicom = "prefix";
+  AddUnsignedInteger16(dicom, 0x7fe0);
+  AddUnsignedInteger16(dicom, 0x0010);
+  dicom += "OW";
+  AddUnsignedInteger16(dicom, 0);
+  AddUnsignedInteger32(dicom, 12);
+  dicom += "aaaabbbbcccc";
+
+  DicomFrameOffsetTable table;
+  ASSERT_EQ(0u, table.GetFramesCount());
+  ASSERT_FALSE(table.Parse(dicom.c_str(), dicom.size(), 0, false, 3, 4));  // Not the pixel data tag
+  ASSERT_FALSE(table.Parse(dicom.c_str(), dicom.size(), 6, false, 3, 5));  // Frames too large
+  ASSERT_FALSE(table.Parse(dicom.c_str(), dicom.size(), 6, false, 4, 4));  // Too many frames
+  ASSERT_FALSE(table.Parse(dicom.c_str(), dicom.size() - 1, 6, false, 3, 4));  // Truncated
+  ASSERT_TRUE(table.Parse(dicom.c_str(), dicom.size(), 6, false, 3, 4));
+
+  ASSERT_EQ(3u, table.GetFramesCount());
+  ASSERT_EQ(3u, table.GetRangesCount());
+  ASSERT_EQ(1u, table.GetFrameRangesCount(1));
+  ASSERT_EQ(4u, table.GetFrameSize(2));
+  ASSERT_THROW(table.GetFrameSize(3), OrthancException);
+
+  uint64_t offset, size;
+  table.GetFrameRange(offset, size, 1, 0);
+  ASSERT_EQ(22u, offset);
+  ASSERT_EQ(4u, size);
+  ASSERT_THROW(table.GetFrameRange(offset, size, 1, 1), OrthancException);
+
+  ASSERT_EQ("aaaa", ExtractFrame(dicom, table, 0));
+  ASSERT_EQ("bbbb", ExtractFrame(dicom, table, 1));
+  ASSERT_EQ("cccc", ExtractFrame(dicom, table, 2));
+
+  std::string s;
+  table.Serialize(s);
+  ASSERT_EQ("18:4;22:4;26:4", s);
+
+  DicomFrameOffsetTable table2;
+  ASSERT_TRUE(table2.Unserialize(s));
+  ASSERT_EQ(3u, table2.GetFramesCount());
+  ASSERT_EQ("bbbb", ExtractFrame(dicom, table2, 1));
+
+  ASSERT_FALSE(table2.Unserialize(""));
+  ASSERT_FALSE(table2.Unserialize("18:4;nope"));
+  ASSERT_EQ(0u, table2.GetFramesCount());
+
+  // Implicit VR Little Endian
+  dicom.clear();
+  AddUnsignedInteger16(dicom, 0x7fe0);
+  AddUnsignedInteger16(dicom, 0x0010);
+  AddUnsignedInteger32(dicom, 6);
+  dicom += "abcdef";
+  ASSERT_TRUE(table.Parse(dicom.c_str(), dicom.size(), 0, true, 2, 3));
+  ASSERT_EQ("abc", ExtractFrame(dicom, table, 0));
+  ASSERT_EQ("def", ExtractFrame(dicom, table, 1));
+}
+
+TEST(DicomFrameOffsetTable, Encapsulated)
+{
+  std::string header;
+  AddUnsignedInteger16(header, 0x7fe0);
+  AddUnsignedInteger16(header, 0x0010);
+  header += "OB";
+  AddUnsignedInteger16(header, 0);
+  AddUnsignedInteger32(header, 0xffffffffu);
+
+  std::string delimiter;
+  AddUnsignedInteger16(delimiter, 0xfffe);
+  AddUnsignedInteger16(delimiter, 0xe0dd);
+  AddUnsignedInteger32(delimiter, 0);
+
+  DicomFrameOffsetTable table;
+
+  {
+    // One fragment per frame, empty offset table
+    std::string dicom = header;
+    AddItem(dicom, "");
+    AddItem(dicom, "hello");
+    AddItem(dicom, "world!");
+    dicom += delimiter;
+
+    ASSERT_TRUE(table.Parse(dicom.c_str(), dicom.size(), 0, false, 2, 0));
+    ASSERT_EQ(2u, table.GetFramesCount());
+    ASSERT_EQ("hello", ExtractFrame(dicom, table, 0));
+    ASSERT_EQ("world!", ExtractFrame(dicom, table, 1));
+
+    ASSERT_FALSE(table.Parse(dicom.c_str(), dicom.size(), 0, false, 3, 0));  // Not enough fragments
+    ASSERT_FALSE(table.Parse(dicom.c_str(), dicom.size() - 1, 0, false, 2, 0));  // No delimiter
+
+    // Single frame made of two fragments
+    ASSERT_TRUE(table.Parse(dicom.c_str(), dicom.size(), 0, false, 1, 0));
+    ASSERT_EQ(1u, table.GetFramesCount());
+    ASSERT_EQ(2u, table.GetFrameRangesCount(0));
+    ASSERT_EQ("helloworld!", ExtractFrame(dicom, table, 0));
+  }
+
+  {
+    // Two frames made of 2 and 1 fragments, described by the offset table
+    std::string offsets;
+    AddUnsignedInteger32(offsets, 0);
+    AddUnsignedInteger32(offsets, 8 + 2 + 8 + 4);
+
+    std::string dicom = header;
+    AddItem(dicom, offsets);
+    AddItem(dicom, "ab");
+    AddItem(dicom, "cdef");
+    AddItem(dicom, "gh");
+    dicom += delimiter;
+
+    ASSERT_TRUE(table.Parse(dicom.c_str(), dicom.size(), 0, false, 2, 0));
+    ASSERT_EQ(2u, table.GetFramesCount());
+    ASSERT_EQ(3u, table.GetRangesCount());
+    ASSERT_EQ(2u, table.GetFrameRangesCount(0));
+    ASSERT_EQ(1u, table.GetFrameRangesCount(1));
+    ASSERT_EQ(6u, table.GetFrameSize(0));
+    ASSERT_EQ("abcdef", ExtractFrame(dicom, table, 0));
+    ASSERT_EQ("gh", ExtractFrame(dicom, table, 1));
+
+    std::string s;
+    table.Serialize(s);
+
+    DicomFrameOffsetTable table2;
+    ASSERT_TRUE(table2.Unserialize(s));
+    ASSERT_EQ(2u, table2.GetFramesCount());
+    ASSERT_EQ("abcdef", ExtractFrame(dicom, table2, 0));
+    ASSERT_EQ("gh", ExtractFrame(dicom, table2, 1));
+  }
+
+  {
+    // Several fragments per frame, but no offset table
+    std::string dicom = header;
+    AddItem(dicom, "");
+    AddItem(dicom, "ab");
+    AddItem(dicom, "cd");
+    AddItem(dicom, "ef");
+    dicom += delimiter;
+
+    ASSERT_FALSE(table.Parse(dicom.c_str(), dicom.size(), 0, false, 2, 0));
+    ASSERT_EQ(0u, table.GetFramesCount());
+  }
+}
+
+
 #if ORTHANC_SANDBOXED != 1
 
 #include "../Sources/SystemToolbox.h"
@@ -34,10 +34,12 @@
 #include "../Sources/HttpServer/BufferHttpSender.h"
 #include "../Sources/HttpServer/FilesystemHttpSender.h"
 #include "../Sources/Logging.h"
+#include "../Sources/MetricsRegistry.h"
 #include "../Sources/OrthancException.h"
 #include "../Sources/Toolbox.h"
 
 #include <ctype.h>
+#include <boost/thread.hpp>
 
 
 using namespace Orthanc;
@@ -87,6 +89,76 @@ TEST(FilesystemStorage, Basic2)
   ASSERT_EQ(s.GetSize(uid), data.size());
 }
 
+TEST(FilesystemStorage, ReadMapped)
+{
+  FilesystemStorage s("UnitTestsStorage");
+
+  std::string data = Toolbox::GenerateUuid();
+  std::string uid = Toolbox::GenerateUuid();
+  s.Create(uid.c_str(), &data[0], data.size(), FileContentType_Unknown);
+
+  std::unique_ptr<IMemoryBuffer> buffer(s.ReadMapped(uid, FileContentType_Unknown));
+  ASSERT_EQ(data.size(), buffer->GetSize());
+  ASSERT_EQ(0, memcmp(buffer->GetData(), &data[0], data.size()));
+
+  std::string d;
+  buffer->MoveToString(d);
+  ASSERT_EQ(data, d);
+  ASSERT_EQ(0u, buffer->GetSize());
+
+  ASSERT_THROW(s.ReadMapped(Toolbox::GenerateUuid(), FileContentType_Unknown), OrthancException);
+  s.Remove(uid, FileContentType_Unknown);
+}
+
+static void CreateFilesThread(FilesystemStorage* storage,
+                              std::vector<std::string>* uuids)
+{
+  for (size_t i = 0; i < uuids->size(); i++)
+  {
+    const std::string& uuid = (*uuids) [i];
+    storage->Create(uuid, uuid.c_str(), uuid.size(), FileContentType_Unknown);
+  }
+}
+
+TEST(FilesystemStorage, BatchedSync)
+{
+  FilesystemStorage s("UnitTestsStorage", true /* fsync */);
+  s.SetBatchedSync(4, 10);
+
+  std::vector< std::vector<std::string> > uuids(4);
+
+  std::vector<boost::thread*> threads;
+  for (size_t i = 0; i < uuids.size(); i++)
+  {
+    for (size_t j = 0; j < 5; j++)
+    {
+      uuids[i].push_back(Toolbox::GenerateUuid());
+    }
+
+    threads.push_back(new boost::thread(CreateFilesThread, &s, &uuids[i]));
+  }
+
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  for (size_t i = 0; i < uuids.size(); i++)
+  {
+    for (size_t j = 0; j < uuids[i].size(); j++)
+    {
+      std::unique_ptr<IMemoryBuffer> buffer(s.Read(uuids[i][j], FileContentType_Unknown));
+      std::string d;
+      buffer->MoveToString(d);
+      ASSERT_EQ(uuids[i][j], d);
+      s.Remove(uuids[i][j], FileContentType_Unknown);
+    }
+  }
+
+  s.SetBatchedSync(0, 0);  // Disable batching
+}
+
 TEST(FilesystemStorage, EndToEnd)
 {
   FilesystemStorage s("UnitTestsStorage");
@@ -123,6 +195,104 @@ TEST(FilesystemStorage, EndToEnd)
 }
 
 
+TEST(StorageCache, Shards)
+{
+  StorageCache cache;
+  ASSERT_EQ(1u, cache.GetShardsCount());
+  ASSERT_THROW(cache.SetShardsCount(0), OrthancException);
+
+  cache.SetMaximumSize(1000);
+  cache.SetShardsCount(4);
+  ASSERT_EQ(4u, cache.GetShardsCount());
+
+  std::vector<std::string> uuids;
+  for (size_t i = 0; i < 20; i++)
+  {
+    uuids.push_back(Toolbox::GenerateUuid());
+    cache.Add(uuids.back(), FileContentType_Dicom, "Hello");
+  }
+
+  std::string s;
+  for (size_t i = 0; i < uuids.size(); i++)
+  {
+    ASSERT_TRUE(cache.Fetch(s, uuids[i], FileContentType_Dicom));
+    ASSERT_EQ("Hello", s);
+    ASSERT_TRUE(cache.FetchStartRange(s, uuids[i], FileContentType_Dicom, 2));
+    ASSERT_EQ("He", s);
+    ASSERT_TRUE(cache.FetchRange(s, uuids[i], FileContentType_Dicom, 1, 4));
+    ASSERT_EQ("ell", s);
+    ASSERT_FALSE(cache.FetchRange(s, uuids[i], FileContentType_Dicom, 1, 6));
+    ASSERT_FALSE(cache.Fetch(s, uuids[i], FileContentType_DicomAsJson));
+  }
+
+  cache.Invalidate(uuids[0], FileContentType_Dicom);
+  ASSERT_FALSE(cache.Fetch(s, uuids[0], FileContentType_Dicom));
+
+  cache.Add(uuids[0], FileContentType_Dicom, std::string(300, 'a'));  // Larger than one shard
+  ASSERT_FALSE(cache.Fetch(s, uuids[0], FileContentType_Dicom));
+
+  MetricsRegistry registry;
+  cache.PublishMetrics(registry);
+
+  std::string metrics;
+  registry.ExportPrometheusText(metrics);
+  ASSERT_NE(std::string::npos, metrics.find("orthanc_storage_cache_hits 80 "));
+  ASSERT_NE(std::string::npos, metrics.find("orthanc_storage_cache_shard_3_misses "));
+}
+
+
+static void FetchFromCacheThread(StorageCache* cache,
+                                 std::string* uuid,
+                                 bool* success,
+                                 std::string* value)
+{
+  StorageCache::Accessor accessor(*cache);
+  *success = accessor.Fetch(*value, *uuid, FileContentType_Dicom);
+}
+
+
+TEST(StorageCache, SingleFlight)
+{
+  StorageCache cache;
+  std::string uuid = Toolbox::GenerateUuid();
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    bool success = false;
+    std::string value;
+
+    std::unique_ptr<StorageCache::Accessor> loader(new StorageCache::Accessor(cache));
+    ASSERT_FALSE(loader->Fetch(value, uuid, FileContentType_Dicom));
+    ASSERT_THROW(loader->Fetch(value, uuid, FileContentType_Dicom), OrthancException);
+
+    // The second accessor waits for the first one
+    boost::thread waiter(FetchFromCacheThread, &cache, &uuid, &success, &value);
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    ASSERT_FALSE(waiter.timed_join(boost::posix_time::milliseconds(0)));
+
+    if (i == 0)
+    {
+      // The load fails: The waiter must read by itself
+      loader.reset(NULL);
+      waiter.join();
+      ASSERT_FALSE(success);
+    }
+    else
+    {
+      loader->Add(uuid, FileContentType_Dicom, "Hello");
+      waiter.join();
+      ASSERT_TRUE(success);
+      ASSERT_EQ("Hello", value);
+    }
+  }
+
+  StorageCache::Accessor accessor(cache);
+  std::string value;
+  ASSERT_TRUE(accessor.Fetch(value, uuid, FileContentType_Dicom));
+  ASSERT_EQ("Hello", value);
+}
+
+
 TEST(StorageAccessor, NoCompression)
 {
   FilesystemStorage s("UnitTestsStorage");
@@ -192,3 +362,39 @@ TEST(StorageAccessor, Mix)
   ASSERT_THROW(accessor.Read(r, uncompressedInfo.GetUuid(), FileContentType_Unknown), OrthancException);
   */
 }
+
+
+TEST(StorageAccessor, ReadRange)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  StorageCache cache;
+
+  std::string data = "Hello world";
+
+  {
+    StorageAccessor accessor(s, NULL);
+    FileInfo info = accessor.Write(data, FileContentType_Dicom, CompressionType_None, false);
+
+    std::string r;
+    accessor.ReadRange(r, info, 6, 11);
+    ASSERT_EQ("world", r);
+    accessor.ReadRange(r, info, 0, 5);
+    ASSERT_EQ("Hello", r);
+    accessor.ReadRange(r, info, 3, 3);
+    ASSERT_TRUE(r.empty());
+    ASSERT_THROW(accessor.ReadRange(r, info, 6, 12), OrthancException);
+    ASSERT_THROW(accessor.ReadRange(r, info, 6, 5), OrthancException);
+  }
+
+  {
+    StorageAccessor accessor(s, &cache);
+    FileInfo info = accessor.Write(data, FileContentType_Dicom, CompressionType_None, false);
+
+    std::string r;
+    accessor.ReadRange(r, info, 2, 8);
+    ASSERT_EQ("llo wo", r);
+
+    FileInfo compressed = accessor.Write(data, FileContentType_Dicom, CompressionType_ZlibWithSize, false);
+    ASSERT_THROW(accessor.ReadRange(r, compressed, 0, 5), OrthancException);
+  }
+}
@@ -662,6 +662,7 @@ TEST(Toolbox, FileBuffer)
   f.Append("a", 1);
   f.Append("", 0);
   f.Append("bc", 2);
+  ASSERT_EQ(3u, f.GetSize());
 
   std::string s;
   f.Read(s);
@@ -669,6 +670,25 @@ TEST(Toolbox, FileBuffer)
 
   ASSERT_THROW(f.Append("d", 1), OrthancException);  // File is closed
 }
+
+TEST(Toolbox, FileBufferPath)
+{
+  std::string path;
+
+  {
+    FileBuffer f;
+    f.Append("hello", 5);
+    path = f.GetPath();
+    ASSERT_THROW(f.Append("d", 1), OrthancException);  // File is closed
+
+    std::string s;
+    SystemToolbox::ReadFile(s, path);
+    ASSERT_EQ("hello", s);
+    ASSERT_TRUE(SystemToolbox::IsRegularFile(path));
+  }
+
+  ASSERT_FALSE(SystemToolbox::IsRegularFile(path));  // Temporary file is removed
+}
 #endif
 
 
@@ -33,9 +33,12 @@
 #include "../Sources/Images/Image.h"
 #include "../Sources/Images/ImageProcessing.h"
 #include "../Sources/Images/ImageTraits.h"
+#include "../Sources/Logging.h"
 #include "../Sources/OrthancException.h"
 
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <memory>
+#include <string.h>
 
 using namespace Orthanc;
 
@@ -1385,3 +1388,462 @@ TEST(ImageProcessing, FillPolygon)
     ASSERT_TRUE(LookupSegment(x1, x2, image, 29));  ASSERT_EQ(5u, x1);  ASSERT_EQ(24u, x2);
   }
 }
+
+
+namespace
+{
+  class SimdToggle : public boost::noncopyable
+  {
+  private:
+    bool  previous_;
+
+  public:
+    explicit SimdToggle(bool enabled) :
+      previous_(ImageProcessing::IsSimdEnabled())
+    {
+      ImageProcessing::SetSimdEnabled(enabled);
+    }
+
+    ~SimdToggle()
+    {
+      ImageProcessing::SetSimdEnabled(previous_);
+    }
+  };
+
+
+  class PseudoRandom : public boost::noncopyable
+  {
+  private:
+    uint32_t  state_;
+
+  public:
+    explicit PseudoRandom(uint32_t seed) :
+      state_(seed)
+    {
+    }
+
+    uint32_t Next()
+    {
+      state_ = state_ * 1664525u + 1013904223u;
+      return state_ >> 8;
+    }
+  };
+}
+
+
+static void FillRandom(ImageAccessor& image,
+                       PseudoRandom& random)
+{
+  for (unsigned int y = 0; y < image.GetHeight(); y++)
+  {
+    if (image.GetFormat() == PixelFormat_Float32)
+    {
+      // Multiples of 0.25 in [-1024, 1024], to test the halfway cases of rounding
+      float* p = reinterpret_cast<float*>(image.GetRow(y));
+      for (unsigned int x = 0; x < image.GetWidth(); x++)
+      {
+        p[x] = static_cast<float>(static_cast<int32_t>(random.Next() % 8193) - 4096) / 4.0f;
+      }
+    }
+    else
+    {
+      uint8_t* p = reinterpret_cast<uint8_t*>(image.GetRow(y));
+      for (unsigned int x = 0; x < image.GetWidth() * image.GetBytesPerPixel(); x++)
+      {
+        p[x] = static_cast<uint8_t>(random.Next());
+      }
+    }
+  }
+}
+
+
+static bool IsSameImage(const ImageAccessor& a,
+                        const ImageAccessor& b)
+{
+  if (a.GetFormat() != b.GetFormat() ||
+      a.GetWidth() != b.GetWidth() ||
+      a.GetHeight() != b.GetHeight())
+  {
+    return false;
+  }
+
+  for (unsigned int y = 0; y < a.GetHeight(); y++)
+  {
+    if (memcmp(a.GetConstRow(y), b.GetConstRow(y), a.GetWidth() * a.GetBytesPerPixel()) != 0)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+TEST(ImageProcessing, SimdConsistency)
+{
+  // The vectorized kernels must give exactly the same results as
+  // the scalar ones, including the pixels at the end of the rows
+  static const unsigned int WIDTHS[] = { 1, 7, 15, 33, 67 };
+  static const PixelFormat INTEGER_FORMATS[] = {
+    PixelFormat_Grayscale8, PixelFormat_Grayscale16, PixelFormat_SignedGrayscale16
+  };
+
+  PseudoRandom random(42);
+
+  for (size_t w = 0; w < sizeof(WIDTHS) / sizeof(unsigned int); w++)
+  {
+    const unsigned int width = WIDTHS[w];
+    const unsigned int height = 3;
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      Image source(INTEGER_FORMATS[i], width, height, false);
+      FillRandom(source, random);
+
+      {
+        int64_t a, b, c, d;
+
+        {
+          SimdToggle toggle(true);
+          ImageProcessing::GetMinMaxIntegerValue(a, b, source);
+        }
+
+        {
+          SimdToggle toggle(false);
+          ImageProcessing::GetMinMaxIntegerValue(c, d, source);
+        }
+
+        ASSERT_EQ(c, a);
+        ASSERT_EQ(d, b);
+      }
+
+      for (size_t j = 0; j < 3; j++)
+      {
+        if (i != j)
+        {
+          Image a(INTEGER_FORMATS[j], width, height, false);
+          Image b(INTEGER_FORMATS[j], width, height, false);
+
+          {
+            SimdToggle toggle(true);
+            ImageProcessing::Convert(a, source);
+          }
+
+          {
+            SimdToggle toggle(false);
+            ImageProcessing::Convert(b, source);
+          }
+
+          ASSERT_TRUE(IsSameImage(a, b));
+        }
+      }
+
+      static const float SHIFT_SCALE[] = { -42.5f, 1.5f,
+                                           10.0f, -0.75f,
+                                           0.5f, 255.0f,
+                                           -1000.0f, 0.01f };
+
+      for (size_t k = 0; k < sizeof(SHIFT_SCALE) / sizeof(float); k += 2)
+      {
+        for (unsigned int useRound = 0; useRound < 2; useRound++)
+        {
+          std::unique_ptr<ImageAccessor> a(Image::Clone(source));
+          std::unique_ptr<ImageAccessor> b(Image::Clone(source));
+
+          {
+            SimdToggle toggle(true);
+            ImageProcessing::ShiftScale2(*a, SHIFT_SCALE[k], SHIFT_SCALE[k + 1], useRound != 0);
+          }
+
+          {
+            SimdToggle toggle(false);
+            ImageProcessing::ShiftScale2(*b, SHIFT_SCALE[k], SHIFT_SCALE[k + 1], useRound != 0);
+          }
+
+          ASSERT_TRUE(IsSameImage(*a, *b));
+        }
+      }
+
+      if (source.GetFormat() != PixelFormat_SignedGrayscale16)
+      {
+        const int64_t maxValue = (source.GetFormat() == PixelFormat_Grayscale8 ? 200 : 4095);
+
+        std::unique_ptr<ImageAccessor> a(Image::Clone(source));
+        std::unique_ptr<ImageAccessor> b(Image::Clone(source));
+
+        {
+          SimdToggle toggle(true);
+          ImageProcessing::Invert(*a, maxValue);
+        }
+
+        {
+          SimdToggle toggle(false);
+          ImageProcessing::Invert(*b, maxValue);
+        }
+
+        ASSERT_TRUE(IsSameImage(*a, *b));
+      }
+    }
+
+    {
+      Image source(PixelFormat_Float32, width, height, false);
+      FillRandom(source, random);
+
+      for (unsigned int useRound = 0; useRound < 2; useRound++)
+      {
+        Image a(PixelFormat_Grayscale8, width, height, false);
+        Image b(PixelFormat_Grayscale8, width, height, false);
+
+        {
+          SimdToggle toggle(true);
+          ImageProcessing::ShiftScale2(a, source, 100.0f, 0.5f, useRound != 0);
+        }
+
+        {
+          SimdToggle toggle(false);
+          ImageProcessing::ShiftScale2(b, source, 100.0f, 0.5f, useRound != 0);
+        }
+
+        ASSERT_TRUE(IsSameImage(a, b));
+      }
+    }
+
+    static const PixelFormat WINDOWING_SOURCES[] = {
+      PixelFormat_Float32, PixelFormat_Grayscale8, PixelFormat_Grayscale16
+    };
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      Image source(WINDOWING_SOURCES[i], width, height, false);
+      FillRandom(source, random);
+
+      for (unsigned int invert = 0; invert < 2; invert++)
+      {
+        for (unsigned int target = 0; target < 2; target++)
+        {
+          const PixelFormat format = (target == 0 ? PixelFormat_Grayscale8 : PixelFormat_Grayscale16);
+          Image a(format, width, height, false);
+          Image b(format, width, height, false);
+
+          {
+            SimdToggle toggle(true);
+            ImageProcessing::ApplyWindowing_Deprecated(a, source, 100.0f, 300.0f, 1.3f, -20.0f, invert != 0);
+          }
+
+          {
+            SimdToggle toggle(false);
+            ImageProcessing::ApplyWindowing_Deprecated(b, source, 100.0f, 300.0f, 1.3f, -20.0f, invert != 0);
+          }
+
+          ASSERT_TRUE(IsSameImage(a, b));
+        }
+      }
+    }
+  }
+}
+
+
+TEST(ImageProcessing, DISABLED_SimdBenchmark)
+{
+  static const unsigned int ITERATIONS = 50;
+
+  PseudoRandom random(42);
+
+  Image source(PixelFormat_Grayscale16, 2048, 2048, false);
+  FillRandom(source, random);
+
+  Image signedSource(PixelFormat_SignedGrayscale16, 2048, 2048, false);
+  FillRandom(signedSource, random);
+
+  Image target(PixelFormat_Grayscale8, 2048, 2048, false);
+  Image work(PixelFormat_SignedGrayscale16, 2048, 2048, false);
+
+  LOG(WARNING) << "SIMD instruction set: " << ImageProcessing::GetSimdInstructionSet();
+
+  for (unsigned int simd = 0; simd < 2; simd++)
+  {
+    SimdToggle toggle(simd == 1);
+
+    int64_t durationMinMax, durationConvert, durationWindowing, durationShiftScale;
+
+    {
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      for (unsigned int i = 0; i < ITERATIONS; i++)
+      {
+        int64_t minValue, maxValue;
+        ImageProcessing::GetMinMaxIntegerValue(minValue, maxValue, source);
+      }
+      durationMinMax = (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+    }
+
+    {
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      for (unsigned int i = 0; i < ITERATIONS; i++)
+      {
+        ImageProcessing::Convert(target, source);
+      }
+      durationConvert = (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+    }
+
+    {
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      for (unsigned int i = 0; i < ITERATIONS; i++)
+      {
+        ImageProcessing::ApplyWindowing_Deprecated(target, source, 2048.0f, 4096.0f, 1.0f, 0.0f, false);
+      }
+      durationWindowing = (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+    }
+
+    {
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      for (unsigned int i = 0; i < ITERATIONS; i++)
+      {
+        ImageProcessing::Copy(work, signedSource);
+        ImageProcessing::ShiftScale2(work, 10.0f, 1.5f, true /* the most costly case */);
+      }
+      durationShiftScale = (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+    }
+
+    LOG(WARNING) << (simd == 1 ? "SIMD" : "Scalar") << " implementation, " << ITERATIONS
+                 << " iterations on 2048x2048 images: GetMinMaxIntegerValue() = " << durationMinMax
+                 << "ms, Convert() = " << durationConvert
+                 << "ms, ApplyWindowing_Deprecated() = " << durationWindowing
+                 << "ms, ShiftScale2(useRound) = " << durationShiftScale << "ms";
+  }
+}
+
+
+TEST(ImageProcessing, ResampleConstant)
+{
+  static const ImageProcessing::ResamplingFilter FILTERS[] = {
+    ImageProcessing::ResamplingFilter_NearestNeighbor,
+    ImageProcessing::ResamplingFilter_Box,
+    ImageProcessing::ResamplingFilter_Bilinear,
+    ImageProcessing::ResamplingFilter_Lanczos3
+  };
+
+  // Downsampling (including the block reduction), then upsampling
+  static const unsigned int SIZES[] = { 1000, 700, 37, 13, 61, 90 };
+
+  for (size_t i = 0; i < sizeof(FILTERS) / sizeof(ImageProcessing::ResamplingFilter); i++)
+  {
+    for (size_t j = 0; j + 1 < sizeof(SIZES) / sizeof(unsigned int); j += 2)
+    {
+      Image source(PixelFormat_Grayscale16, SIZES[j], SIZES[j + 1], false);
+      ImageProcessing::Set(source, 1234);
+
+      Image target(PixelFormat_Grayscale16, SIZES[j + 1], SIZES[j], false);
+      ImageProcessing::Resample(target, source, FILTERS[i], 4);
+
+      int64_t a, b;
+      ImageProcessing::GetMinMaxIntegerValue(a, b, target);
+      ASSERT_EQ(1234, a);
+      ASSERT_EQ(1234, b);
+    }
+
+    {
+      Image source(PixelFormat_RGB24, 50, 30, false);
+      ImageProcessing::Set(source, 10, 20, 30, 255);
+
+      Image target(PixelFormat_RGB24, 17, 11, false);
+      ImageProcessing::Resample(target, source, FILTERS[i], 1);
+      ASSERT_TRUE(TestRGB24Pixel(target, 0, 0, 10, 20, 30));
+      ASSERT_TRUE(TestRGB24Pixel(target, 8, 5, 10, 20, 30));
+      ASSERT_TRUE(TestRGB24Pixel(target, 16, 10, 10, 20, 30));
+    }
+  }
+}
+
+
+TEST(ImageProcessing, ResampleAntialiasing)
+{
+  // Checkerboard of 0/200 values: The nearest neighbor only picks the
+  // 200 values after a reduction by 2, whereas the other filters average
+  Image source(PixelFormat_Grayscale8, 64, 64, false);
+  for (unsigned int y = 0; y < 64; y++)
+  {
+    for (unsigned int x = 0; x < 64; x++)
+    {
+      SetGrayscale8Pixel(source, x, y, (x + y) % 2 == 0 ? 200 : 0);
+    }
+  }
+
+  Image target(PixelFormat_Grayscale8, 32, 32, false);
+
+  ImageProcessing::Resample(target, source, ImageProcessing::ResamplingFilter_NearestNeighbor, 1);
+  ASSERT_TRUE(TestGrayscale8Pixel(target, 0, 0, 200));
+  ASSERT_TRUE(TestGrayscale8Pixel(target, 10, 10, 200));
+
+  ImageProcessing::Resample(target, source, ImageProcessing::ResamplingFilter_Box, 1);
+  ASSERT_TRUE(TestGrayscale8Pixel(target, 0, 0, 100));
+  ASSERT_TRUE(TestGrayscale8Pixel(target, 10, 10, 100));
+  ASSERT_TRUE(TestGrayscale8Pixel(target, 31, 31, 100));
+
+  ImageProcessing::Resample(target, source, ImageProcessing::ResamplingFilter_Bilinear, 1);
+  ASSERT_TRUE(TestGrayscale8Pixel(target, 10, 10, 100));
+
+  // Block reduction by 8, followed by the box filter => Average of 16x16 blocks
+  Image small(PixelFormat_Grayscale8, 4, 4, false);
+  ImageProcessing::Resample(small, source, ImageProcessing::ResamplingFilter_Box, 1);
+  ASSERT_TRUE(TestGrayscale8Pixel(small, 0, 0, 100));
+  ASSERT_TRUE(TestGrayscale8Pixel(small, 3, 3, 100));
+}
+
+
+TEST(ImageProcessing, ResampleThreads)
+{
+  PseudoRandom random(42);
+
+  static const PixelFormat FORMATS[] = {
+    PixelFormat_Grayscale8, PixelFormat_SignedGrayscale16, PixelFormat_Float32,
+    PixelFormat_RGB24, PixelFormat_RGBA64
+  };
+
+  for (size_t i = 0; i < sizeof(FORMATS) / sizeof(PixelFormat); i++)
+  {
+    Image source(FORMATS[i], 517, 389, false);
+    FillRandom(source, random);
+
+    for (unsigned int up = 0; up < 2; up++)
+    {
+      const unsigned int width = (up ? 731 : 133);
+      const unsigned int height = (up ? 401 : 97);
+
+      Image a(FORMATS[i], width, height, false);
+      Image b(FORMATS[i], width, height, false);
+      ImageProcessing::Resample(a, source, ImageProcessing::ResamplingFilter_Lanczos3, 1);
+      ImageProcessing::Resample(b, source, ImageProcessing::ResamplingFilter_Lanczos3, 4);
+      ASSERT_TRUE(IsSameImage(a, b));
+
+      ImageProcessing::Resample(a, source, ImageProcessing::ResamplingFilter_NearestNeighbor, 1);
+      ImageProcessing::Resample(b, source, ImageProcessing::ResamplingFilter_NearestNeighbor, 3);
+      ASSERT_TRUE(IsSameImage(a, b));
+    }
+  }
+
+  {
+    Image source(PixelFormat_Grayscale8, 10, 10, false);
+    Image target(PixelFormat_Grayscale16, 5, 5, false);
+    ASSERT_THROW(ImageProcessing::Resample(target, source, ImageProcessing::ResamplingFilter_Box, 1), OrthancException);
+  }
+}
+
+
+TEST(ImageProcessing, FitSizeKeepAspectRatioResampled)
+{
+  Image source(PixelFormat_Grayscale8, 400, 100, false);
+  ImageProcessing::Set(source, 50);
+
+  std::unique_ptr<ImageAccessor> target(ImageProcessing::FitSizeKeepAspectRatio(
+                                          source, 100, 100, ImageProcessing::ResamplingFilter_Lanczos3, 2));
+  ASSERT_EQ(100u, target->GetWidth());
+  ASSERT_EQ(100u, target->GetHeight());
+
+  // The resized image is 100x25, centered vertically
+  ASSERT_TRUE(TestGrayscale8Pixel(*target, 50, 0, 0));
+  ASSERT_TRUE(TestGrayscale8Pixel(*target, 50, 36, 0));
+  ASSERT_TRUE(TestGrayscale8Pixel(*target, 0, 37, 50));
+  ASSERT_TRUE(TestGrayscale8Pixel(*target, 99, 50, 50));
+  ASSERT_TRUE(TestGrayscale8Pixel(*target, 50, 61, 50));
+  ASSERT_TRUE(TestGrayscale8Pixel(*target, 50, 62, 0));
+}
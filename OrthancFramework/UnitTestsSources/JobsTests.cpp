@@ -42,10 +42,14 @@
 #include "../../OrthancFramework/Sources/JobsEngine/Operations/StringOperationValue.h"
 #include "../../OrthancFramework/Sources/JobsEngine/SetOfInstancesJob.h"
 #include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/MultiThreading/LeaderFollowersQueue.h"
 #include "../../OrthancFramework/Sources/MultiThreading/SharedMessageQueue.h"
 #include "../../OrthancFramework/Sources/OrthancException.h"
 #include "../../OrthancFramework/Sources/SerializationToolbox.h"
 
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+
 
 using namespace Orthanc;
 
@@ -134,6 +138,52 @@ namespace
   };
 
 
+  class SlowJob : public DummyJob
+  {
+  private:
+    unsigned int remainingSteps_;
+
+  public:
+    explicit SlowJob(unsigned int steps) :
+      remainingSteps_(steps)
+    {
+    }
+
+    virtual JobStepResult Step(const std::string& jobId) ORTHANC_OVERRIDE
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+
+      if (remainingSteps_ == 0)
+      {
+        return JobStepResult::Success();
+      }
+      else
+      {
+        remainingSteps_--;
+        return JobStepResult::Continue();
+      }
+    }
+  };
+
+
+  class StopRecorderJob : public DummyJob
+  {
+  private:
+    std::vector<JobStopReason>&  stops_;
+
+  public:
+    explicit StopRecorderJob(std::vector<JobStopReason>& stops) :
+      stops_(stops)
+    {
+    }
+
+    virtual void Stop(JobStopReason reason) ORTHANC_OVERRIDE
+    {
+      stops_.push_back(reason);
+    }
+  };
+
+
   class DummyInstancesJob : public SetOfInstancesJob
   {
   private:
@@ -281,6 +331,198 @@ TEST(MultiThreading, SharedMessageQueueClean)
 }
 
 
+#if ORTHANC_SANDBOXED != 1
+namespace
+{
+  // Records the size of the batches. The first batch can be delayed
+  // so that the other threads queue up behind it, and the batches
+  // that contain a "bad" item fail.
+  class RecordingBatchHandler : public LeaderFollowersQueue::IBatchHandler
+  {
+  private:
+    boost::mutex         mutex_;
+    unsigned int         firstDelay_;
+    std::vector<size_t>  sizes_;
+
+  public:
+    class Item : public LeaderFollowersQueue::Item
+    {
+    private:
+      bool  bad_;
+
+    public:
+      explicit Item(bool bad) :
+        bad_(bad)
+      {
+      }
+
+      bool IsBad() const
+      {
+        return bad_;
+      }
+    };
+
+    explicit RecordingBatchHandler(unsigned int firstDelay) :
+      firstDelay_(firstDelay)
+    {
+    }
+
+    virtual bool HandleBatch(const std::vector<LeaderFollowersQueue::Item*>& batch) ORTHANC_OVERRIDE
+    {
+      unsigned int delay;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        sizes_.push_back(batch.size());
+        delay = firstDelay_;
+        firstDelay_ = 0;
+      }
+
+      if (delay != 0)
+      {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(delay));
+      }
+
+      for (size_t i = 0; i < batch.size(); i++)
+      {
+        if (dynamic_cast<Item&>(*batch[i]).IsBad())
+        {
+          if (batch.size() == 1)
+          {
+            throw OrthancException(ErrorCode_InternalError);
+          }
+          else
+          {
+            return false;
+          }
+        }
+      }
+
+      return true;
+    }
+
+    std::vector<size_t> GetSizes()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return sizes_;
+    }
+  };
+
+
+  void SubmitToLeaderFollowersQueue(LeaderFollowersQueue* queue,
+                                    RecordingBatchHandler* handler,
+                                    bool bad,
+                                    int* result)
+  {
+    try
+    {
+      RecordingBatchHandler::Item item(bad);
+      *result = (queue->Submit(item, *handler) ? 1 : 0);
+    }
+    catch (OrthancException&)
+    {
+      *result = -1;
+    }
+  }
+}
+
+
+TEST(MultiThreading, LeaderFollowersQueueAlone)
+{
+  // A lone item doesn't wait for the time window
+  LeaderFollowersQueue queue(8, 10000);
+  RecordingBatchHandler handler(0);
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  RecordingBatchHandler::Item item(false);
+  ASSERT_TRUE(queue.Submit(item, handler));
+
+  const boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+  ASSERT_LT((end - start).total_milliseconds(), 5000);
+
+  // The exceptions of a lone item are propagated to its thread
+  RecordingBatchHandler::Item bad(true);
+  ASSERT_THROW(queue.Submit(bad, handler), OrthancException);
+
+  ASSERT_EQ(2u, handler.GetSizes().size());
+  ASSERT_EQ(1u, handler.GetSizes()[0]);
+  ASSERT_EQ(1u, handler.GetSizes()[1]);
+
+  // The queue is still usable
+  ASSERT_TRUE(queue.Submit(item, handler));
+}
+
+
+TEST(MultiThreading, LeaderFollowersQueueBatches)
+{
+  static const size_t COUNT = 8;
+
+  LeaderFollowersQueue queue(COUNT, 100);
+  RecordingBatchHandler handler(200);
+
+  int results[COUNT];
+  boost::thread_group threads;
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    threads.create_thread(boost::bind(SubmitToLeaderFollowersQueue, &queue, &handler, false, &results[i]));
+  }
+
+  threads.join_all();
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    ASSERT_EQ(1, results[i]);
+  }
+
+  const std::vector<size_t> sizes = handler.GetSizes();
+  ASSERT_LT(sizes.size(), COUNT);
+
+  size_t total = 0;
+  for (size_t i = 0; i < sizes.size(); i++)
+  {
+    ASSERT_LE(sizes[i], COUNT);
+    total += sizes[i];
+  }
+
+  ASSERT_EQ(COUNT, total);
+}
+
+
+TEST(MultiThreading, LeaderFollowersQueueFailure)
+{
+  LeaderFollowersQueue queue(8, 100);
+  RecordingBatchHandler handler(200);
+
+  int first;
+  boost::thread blocker(SubmitToLeaderFollowersQueue, &queue, &handler, false, &first);
+
+  // Queue up the next items behind the delayed first batch
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+
+  int results[3];
+  boost::thread_group threads;
+  threads.create_thread(boost::bind(SubmitToLeaderFollowersQueue, &queue, &handler, false, &results[0]));
+  threads.create_thread(boost::bind(SubmitToLeaderFollowersQueue, &queue, &handler, true, &results[1]));
+  threads.create_thread(boost::bind(SubmitToLeaderFollowersQueue, &queue, &handler, false, &results[2]));
+
+  threads.join_all();
+  blocker.join();
+
+  // The whole batch that contains the bad item fails
+  ASSERT_EQ(1, first);
+  ASSERT_EQ(0, results[0]);
+  ASSERT_EQ(0, results[1]);
+  ASSERT_EQ(0, results[2]);
+
+  ASSERT_EQ(2u, handler.GetSizes().size());
+  ASSERT_EQ(1u, handler.GetSizes()[0]);
+  ASSERT_EQ(3u, handler.GetSizes()[1]);
+}
+#endif
+
+
 
 
 static bool CheckState(JobsRegistry& registry,
@@ -697,6 +939,132 @@ TEST(JobsRegistry, Cancel)
 
 
 
+TEST(JobsRegistry, Yield)
+{
+  JobsRegistry registry(10);
+
+  std::string i1, i2, i3;
+  registry.Submit(i1, new DummyJob(), 10);
+  registry.Submit(i2, new DummyJob(), 10);
+
+  {
+    // Jobs with the same priority are started in FIFO order
+    JobsRegistry::RunningJob job(registry, 0);
+    ASSERT_TRUE(job.IsValid());
+    ASSERT_EQ(i1, job.GetId());
+    ASSERT_GE(job.GetQueueWait().total_milliseconds(), 0);
+
+    ASSERT_TRUE(job.HasWaitingJob(false));
+    ASSERT_FALSE(job.HasWaitingJob(true));
+    job.MarkYield();
+  }
+
+  ASSERT_TRUE(CheckState(registry, i1, JobState_Pending));
+  ASSERT_TRUE(CheckState(registry, i2, JobState_Pending));
+
+  {
+    // The job that has yielded is put at the end of the queue
+    JobsRegistry::RunningJob job(registry, 0);
+    ASSERT_TRUE(job.IsValid());
+    ASSERT_EQ(i2, job.GetId());
+    job.MarkSuccess();
+  }
+
+  {
+    JobsRegistry::RunningJob job(registry, 0);
+    ASSERT_TRUE(job.IsValid());
+    ASSERT_EQ(i1, job.GetId());
+    ASSERT_FALSE(job.HasWaitingJob(false));
+
+    registry.Submit(i3, new DummyJob(), 20);
+    ASSERT_TRUE(job.HasWaitingJob(true));
+
+    // A pause that is requested while yielding must not be lost
+    ASSERT_TRUE(registry.Pause(i1));
+    job.MarkYield();
+  }
+
+  ASSERT_TRUE(CheckState(registry, i1, JobState_Paused));
+  ASSERT_TRUE(CheckState(registry, i3, JobState_Pending));
+
+  {
+    JobsRegistry::RunningJob job(registry, 0);
+    ASSERT_TRUE(job.IsValid());
+    ASSERT_EQ(i3, job.GetId());
+
+    ASSERT_TRUE(registry.Cancel(i3));
+    job.MarkYield();
+  }
+
+  ASSERT_TRUE(CheckState(registry, i3, JobState_Failure));
+  ASSERT_TRUE(CheckErrorCode(registry, i3, ErrorCode_CanceledJob));
+}
+
+
+TEST(JobsRegistry, StopYielded)
+{
+  JobsRegistry registry(10);
+
+  std::vector<JobStopReason> stops1, stops2, stops3;
+
+  std::string i1, i2, i3;
+  registry.Submit(i1, new StopRecorderJob(stops1), 10);
+  registry.Submit(i2, new StopRecorderJob(stops2), 10);
+  registry.Submit(i3, new StopRecorderJob(stops3), 10);
+
+  // A job that has not started yet is not stopped
+  ASSERT_TRUE(registry.Pause(i3));
+  ASSERT_TRUE(CheckState(registry, i3, JobState_Paused));
+  ASSERT_TRUE(stops3.empty());
+  ASSERT_TRUE(registry.Resume(i3));
+
+  for (unsigned int i = 0; i < 3; i++)
+  {
+    JobsRegistry::RunningJob job(registry, 0);
+    ASSERT_TRUE(job.IsValid());
+    job.MarkYield();
+  }
+
+  ASSERT_TRUE(CheckState(registry, i1, JobState_Pending));
+  ASSERT_TRUE(CheckState(registry, i2, JobState_Pending));
+  ASSERT_TRUE(CheckState(registry, i3, JobState_Pending));
+  ASSERT_TRUE(stops1.empty());
+  ASSERT_TRUE(stops2.empty());
+  ASSERT_TRUE(stops3.empty());
+
+  // Pausing or canceling a job that has yielded must stop it
+  ASSERT_TRUE(registry.Pause(i1));
+  ASSERT_TRUE(CheckState(registry, i1, JobState_Paused));
+  ASSERT_EQ(1u, stops1.size());
+  ASSERT_EQ(JobStopReason_Paused, stops1[0]);
+
+  ASSERT_TRUE(registry.Cancel(i2));
+  ASSERT_TRUE(CheckState(registry, i2, JobState_Failure));
+  ASSERT_EQ(1u, stops2.size());
+  ASSERT_EQ(JobStopReason_Canceled, stops2[0]);
+
+  // A paused job that has been stopped is not stopped twice
+  ASSERT_TRUE(registry.Cancel(i1));
+  ASSERT_EQ(1u, stops1.size());
+
+  {
+    // Resuming a job that has yielded does not stop it, but a cancel
+    // that is requested while yielding again does
+    JobsRegistry::RunningJob job(registry, 0);
+    ASSERT_TRUE(job.IsValid());
+    ASSERT_EQ(i3, job.GetId());
+    ASSERT_TRUE(stops3.empty());
+
+    ASSERT_TRUE(registry.Cancel(i3));
+    job.MarkYield();
+  }
+
+  ASSERT_TRUE(CheckState(registry, i3, JobState_Failure));
+  ASSERT_EQ(1u, stops3.size());
+  ASSERT_EQ(JobStopReason_Canceled, stops3[0]);
+}
+
+
 TEST(JobsEngine, SubmitAndWait)
 {
   JobsEngine engine(10);
@@ -717,6 +1085,47 @@ TEST(JobsEngine, SubmitAndWait)
 }
 
 
+TEST(JobsEngine, TimeSlice)
+{
+  MetricsRegistry metrics;
+
+  JobsEngine engine(10);
+  engine.SetThreadSleep(10);
+  engine.SetWorkersCount(1);
+  engine.SetTimeSlice(10);
+  engine.SetMetricsRegistry(metrics);
+  engine.Start();
+
+  // This job lasts for about 2 seconds
+  std::string slow;
+  engine.GetRegistry().Submit(slow, new SlowJob(1000), 0);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+  ASSERT_TRUE(CheckState(engine.GetRegistry(), slow, JobState_Running));
+
+  // The only worker thread is busy with the slow job, which must
+  // give way to the jobs with a higher or with the same priority
+  Json::Value content = Json::nullValue;
+  engine.GetRegistry().SubmitAndWait(content, new DummyJob(), 10);
+  ASSERT_EQ("world", content["hello"].asString());
+
+  content = Json::nullValue;
+  engine.GetRegistry().SubmitAndWait(content, new DummyJob(), 0);
+  ASSERT_EQ("world", content["hello"].asString());
+
+  JobState state;
+  ASSERT_TRUE(engine.GetRegistry().GetState(state, slow));
+  ASSERT_TRUE(state == JobState_Running || state == JobState_Pending);
+
+  ASSERT_TRUE(engine.GetRegistry().Cancel(slow));
+  engine.Stop();
+
+  std::string s;
+  metrics.ExportPrometheusText(s);
+  ASSERT_NE(std::string::npos, s.find("orthanc_jobs_queue_wait_ms"));
+  ASSERT_NE(std::string::npos, s.find("orthanc_jobs_step_duration_ms"));
+}
+
+
 TEST(JobsEngine, DISABLED_SequenceOfOperationsJob)
 {
   JobsEngine engine(10);
@@ -1289,6 +1698,58 @@ TEST(JobsSerialization, TrailingStep)
 }
 
 
+namespace
+{
+  // Handles two instances at each step, bypassing "HandleInstance()"
+  class BatchInstancesJob : public DummyInstancesJob
+  {
+  public:
+    virtual JobStepResult Step(const std::string& jobId) ORTHANC_OVERRIDE
+    {
+      const size_t count = std::min(static_cast<size_t>(2), GetInstancesCount() - GetPosition());
+
+      for (size_t i = 0; i < count; i++)
+      {
+        if (GetInstance(GetPosition() + i) == "nope")
+        {
+          AddFailedInstance(GetInstance(GetPosition() + i));
+        }
+      }
+
+      return AdvancePosition(count);
+    }
+  };
+}
+
+
+TEST(JobsSerialization, AdvancePosition)
+{
+  BatchInstancesJob job;
+  job.AddInstance("a");
+  job.AddInstance("nope");
+  job.AddInstance("b");
+  job.SetPermissive(true);
+
+  ASSERT_THROW(job.Step("jobId"), OrthancException);  // Not started
+
+  job.Start();
+  ASSERT_EQ(JobStepCode_Continue, job.Step("jobId").GetCode());
+  ASSERT_EQ(2u, job.GetPosition());
+  ASSERT_TRUE(job.IsFailedInstance("nope"));
+  ASSERT_FALSE(job.IsFailedInstance("a"));
+  ASSERT_FLOAT_EQ(2.0f / 3.0f, job.GetProgress());
+
+  ASSERT_EQ(JobStepCode_Success, job.Step("jobId").GetCode());
+  ASSERT_EQ(3u, job.GetPosition());
+  ASSERT_EQ(1u, job.GetFailedInstances().size());
+
+  ASSERT_THROW(job.Step("jobId"), OrthancException);  // Already done
+
+  job.Reset();
+  ASSERT_EQ(0u, job.GetPosition());
+  ASSERT_TRUE(job.GetFailedInstances().empty());
+}
+
 TEST(JobsSerialization, RemoteModalityParameters)
 {
   Json::Value s;
@@ -1436,8 +1897,34 @@ TEST(JobsSerialization, RemoteModalityParameters)
     ASSERT_EQ("hello", modality.GetLocalAet());
     ASSERT_TRUE(modality.HasTimeout());
     ASSERT_EQ(42u, modality.GetTimeout());
+    ASSERT_EQ(1u, modality.GetStoreAssociations());
   }
 
+  s = Json::nullValue;
+
+  {
+    RemoteModalityParameters modality;
+    ASSERT_EQ(1u, modality.GetStoreAssociations());
+    ASSERT_THROW(modality.SetStoreAssociations(0), OrthancException);
+    ASSERT_THROW(modality.SetStoreAssociations(33), OrthancException);
+    modality.SetStoreAssociations(32);
+    modality.SetStoreAssociations(4);
+    ASSERT_TRUE(modality.IsAdvancedFormatNeeded());
+    modality.Serialize(s, false);
+    ASSERT_EQ(Json::objectValue, s.type());
+  }
+
+  {
+    RemoteModalityParameters modality(s);
+    ASSERT_EQ(4u, modality.GetStoreAssociations());
+  }
+
+  s["StoreAssociations"] = 0;
+  ASSERT_THROW(RemoteModalityParameters m(s), OrthancException);
+
+  s["StoreAssociations"] = 1000;
+  ASSERT_THROW(RemoteModalityParameters m(s), OrthancException);
+
   {
     Json::Value t;
     t["AllowStorageCommitment"] = false;
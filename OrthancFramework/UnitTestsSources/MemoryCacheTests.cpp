@@ -360,3 +360,32 @@ TEST(MemoryStringCache, Invalidate)
   ASSERT_FALSE(c.Fetch(v, "hello"));
   ASSERT_TRUE(c.Fetch(v, "hello2"));  ASSERT_EQ("b", v);
 }
+
+
+TEST(MemoryStringCache, Statistics)
+{
+  Orthanc::MemoryStringCache c;
+  c.SetMaximumSize(2);
+
+  uint64_t hits, misses, evictions;
+  c.GetStatistics(hits, misses, evictions);
+  ASSERT_EQ(0u, hits);
+  ASSERT_EQ(0u, misses);
+  ASSERT_EQ(0u, evictions);
+
+  std::string v;
+  ASSERT_FALSE(c.Fetch(v, "hello"));
+  c.Add("hello", "a");
+  c.Add("hello2", "b");
+  ASSERT_TRUE(c.Fetch(v, "hello"));
+  ASSERT_EQ(2u, c.GetCurrentSize());
+
+  c.Add("hello3", "c");  // Recycles "hello2"
+  ASSERT_FALSE(c.Fetch(v, "hello2"));
+  ASSERT_TRUE(c.Fetch(v, "hello3"));
+
+  c.GetStatistics(hits, misses, evictions);
+  ASSERT_EQ(2u, hits);
+  ASSERT_EQ(2u, misses);
+  ASSERT_EQ(1u, evictions);
+}
@@ -90,6 +90,64 @@ TEST(HttpClient, Basic)
 #endif
 
 
+#if ORTHANC_SANDBOXED != 1
+TEST(HttpClient, ConnectionPool)
+{
+  uint64_t created, reused, created2, reused2;
+  unsigned int idle, active, idle2, active2;
+  HttpClient::GetConnectionPoolStatistics(created, reused, idle, active);
+
+  {
+    // Nothing listens on port 1, but the handle is taken from the pool anyway
+    HttpClient c;
+    c.SetUrl("http://127.0.0.1:1/");
+    c.SetTimeout(1);
+
+    std::string s;
+    ASSERT_THROW(c.Apply(s), OrthancException);
+
+    HttpClient::GetConnectionPoolStatistics(created2, reused2, idle2, active2);
+    ASSERT_EQ(active + 1u, active2);
+  }
+
+  HttpClient::GetConnectionPoolStatistics(created, reused, idle, active);
+  ASSERT_LE(1u, idle);
+
+  {
+    // Same endpoint => the idle handle is reused
+    HttpClient c;
+    c.SetUrl("http://127.0.0.1:1/hello");
+    c.SetTimeout(1);
+
+    std::string s;
+    ASSERT_THROW(c.Apply(s), OrthancException);
+  }
+
+  HttpClient::GetConnectionPoolStatistics(created2, reused2, idle2, active2);
+  ASSERT_EQ(created, created2);
+  ASSERT_EQ(reused + 1u, reused2);
+  ASSERT_EQ(idle, idle2);
+  ASSERT_EQ(active, active2);
+
+  {
+    // Other credentials => a new handle is created
+    HttpClient c;
+    c.SetUrl("http://127.0.0.1:1/");
+    c.SetCredentials("alice", "orthanc");
+    c.SetTimeout(1);
+
+    std::string s;
+    ASSERT_THROW(c.Apply(s), OrthancException);
+  }
+
+  HttpClient::GetConnectionPoolStatistics(created, reused, idle, active);
+  ASSERT_EQ(created2 + 1u, created);
+  ASSERT_EQ(reused2, reused);
+  ASSERT_EQ(idle2 + 1u, idle);
+}
+#endif
+
+
 #if (UNIT_TESTS_WITH_HTTP_CONNEXIONS == 1) && (ORTHANC_ENABLE_SSL == 1) && (ORTHANC_SANDBOXED != 1)
 
 /**
@@ -37,6 +37,8 @@
 
 #if ORTHANC_SANDBOXED != 1
 #  include "../Sources/HttpServer/FilesystemHttpSender.h"
+#  include "../Sources/HttpServer/MemoryBufferHttpSender.h"
+#  include "../Sources/MappedFileMemoryBuffer.h"
 #  include "../Sources/SystemToolbox.h"
 #endif
 
@@ -252,6 +254,31 @@ TEST(FilesystemHttpSender, Basic)
 #endif
 
 
+#if ORTHANC_SANDBOXED != 1
+TEST(MemoryBufferHttpSender, MappedFile)
+{
+  const std::string& path = "UnitTestsResults/stream";
+  const std::string s = "Hello world";
+  std::string t;
+
+  {
+    SystemToolbox::WriteFile(s, path);
+    MemoryBufferHttpSender sender(new MappedFileMemoryBuffer(path));
+    ASSERT_EQ(s.size(), sender.GetContentLength());
+    ASSERT_TRUE(ReadAllStream(t, sender));
+    ASSERT_EQ(s, t);
+  }
+
+  {
+    SystemToolbox::WriteFile("", path);
+    MemoryBufferHttpSender sender(new MappedFileMemoryBuffer(path));
+    ASSERT_TRUE(ReadAllStream(t, sender));
+    ASSERT_EQ(0u, t.size());
+  }
+}
+#endif
+
+
 #if ORTHANC_SANDBOXED != 1
 TEST(HttpStreamTranscoder, Basic)
 {
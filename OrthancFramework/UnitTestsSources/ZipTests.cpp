@@ -412,3 +412,82 @@ namespace Orthanc
     ASSERT_EQ(0u, buffer.GetPosition());
   }
 }
+
+
+TEST(ZipWriter, ParallelCompression)
+{
+  std::vector<std::string> contents;
+  for (size_t i = 0; i < 20; i++)
+  {
+    std::string s;
+
+    switch (i % 4)
+    {
+      case 0:
+        s.resize(65536 + i);
+        for (size_t j = 0; j < s.size(); j++)
+        {
+          s[j] = rand() % 256;
+        }
+        break;
+
+      case 1:
+        for (size_t j = 0; j < 1000; j++)
+        {
+          s += "Hello world " + boost::lexical_cast<std::string>(j);
+        }
+        break;
+
+      case 2:
+        break;  // Empty file
+
+      default:
+        s = "Hello " + boost::lexical_cast<std::string>(i);
+    }
+
+    contents.push_back(s);
+  }
+
+  for (int i = 0; i < 2; i++)
+  {
+    std::string memory;
+
+    {
+      Orthanc::ZipWriter w;
+      w.SetCompressionThreads(4);
+      ASSERT_EQ(4u, w.GetCompressionThreads());
+
+      w.SetMemoryOutput(memory, (i == 0) /* ZIP64? */);
+      w.Open();
+
+      for (size_t j = 0; j < contents.size(); j++)
+      {
+        w.SetCompressionLevel(j % 10);
+        w.OpenFile(("file" + boost::lexical_cast<std::string>(j)).c_str());
+
+        // Write the content in two chunks
+        const size_t half = contents[j].size() / 2;
+        w.Write(contents[j].substr(0, half));
+        w.Write(contents[j].substr(half));
+      }
+
+      ASSERT_THROW(w.SetCompressionThreads(2), Orthanc::OrthancException);
+      w.Close();
+      ASSERT_EQ(memory.size(), w.GetArchiveSize());
+    }
+
+    std::unique_ptr<ZipReader> reader(ZipReader::CreateFromMemory(memory));
+    ASSERT_EQ(contents.size(), reader->GetFilesCount());
+
+    for (size_t j = 0; j < contents.size(); j++)
+    {
+      std::string filename, content;
+      ASSERT_TRUE(reader->ReadNextFile(filename, content));
+      ASSERT_EQ("file" + boost::lexical_cast<std::string>(j), filename);
+      ASSERT_EQ(contents[j], content);
+    }
+
+    std::string filename, content;
+    ASSERT_FALSE(reader->ReadNextFile(filename, content));
+  }
+}
@@ -597,6 +597,36 @@ namespace Orthanc
       }
     }
 
+    virtual void ApplyLookupResources(std::list<std::string>& resourcesId,
+                                      std::list<std::string>* instancesId,
+                                      std::list<int64_t>& internalIds,
+                                      const std::vector<DatabaseConstraint>& lookup,
+                                      ResourceType queryLevel,
+                                      int64_t afterInternalId,
+                                      size_t limit) ORTHANC_OVERRIDE
+    {
+      throw OrthancException(ErrorCode_NotImplemented);  // Not called, as "HasKeysetPagination()" is "false"
+    }
+
+
+    virtual void AddPendingDeletion(const std::string& uuid,
+                                    FileContentType type) ORTHANC_OVERRIDE
+    {
+      throw OrthancException(ErrorCode_NotImplemented);  // Not called, as "HasPendingDeletions()" is "false"
+    }
+
+
+    virtual void GetPendingDeletions(std::map<std::string, FileContentType>& target) ORTHANC_OVERRIDE
+    {
+      throw OrthancException(ErrorCode_NotImplemented);  // Not called, as "HasPendingDeletions()" is "false"
+    }
+
+
+    virtual void RemovePendingDeletion(const std::string& uuid) ORTHANC_OVERRIDE
+    {
+      throw OrthancException(ErrorCode_NotImplemented);  // Not called, as "HasPendingDeletions()" is "false"
+    }
+
 
     virtual bool CreateInstance(IDatabaseWrapper::CreateInstanceResult& result,
                                 int64_t& instanceId,
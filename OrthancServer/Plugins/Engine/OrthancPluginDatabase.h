@@ -113,6 +113,16 @@ namespace Orthanc
       return false;  // No support for revisions in old API
     }
 
+    virtual bool HasKeysetPagination() const ORTHANC_OVERRIDE
+    {
+      return false;  // No support for keyset pagination in database plugins
+    }
+
+    virtual bool HasPendingDeletions() const ORTHANC_OVERRIDE
+    {
+      return false;  // The files are removed synchronously with database plugins
+    }
+
     void AnswerReceived(const _OrthancPluginDatabaseAnswer& answer);
   };
 }
@@ -82,6 +82,16 @@ namespace Orthanc
                          IStorageArea& storageArea) ORTHANC_OVERRIDE;    
 
     virtual bool HasRevisionsSupport() const ORTHANC_OVERRIDE;
+
+    virtual bool HasKeysetPagination() const ORTHANC_OVERRIDE
+    {
+      return false;  // No support for keyset pagination in database plugins
+    }
+
+    virtual bool HasPendingDeletions() const ORTHANC_OVERRIDE
+    {
+      return false;  // The files are removed synchronously with database plugins
+    }
   };
 }
 
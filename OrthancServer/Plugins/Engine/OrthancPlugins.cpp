@@ -2458,6 +2458,34 @@ namespace Orthanc
   }
 
 
+  bool OrthancPlugins::HasRestCallback(const UriComponents& uri)
+  {
+    RestCallbackMatcher matcher(uri);
+
+    boost::shared_lock<boost::shared_mutex> lock(pimpl_->restCallbackRegistrationMutex_);
+
+    for (PImpl::RestCallbacks::const_iterator it = pimpl_->restCallbacks_.begin(); 
+         it != pimpl_->restCallbacks_.end(); ++it)
+    {
+      if (matcher.IsMatch((*it)->GetRegularExpression()))
+      {
+        return true;
+      }
+    }
+
+    for (PImpl::ChunkedRestCallbacks::const_iterator it = pimpl_->chunkedRestCallbacks_.begin(); 
+         it != pimpl_->chunkedRestCallbacks_.end(); ++it)
+    {
+      if (matcher.IsMatch((*it)->GetRegularExpression()))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
   class OrthancPlugins::IDicomInstance : public boost::noncopyable
   {
   public:
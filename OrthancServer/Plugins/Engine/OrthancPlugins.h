@@ -262,6 +262,9 @@ namespace Orthanc
                         const void* bodyData,
                         size_t bodySize) ORTHANC_OVERRIDE;
 
+    // New in Orthanc 1.11.2
+    bool HasRestCallback(const UriComponents& uri);
+
     virtual bool InvokeService(SharedLibrary& plugin,
                                _OrthancPluginService service,
                                const void* parameters) ORTHANC_OVERRIDE;
@@ -220,6 +220,9 @@ namespace Orthanc
         case FileContentType_DicomUntilPixelData:
           return OrthancPluginContentType_DicomUntilPixelData;
 
+        case FileContentType_Thumbnail:
+          return OrthancPluginContentType_Thumbnail;
+
         default:
           return OrthancPluginContentType_Unknown;
       }
@@ -239,6 +242,9 @@ namespace Orthanc
         case OrthancPluginContentType_DicomUntilPixelData:
           return FileContentType_DicomUntilPixelData;
 
+        case OrthancPluginContentType_Thumbnail:
+          return FileContentType_Thumbnail;
+
         default:
           return FileContentType_Unknown;
       }
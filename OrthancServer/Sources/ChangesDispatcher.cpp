@@ -0,0 +1,408 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "PrecompiledHeadersServer.h"
+#include "ChangesDispatcher.h"
+
+#include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/MetricsRegistry.h"
+#include "../../OrthancFramework/Sources/OrthancException.h"
+
+#include <boost/functional/hash.hpp>
+
+
+namespace Orthanc
+{
+  class ChangesDispatcher::Worker : public boost::noncopyable
+  {
+  private:
+    struct Pending
+    {
+      ServerIndexChange*        change_;
+      boost::posix_time::ptime  time_;
+
+      Pending(ServerIndexChange* change,
+              const boost::posix_time::ptime& time) :
+        change_(change),
+        time_(time)
+      {
+      }
+    };
+
+    IServerListener&           listener_;
+    const std::string&         description_;
+    size_t                     maxQueueSize_;
+    OverflowPolicy             policy_;
+    mutable boost::mutex       mutex_;
+    boost::condition_variable  available_;
+    boost::condition_variable  room_;
+    std::deque<Pending>        queue_;
+    bool                       done_;
+    uint64_t                   dropped_;
+    boost::posix_time::ptime   current_;  // Time of the change being delivered, if any
+    boost::thread              thread_;
+
+    static void Run(Worker* that)
+    {
+      assert(that != NULL);
+
+      for (;;)
+      {
+        std::unique_ptr<ServerIndexChange> change;
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+
+          while (that->queue_.empty() &&
+                 !that->done_)
+          {
+            that->available_.wait(lock);
+          }
+
+          if (that->done_)
+          {
+            return;
+          }
+
+          change.reset(that->queue_.front().change_);
+          that->current_ = that->queue_.front().time_;
+          that->queue_.pop_front();
+          that->room_.notify_one();
+        }
+
+        SignalChange(that->listener_, that->description_, *change);
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+          that->current_ = boost::posix_time::not_a_date_time;
+        }
+      }
+    }
+
+  public:
+    Worker(IServerListener& listener,
+           const std::string& description,
+           size_t maxQueueSize,
+           OverflowPolicy policy) :
+      listener_(listener),
+      description_(description),
+      maxQueueSize_(maxQueueSize),
+      policy_(policy),
+      done_(false),
+      dropped_(0)
+    {
+      thread_ = boost::thread(Run, this);
+    }
+
+    ~Worker()
+    {
+      Stop();
+    }
+
+    // Returns the number of changes that were discarded
+    size_t Stop()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        done_ = true;
+        available_.notify_all();
+        room_.notify_all();
+      }
+
+      if (thread_.joinable())
+      {
+        thread_.join();
+      }
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      const size_t discarded = queue_.size();
+
+      for (std::deque<Pending>::iterator it = queue_.begin(); it != queue_.end(); ++it)
+      {
+        delete it->change_;
+      }
+
+      queue_.clear();
+
+      return discarded;
+    }
+
+    void Enqueue(const ServerIndexChange& change)
+    {
+      std::unique_ptr<ServerIndexChange> copy(change.Clone());
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (maxQueueSize_ != 0)
+      {
+        if (policy_ == OverflowPolicy_Block)
+        {
+          while (queue_.size() >= maxQueueSize_ &&
+                 !done_)
+          {
+            room_.wait(lock);
+          }
+        }
+        else
+        {
+          while (queue_.size() >= maxQueueSize_)
+          {
+            delete queue_.front().change_;
+            queue_.pop_front();
+            dropped_++;
+          }
+        }
+      }
+
+      if (!done_)
+      {
+        queue_.push_back(Pending(copy.release(), boost::posix_time::microsec_clock::universal_time()));
+        available_.notify_one();
+      }
+    }
+
+    size_t GetPendingCount() const
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return queue_.size() + (current_.is_not_a_date_time() ? 0 : 1);
+    }
+
+    uint64_t GetDroppedCount() const
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return dropped_;
+    }
+
+    uint64_t GetLagMilliseconds() const
+    {
+      boost::posix_time::ptime oldest;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (!current_.is_not_a_date_time())
+        {
+          oldest = current_;
+        }
+        else if (!queue_.empty())
+        {
+          oldest = queue_.front().time_;
+        }
+        else
+        {
+          return 0;
+        }
+      }
+
+      const int64_t lag = (boost::posix_time::microsec_clock::universal_time() - oldest).total_milliseconds();
+      return (lag < 0 ? 0 : static_cast<uint64_t>(lag));
+    }
+  };
+
+
+  ChangesDispatcher::ChangesDispatcher(IServerListener& listener,
+                                       const std::string& description,
+                                       unsigned int threadsCount,
+                                       size_t maxQueueSize,
+                                       OverflowPolicy policy) :
+    listener_(listener),
+    description_(description)
+  {
+    if (threadsCount == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    LOG(INFO) << "Starting " << threadsCount << " thread(s) to signal the changes to the "
+              << description << " listener";
+
+    workers_.resize(threadsCount);
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      workers_[i] = new Worker(listener_, description_, maxQueueSize, policy);
+    }
+  }
+
+
+  ChangesDispatcher::~ChangesDispatcher()
+  {
+    Stop();
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      assert(workers_[i] != NULL);
+      delete workers_[i];
+    }
+  }
+
+
+  void ChangesDispatcher::Stop()
+  {
+    size_t discarded = 0;
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      assert(workers_[i] != NULL);
+      discarded += workers_[i]->Stop();
+    }
+
+    if (discarded != 0)
+    {
+      LOG(WARNING) << "Discarding " << discarded << " change(s) that were not delivered yet to the "
+                   << description_ << " listener";
+    }
+  }
+
+
+  void ChangesDispatcher::Enqueue(const ServerIndexChange& change)
+  {
+    assert(!workers_.empty());
+
+    // The changes of one resource are always handled by the same
+    // worker, which preserves their order
+    const size_t index = boost::hash<std::string>()(change.GetPublicId()) % workers_.size();
+
+    assert(workers_[index] != NULL);
+    workers_[index]->Enqueue(change);
+  }
+
+
+  size_t ChangesDispatcher::GetPendingCount() const
+  {
+    size_t count = 0;
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      assert(workers_[i] != NULL);
+      count += workers_[i]->GetPendingCount();
+    }
+
+    return count;
+  }
+
+
+  uint64_t ChangesDispatcher::GetDroppedCount() const
+  {
+    uint64_t count = 0;
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      assert(workers_[i] != NULL);
+      count += workers_[i]->GetDroppedCount();
+    }
+
+    return count;
+  }
+
+
+  uint64_t ChangesDispatcher::GetLagMilliseconds() const
+  {
+    uint64_t lag = 0;
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      assert(workers_[i] != NULL);
+      lag = std::max(lag, workers_[i]->GetLagMilliseconds());
+    }
+
+    return lag;
+  }
+
+
+  void ChangesDispatcher::PublishMetrics(MetricsRegistry& registry) const
+  {
+    // For instance, "rendered cache" gives "orthanc_changes_rendered_cache_lag_ms"
+    std::string name = "orthanc_changes_";
+
+    for (size_t i = 0; i < description_.size(); i++)
+    {
+      const char c = description_[i];
+      if ((c >= 'a' && c <= 'z') ||
+          (c >= '0' && c <= '9'))
+      {
+        name.push_back(c);
+      }
+      else if (c >= 'A' && c <= 'Z')
+      {
+        name.push_back(c - 'A' + 'a');
+      }
+      else
+      {
+        name.push_back('_');
+      }
+    }
+
+    registry.SetValue(name + "_pending", static_cast<float>(GetPendingCount()));
+    registry.SetValue(name + "_dropped", static_cast<float>(GetDroppedCount()));
+    registry.SetValue(name + "_lag_ms", static_cast<float>(GetLagMilliseconds()));
+  }
+
+
+  void ChangesDispatcher::SignalChange(IServerListener& listener,
+                                       const std::string& description,
+                                       const ServerIndexChange& change)
+  {
+    try
+    {
+      try
+      {
+        listener.SignalChange(change);
+      }
+      catch (std::bad_alloc&)
+      {
+        LOG(ERROR) << "Not enough memory while signaling a change";
+      }
+      catch (...)
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+    }
+    catch (OrthancException& e)
+    {
+      LOG(ERROR) << "Error in the " << description
+                 << " callback while signaling a change: " << e.What()
+                 << " (code " << e.GetErrorCode() << ")";
+    }
+  }
+
+
+  ChangesDispatcher::OverflowPolicy ChangesDispatcher::StringToOverflowPolicy(const std::string& value)
+  {
+    if (value == "Block")
+    {
+      return OverflowPolicy_Block;
+    }
+    else if (value == "Drop")
+    {
+      return OverflowPolicy_DropOldest;
+    }
+    else
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "Unknown policy for the overflow of the queues of changes "
+                             "(must be \"Block\" or \"Drop\"): " + value);
+    }
+  }
+}
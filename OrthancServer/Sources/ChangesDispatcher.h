@@ -0,0 +1,102 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "IServerListener.h"
+
+#include <boost/thread.hpp>
+#include <deque>
+
+namespace Orthanc
+{
+  class MetricsRegistry;
+
+  /**
+   * Delivers the changes to one server listener (Lua, plugins...)
+   * from dedicated worker threads, so that a slow listener does not
+   * delay the other ones (new in Orthanc 1.11.2). The changes are
+   * split between the workers according to the identifier of their
+   * resource, which preserves the order of the changes of each
+   * resource. Each worker has a bounded queue.
+   **/
+  class ChangesDispatcher : public boost::noncopyable
+  {
+  public:
+    enum OverflowPolicy
+    {
+      OverflowPolicy_Block,       // Wait for the listener to catch up
+      OverflowPolicy_DropOldest   // Discard the oldest pending change
+    };
+
+  private:
+    class Worker;
+
+    IServerListener&       listener_;
+    std::string            description_;
+    std::vector<Worker*>   workers_;
+
+  public:
+    // "maxQueueSize == 0" means that the queues are unbounded
+    ChangesDispatcher(IServerListener& listener,
+                      const std::string& description,
+                      unsigned int threadsCount,
+                      size_t maxQueueSize,
+                      OverflowPolicy policy);
+
+    ~ChangesDispatcher();
+
+    IServerListener& GetListener() const
+    {
+      return listener_;
+    }
+
+    const std::string& GetDescription() const
+    {
+      return description_;
+    }
+
+    // Waits for the current callbacks to complete, then discards the
+    // pending changes (a warning gives their number) and the changes
+    // that are enqueued afterwards
+    void Stop();
+
+    void Enqueue(const ServerIndexChange& change);
+
+    size_t GetPendingCount() const;
+
+    uint64_t GetDroppedCount() const;
+
+    // Age of the oldest change that has not been delivered yet
+    uint64_t GetLagMilliseconds() const;
+
+    void PublishMetrics(MetricsRegistry& registry) const;
+
+    // Logs the errors of the listener, as the caller cannot report them
+    static void SignalChange(IServerListener& listener,
+                             const std::string& description,
+                             const ServerIndexChange& change);
+
+    static OverflowPolicy StringToOverflowPolicy(const std::string& value);
+  };
+}
@@ -235,6 +235,35 @@ namespace Orthanc
                                            ResourceType& type,
                                            std::string& parentPublicId,
                                            const std::string& publicId) = 0;
+
+
+      /**
+       * Primitives introduced in Orthanc 1.11.2
+       **/
+
+      // Keyset pagination: Only report the resources whose internal
+      // ID is strictly greater than "afterInternalId", by increasing
+      // internal ID. The internal IDs of the reported resources are
+      // stored in "internalIds", so that the caller can resume the
+      // lookup. Only called if "HasKeysetPagination()" is "true".
+      virtual void ApplyLookupResources(std::list<std::string>& resourcesId,
+                                        std::list<std::string>* instancesId, // Can be NULL if not needed
+                                        std::list<int64_t>& internalIds,
+                                        const std::vector<DatabaseConstraint>& lookup,
+                                        ResourceType queryLevel,
+                                        int64_t afterInternalId,
+                                        size_t limit) = 0;
+
+      // Persistent queue of the attachments whose files are still to
+      // be removed from the storage area. The queue is filled in the
+      // same transaction as the one that deletes the attachments. Only
+      // called if "HasPendingDeletions()" is "true".
+      virtual void AddPendingDeletion(const std::string& uuid,
+                                      FileContentType type) = 0;
+
+      virtual void GetPendingDeletions(std::map<std::string, FileContentType>& target) = 0;
+
+      virtual void RemovePendingDeletion(const std::string& uuid) = 0;
     };
 
 
@@ -259,5 +288,9 @@ namespace Orthanc
                          IStorageArea& storageArea) = 0;
 
     virtual bool HasRevisionsSupport() const = 0;
+
+    virtual bool HasKeysetPagination() const = 0;  // New in Orthanc 1.11.2
+
+    virtual bool HasPendingDeletions() const = 0;  // New in Orthanc 1.11.2
   };
 }
@@ -0,0 +1,61 @@
+-- Orthanc - A Lightweight, RESTful DICOM Store
+-- Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+-- Department, University Hospital of Liege, Belgium
+-- Copyright (C) 2017-2022 Osimis S.A., Belgium
+-- Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+--
+-- This program is free software: you can redistribute it and/or
+-- modify it under the terms of the GNU General Public License as
+-- published by the Free Software Foundation, either version 3 of the
+-- License, or (at your option) any later version.
+-- 
+-- This program is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+-- General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+-- This file was added in Orthanc 1.11.2. The "IndexedMainDicomTags"
+-- table contains a copy of the values of the main DICOM tags that are
+-- listed in the "IndexedMainDicomTags" configuration option. Contrarily
+-- to the "MainDicomTags" table, it is indexed by tag and by value, which
+-- allows the range and prefix lookups over such tags to avoid a full scan.
+
+-- The copy is maintained by triggers, so that it stays consistent even
+-- if the database is written by a version of Orthanc that does not know
+-- about these tables. The tags to be copied are listed in the table
+-- "IndexedMainDicomTagsList".
+
+CREATE TABLE IndexedMainDicomTagsList(
+       tagGroup INTEGER,
+       tagElement INTEGER,
+       PRIMARY KEY(tagGroup, tagElement)
+       );
+
+CREATE TABLE IndexedMainDicomTags(
+       id INTEGER REFERENCES Resources(internalId) ON DELETE CASCADE,
+       tagGroup INTEGER,
+       tagElement INTEGER,
+       value TEXT,
+       PRIMARY KEY(id, tagGroup, tagElement)
+       );
+
+CREATE INDEX IndexedMainDicomTagsIndexValues ON IndexedMainDicomTags(tagGroup, tagElement, value COLLATE BINARY);
+
+CREATE TRIGGER IndexedMainDicomTagsAdded
+AFTER INSERT ON MainDicomTags
+WHEN EXISTS (SELECT 1 FROM IndexedMainDicomTagsList
+             WHERE tagGroup = new.tagGroup AND tagElement = new.tagElement)
+BEGIN
+  INSERT OR REPLACE INTO IndexedMainDicomTags VALUES (new.id, new.tagGroup, new.tagElement, new.value);
+END;
+
+CREATE TRIGGER IndexedMainDicomTagsDeleted
+AFTER DELETE ON MainDicomTags
+BEGIN
+  DELETE FROM IndexedMainDicomTags
+  WHERE id = old.id AND tagGroup = old.tagGroup AND tagElement = old.tagElement;
+END;
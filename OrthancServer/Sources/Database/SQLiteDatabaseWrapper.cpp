@@ -38,15 +38,22 @@
 
 #include <stdio.h>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 namespace Orthanc
 {  
   class SQLiteDatabaseWrapper::LookupFormatter : public ISqlLookupFormatter
   {
   private:
-    std::list<std::string>  values_;
+    std::list<std::string>         values_;
+    const std::set<DicomTag>&      indexedMainDicomTags_;
 
   public:
+    explicit LookupFormatter(const std::set<DicomTag>& indexedMainDicomTags) :
+      indexedMainDicomTags_(indexedMainDicomTags)
+    {
+    }
+
     virtual std::string GenerateParameter(const std::string& value) ORTHANC_OVERRIDE
     {
       values_.push_back(value);
@@ -68,6 +75,11 @@ namespace Orthanc
       return false;
     }
 
+    virtual bool IsIndexedMainDicomTag(const DicomTag& tag) const ORTHANC_OVERRIDE
+    {
+      return indexedMainDicomTags_.find(tag) != indexedMainDicomTags_.end();
+    }
+
     void Bind(SQLite::Statement& statement) const
     {
       size_t pos = 0;
@@ -153,10 +165,16 @@ namespace Orthanc
   private:
     void AnswerLookup(std::list<std::string>& resourcesId,
                       std::list<std::string>& instancesId,
+                      std::list<int64_t>* internalIds,  // Can be NULL if not needed
                       ResourceType level)
     {
       resourcesId.clear();
       instancesId.clear();
+
+      if (internalIds != NULL)
+      {
+        internalIds->clear();
+      }
     
       std::unique_ptr<SQLite::Statement> statement;
     
@@ -167,11 +185,11 @@ namespace Orthanc
           statement.reset(
             new SQLite::Statement(
               db_, SQLITE_FROM_HERE,
-              "SELECT patients.publicId, instances.publicID FROM Lookup AS patients "
+              "SELECT patients.publicId, instances.publicID, patients.internalId FROM Lookup AS patients "
               "INNER JOIN Resources studies ON patients.internalId=studies.parentId "
               "INNER JOIN Resources series ON studies.internalId=series.parentId "
               "INNER JOIN Resources instances ON series.internalId=instances.parentId "
-              "GROUP BY patients.publicId"));
+              "GROUP BY patients.publicId ORDER BY patients.internalId"));
       
           break;
         }
@@ -181,10 +199,10 @@ namespace Orthanc
           statement.reset(
             new SQLite::Statement(
               db_, SQLITE_FROM_HERE,
-              "SELECT studies.publicId, instances.publicID FROM Lookup AS studies "
+              "SELECT studies.publicId, instances.publicID, studies.internalId FROM Lookup AS studies "
               "INNER JOIN Resources series ON studies.internalId=series.parentId "
               "INNER JOIN Resources instances ON series.internalId=instances.parentId "
-              "GROUP BY studies.publicId"));
+              "GROUP BY studies.publicId ORDER BY studies.internalId"));
       
           break;
         }
@@ -194,9 +212,9 @@ namespace Orthanc
           statement.reset(
             new SQLite::Statement(
               db_, SQLITE_FROM_HERE,
-              "SELECT series.publicId, instances.publicID FROM Lookup AS series "
+              "SELECT series.publicId, instances.publicID, series.internalId FROM Lookup AS series "
               "INNER JOIN Resources instances ON series.internalId=instances.parentId "
-              "GROUP BY series.publicId"));
+              "GROUP BY series.publicId ORDER BY series.internalId"));
       
           break;
         }
@@ -205,7 +223,7 @@ namespace Orthanc
         {
           statement.reset(
             new SQLite::Statement(
-              db_, SQLITE_FROM_HERE, "SELECT publicId, publicId FROM Lookup"));
+              db_, SQLITE_FROM_HERE, "SELECT publicId, publicId, internalId FROM Lookup ORDER BY internalId"));
         
           break;
         }
@@ -220,6 +238,11 @@ namespace Orthanc
       {
         resourcesId.push_back(statement->ColumnString(0));
         instancesId.push_back(statement->ColumnString(1));
+
+        if (internalIds != NULL)
+        {
+          internalIds->push_back(statement->ColumnInt64(2));
+        }
       }
     }
 
@@ -297,19 +320,34 @@ namespace Orthanc
       }
     }
 
-    boost::mutex::scoped_lock  lock_;
-    IDatabaseListener&         listener_;
-    SignalRemainingAncestor&   signalRemainingAncestor_;
+    boost::unique_lock<boost::mutex>  lock_;
+    IDatabaseListener&                listener_;
+    SignalRemainingAncestor&          signalRemainingAncestor_;
+    const std::set<DicomTag>&         indexedMainDicomTags_;
 
   public:
     TransactionBase(boost::mutex& mutex,
                     SQLite::Connection& db,
                     IDatabaseListener& listener,
-                    SignalRemainingAncestor& signalRemainingAncestor) :
+                    SignalRemainingAncestor& signalRemainingAncestor,
+                    const std::set<DicomTag>& indexedMainDicomTags) :
       UnitTestsTransaction(db),
       lock_(mutex),
       listener_(listener),
-      signalRemainingAncestor_(signalRemainingAncestor)
+      signalRemainingAncestor_(signalRemainingAncestor),
+      indexedMainDicomTags_(indexedMainDicomTags)
+    {
+    }
+
+    // For connections that are not shared with other threads (new in Orthanc 1.11.2)
+    TransactionBase(SQLite::Connection& db,
+                    IDatabaseListener& listener,
+                    SignalRemainingAncestor& signalRemainingAncestor,
+                    const std::set<DicomTag>& indexedMainDicomTags) :
+      UnitTestsTransaction(db),
+      listener_(listener),
+      signalRemainingAncestor_(signalRemainingAncestor),
+      indexedMainDicomTags_(indexedMainDicomTags)
     {
     }
 
@@ -337,18 +375,14 @@ namespace Orthanc
     }
 
 
-    virtual void ApplyLookupResources(std::list<std::string>& resourcesId,
-                                      std::list<std::string>* instancesId,
-                                      const std::vector<DatabaseConstraint>& lookup,
-                                      ResourceType queryLevel,
-                                      size_t limit) ORTHANC_OVERRIDE
+    void ApplyLookupInternal(std::list<std::string>& resourcesId,
+                             std::list<std::string>* instancesId,
+                             std::list<int64_t>* internalIds,  // Can be NULL if not needed
+                             ResourceType queryLevel,
+                             const LookupFormatter& formatter,
+                             const std::string& lookupSql)
     {
-      LookupFormatter formatter;
-
-      std::string sql;
-      LookupFormatter::Apply(sql, formatter, lookup, queryLevel, limit);
-
-      sql = "CREATE TEMPORARY TABLE Lookup AS " + sql;
+      const std::string sql = "CREATE TEMPORARY TABLE Lookup AS " + lookupSql;
     
       {
         SQLite::Statement s(db_, SQLITE_FROM_HERE, "DROP TABLE IF EXISTS Lookup");
@@ -363,22 +397,94 @@ namespace Orthanc
 
       if (instancesId != NULL)
       {
-        AnswerLookup(resourcesId, *instancesId, queryLevel);
+        AnswerLookup(resourcesId, *instancesId, internalIds, queryLevel);
       }
       else
       {
         resourcesId.clear();
+
+        if (internalIds != NULL)
+        {
+          internalIds->clear();
+        }
     
-        SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT publicId FROM Lookup");
+        SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT publicId, internalId FROM Lookup ORDER BY internalId");
         
         while (s.Step())
         {
           resourcesId.push_back(s.ColumnString(0));
+
+          if (internalIds != NULL)
+          {
+            internalIds->push_back(s.ColumnInt64(1));
+          }
         }
       }
     }
 
 
+    virtual void ApplyLookupResources(std::list<std::string>& resourcesId,
+                                      std::list<std::string>* instancesId,
+                                      const std::vector<DatabaseConstraint>& lookup,
+                                      ResourceType queryLevel,
+                                      size_t limit) ORTHANC_OVERRIDE
+    {
+      LookupFormatter formatter(indexedMainDicomTags_);
+
+      std::string sql;
+      LookupFormatter::Apply(sql, formatter, lookup, queryLevel, limit);
+
+      ApplyLookupInternal(resourcesId, instancesId, NULL, queryLevel, formatter, sql);
+    }
+
+
+    virtual void ApplyLookupResources(std::list<std::string>& resourcesId,
+                                      std::list<std::string>* instancesId,
+                                      std::list<int64_t>& internalIds,
+                                      const std::vector<DatabaseConstraint>& lookup,
+                                      ResourceType queryLevel,
+                                      int64_t afterInternalId,
+                                      size_t limit) ORTHANC_OVERRIDE
+    {
+      LookupFormatter formatter(indexedMainDicomTags_);
+
+      std::string sql;
+      LookupFormatter::Apply(sql, formatter, lookup, queryLevel, afterInternalId, limit);
+
+      ApplyLookupInternal(resourcesId, instancesId, &internalIds, queryLevel, formatter, sql);
+    }
+
+
+    virtual void AddPendingDeletion(const std::string& uuid,
+                                    FileContentType type) ORTHANC_OVERRIDE
+    {
+      SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT OR IGNORE INTO PendingDeletions VALUES(?, ?)");
+      s.BindString(0, uuid);
+      s.BindInt(1, type);
+      s.Run();
+    }
+
+
+    virtual void GetPendingDeletions(std::map<std::string, FileContentType>& target) ORTHANC_OVERRIDE
+    {
+      target.clear();
+
+      SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT uuid, fileType FROM PendingDeletions");
+      while (s.Step())
+      {
+        target[s.ColumnString(0)] = static_cast<FileContentType>(s.ColumnInt(1));
+      }
+    }
+
+
+    virtual void RemovePendingDeletion(const std::string& uuid) ORTHANC_OVERRIDE
+    {
+      SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM PendingDeletions WHERE uuid=?");
+      s.BindString(0, uuid);
+      s.Run();
+    }
+
+
     // From the "ICreateInstance" interface
     virtual void AttachChild(int64_t parent,
                              int64_t child) ORTHANC_OVERRIDE
@@ -1022,12 +1128,16 @@ namespace Orthanc
                                  const DicomTag& tag,
                                  const std::string& value) ORTHANC_OVERRIDE
     {
-      SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT INTO MainDicomTags VALUES(?, ?, ?, ?)");
-      s.BindInt64(0, id);
-      s.BindInt(1, tag.GetGroup());
-      s.BindInt(2, tag.GetElement());
-      s.BindString(3, value);
-      s.Run();
+      {
+        SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT INTO MainDicomTags VALUES(?, ?, ?, ?)");
+        s.BindInt64(0, id);
+        s.BindInt(1, tag.GetGroup());
+        s.BindInt(2, tag.GetElement());
+        s.BindString(3, value);
+        s.Run();
+      }
+
+      // The "IndexedMainDicomTags" table is updated by a SQLite trigger
     }
 
 
@@ -1174,7 +1284,7 @@ namespace Orthanc
   public:
     ReadWriteTransaction(SQLiteDatabaseWrapper& that,
                          IDatabaseListener& listener) :
-      TransactionBase(that.mutex_, that.db_, listener, *that.signalRemainingAncestor_),
+      TransactionBase(that.mutex_, that.db_, listener, *that.signalRemainingAncestor_, that.indexedMainDicomTags_),
       that_(that),
       transaction_(new SQLite::Transaction(that_.db_))
     {
@@ -1228,7 +1338,7 @@ namespace Orthanc
   public:
     ReadOnlyTransaction(SQLiteDatabaseWrapper& that,
                         IDatabaseListener& listener) :
-      TransactionBase(that.mutex_, that.db_, listener, *that.signalRemainingAncestor_),
+      TransactionBase(that.mutex_, that.db_, listener, *that.signalRemainingAncestor_, that.indexedMainDicomTags_),
       that_(that)
     {
       if (that_.activeTransaction_ != NULL)
@@ -1259,10 +1369,163 @@ namespace Orthanc
   };
   
 
+  class SQLiteDatabaseWrapper::ReadConnectionsPool : public boost::noncopyable
+  {
+  private:
+    boost::mutex                      mutex_;
+    boost::condition_variable         available_;
+    std::vector<SQLite::Connection*>  connections_;
+    std::vector<SQLite::Connection*>  free_;
+
+    void Clear()
+    {
+      for (size_t i = 0; i < connections_.size(); i++)
+      {
+        assert(connections_[i] != NULL);
+        delete connections_[i];
+      }
+
+      connections_.clear();
+      free_.clear();
+    }
+
+  public:
+    ReadConnectionsPool(const std::string& path,
+                        unsigned int count)
+    {
+      try
+      {
+        for (unsigned int i = 0; i < count; i++)
+        {
+          std::unique_ptr<SQLite::Connection> connection(new SQLite::Connection);
+          connection->Open(path);
+          connection->Execute("PRAGMA case_sensitive_like = true;");
+
+          // Wait instead of failing if the writer is holding an
+          // exclusive lock (e.g. while recovering the WAL)
+          connection->Execute("PRAGMA busy_timeout = 5000;");
+
+          connections_.push_back(connection.release());
+        }
+      }
+      catch (OrthancException&)
+      {
+        Clear();
+        throw;
+      }
+
+      free_ = connections_;
+    }
+
+    ~ReadConnectionsPool()
+    {
+      if (free_.size() != connections_.size())
+      {
+        LOG(ERROR) << "Some SQLite read transactions are still active while closing the database: Expect a crash";
+      }
+
+      Clear();
+    }
+
+    SQLite::Connection& Acquire()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (free_.empty())
+      {
+        available_.wait(lock);
+      }
+
+      SQLite::Connection* connection = free_.back();
+      free_.pop_back();
+
+      assert(connection != NULL);
+      return *connection;
+    }
+
+    void Release(SQLite::Connection& connection)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        free_.push_back(&connection);
+      }
+
+      available_.notify_one();
+    }
+  };
+
+
+  class SQLiteDatabaseWrapper::PooledReadOnlyTransaction : public SQLiteDatabaseWrapper::TransactionBase
+  {
+  private:
+    ReadConnectionsPool&  pool_;
+    SQLite::Connection&   connection_;
+    SQLite::Transaction   transaction_;
+
+  public:
+    // The connection must have been acquired from the pool, and is
+    // given back to the pool by the destructor
+    PooledReadOnlyTransaction(ReadConnectionsPool& pool,
+                              SQLite::Connection& connection,
+                              IDatabaseListener& listener,
+                              SignalRemainingAncestor& signalRemainingAncestor,
+                              const std::set<DicomTag>& indexedMainDicomTags) :
+      TransactionBase(connection, listener, signalRemainingAncestor, indexedMainDicomTags),
+      pool_(pool),
+      connection_(connection),
+      transaction_(connection)
+    {
+      // The explicit transaction provides the same snapshot of the
+      // database to all the statements of this read-only transaction
+      transaction_.Begin();
+    }
+
+    virtual ~PooledReadOnlyTransaction()
+    {
+      if (transaction_.IsOpen())
+      {
+        try
+        {
+          transaction_.Rollback();
+        }
+        catch (OrthancException& e)
+        {
+          LOG(ERROR) << "Cannot end a SQLite read transaction: " << e.What();
+        }
+      }
+
+      pool_.Release(connection_);
+    }
+
+    virtual void Rollback() ORTHANC_OVERRIDE
+    {
+      if (transaction_.IsOpen())
+      {
+        transaction_.Rollback();
+      }
+    }
+
+    virtual void Commit(int64_t fileSizeDelta /* only used in debug */) ORTHANC_OVERRIDE
+    {
+      if (fileSizeDelta != 0)
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      if (transaction_.IsOpen())
+      {
+        transaction_.Commit();
+      }
+    }
+  };
+  
+
   SQLiteDatabaseWrapper::SQLiteDatabaseWrapper(const std::string& path) : 
     activeTransaction_(NULL), 
     signalRemainingAncestor_(NULL),
-    version_(0)
+    version_(0),
+    path_(path),
+    readConnectionsCount_(0)
   {
     db_.Open(path);
   }
@@ -1271,7 +1534,8 @@ namespace Orthanc
   SQLiteDatabaseWrapper::SQLiteDatabaseWrapper() : 
     activeTransaction_(NULL), 
     signalRemainingAncestor_(NULL),
-    version_(0)
+    version_(0),
+    readConnectionsCount_(0)
   {
     db_.OpenInMemory();
   }
@@ -1285,6 +1549,48 @@ namespace Orthanc
   }
 
 
+  void SQLiteDatabaseWrapper::SetIndexedMainDicomTags(const std::set<DicomTag>& tags)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (signalRemainingAncestor_ != NULL)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls, "The database is already opened");
+    }
+
+    for (std::set<DicomTag>::const_iterator it = tags.begin(); it != tags.end(); ++it)
+    {
+      if (!DicomMap::IsMainDicomTag(*it))
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange, "Not a main DICOM tag: " + it->Format());
+      }
+    }
+
+    indexedMainDicomTags_ = tags;
+  }
+
+
+  void SQLiteDatabaseWrapper::SetReadConnectionsCount(unsigned int count)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (signalRemainingAncestor_ != NULL)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls, "The database is already opened");
+    }
+    else if (count != 0 &&
+             path_.empty())
+    {
+      LOG(WARNING) << "Read connections are not available for in-memory SQLite databases";
+      readConnectionsCount_ = 0;
+    }
+    else
+    {
+      readConnectionsCount_ = count;
+    }
+  }
+
+
   void SQLiteDatabaseWrapper::Open()
   {
     {
@@ -1305,7 +1611,19 @@ namespace Orthanc
       // http://www.sqlite.org/pragma.html
       db_.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
       db_.Execute("PRAGMA JOURNAL_MODE=WAL;");
-      db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+
+      if (readConnectionsCount_ == 0)
+      {
+        db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+      }
+      else
+      {
+        // The exclusive locking mode would prevent the read
+        // connections from accessing the WAL (new in Orthanc 1.11.2)
+        db_.Execute("PRAGMA LOCKING_MODE=NORMAL;");
+        db_.Execute("PRAGMA busy_timeout = 5000;");
+      }
+
       db_.Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
       //db_.Execute("PRAGMA TEMP_STORE=memory");
 
@@ -1363,14 +1681,111 @@ namespace Orthanc
         }
       }
 
+      // New in Orthanc 1.11.2
+      if (!db_.DoesTableExist("IndexedMainDicomTagsList"))
+      {
+        LOG(INFO) << "Installing the SQLite table of the indexed main DICOM tags";
+        std::string query;
+        ServerResources::GetFileResource(query, ServerResources::INSTALL_INDEXED_MAIN_DICOM_TAGS);
+        db_.Execute(query);
+      }
+
+      // New in Orthanc 1.11.2
+      if (!db_.DoesTableExist("PendingDeletions"))
+      {
+        LOG(INFO) << "Installing the SQLite table of the pending deletions";
+        db_.Execute("CREATE TABLE PendingDeletions(uuid TEXT PRIMARY KEY, fileType INTEGER);");
+      }
+
+      std::set<DicomTag> previousTags;
+
+      {
+        SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT tagGroup, tagElement FROM IndexedMainDicomTagsList");
+        while (s.Step())
+        {
+          previousTags.insert(DicomTag(s.ColumnInt(0), s.ColumnInt(1)));
+        }
+      }
+
+      if (previousTags != indexedMainDicomTags_)
+      {
+        // The configuration has changed since the last execution:
+        // Copy the values of the indexed tags from "MainDicomTags"
+        if (indexedMainDicomTags_.empty())
+        {
+          LOG(WARNING) << "Removing the index of the main DICOM tags from the SQLite database";
+        }
+        else
+        {
+          std::string indexedTags;
+          for (std::set<DicomTag>::const_iterator it = indexedMainDicomTags_.begin();
+               it != indexedMainDicomTags_.end(); ++it)
+          {
+            if (!indexedTags.empty())
+            {
+              indexedTags += ";";
+            }
+
+            indexedTags += it->Format();
+          }
+
+          LOG(WARNING) << "Indexing the values of the main DICOM tags [" << indexedTags
+                       << "] in the SQLite database, this might take some time";
+        }
+
+        SQLite::Transaction reindex(db_);
+        reindex.Begin();
+
+        {
+          SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM IndexedMainDicomTagsList");
+          s.Run();
+        }
+
+        {
+          SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM IndexedMainDicomTags");
+          s.Run();
+        }
+
+        for (std::set<DicomTag>::const_iterator it = indexedMainDicomTags_.begin();
+             it != indexedMainDicomTags_.end(); ++it)
+        {
+          {
+            SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT INTO IndexedMainDicomTagsList VALUES(?, ?)");
+            s.BindInt(0, it->GetGroup());
+            s.BindInt(1, it->GetElement());
+            s.Run();
+          }
+
+          {
+            SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT INTO IndexedMainDicomTags "
+                                "SELECT id, tagGroup, tagElement, value FROM MainDicomTags "
+                                "WHERE tagGroup=? AND tagElement=?");
+            s.BindInt(0, it->GetGroup());
+            s.BindInt(1, it->GetElement());
+            s.Run();
+          }
+        }
+
+        reindex.Commit();
+      }
+
       transaction->Commit(0);
     }
+
+    if (readConnectionsCount_ != 0)
+    {
+      // The read connections are opened once the schema of the database is created
+      boost::mutex::scoped_lock lock(mutex_);
+      readConnections_.reset(new ReadConnectionsPool(path_, readConnectionsCount_));
+      LOG(WARNING) << "Number of read connections to the SQLite database: " << readConnectionsCount_;
+    }
   }
 
 
   void SQLiteDatabaseWrapper::Close()
   {
     boost::mutex::scoped_lock lock(mutex_);
+    readConnections_.reset(NULL);
     db_.Close();
   }
 
@@ -1451,7 +1866,26 @@ namespace Orthanc
     switch (type)
     {
       case TransactionType_ReadOnly:
-        return new ReadOnlyTransaction(*this, listener);  // This is a no-op transaction in SQLite (thanks to mutex)
+        if (readConnections_.get() == NULL)
+        {
+          return new ReadOnlyTransaction(*this, listener);  // This is a no-op transaction in SQLite (thanks to mutex)
+        }
+        else
+        {
+          // Blocks until one of the read connections is available (new in Orthanc 1.11.2)
+          SQLite::Connection& connection = readConnections_->Acquire();
+
+          try
+          {
+            return new PooledReadOnlyTransaction(*readConnections_, connection, listener,
+                                                 *signalRemainingAncestor_, indexedMainDicomTags_);
+          }
+          catch (OrthancException&)
+          {
+            readConnections_->Release(connection);
+            throw;
+          }
+        }
 
       case TransactionType_ReadWrite:
       {
@@ -24,6 +24,7 @@
 
 #include "IDatabaseWrapper.h"
 
+#include "../../../OrthancFramework/Sources/Compatibility.h"
 #include "../../../OrthancFramework/Sources/SQLite/Connection.h"
 
 #include <boost/thread/mutex.hpp>
@@ -34,6 +35,12 @@ namespace Orthanc
    * This class manages an instance of the Orthanc SQLite database. It
    * translates low-level requests into SQL statements. Mutual
    * exclusion MUST be implemented at a higher level.
+   *
+   * If read connections are enabled (new in Orthanc 1.11.2), the
+   * read-only transactions are executed on a pool of separate
+   * connections to the same database file. Thanks to the WAL
+   * journal, they run concurrently with each other and with the
+   * single read-write transaction.
    **/
   class SQLiteDatabaseWrapper : public IDatabaseWrapper
   {
@@ -45,12 +52,18 @@ namespace Orthanc
     class ReadOnlyTransaction;
     class ReadWriteTransaction;
     class LookupFormatter;
+    class ReadConnectionsPool;
+    class PooledReadOnlyTransaction;
 
     boost::mutex              mutex_;
     SQLite::Connection        db_;
     TransactionBase*          activeTransaction_;
     SignalRemainingAncestor*  signalRemainingAncestor_;
     unsigned int              version_;
+    std::string               path_;  // Empty for in-memory databases
+    unsigned int              readConnectionsCount_;
+    std::unique_ptr<ReadConnectionsPool>  readConnections_;
+    std::set<DicomTag>        indexedMainDicomTags_;
 
     void GetChangesInternal(std::list<ServerIndexChange>& target,
                             bool& done,
@@ -69,6 +82,24 @@ namespace Orthanc
 
     virtual ~SQLiteDatabaseWrapper();
 
+    // Must be called before "Open()". A value of "0" means that all
+    // the transactions share the same connection (new in Orthanc 1.11.2).
+    void SetReadConnectionsCount(unsigned int count);
+
+    unsigned int GetReadConnectionsCount() const
+    {
+      return readConnectionsCount_;
+    }
+
+    // Must be called before "Open()". The values of these main DICOM
+    // tags are indexed to speed up the lookups (new in Orthanc 1.11.2).
+    void SetIndexedMainDicomTags(const std::set<DicomTag>& tags);
+
+    const std::set<DicomTag>& GetIndexedMainDicomTags() const
+    {
+      return indexedMainDicomTags_;
+    }
+
     virtual void Open() ORTHANC_OVERRIDE;
 
     virtual void Close() ORTHANC_OVERRIDE;
@@ -97,6 +128,16 @@ namespace Orthanc
       return false;  // TODO - REVISIONS
     }
 
+    virtual bool HasKeysetPagination() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual bool HasPendingDeletions() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
 
     /**
      * The "StartTransaction()" method is guaranteed to return a class
@@ -30,6 +30,7 @@
 #include "../../../OrthancFramework/Sources/DicomParsing/FromDcmtkBridge.h"
 #include "../../../OrthancFramework/Sources/DicomParsing/ParsedDicomFile.h"
 #include "../../../OrthancFramework/Sources/Logging.h"
+#include "../../../OrthancFramework/Sources/MultiThreading/LeaderFollowersQueue.h"
 #include "../../../OrthancFramework/Sources/OrthancException.h"
 #include "../OrthancConfiguration.h"
 #include "../Search/DatabaseLookup.h"
@@ -37,6 +38,7 @@
 #include "../ServerToolbox.h"
 #include "ResourcesContent.h"
 
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
@@ -299,6 +301,125 @@ namespace Orthanc
   }
 
 
+  /**
+   * Group commit (new in Orthanc 1.11.2). The concurrent write
+   * operations that are submitted within a small time window are
+   * coalesced into one single database transaction, which amortizes
+   * the cost of the commit (typically, the "fsync()" of SQLite) over
+   * several operations. The batches are formed by a
+   * "LeaderFollowersQueue". If a batch fails for whatever reason,
+   * each thread falls back to applying its own operation in a
+   * separate transaction, so that errors are reported individually.
+   **/
+  class StatelessDatabaseOperations::GroupCommit : public boost::noncopyable
+  {
+  private:
+    class PendingOperation : public LeaderFollowersQueue::Item
+    {
+    private:
+      IReadWriteOperations&  operations_;
+
+    public:
+      explicit PendingOperation(IReadWriteOperations& operations) :
+        operations_(operations)
+      {
+      }
+
+      IReadWriteOperations& GetOperations() const
+      {
+        return operations_;
+      }
+    };
+
+    class BatchOperations : public IReadWriteOperations
+    {
+    private:
+      const std::vector<LeaderFollowersQueue::Item*>&  batch_;
+
+    public:
+      explicit BatchOperations(const std::vector<LeaderFollowersQueue::Item*>& batch) :
+        batch_(batch)
+      {
+      }
+
+      virtual void Apply(ReadWriteTransaction& transaction) ORTHANC_OVERRIDE
+      {
+        for (size_t i = 0; i < batch_.size(); i++)
+        {
+          assert(batch_[i] != NULL);
+          dynamic_cast<PendingOperation&>(*batch_[i]).GetOperations().Apply(transaction);
+        }
+      }
+    };
+
+    class BatchHandler : public LeaderFollowersQueue::IBatchHandler
+    {
+    private:
+      StatelessDatabaseOperations&  that_;
+
+    public:
+      explicit BatchHandler(StatelessDatabaseOperations& that) :
+        that_(that)
+      {
+      }
+
+      virtual bool HandleBatch(const std::vector<LeaderFollowersQueue::Item*>& batch) ORTHANC_OVERRIDE
+      {
+        if (batch.size() == 1)
+        {
+          that_.Apply(dynamic_cast<PendingOperation&>(*batch[0]).GetOperations());
+          return true;
+        }
+
+        try
+        {
+          BatchOperations batchOperations(batch);
+          that_.Apply(batchOperations);
+          LOG(TRACE) << "Group commit of " << batch.size() << " write operations";
+          return true;
+        }
+        catch (...)
+        {
+          LOG(INFO) << "Group commit of " << batch.size() << " write operations has failed, "
+                    << "applying them one by one";
+          return false;
+        }
+      }
+    };
+
+    LeaderFollowersQueue  queue_;
+
+  public:
+    GroupCommit() :
+      queue_(0, 0)
+    {
+    }
+
+    void SetParameters(unsigned int maxBatchSize,
+                       unsigned int windowMilliseconds)
+    {
+      queue_.SetParameters(maxBatchSize, windowMilliseconds);
+    }
+
+    bool IsEnabled()
+    {
+      return queue_.GetMaxBatchSize() > 1;
+    }
+
+    void Apply(StatelessDatabaseOperations& that,
+               IReadWriteOperations& operations)
+    {
+      PendingOperation operation(operations);
+      BatchHandler handler(that);
+
+      if (!queue_.Submit(operation, handler))
+      {
+        that.Apply(operations);
+      }
+    }
+  };
+
+
   class StatelessDatabaseOperations::MainDicomTagsRegistry : public boost::noncopyable
   {
   private:
@@ -560,6 +681,7 @@ namespace Orthanc
       {
         int64_t delta = context_->GetCompressedSizeDelta();
 
+        context_->PrepareCommit(*transaction_);
         transaction_->Commit(delta);
         context_->Commit();
         isCommitted_ = true;
@@ -653,6 +775,7 @@ namespace Orthanc
   StatelessDatabaseOperations::StatelessDatabaseOperations(IDatabaseWrapper& db) : 
     db_(db),
     mainDicomTagsRegistry_(new MainDicomTagsRegistry),
+    groupCommit_(new GroupCommit),
     hasFlushToDisk_(db.HasFlushToDisk()),
     maxRetries_(0)
   {
@@ -691,6 +814,19 @@ namespace Orthanc
   }
     
 
+  void StatelessDatabaseOperations::SetGroupCommit(unsigned int maxBatchSize,
+                                                   unsigned int windowMilliseconds)
+  {
+    groupCommit_->SetParameters(maxBatchSize, windowMilliseconds);
+
+    if (maxBatchSize > 1)
+    {
+      LOG(WARNING) << "Group commit is enabled for the storage of instances: Up to " << maxBatchSize
+                   << " instances received within " << windowMilliseconds << "ms are committed together";
+    }
+  }
+
+
   void StatelessDatabaseOperations::SetMaxDatabaseRetries(unsigned int maxRetries)
   {
     boost::unique_lock<boost::shared_mutex> lock(mutex_);
@@ -1043,6 +1179,23 @@ namespace Orthanc
   }
 
 
+  void StatelessDatabaseOperations::GetPendingDeletions(std::map<std::string, FileContentType>& target)
+  {
+    class Operations : public ReadOnlyOperationsT1<std::map<std::string, FileContentType>&>
+    {
+    public:
+      virtual void ApplyTuple(ReadOnlyTransaction& transaction,
+                              const Tuple& tuple) ORTHANC_OVERRIDE
+      {
+        transaction.GetPendingDeletions(tuple.get<0>());
+      }
+    };
+
+    Operations operations;
+    operations.Apply(*this, target);
+  }
+
+
   void StatelessDatabaseOperations::GetAllUuids(std::list<std::string>& target,
                                                 ResourceType resourceType)
   {
@@ -1964,6 +2117,122 @@ namespace Orthanc
   }
 
 
+  void StatelessDatabaseOperations::ApplyLookupResources(std::vector<std::string>& resourcesId,
+                                                         std::vector<std::string>* instancesId,
+                                                         std::vector<int64_t>& internalIds,
+                                                         const DatabaseLookup& lookup,
+                                                         ResourceType queryLevel,
+                                                         int64_t afterInternalId,
+                                                         size_t limit)
+  {
+    class Operations : public ReadOnlyOperationsT6<bool, bool, const std::vector<DatabaseConstraint>&, ResourceType,
+                                                   int64_t, size_t>
+    {
+    private:
+      std::list<std::string>  resourcesList_;
+      std::list<std::string>  instancesList_;
+      std::list<int64_t>      internalIdsList_;
+      
+    public:
+      const std::list<std::string>& GetResourcesList() const
+      {
+        return resourcesList_;
+      }
+
+      const std::list<std::string>& GetInstancesList() const
+      {
+        return instancesList_;
+      }
+
+      const std::list<int64_t>& GetInternalIdsList() const
+      {
+        return internalIdsList_;
+      }
+
+      virtual void ApplyTuple(ReadOnlyTransaction& transaction,
+                              const Tuple& tuple) ORTHANC_OVERRIDE
+      {
+        const bool hasKeysetPagination = tuple.get<0>();
+        const bool withInstances = tuple.get<1>();
+        const int64_t afterInternalId = tuple.get<4>();
+        const size_t limit = tuple.get<5>();
+
+        if (hasKeysetPagination)
+        {
+          transaction.ApplyLookupResources(resourcesList_, (withInstances ? &instancesList_ : NULL), internalIdsList_,
+                                           tuple.get<2>(), tuple.get<3>(), afterInternalId, limit);
+          return;
+        }
+
+        /**
+         * Fallback for the database plugins, that neither report the
+         * internal IDs, nor guarantee the order of the lookups: Run
+         * the full lookup once, resolve the internal IDs, and only
+         * keep the "limit" smallest ones that follow the cursor.
+         **/
+        std::list<std::string> resources, instances;
+        transaction.ApplyLookupResources(resources, (withInstances ? &instances : NULL),
+                                         tuple.get<2>(), tuple.get<3>(), 0 /* no limit */);
+
+        typedef std::map<int64_t, std::pair<std::string, std::string> >  Candidates;
+        Candidates candidates;
+
+        std::list<std::string>::const_iterator instance = instances.begin();
+
+        for (std::list<std::string>::const_iterator
+               resource = resources.begin(); resource != resources.end(); ++resource)
+        {
+          int64_t internalId;
+          ResourceType type;
+          if (transaction.LookupResource(internalId, type, *resource) &&
+              internalId > afterInternalId)
+          {
+            candidates[internalId] = std::make_pair(*resource, (withInstances ? *instance : std::string()));
+
+            if (limit != 0 &&
+                candidates.size() > limit)
+            {
+              candidates.erase(--candidates.end());
+            }
+          }
+
+          if (withInstances)
+          {
+            ++instance;
+          }
+        }
+
+        for (Candidates::const_iterator it = candidates.begin(); it != candidates.end(); ++it)
+        {
+          internalIdsList_.push_back(it->first);
+          resourcesList_.push_back(it->second.first);
+
+          if (withInstances)
+          {
+            instancesList_.push_back(it->second.second);
+          }
+        }
+      }
+    };
+
+
+    std::vector<DatabaseConstraint> normalized;
+    NormalizeLookup(normalized, lookup, queryLevel);
+
+    Operations operations;
+    operations.Apply(*this, db_.HasKeysetPagination(), (instancesId != NULL), normalized, queryLevel,
+                     afterInternalId, limit);
+    
+    CopyListToVector(resourcesId, operations.GetResourcesList());
+    internalIds.assign(operations.GetInternalIdsList().begin(), operations.GetInternalIdsList().end());
+
+    if (instancesId != NULL)
+    { 
+      CopyListToVector(*instancesId, operations.GetInstancesList());
+    }
+  }
+
+
   bool StatelessDatabaseOperations::DeleteResource(Json::Value& remainingAncestor,
                                                    const std::string& uuid,
                                                    ResourceType expectedType)
@@ -2491,6 +2760,36 @@ namespace Orthanc
   }
 
 
+  void StatelessDatabaseOperations::RemovePendingDeletions(const std::list<std::string>& uuids)
+  {
+    class Operations : public IReadWriteOperations
+    {
+    private:
+      const std::list<std::string>&  uuids_;
+      
+    public:
+      explicit Operations(const std::list<std::string>& uuids) :
+        uuids_(uuids)
+      {
+      }
+        
+      virtual void Apply(ReadWriteTransaction& transaction) ORTHANC_OVERRIDE
+      {
+        for (std::list<std::string>::const_iterator it = uuids_.begin(); it != uuids_.end(); ++it)
+        {
+          transaction.RemovePendingDeletion(*it);
+        }
+      }
+    };
+
+    if (!uuids.empty())
+    {
+      Operations operations(uuids);
+      Apply(operations);
+    }
+  }
+
+
   bool StatelessDatabaseOperations::DeleteAttachment(const std::string& publicId,
                                                      FileContentType type,
                                                      bool hasRevision,
@@ -3350,7 +3649,16 @@ namespace Orthanc
     Operations operations(instanceMetadata, dicomSummary, attachments, metadata, origin,
                           overwrite, hasTransferSyntax, transferSyntax, hasPixelDataOffset,
                           pixelDataOffset, maximumStorageSize, maximumPatients, isReconstruct);
-    Apply(operations);
+
+    if (groupCommit_->IsEnabled())
+    {
+      groupCommit_->Apply(*this, operations);
+    }
+    else
+    {
+      Apply(operations);
+    }
+
     return operations.GetStoreStatus();
   }
 
@@ -105,6 +105,11 @@ namespace Orthanc
       virtual void SignalAttachmentsAdded(uint64_t compressedSize) = 0;
 
       virtual void SignalChange(const ServerIndexChange& change) = 0;
+
+      // Invoked right before the database transaction is committed,
+      // in order to write into the same transaction (new in Orthanc
+      // 1.11.2)
+      virtual void PrepareCommit(IDatabaseWrapper::ITransaction& transaction) = 0;
     };
 
     
@@ -162,12 +167,28 @@ namespace Orthanc
         return transaction_.ApplyLookupResources(resourcesId, instancesId, lookup, queryLevel, limit);
       }
 
+      void ApplyLookupResources(std::list<std::string>& resourcesId,
+                                std::list<std::string>* instancesId, // Can be NULL if not needed
+                                std::list<int64_t>& internalIds,
+                                const std::vector<DatabaseConstraint>& lookup,
+                                ResourceType queryLevel,
+                                int64_t afterInternalId,
+                                size_t limit)
+      {
+        return transaction_.ApplyLookupResources(resourcesId, instancesId, internalIds, lookup, queryLevel, afterInternalId, limit);
+      }
+
       void GetAllMetadata(std::map<MetadataType, std::string>& target,
                           int64_t id)
       {
         transaction_.GetAllMetadata(target, id);
       }
 
+      void GetPendingDeletions(std::map<std::string, FileContentType>& target)
+      {
+        transaction_.GetPendingDeletions(target);
+      }
+
       void GetAllPublicIds(std::list<std::string>& target,
                            ResourceType resourceType)
       {
@@ -381,6 +402,11 @@ namespace Orthanc
         transaction_.LogExportedResource(resource);
       }
 
+      void RemovePendingDeletion(const std::string& uuid)
+      {
+        transaction_.RemovePendingDeletion(uuid);
+      }
+
       void SetGlobalProperty(GlobalProperty property,
                              bool shared,
                              const std::string& value)
@@ -439,9 +465,11 @@ namespace Orthanc
   private:
     class MainDicomTagsRegistry;
     class Transaction;
+    class GroupCommit;
 
     IDatabaseWrapper&                            db_;
     boost::shared_ptr<MainDicomTagsRegistry>     mainDicomTagsRegistry_;  // "shared_ptr" because of PImpl
+    boost::shared_ptr<GroupCommit>               groupCommit_;  // "shared_ptr" because of PImpl
     bool                                         hasFlushToDisk_;
 
     // Mutex to protect the configuration options
@@ -468,6 +496,13 @@ namespace Orthanc
     // Only used to handle "ErrorCode_DatabaseCannotSerialize" in the
     // case of collision between multiple writers
     void SetMaxDatabaseRetries(unsigned int maxRetries);
+
+    // New in Orthanc 1.11.2: Coalesce up to "maxBatchSize" concurrent
+    // calls to "Store()" that are received within
+    // "windowMilliseconds" into one single database transaction.
+    // Group commit is disabled if "maxBatchSize" is 0 or 1.
+    void SetGroupCommit(unsigned int maxBatchSize,
+                        unsigned int windowMilliseconds);
     
     // It is assumed that "GetDatabaseVersion()" can run out of a
     // database transaction
@@ -595,6 +630,34 @@ namespace Orthanc
                               ResourceType queryLevel,
                               size_t limit);
 
+    // Keyset pagination: Only report the resources whose internal ID
+    // is strictly greater than "afterInternalId", by increasing
+    // internal ID. The cursor doesn't have to correspond to an
+    // existing resource, which makes it robust to deletions between
+    // two pages (new in Orthanc 1.11.2)
+    void ApplyLookupResources(std::vector<std::string>& resourcesId,
+                              std::vector<std::string>* instancesId,  // Can be NULL if not needed
+                              std::vector<int64_t>& internalIds,
+                              const DatabaseLookup& lookup,
+                              ResourceType queryLevel,
+                              int64_t afterInternalId,
+                              size_t limit);
+
+    bool HasKeysetPagination() const
+    {
+      return db_.HasKeysetPagination();
+    }
+
+    bool HasPendingDeletions() const
+    {
+      return db_.HasPendingDeletions();
+    }
+
+    // Files that are still to be removed from the storage area, once
+    // the attachments have been deleted from the database (new in
+    // Orthanc 1.11.2). Only available if "HasPendingDeletions()".
+    void GetPendingDeletions(std::map<std::string, FileContentType>& target);
+
     bool DeleteResource(Json::Value& remainingAncestor /* out */,
                         const std::string& uuid,
                         ResourceType expectedType);
@@ -635,6 +698,9 @@ namespace Orthanc
                            bool shared,
                            const std::string& value);
 
+    // New in Orthanc 1.11.2
+    void RemovePendingDeletions(const std::list<std::string>& uuids);
+
     bool DeleteAttachment(const std::string& publicId,
                           FileContentType type,
                           bool hasRevision,
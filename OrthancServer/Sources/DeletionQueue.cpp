@@ -0,0 +1,344 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "PrecompiledHeadersServer.h"
+#include "DeletionQueue.h"
+
+#include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/MetricsRegistry.h"
+#include "../../OrthancFramework/Sources/OrthancException.h"
+#include "ServerContext.h"
+#include "ServerEnumerations.h"
+
+#include <boost/lexical_cast.hpp>
+
+
+namespace Orthanc
+{
+  class DeletionQueue::Item : public IDynamicObject
+  {
+  private:
+    std::string      uuid_;
+    FileContentType  type_;
+
+  public:
+    Item(const std::string& uuid,
+         FileContentType type) :
+      uuid_(uuid),
+      type_(type)
+    {
+    }
+
+    const std::string& GetUuid() const
+    {
+      return uuid_;
+    }
+
+    FileContentType GetContentType() const
+    {
+      return type_;
+    }
+  };
+
+
+  // Number of removed files that are buffered before being cleared
+  // from the "PendingDeletions" table of the index, in order to avoid
+  // one write transaction per removed file
+  static const size_t FLUSH_REMOVED_THRESHOLD = 100;
+
+
+  void DeletionQueue::Worker(DeletionQueue* that)
+  {
+    assert(that != NULL);
+
+    while (that->IsRunning())
+    {
+      std::unique_ptr<IDynamicObject> obj(that->queue_.Dequeue(100));
+      if (obj.get() == NULL)
+      {
+        // The queue is idle
+        that->FlushRemoved();
+      }
+      else
+      {
+        const Item& item = dynamic_cast<const Item&>(*obj);
+
+        const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+        that->RemoveFile(item.GetUuid(), item.GetContentType());
+
+        if (that->rate_ != 0)
+        {
+          // Each of the workers removes at most "rate / workers" files per second
+          const int64_t period = (static_cast<int64_t>(that->workers_.size()) * 1000000 /
+                                  static_cast<int64_t>(that->rate_));
+
+          for (;;)
+          {
+            const int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+            if (elapsed >= period ||
+                !that->IsRunning())
+            {
+              break;
+            }
+
+            boost::this_thread::sleep(boost::posix_time::microseconds(std::min(period - elapsed, static_cast<int64_t>(100000))));
+          }
+        }
+      }
+    }
+  }
+
+
+  void DeletionQueue::RemoveFile(const std::string& uuid,
+                                 FileContentType type)
+  {
+    try
+    {
+      context_.RemoveFile(uuid, type);
+    }
+    catch (OrthancException& e)
+    {
+      LOG(ERROR) << "Unable to remove an attachment from the storage area: "
+                 << uuid << " (type: " << EnumerationToString(type) << ")";
+    }
+
+    bool flush;
+
+    {
+      boost::mutex::scoped_lock lock(removedMutex_);
+      removed_.push_back(uuid);
+      countRemoved_++;
+      flush = (removed_.size() >= FLUSH_REMOVED_THRESHOLD);
+    }
+
+    if (flush)
+    {
+      FlushRemoved();
+    }
+  }
+
+
+  void DeletionQueue::FlushRemoved()
+  {
+    std::list<std::string> uuids;
+
+    {
+      boost::mutex::scoped_lock lock(removedMutex_);
+      uuids.swap(removed_);
+    }
+
+    if (!uuids.empty())
+    {
+      try
+      {
+        context_.GetIndex().RemovePendingDeletions(uuids);
+      }
+      catch (OrthancException& e)
+      {
+        // The removal of these files will be attempted once again at
+        // the next startup, which is harmless
+        LOG(ERROR) << "Cannot update the pending deletions in the database: " << e.What();
+      }
+    }
+  }
+
+
+  DeletionQueue::DeletionQueue(ServerContext& context) :
+    context_(context),
+    running_(false),
+    rate_(0),
+    countRemoved_(0)
+  {
+  }
+
+
+  DeletionQueue::~DeletionQueue()
+  {
+    if (IsRunning())
+    {
+      LOG(ERROR) << "INTERNAL ERROR: DeletionQueue::Stop() should be invoked manually to avoid mess in the destruction order!";
+      Stop();
+    }
+  }
+
+
+  void DeletionQueue::SetRate(unsigned int filesPerSecond)
+  {
+    if (IsRunning())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      rate_ = filesPerSecond;
+    }
+  }
+
+
+  void DeletionQueue::Start(unsigned int threadsCount)
+  {
+    if (IsRunning())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (!context_.GetIndex().HasPendingDeletions())
+    {
+      if (threadsCount != 0)
+      {
+        LOG(WARNING) << "The database backend doesn't support asynchronous deletions, "
+                     << "the deleted files will be removed synchronously from the storage area";
+      }
+
+      return;
+    }
+
+    std::map<std::string, FileContentType> pending;
+    context_.GetIndex().GetPendingDeletions(pending);
+
+    if (threadsCount == 0)
+    {
+      // The asynchronous deletions have been disabled since the
+      // previous execution: Complete the removals that it left
+      if (!pending.empty())
+      {
+        LOG(WARNING) << "Completing the removal of " << pending.size()
+                     << " file(s) from the storage area, that was pending from the previous execution";
+
+        for (std::map<std::string, FileContentType>::const_iterator it = pending.begin(); it != pending.end(); ++it)
+        {
+          RemoveFile(it->first, it->second);
+        }
+
+        FlushRemoved();
+      }
+
+      return;
+    }
+
+    for (std::map<std::string, FileContentType>::const_iterator it = pending.begin(); it != pending.end(); ++it)
+    {
+      queue_.Enqueue(new Item(it->first, it->second));
+    }
+
+    LOG(WARNING) << "Starting " << threadsCount << " thread(s) to remove the deleted files from the storage area"
+                 << (rate_ == 0 ? "" : " (at most " + boost::lexical_cast<std::string>(rate_) + " files per second)")
+                 << ", " << pending.size() << " file(s) pending from the previous execution";
+
+    {
+      boost::mutex::scoped_lock lock(runningMutex_);
+      running_ = true;
+    }
+
+    workers_.resize(threadsCount);
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      workers_[i] = new boost::thread(Worker, this);
+    }
+  }
+
+
+  void DeletionQueue::Stop()
+  {
+    bool wasRunning;
+
+    {
+      boost::mutex::scoped_lock lock(runningMutex_);
+      wasRunning = running_;
+      running_ = false;
+    }
+
+    if (wasRunning)
+    {
+      LOG(INFO) << "Stopping the threads that remove the deleted files from the storage area";
+
+      for (size_t i = 0; i < workers_.size(); i++)
+      {
+        assert(workers_[i] != NULL);
+
+        if (workers_[i]->joinable())
+        {
+          workers_[i]->join();
+        }
+
+        delete workers_[i];
+      }
+
+      workers_.clear();
+
+      FlushRemoved();
+
+      if (queue_.GetSize() != 0)
+      {
+        LOG(WARNING) << "The removal of " << queue_.GetSize() << " file(s) from the storage area "
+                     << "will be completed at the next startup";
+      }
+
+      // The remaining removals are still in the index
+      queue_.Clear();
+    }
+  }
+
+
+  bool DeletionQueue::IsRunning() const
+  {
+    boost::mutex::scoped_lock lock(runningMutex_);
+    return running_;
+  }
+
+
+  void DeletionQueue::Enqueue(const Files& files)
+  {
+    // The mutex is held while enqueuing, so that no file is enqueued
+    // once "Stop()" has started
+    boost::mutex::scoped_lock lock(runningMutex_);
+
+    if (!running_)
+    {
+      // The queue was stopped after the files were recorded in the
+      // index: Their removal will be completed at the next startup
+      return;
+    }
+
+    for (Files::const_iterator it = files.begin(); it != files.end(); ++it)
+    {
+      queue_.Enqueue(new Item(it->first, it->second));
+    }
+  }
+
+
+  uint64_t DeletionQueue::GetRemovedCount()
+  {
+    boost::mutex::scoped_lock lock(removedMutex_);
+    return countRemoved_;
+  }
+
+
+  void DeletionQueue::PublishMetrics(MetricsRegistry& registry)
+  {
+    registry.SetValue("orthanc_deletion_queue_pending", static_cast<float>(GetPendingCount()));
+    registry.SetValue("orthanc_deletion_queue_removed", static_cast<float>(GetRemovedCount()));
+  }
+}
@@ -0,0 +1,112 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "../../OrthancFramework/Sources/Enumerations.h"
+#include "../../OrthancFramework/Sources/MultiThreading/SharedMessageQueue.h"
+
+#include <boost/thread.hpp>
+#include <list>
+
+namespace Orthanc
+{
+  class MetricsRegistry;
+  class ServerContext;
+
+  /**
+   * Queue of the attachments to be removed from the storage area
+   * once the database transaction that deleted them has been
+   * committed (new in Orthanc 1.11.2). The files are removed by a
+   * pool of worker threads, possibly throttled, so that deletions
+   * and recycling do not block the calling thread. The queue is
+   * persisted in the "PendingDeletions" table of the index, which is
+   * written in the same transaction as the deletion of the
+   * attachments, so that the removals that are pending on shutdown or
+   * crash are resumed on the next startup. This requires a database
+   * backend with "HasPendingDeletions()".
+   **/
+  class DeletionQueue : public boost::noncopyable
+  {
+  public:
+    typedef std::list<std::pair<std::string, FileContentType> >  Files;
+
+  private:
+    class Item;
+
+    ServerContext&               context_;
+    SharedMessageQueue           queue_;
+    mutable boost::mutex         runningMutex_;
+    bool                         running_;   // Protected by "runningMutex_"
+    std::vector<boost::thread*>  workers_;
+    unsigned int                 rate_;
+    boost::mutex                 removedMutex_;
+    std::list<std::string>       removed_;   // Removed files, not flushed yet to the index
+    uint64_t                     countRemoved_;
+
+    static void Worker(DeletionQueue* that);
+
+    void RemoveFile(const std::string& uuid,
+                    FileContentType type);
+
+    void FlushRemoved();
+
+  public:
+    explicit DeletionQueue(ServerContext& context);
+
+    virtual ~DeletionQueue();
+
+    // Maximum number of files removed per second by all the worker
+    // threads together, "0" means no limit
+    void SetRate(unsigned int filesPerSecond);
+
+    unsigned int GetRate() const
+    {
+      return rate_;
+    }
+
+    /**
+     * If "threadsCount" is zero, the queue is not started, but the
+     * removals that were left pending in the index by a previous
+     * execution are still completed.
+     **/
+    void Start(unsigned int threadsCount);
+
+    void Stop();
+
+    bool IsRunning() const;
+
+    // The files must have been recorded as pending deletions in the
+    // index beforehand
+    void Enqueue(const Files& files);
+
+    size_t GetPendingCount()
+    {
+      return queue_.GetSize();
+    }
+
+    uint64_t GetRemovedCount();
+
+    void PublishMetrics(MetricsRegistry& registry);
+  };
+}
@@ -94,6 +94,12 @@ namespace Orthanc
       metadata_[std::make_pair(level, metadata)] = value;
     }
 
+    void RemoveMetadata(ResourceType level,
+                        MetadataType metadata)
+    {
+      metadata_.erase(std::make_pair(level, metadata));
+    }
+
     void CopyMetadata(const MetadataMap& metadata);
 
     bool LookupTransferSyntax(DicomTransferSyntax& result) const;
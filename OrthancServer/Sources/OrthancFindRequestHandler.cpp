@@ -34,22 +34,23 @@
 #include "ServerToolbox.h"
 
 #include <boost/regex.hpp> 
+#include <boost/thread.hpp>
+#include <deque>
 
 
 namespace Orthanc
 {
-  static void AddAnswer(DicomFindAnswers& answers,
-                        ServerContext& context,
-                        const std::string& publicId,
-                        const std::string& instanceId,
-                        const DicomMap& mainDicomTags,
-                        const Json::Value* dicomAsJson,
-                        ResourceType level,
-                        const DicomArray& query,
-                        const std::list<DicomTag>& sequencesToReturn,
-                        const std::string& defaultPrivateCreator,
-                        const std::map<uint16_t, std::string>& privateCreators,
-                        const std::string& retrieveAet)
+  // This function is thread-safe, and contains the costly part of the
+  // generation of an answer (it might read the DICOM file)
+  static void ExpandAnswer(DicomMap& result /* out */,
+                           ServerContext& context,
+                           const std::string& publicId,
+                           const std::string& instanceId,
+                           const DicomMap& mainDicomTags,
+                           const Json::Value* dicomAsJson,
+                           ResourceType level,
+                           const DicomArray& query,
+                           const std::string& retrieveAet)
   {
     ExpandedResource resource;
     std::set<DicomTag> requestedTags;
@@ -60,7 +61,7 @@ namespace Orthanc
     // reuse ExpandResource to get missing tags and computed tags (ModalitiesInStudy ...).  This code is therefore shared between C-Find, tools/find, list-resources and QIDO-RS
     context.ExpandResource(resource, publicId, mainDicomTags, instanceId, dicomAsJson, level, requestedTags, ExpandResourceDbFlags_IncludeMainDicomTags);
 
-    DicomMap result;
+    result.Clear();
 
     /**
      * Add the mandatory "Retrieve AE Title (0008,0054)" tag, which was missing in Orthanc <= 1.7.2.
@@ -97,7 +98,16 @@ namespace Orthanc
         }
       }
     }
+  }
+
 
+  static void AddAnswer(DicomFindAnswers& answers,
+                        const DicomMap& result,
+                        const Json::Value* dicomAsJson,
+                        const std::list<DicomTag>& sequencesToReturn,
+                        const std::string& defaultPrivateCreator,
+                        const std::map<uint16_t, std::string>& privateCreators)
+  {
     if (result.GetSize() == 0 &&
         sequencesToReturn.empty())
     {
@@ -229,14 +239,103 @@ namespace Orthanc
   OrthancFindRequestHandler::OrthancFindRequestHandler(ServerContext& context) :
     context_(context),
     maxResults_(0),
-    maxInstances_(0)
+    maxInstances_(0),
+    threadsCount_(0)
   {
   }
 
 
+  /**
+   * An answer whose expansion is delegated to a worker thread (new in
+   * Orthanc 1.11.2). Its fields are only accessed by the worker until
+   * "done_" is set, then only by the thread that runs the lookup.
+   **/
+  class OrthancFindRequestHandler::PendingAnswer : public boost::noncopyable
+  {
+  private:
+    std::string                         publicId_;
+    std::string                         instanceId_;
+    DicomMap                            mainDicomTags_;
+    std::unique_ptr<Json::Value>        dicomAsJson_;
+    DicomMap                            result_;
+    bool                                done_;
+    std::unique_ptr<OrthancException>   error_;
+
+  public:
+    PendingAnswer(const std::string& publicId,
+                  const std::string& instanceId,
+                  const DicomMap& mainDicomTags,
+                  const Json::Value* dicomAsJson) :
+      publicId_(publicId),
+      instanceId_(instanceId),
+      done_(false)
+    {
+      mainDicomTags_.Assign(mainDicomTags);
+
+      if (dicomAsJson != NULL)
+      {
+        dicomAsJson_.reset(new Json::Value(*dicomAsJson));
+      }
+    }
+
+    void Expand(ServerContext& context,
+                ResourceType level,
+                const DicomArray& query,
+                const std::string& retrieveAet)
+    {
+      try
+      {
+        ExpandAnswer(result_, context, publicId_, instanceId_, mainDicomTags_,
+                     dicomAsJson_.get(), level, query, retrieveAet);
+      }
+      catch (OrthancException& e)
+      {
+        error_.reset(new OrthancException(e));
+      }
+      catch (std::exception& e)
+      {
+        error_.reset(new OrthancException(ErrorCode_InternalError, e.what()));
+      }
+      catch (...)
+      {
+        error_.reset(new OrthancException(ErrorCode_InternalError));
+      }
+    }
+
+    bool IsDone() const
+    {
+      return done_;
+    }
+
+    void SetDone()
+    {
+      done_ = true;
+    }
+
+    void AddTo(DicomFindAnswers& answers,
+               const std::list<DicomTag>& sequencesToReturn,
+               const std::string& defaultPrivateCreator,
+               const std::map<uint16_t, std::string>& privateCreators) const
+    {
+      assert(done_);
+
+      if (error_.get() != NULL)
+      {
+        throw OrthancException(*error_);
+      }
+      else
+      {
+        AddAnswer(answers, result_, dicomAsJson_.get(), sequencesToReturn, defaultPrivateCreator, privateCreators);
+      }
+    }
+  };
+
+
   class OrthancFindRequestHandler::LookupVisitor : public ServerContext::ILookupVisitor
   {
   private:
+    typedef std::deque<boost::shared_ptr<PendingAnswer> >  PendingAnswers;
+
     DicomFindAnswers&           answers_;
     ServerContext&              context_;
     ResourceType                level_;
@@ -247,20 +346,122 @@ namespace Orthanc
     const std::map<uint16_t, std::string>& privateCreators_;  // the private creators defined in the query itself
     std::string                 retrieveAet_;
 
+    // Parallel expansion of the answers (new in Orthanc 1.11.2)
+    unsigned int                threadsCount_;
+    PendingAnswers              pending_;   // All the answers being expanded, in the order of the lookup
+    PendingAnswers              queue_;     // The answers that are not taken by a worker yet
+    bool                        stopped_;
+    boost::mutex                mutex_;
+    boost::condition_variable   queueCondition_;
+    boost::condition_variable   doneCondition_;
+    std::vector<boost::thread*> workers_;
+
+    static void Worker(LookupVisitor* that)
+    {
+      for (;;)
+      {
+        boost::shared_ptr<PendingAnswer> answer;
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+
+          while (!that->stopped_ &&
+                 that->queue_.empty())
+          {
+            that->queueCondition_.wait(lock);
+          }
+
+          if (that->stopped_)
+          {
+            return;
+          }
+
+          answer = that->queue_.front();
+          that->queue_.pop_front();
+        }
+
+        answer->Expand(that->context_, that->level_, that->queryAsArray_, that->retrieveAet_);
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+          answer->SetDone();
+        }
+
+        that->doneCondition_.notify_all();
+      }
+    }
+
+    void StopWorkers()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopped_ = true;
+      }
+
+      queueCondition_.notify_all();
+
+      for (size_t i = 0; i < workers_.size(); i++)
+      {
+        if (workers_[i]->joinable())
+        {
+          workers_[i]->join();
+        }
+
+        delete workers_[i];
+      }
+
+      workers_.clear();
+    }
+
+    /**
+     * Add the expanded answers to "answers_", in the order of the
+     * lookup. Waits for the expansion of the oldest answers as long
+     * as more than "maxPending" answers are being expanded.
+     **/
+    void FlushAnswers(size_t maxPending)
+    {
+      while (!pending_.empty())
+      {
+        boost::shared_ptr<PendingAnswer> answer = pending_.front();
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          if (pending_.size() > maxPending)
+          {
+            while (!answer->IsDone())
+            {
+              doneCondition_.wait(lock);
+            }
+          }
+          else if (!answer->IsDone())
+          {
+            return;
+          }
+        }
+
+        pending_.pop_front();
+        answer->AddTo(answers_, sequencesToReturn_, defaultPrivateCreator_, privateCreators_);
+      }
+    }
+
   public:
     LookupVisitor(DicomFindAnswers&  answers,
                   ServerContext& context,
                   ResourceType level,
                   const DicomMap& query,
                   const std::list<DicomTag>& sequencesToReturn,
-                  const std::map<uint16_t, std::string>& privateCreators) :
+                  const std::map<uint16_t, std::string>& privateCreators,
+                  unsigned int threadsCount) :
       answers_(answers),
       context_(context),
       level_(level),
       query_(query),
       queryAsArray_(query),
       sequencesToReturn_(sequencesToReturn),
-      privateCreators_(privateCreators)
+      privateCreators_(privateCreators),
+      threadsCount_(threadsCount),
+      stopped_(false)
     {
       answers_.SetComplete(false);
 
@@ -271,6 +472,11 @@ namespace Orthanc
       }
     }
 
+    virtual ~LookupVisitor()
+    {
+      StopWorkers();
+    }
+
     virtual bool IsDicomAsJsonNeeded() const ORTHANC_OVERRIDE
     {
       // Ask the "DICOM-as-JSON" attachment only if sequences are to
@@ -307,8 +513,42 @@ namespace Orthanc
                        const DicomMap& mainDicomTags,
                        const Json::Value* dicomAsJson) ORTHANC_OVERRIDE
     {
-      AddAnswer(answers_, context_, publicId, instanceId, mainDicomTags, dicomAsJson, level_, queryAsArray_, sequencesToReturn_,
-                defaultPrivateCreator_, privateCreators_, retrieveAet_);
+      if (threadsCount_ <= 1)
+      {
+        DicomMap result;
+        ExpandAnswer(result, context_, publicId, instanceId, mainDicomTags, dicomAsJson, level_, queryAsArray_, retrieveAet_);
+        AddAnswer(answers_, result, dicomAsJson, sequencesToReturn_, defaultPrivateCreator_, privateCreators_);
+      }
+      else
+      {
+        if (workers_.empty())
+        {
+          // The workers are only started if there is at least one answer
+          for (unsigned int i = 0; i < threadsCount_; i++)
+          {
+            workers_.push_back(new boost::thread(Worker, this));
+          }
+        }
+
+        boost::shared_ptr<PendingAnswer> answer(new PendingAnswer(publicId, instanceId, mainDicomTags, dicomAsJson));
+        pending_.push_back(answer);
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          queue_.push_back(answer);
+        }
+
+        queueCondition_.notify_one();
+
+        // Bound the memory that is used by the answers being expanded
+        FlushAnswers(2 * threadsCount_);
+      }
+    }
+
+    void Finish()
+    {
+      FlushAnswers(0);
+      StopWorkers();
     }
   };
 
@@ -478,8 +718,9 @@ namespace Orthanc
     size_t limit = (level == ResourceType_Instance) ? maxInstances_ : maxResults_;
 
 
-    LookupVisitor visitor(answers, context_, level, *filteredInput, sequencesToReturn, privateCreators);
+    LookupVisitor visitor(answers, context_, level, *filteredInput, sequencesToReturn, privateCreators, threadsCount_);
     context_.Apply(visitor, lookup, level, 0 /* "since" is not relevant to C-FIND */, limit);
+    visitor.Finish();
   }
 
 
@@ -30,11 +30,13 @@ namespace Orthanc
   class OrthancFindRequestHandler : public IFindRequestHandler
   {
   private:
+    class PendingAnswer;
     class LookupVisitor;
 
     ServerContext& context_;
     unsigned int   maxResults_;
     unsigned int   maxInstances_;
+    unsigned int   threadsCount_;  // New in Orthanc 1.11.2
 
     bool HasReachedLimit(const DicomFindAnswers& answers,
                          ResourceType level) const;
@@ -82,6 +84,20 @@ namespace Orthanc
       maxInstances_ = instances;
     }
 
+    unsigned int GetThreadsCount() const
+    {
+      return threadsCount_;
+    }
+
+    // Number of threads that expand the answers in parallel, while
+    // preserving their order. A value of 0 or 1 means that the answers
+    // are expanded by the thread that runs the lookup (new in Orthanc
+    // 1.11.2).
+    void SetThreadsCount(unsigned int threadsCount)
+    {
+      threadsCount_ = threadsCount;
+    }
+
     static void FormatOrigin(Json::Value& origin,
                              const std::string& remoteIp,
                              const std::string& remoteAet,
@@ -46,6 +46,7 @@
 
 #include "Database/SQLiteDatabaseWrapper.h"
 #include "OrthancConfiguration.h"
+#include "ServerToolbox.h"
 
 #include <OrthancServerResources.h>
 
@@ -412,7 +413,40 @@ namespace Orthanc
     {
     }
 
-    return new SQLiteDatabaseWrapper(indexDirectory.string() + "/index");
+    std::unique_ptr<SQLiteDatabaseWrapper> database(new SQLiteDatabaseWrapper(indexDirectory.string() + "/index"));
+
+    // New in Orthanc 1.11.2
+    database->SetReadConnectionsCount(lock.GetConfiguration().GetUnsignedIntegerParameter("SQLiteReadConnections", 0));
+
+    // New in Orthanc 1.11.2
+    std::list<std::string> indexedTagNames;
+    lock.GetConfiguration().GetListOfStringsParameter(indexedTagNames, "IndexedMainDicomTags");
+
+    std::set<DicomTag> indexedTags;
+    for (std::list<std::string>::const_iterator it = indexedTagNames.begin(); it != indexedTagNames.end(); ++it)
+    {
+      DicomTag tag(FromDcmtkBridge::ParseTag(*it));
+
+      if (!DicomMap::IsMainDicomTag(tag))
+      {
+        LOG(WARNING) << "Tag " << *it << " is not a main DICOM tag, it cannot be indexed in the SQLite database";
+      }
+      else if (ServerToolbox::IsIdentifier(tag, ResourceType_Patient) ||
+               ServerToolbox::IsIdentifier(tag, ResourceType_Study) ||
+               ServerToolbox::IsIdentifier(tag, ResourceType_Series) ||
+               ServerToolbox::IsIdentifier(tag, ResourceType_Instance))
+      {
+        LOG(INFO) << "Tag " << *it << " is an identifier, it is always indexed in the SQLite database";
+      }
+      else
+      {
+        indexedTags.insert(tag);
+      }
+    }
+
+    database->SetIndexedMainDicomTags(indexedTags);
+
+    return database.release();
   }
 
 
@@ -432,6 +466,12 @@ namespace Orthanc
       {
       }
 
+      void SetBatchedSync(unsigned int maxBatchSize,
+                          unsigned int windowMilliseconds)
+      {
+        storage_.SetBatchedSync(maxBatchSize, windowMilliseconds);
+      }
+
       virtual void Create(const std::string& uuid,
                           const void* content, 
                           size_t size,
@@ -491,6 +531,8 @@ namespace Orthanc
   static IStorageArea* CreateFilesystemStorage()
   {
     static const char* const SYNC_STORAGE_AREA = "SyncStorageArea";
+    static const char* const SYNC_STORAGE_AREA_BATCH_SIZE = "SyncStorageAreaBatchSize";
+    static const char* const SYNC_STORAGE_AREA_BATCH_WINDOW = "SyncStorageAreaBatchWindow";
     static const char* const STORE_DICOM = "StoreDicom";
     
     OrthancConfiguration::ReaderLock lock;
@@ -506,14 +548,23 @@ namespace Orthanc
     // New in Orthanc 1.7.4
     bool fsyncOnWrite = lock.GetConfiguration().GetBooleanParameter(SYNC_STORAGE_AREA, true);
 
+    // New in Orthanc 1.11.2
+    unsigned int syncBatchSize = lock.GetConfiguration().GetUnsignedIntegerParameter(SYNC_STORAGE_AREA_BATCH_SIZE, 0);
+    unsigned int syncBatchWindow = lock.GetConfiguration().GetUnsignedIntegerParameter(SYNC_STORAGE_AREA_BATCH_WINDOW, 5);
+
     if (lock.GetConfiguration().GetBooleanParameter(STORE_DICOM, true))
     {
-      return new FilesystemStorage(storageDirectory.string(), fsyncOnWrite);
+      std::unique_ptr<FilesystemStorage> storage(new FilesystemStorage(storageDirectory.string(), fsyncOnWrite));
+      storage->SetBatchedSync(syncBatchSize, syncBatchWindow);
+      return storage.release();
     }
     else
     {
       LOG(WARNING) << "The DICOM files will not be stored, Orthanc running in index-only mode";
-      return new FilesystemStorageWithoutDicom(storageDirectory.string(), fsyncOnWrite);
+      std::unique_ptr<FilesystemStorageWithoutDicom> storage(
+        new FilesystemStorageWithoutDicom(storageDirectory.string(), fsyncOnWrite));
+      storage->SetBatchedSync(syncBatchSize, syncBatchWindow);
+      return storage.release();
     }
   }
 
@@ -23,12 +23,16 @@
 #include "../PrecompiledHeadersServer.h"
 #include "OrthancRestApi.h"
 
+#include "../../../OrthancFramework/Sources/ChunkedBuffer.h"
 #include "../../../OrthancFramework/Sources/Compression/GzipCompressor.h"
 #include "../../../OrthancFramework/Sources/Compression/ZipReader.h"
+#include "../../../OrthancFramework/Sources/FileBuffer.h"
+#include "../../../OrthancFramework/Sources/HttpServer/MultipartStreamReader.h"
 #include "../../../OrthancFramework/Sources/Logging.h"
 #include "../../../OrthancFramework/Sources/MetricsRegistry.h"
 #include "../../../OrthancFramework/Sources/SerializationToolbox.h"
 #include "../../../OrthancFramework/Sources/DicomParsing/FromDcmtkBridge.h"
+#include "../../Plugins/Engine/OrthancPlugins.h"
 #include "../OrthancConfiguration.h"
 #include "../ServerContext.h"
 
@@ -129,6 +133,58 @@ namespace Orthanc
 
   // Upload of DICOM files through HTTP ---------------------------------------
 
+  static void StoreZipArchive(Json::Value& answer,
+                              ServerContext& context,
+                              ZipReader& reader,
+                              const DicomInstanceOrigin& origin)
+  {
+    answer = Json::arrayValue;
+      
+    std::string filename, content;
+    while (reader.ReadNextFile(filename, content))
+    {
+      if (!content.empty())
+      {
+        LOG(INFO) << "Uploading DICOM file from ZIP archive: " << filename;
+
+        std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromBuffer(content));
+        toStore->SetOrigin(origin);
+
+        std::string publicId;
+
+        try
+        {
+          ServerContext::StoreResult result = context.Store(publicId, *toStore, StoreInstanceMode_Default);
+
+          Json::Value info;
+          SetupResourceAnswer(info, *toStore, result.GetStatus(), publicId);
+          answer.append(info);
+        }
+        catch (OrthancException& e)
+        {
+          if (e.GetErrorCode() == ErrorCode_BadFileFormat)
+          {
+            LOG(ERROR) << "Cannot import non-DICOM file from ZIP archive: " << filename;
+          }
+          else if (e.GetErrorCode() == ErrorCode_InexistentTag)
+          {
+            /**
+             * Allow upload of ZIP archives containing a DICOMDIR
+             * file (new in Orthanc 1.9.7):
+             * https://groups.google.com/g/orthanc-users/c/sgBU89o4nhU/m/kbRAYiQUAAAJ
+             **/
+            LOG(ERROR) << "Ignoring what is probably a DICOMDIR file within a ZIP archive: \"" << filename << "\"";
+          }
+          else
+          {
+            throw;
+          }
+        }
+      }
+    }
+  }
+
+
   static void UploadDicomFile(RestApiPostCall& call)
   {
     if (call.GetRequestOrigin() == RequestOrigin_Documentation)
@@ -173,50 +229,8 @@ namespace Orthanc
       // New in Orthanc 1.8.2
       std::unique_ptr<ZipReader> reader(ZipReader::CreateFromMemory(call.GetBodyData(), call.GetBodySize()));
 
-      Json::Value answer = Json::arrayValue;
-      
-      std::string filename, content;
-      while (reader->ReadNextFile(filename, content))
-      {
-        if (!content.empty())
-        {
-          LOG(INFO) << "Uploading DICOM file from ZIP archive: " << filename;
-
-          std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromBuffer(content));
-          toStore->SetOrigin(DicomInstanceOrigin::FromRest(call));
-
-          std::string publicId;
-
-          try
-          {
-            ServerContext::StoreResult result = context.Store(publicId, *toStore, StoreInstanceMode_Default);
-
-            Json::Value info;
-            SetupResourceAnswer(info, *toStore, result.GetStatus(), publicId);
-            answer.append(info);
-          }
-          catch (OrthancException& e)
-          {
-            if (e.GetErrorCode() == ErrorCode_BadFileFormat)
-            {
-              LOG(ERROR) << "Cannot import non-DICOM file from ZIP archive: " << filename;
-            }
-            else if (e.GetErrorCode() == ErrorCode_InexistentTag)
-            {
-              /**
-               * Allow upload of ZIP archives containing a DICOMDIR
-               * file (new in Orthanc 1.9.7):
-               * https://groups.google.com/g/orthanc-users/c/sgBU89o4nhU/m/kbRAYiQUAAAJ
-               **/
-              LOG(ERROR) << "Ignoring what is probably a DICOMDIR file within a ZIP archive: \"" << filename << "\"";
-            }
-            else
-            {
-              throw;
-            }
-          }
-        }
-      }      
+      Json::Value answer;
+      StoreZipArchive(answer, context, *reader, DicomInstanceOrigin::FromRest(call));
 
       call.GetOutput().AnswerJson(answer);
     }
@@ -250,6 +264,233 @@ namespace Orthanc
 
 
 
+  /**
+   * Streamed version of "POST /instances" (new in Orthanc 1.11.2),
+   * that avoids keeping the full HTTP body in RAM while it is being
+   * received. The bodies of type "multipart/related" (as in STOW-RS)
+   * are parsed on-the-fly, and each part of type "application/dicom"
+   * is stored as soon as it is complete. The other bodies are buffered in RAM as long as they
+   * are smaller than "HttpRequestChunkSize", then spilled to a
+   * temporary file.
+   **/
+  class OrthancRestApi::UploadDicomFileReader : public IHttpHandler::IChunkedRequestReader
+  {
+  private:
+    class MultipartHandler : public MultipartStreamReader::IHandler
+    {
+    private:
+      ServerContext&       context_;
+      DicomInstanceOrigin  origin_;
+      std::string          defaultPartType_;
+      Json::Value          answer_;
+
+    public:
+      MultipartHandler(ServerContext& context,
+                       const DicomInstanceOrigin& origin,
+                       const std::string& defaultPartType) :
+        context_(context),
+        origin_(origin),
+        defaultPartType_(defaultPartType),
+        answer_(Json::arrayValue)
+      {
+      }
+
+      virtual void HandlePart(const MultipartStreamReader::HttpHeaders& headers,
+                              const void* part,
+                              size_t size) ORTHANC_OVERRIDE
+      {
+        if (size == 0)
+        {
+          return;
+        }
+
+        // As in STOW-RS, the type of a part defaults to the "type"
+        // argument of the "multipart/related" body
+        std::string partType = defaultPartType_;
+
+        std::string header;
+        std::map<std::string, std::string> arguments;
+        if (MultipartStreamReader::GetMainContentType(header, headers) &&
+            !MultipartStreamReader::ParseHeaderArguments(partType, arguments, header))
+        {
+          partType.clear();
+        }
+
+        if (partType != EnumerationToString(MimeType_Dicom))
+        {
+          LOG(ERROR) << "Ignoring a part of type \"" << partType << "\" in a multipart upload, "
+                     << "only \"" << EnumerationToString(MimeType_Dicom) << "\" is accepted";
+          return;
+        }
+
+        std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromBuffer(part, size));
+        toStore->SetOrigin(origin_);
+
+        std::string publicId;
+
+        try
+        {
+          ServerContext::StoreResult result = context_.Store(publicId, *toStore, StoreInstanceMode_Default);
+
+          Json::Value info;
+          SetupResourceAnswer(info, *toStore, result.GetStatus(), publicId);
+          answer_.append(info);
+        }
+        catch (OrthancException& e)
+        {
+          if (e.GetErrorCode() == ErrorCode_BadFileFormat)
+          {
+            LOG(ERROR) << "Cannot import non-DICOM part from multipart upload";
+          }
+          else
+          {
+            throw;
+          }
+        }
+      }
+
+      const Json::Value& GetAnswer() const
+      {
+        return answer_;
+      }
+    };
+
+    OrthancRestApi&                         that_;
+    std::string                             remoteIp_;
+    std::string                             username_;
+    UriComponents                           uri_;
+    HttpToolbox::Arguments                  headers_;
+    size_t                                  bufferSize_;
+    std::unique_ptr<MultipartHandler>       multipartHandler_;
+    std::unique_ptr<MultipartStreamReader>  multipartReader_;
+    ChunkedBuffer                           memory_;
+    std::unique_ptr<FileBuffer>             file_;
+
+    void AnswerJson(HttpOutput& output,
+                    const Json::Value& answer)
+    {
+      RestApiOutput wrappedOutput(output, HttpMethod_Post);
+      wrappedOutput.AnswerJson(answer);
+      wrappedOutput.Finalize();
+    }
+
+    void HandleBuffer(HttpOutput& output,
+                      const std::string& body)
+    {
+      /**
+       * Delegate to "UploadDicomFile()" through the full chain of
+       * HTTP handlers, as if the body had not been streamed. The
+       * chunked readers never see the query string of the request,
+       * which is not used by "POST /instances" anyway.
+       **/
+      HttpToolbox::GetArguments getArguments;
+      if (!that_.context_.GetHttpHandler().Handle(
+            output, RequestOrigin_RestApi, remoteIp_.c_str(), username_.c_str(), HttpMethod_Post,
+            uri_, headers_, getArguments, body.empty() ? NULL : body.c_str(), body.size()))
+      {
+        throw OrthancException(ErrorCode_UnknownResource);
+      }
+    }
+
+  public:
+    UploadDicomFileReader(OrthancRestApi& that,
+                          const char* remoteIp,
+                          const char* username,
+                          const UriComponents& uri,
+                          const HttpToolbox::Arguments& headers) :
+      that_(that),
+      remoteIp_(remoteIp),
+      username_(username),
+      uri_(uri),
+      headers_(headers),
+      bufferSize_(that.uploadBufferSize_)
+    {
+      HttpToolbox::Arguments::const_iterator contentType = headers.find("content-type");
+
+      std::string type, subType, boundary;
+      if (contentType != headers.end() &&
+          MultipartStreamReader::ParseMultipartContentType(type, subType, boundary, contentType->second) &&
+          type == "multipart/related")
+      {
+        multipartHandler_.reset(new MultipartHandler(that.context_, DicomInstanceOrigin::FromHttp(remoteIp, username), subType));
+        multipartReader_.reset(new MultipartStreamReader(boundary));
+        multipartReader_->SetHandler(*multipartHandler_);
+      }
+    }
+
+    virtual void AddBodyChunk(const void* data,
+                              size_t size) ORTHANC_OVERRIDE
+    {
+      if (multipartReader_.get() != NULL)
+      {
+        multipartReader_->AddChunk(data, size);
+      }
+      else if (file_.get() != NULL)
+      {
+        file_->Append(reinterpret_cast<const char*>(data), size);
+      }
+      else if (memory_.GetNumBytes() + size <= bufferSize_)
+      {
+        memory_.AddChunk(data, size);
+      }
+      else
+      {
+        // The body is too large to be kept in RAM
+        std::string buffer;
+        memory_.Flatten(buffer);
+
+        file_.reset(new FileBuffer);
+        file_->Append(buffer.c_str(), buffer.size());
+        file_->Append(reinterpret_cast<const char*>(data), size);
+      }
+    }
+
+    virtual void Execute(HttpOutput& output) ORTHANC_OVERRIDE
+    {
+      if (multipartReader_.get() != NULL)
+      {
+        MetricsRegistry::Timer timer(that_.context_.GetMetricsRegistry(), "orthanc_rest_api_duration_ms");
+        MetricsRegistry::ActiveCounter counter(that_.activeRequests_);
+
+        multipartReader_->CloseStream();
+        AnswerJson(output, multipartHandler_->GetAnswer());
+      }
+      else if (file_.get() != NULL)
+      {
+        CLOG(INFO, HTTP) << "Receiving a DICOM file of " << file_->GetSize()
+                         << " bytes through HTTP, spilled to a temporary file";
+
+        if (ZipReader::IsZipFile(file_->GetPath()))
+        {
+          MetricsRegistry::Timer timer(that_.context_.GetMetricsRegistry(), "orthanc_rest_api_duration_ms");
+          MetricsRegistry::ActiveCounter counter(that_.activeRequests_);
+
+          // Extract the DICOM instances one by one from the temporary file
+          std::unique_ptr<ZipReader> reader(ZipReader::CreateFromFile(file_->GetPath()));
+
+          Json::Value answer;
+          StoreZipArchive(answer, that_.context_, *reader, DicomInstanceOrigin::FromHttp(remoteIp_.c_str(), username_.c_str()));
+          AnswerJson(output, answer);
+        }
+        else
+        {
+          std::string body;
+          file_->Read(body);
+          file_.reset(NULL);  // Remove the temporary file as soon as possible
+          HandleBuffer(output, body);
+        }
+      }
+      else
+      {
+        std::string body;
+        memory_.Flatten(body);
+        HandleBuffer(output, body);
+      }
+    }
+  };
+
+
+
   // Registration of the various REST handlers --------------------------------
 
   OrthancRestApi::OrthancRestApi(ServerContext& context, 
@@ -261,6 +502,12 @@ namespace Orthanc
                     "orthanc_rest_api_active_requests", 
                     MetricsType_MaxOver10Seconds)
   {
+    {
+      OrthancConfiguration::ReaderLock lock;
+      uploadBufferSize_ = static_cast<size_t>(
+        lock.GetConfiguration().GetUnsignedIntegerParameter("HttpRequestChunkSize", 1024)) * 1024;  // New in Orthanc 1.11.2
+    }
+
     RegisterSystem(orthancExplorerEnabled);
 
     RegisterChanges();
@@ -278,6 +525,37 @@ namespace Orthanc
   }
 
 
+  bool OrthancRestApi::CreateChunkedRequestReader(std::unique_ptr<IChunkedRequestReader>& target,
+                                                  RequestOrigin origin,
+                                                  const char* remoteIp,
+                                                  const char* username,
+                                                  HttpMethod method,
+                                                  const UriComponents& uri,
+                                                  const HttpToolbox::Arguments& headers)
+  {
+    if (method == HttpMethod_Post &&
+        uri.size() == 1 &&
+        uri[0] == "instances")
+    {
+#if ORTHANC_ENABLE_PLUGINS == 1
+      if (context_.HasPlugins() &&
+          context_.GetPlugins().HasRestCallback(uri))
+      {
+        // A plugin overrides "POST /instances": Don't stream the body
+        return false;
+      }
+#endif
+
+      target.reset(new UploadDicomFileReader(*this, remoteIp, username, uri, headers));
+      return true;
+    }
+    else
+    {
+      return RestApi::CreateChunkedRequestReader(target, origin, remoteIp, username, method, uri, headers);
+    }
+  }
+
+
   bool OrthancRestApi::Handle(HttpOutput& output,
                               RequestOrigin origin,
                               const char* remoteIp,
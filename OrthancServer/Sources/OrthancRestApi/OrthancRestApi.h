@@ -42,10 +42,13 @@ namespace Orthanc
     typedef std::set<std::string> SetOfStrings;
 
   private:
+    class UploadDicomFileReader;
+
     ServerContext&                  context_;
     bool                            leaveBarrier_;
     bool                            resetRequestReceived_;
     MetricsRegistry::SharedMetrics  activeRequests_;
+    size_t                          uploadBufferSize_;
 
     void RegisterSystem(bool orthancExplorerEnabled);
 
@@ -67,6 +70,14 @@ namespace Orthanc
     explicit OrthancRestApi(ServerContext& context,
                             bool orthancExplorerEnabled);
 
+    virtual bool CreateChunkedRequestReader(std::unique_ptr<IChunkedRequestReader>& target,
+                                            RequestOrigin origin,
+                                            const char* remoteIp,
+                                            const char* username,
+                                            HttpMethod method,
+                                            const UriComponents& uri,
+                                            const HttpToolbox::Arguments& headers) ORTHANC_OVERRIDE;
+
     virtual bool Handle(HttpOutput& output,
                         RequestOrigin origin,
                         const char* remoteIp,
@@ -42,6 +42,7 @@ namespace Orthanc
   static const char* const KEY_TRANSCODE = "Transcode";
 
   static const char* const CONFIG_LOADER_THREADS = "ZipLoaderThreads";
+  static const char* const CONFIG_COMPRESSION_THREADS = "ZipCompressionThreads";
 
   static void AddResourcesOfInterestFromArray(ArchiveJob& job,
                                               const Json::Value& resources)
@@ -115,6 +116,7 @@ namespace Orthanc
                                DicomTransferSyntax& syntax,  /* out */
                                int& priority,                /* out */
                                unsigned int& loaderThreads,  /* out */
+                               unsigned int& compressionThreads,  /* out */
                                const Json::Value& body,      /* in */
                                const bool defaultExtended    /* in */)
   {
@@ -147,6 +149,7 @@ namespace Orthanc
     {
       OrthancConfiguration::ReaderLock lock;
       loaderThreads = lock.GetConfiguration().GetUnsignedIntegerParameter(CONFIG_LOADER_THREADS, 0);  // New in Orthanc 1.10.0
+      compressionThreads = lock.GetConfiguration().GetUnsignedIntegerParameter(CONFIG_COMPRESSION_THREADS, 0);  // New in Orthanc 1.11.2
     }
    
   }
@@ -552,9 +555,9 @@ namespace Orthanc
       bool synchronous, extended, transcode;
       DicomTransferSyntax transferSyntax;
       int priority;
-      unsigned int loaderThreads;
+      unsigned int loaderThreads, compressionThreads;
       GetJobParameters(synchronous, extended, transcode, transferSyntax,
-                       priority, loaderThreads, body, DEFAULT_IS_EXTENDED);
+                       priority, loaderThreads, compressionThreads, body, DEFAULT_IS_EXTENDED);
       
       std::unique_ptr<ArchiveJob> job(new ArchiveJob(context, IS_MEDIA, extended));
       AddResourcesOfInterest(*job, body);
@@ -565,6 +568,7 @@ namespace Orthanc
       }
       
       job->SetLoaderThreads(loaderThreads);
+      job->SetCompressionThreads(compressionThreads);
 
       SubmitJob(call.GetOutput(), context, job, priority, synchronous, "Archive.zip");
     }
@@ -638,6 +642,9 @@ namespace Orthanc
       OrthancConfiguration::ReaderLock lock;
       unsigned int loaderThreads = lock.GetConfiguration().GetUnsignedIntegerParameter(CONFIG_LOADER_THREADS, 0);  // New in Orthanc 1.10.0
       job->SetLoaderThreads(loaderThreads);
+
+      unsigned int compressionThreads = lock.GetConfiguration().GetUnsignedIntegerParameter(CONFIG_COMPRESSION_THREADS, 0);  // New in Orthanc 1.11.2
+      job->SetCompressionThreads(compressionThreads);
     }
 
     SubmitJob(call.GetOutput(), context, job, 0 /* priority */,
@@ -673,9 +680,9 @@ namespace Orthanc
       bool synchronous, extended, transcode;
       DicomTransferSyntax transferSyntax;
       int priority;
-      unsigned int loaderThreads;
+      unsigned int loaderThreads, compressionThreads;
       GetJobParameters(synchronous, extended, transcode, transferSyntax,
-                       priority, loaderThreads, body, false /* by default, not extented */);
+                       priority, loaderThreads, compressionThreads, body, false /* by default, not extented */);
       
       std::unique_ptr<ArchiveJob> job(new ArchiveJob(context, IS_MEDIA, extended));
       job->AddResource(id);
@@ -686,6 +693,7 @@ namespace Orthanc
       }
 
       job->SetLoaderThreads(loaderThreads);
+      job->SetCompressionThreads(compressionThreads);
 
       SubmitJob(call.GetOutput(), context, job, priority, synchronous, id + ".zip");
     }
@@ -1687,6 +1687,10 @@ namespace Orthanc
   {
     static const char* KEY_TRANSCODE = "Transcode";
     static const char* KEY_COMPRESS = "Compress";
+    static const char* KEY_COMPRESSION_LEVEL = "CompressionLevel";
+    static const char* KEY_BATCH_INSTANCES = "BatchInstances";
+    static const char* KEY_BATCH_SIZE = "BatchSize";
+    static const char* KEY_BATCH_THREADS = "BatchThreads";
 
     if (call.IsDocumentation())
     {
@@ -1703,6 +1707,19 @@ namespace Orthanc
                          "Transcode to the provided DICOM transfer syntax before the actual sending", false)
         .SetRequestField(KEY_COMPRESS, RestApiCallDocumentation::Type_Boolean,
                          "Whether to compress the DICOM instances using gzip before the actual sending", false)
+        .SetRequestField(KEY_COMPRESSION_LEVEL, RestApiCallDocumentation::Type_Number,
+                         "Compression level between 0 and 9, if `Compress` is `true`. Defaults to the "
+                         "`OrthancPeersStoreCompressionLevel` configuration option (new in Orthanc 1.11.2)", false)
+        .SetRequestField(KEY_BATCH_INSTANCES, RestApiCallDocumentation::Type_Number,
+                         "If above 1, pack up to this number of instances into each ZIP archive that is sent "
+                         "to the peer. Defaults to the `OrthancPeersStoreBatchInstances` configuration option "
+                         "(new in Orthanc 1.11.2)", false)
+        .SetRequestField(KEY_BATCH_SIZE, RestApiCallDocumentation::Type_Number,
+                         "Maximum size of the DICOM instances in one batch, in MB. Defaults to the "
+                         "`OrthancPeersStoreBatchSize` configuration option (new in Orthanc 1.11.2)", false)
+        .SetRequestField(KEY_BATCH_THREADS, RestApiCallDocumentation::Type_Number,
+                         "Number of batches that are sent concurrently. Defaults to the "
+                         "`OrthancPeersStoreBatchThreads` configuration option (new in Orthanc 1.11.2)", false)
         .SetUriArgument("id", "Identifier of the modality of interest");
       return;
     }
@@ -1727,6 +1744,38 @@ namespace Orthanc
     {
       job->SetCompress(SerializationToolbox::ReadBoolean(request, KEY_COMPRESS));
     }
+
+    {
+      // New in Orthanc 1.11.2
+      unsigned int compressionLevel, batchInstances, batchSize, batchThreads;
+
+      {
+        OrthancConfiguration::ReaderLock lock;
+        compressionLevel = lock.GetConfiguration().GetUnsignedIntegerParameter("OrthancPeersStoreCompressionLevel", 9);
+        batchInstances = lock.GetConfiguration().GetUnsignedIntegerParameter("OrthancPeersStoreBatchInstances", 0);
+        batchSize = lock.GetConfiguration().GetUnsignedIntegerParameter("OrthancPeersStoreBatchSize", 64);
+        batchThreads = lock.GetConfiguration().GetUnsignedIntegerParameter("OrthancPeersStoreBatchThreads", 1);
+      }
+
+      if (request.type() == Json::objectValue)
+      {
+        compressionLevel = SerializationToolbox::ReadUnsignedInteger(request, KEY_COMPRESSION_LEVEL, compressionLevel);
+        batchInstances = SerializationToolbox::ReadUnsignedInteger(request, KEY_BATCH_INSTANCES, batchInstances);
+        batchSize = SerializationToolbox::ReadUnsignedInteger(request, KEY_BATCH_SIZE, batchSize);
+        batchThreads = SerializationToolbox::ReadUnsignedInteger(request, KEY_BATCH_THREADS, batchThreads);
+      }
+
+      if (compressionLevel > 9)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange,
+                               "The compression level must be between 0 and 9");
+      }
+
+      job->SetCompressionLevel(static_cast<uint8_t>(compressionLevel));
+      job->SetBatchInstances(batchInstances);
+      job->SetBatchSize(static_cast<uint64_t>(batchSize) * 1024 * 1024);
+      job->SetBatchThreads(batchThreads);
+    }
     
     {
       OrthancConfiguration::ReaderLock lock;
@@ -29,9 +29,11 @@
 #include "../../../OrthancFramework/Sources/DicomParsing/FromDcmtkBridge.h"
 #include "../../../OrthancFramework/Sources/DicomParsing/Internals/DicomImageDecoder.h"
 #include "../../../OrthancFramework/Sources/HttpServer/HttpContentNegociation.h"
+#include "../../../OrthancFramework/Sources/HttpServer/IHttpStreamAnswer.h"
 #include "../../../OrthancFramework/Sources/Images/Image.h"
 #include "../../../OrthancFramework/Sources/Images/ImageProcessing.h"
 #include "../../../OrthancFramework/Sources/Images/NumpyWriter.h"
+#include "../../../OrthancFramework/Sources/Images/PngWriter.h"
 #include "../../../OrthancFramework/Sources/Logging.h"
 #include "../../../OrthancFramework/Sources/MultiThreading/Semaphore.h"
 #include "../../../OrthancFramework/Sources/SerializationToolbox.h"
@@ -125,6 +127,106 @@ namespace Orthanc
 
 
   // List all the patients, studies, series or instances ----------------------
+
+  namespace
+  {
+    /**
+     * Sends the JSON array of the expanded resources using chunked
+     * transfer, one resource at a time, so that the full answer is
+     * never stored in memory (new in Orthanc 1.11.2)
+     **/
+    class ExpandedResourcesSender : public IHttpStreamAnswer
+    {
+    private:
+      ServerContext&                          context_;
+      const std::list<std::string>&           resources_;
+      std::list<std::string>::const_iterator  current_;
+      ResourceType                            level_;
+      DicomToJsonFormat                       format_;
+      const std::set<DicomTag>&               requestedTags_;
+      bool                                    isFirst_;
+      bool                                    done_;
+      std::string                             chunk_;
+
+    public:
+      ExpandedResourcesSender(ServerContext& context,
+                              const std::list<std::string>& resources,
+                              ResourceType level,
+                              DicomToJsonFormat format,
+                              const std::set<DicomTag>& requestedTags) :
+        context_(context),
+        resources_(resources),
+        current_(resources.begin()),
+        level_(level),
+        format_(format),
+        requestedTags_(requestedTags),
+        isFirst_(true),
+        done_(false)
+      {
+      }
+
+      virtual HttpCompression SetupHttpCompression(bool gzipAllowed,
+                                                   bool deflateAllowed) ORTHANC_OVERRIDE
+      {
+        // This function is not called by HttpOutput::AnswerWithoutBuffering()
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      virtual bool HasContentFilename(std::string& filename) ORTHANC_OVERRIDE
+      {
+        return false;
+      }
+
+      virtual std::string GetContentType() ORTHANC_OVERRIDE
+      {
+        return MIME_JSON_UTF8;
+      }
+
+      virtual uint64_t GetContentLength() ORTHANC_OVERRIDE
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      virtual bool ReadNextChunk() ORTHANC_OVERRIDE
+      {
+        if (done_)
+        {
+          return false;
+        }
+
+        while (current_ != resources_.end())
+        {
+          Json::Value expanded;
+          const bool found = context_.ExpandResource(expanded, *current_, level_, format_, requestedTags_);
+          ++current_;
+
+          if (found)  // Ignore the resources that were deleted since the lookup
+          {
+            std::string s;
+            Toolbox::WriteStyledJson(s, expanded);
+            chunk_ = (isFirst_ ? "[\n" : ",\n") + s;
+            isFirst_ = false;
+            return true;
+          }
+        }
+
+        chunk_ = (isFirst_ ? "[]\n" : "\n]\n");
+        done_ = true;
+        return true;
+      }
+
+      virtual const char* GetChunkContent() ORTHANC_OVERRIDE
+      {
+        return chunk_.c_str();
+      }
+
+      virtual size_t GetChunkSize() ORTHANC_OVERRIDE
+      {
+        return chunk_.size();
+      }
+    };
+  }
+
  
   static void AnswerListOfResources(RestApiOutput& output,
                                     ServerContext& context,
@@ -137,6 +239,26 @@ namespace Orthanc
                                     DicomToJsonFormat format,
                                     const std::set<DicomTag>& requestedTags)
   {
+    if (expand &&
+        !output.IsConvertJsonToXml())
+    {
+      unsigned int threshold;
+
+      {
+        OrthancConfiguration::ReaderLock lock;
+        threshold = lock.GetConfiguration().GetUnsignedIntegerParameter("ExpandStreamingThreshold", 0);  // New in Orthanc 1.11.2
+      }
+
+      if (threshold != 0 &&
+          resources.size() >= threshold)
+      {
+        LOG(INFO) << "Streaming the " << resources.size() << " expanded resources of the answer";
+        ExpandedResourcesSender sender(context, resources, level, format, requestedTags);
+        output.AnswerWithoutBuffering(sender);
+        return;
+      }
+    }
+
     Json::Value answer = Json::arrayValue;
 
     for (std::list<std::string>::const_iterator
@@ -176,6 +298,44 @@ namespace Orthanc
   }
 
 
+  // Keyset pagination (new in Orthanc 1.11.2). The cursors are
+  // opaque to the clients: They encode the internal ID of the last
+  // resource that was examined, which is robust to the deletion of
+  // this resource between two pages. An empty cursor reads the first
+  // page. The cursor of the next page is reported as a HTTP header,
+  // that is absent if the last page was reached.
+  static const char* const NEXT_CURSOR_HEADER = "Orthanc-Next-Cursor";
+
+  static int64_t ParseCursor(const std::string& cursor)
+  {
+    if (cursor.empty())
+    {
+      return 0;
+    }
+
+    try
+    {
+      int64_t value = boost::lexical_cast<int64_t>(cursor);
+      if (value >= 0)
+      {
+        return value;
+      }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+    }
+
+    throw OrthancException(ErrorCode_ParameterOutOfRange, "Invalid cursor for keyset pagination: " + cursor);
+  }
+
+
+  static void SetNextCursor(RestApiOutput& output,
+                            int64_t next)
+  {
+    output.GetLowLevelOutput().AddHeader(NEXT_CURSOR_HEADER, boost::lexical_cast<std::string>(next));
+  }
+
+
   template <enum ResourceType resourceType>
   static void ListResources(RestApiGetCall& call)
   {
@@ -185,16 +345,23 @@ namespace Orthanc
       OrthancRestApi::DocumentRequestedTags(call);
 
       const std::string resources = GetResourceTypeText(resourceType, true /* plural */, false /* lower case */);
+      const std::string resource = GetResourceTypeText(resourceType, false /* plural */, false /* lower case */);
       call.GetDocumentation()
         .SetTag(GetResourceTypeText(resourceType, true /* plural */, true /* upper case */))
         .SetSummary("List the available " + resources)
         .SetDescription("List the Orthanc identifiers of all the available DICOM " + resources)
         .SetHttpGetArgument("limit", RestApiCallDocumentation::Type_Number, "Limit the number of results", false)
         .SetHttpGetArgument("since", RestApiCallDocumentation::Type_Number, "Show only the resources since the provided index", false)
+        .SetHttpGetArgument("after", RestApiCallDocumentation::Type_String,
+                            "Keyset pagination: Opaque cursor that was reported in the `" +
+                            std::string(NEXT_CURSOR_HEADER) + "` HTTP header of the previous page, or empty "
+                            "string to read the first page (incompatible with `since`)", false)
         .SetHttpGetArgument("expand", RestApiCallDocumentation::Type_String,
                             "If present, retrieve detailed information about the individual " + resources, false)
         .AddAnswerType(MimeType_Json, "JSON array containing either the Orthanc identifiers, or detailed information "
                        "about the reported " + resources + " (if `expand` argument is provided)")
+        .SetAnswerHeader(NEXT_CURSOR_HEADER, "If `after` is provided, cursor to read the next page, "
+                         "absent if the last page was reached")
         .SetHttpGetSample("https://demo.orthanc-server.com/" + resources + "?since=0&limit=2", true);
       return;
     }
@@ -207,8 +374,39 @@ namespace Orthanc
     std::set<DicomTag> requestedTags;
     OrthancRestApi::GetRequestedTags(requestedTags, call);
 
-    if (call.HasArgument("limit") ||
-        call.HasArgument("since"))
+    if (call.HasArgument("after"))
+    {
+      // New in Orthanc 1.11.2
+      if (call.HasArgument("since"))
+      {
+        throw OrthancException(ErrorCode_BadRequest,
+                               "Arguments \"since\" and \"after\" cannot be used together for GET request against: " +
+                               call.FlattenUri());
+      }
+
+      size_t limit = 0;
+      if (call.HasArgument("limit"))
+      {
+        limit = boost::lexical_cast<size_t>(call.GetArgument("limit", ""));
+      }
+
+      // Read one more resource to know whether this is the last page
+      std::vector<std::string> tmp;
+      std::vector<int64_t> internalIds;
+      index.ApplyLookupResources(tmp, NULL, internalIds, DatabaseLookup(), resourceType,
+                                 ParseCursor(call.GetArgument("after", "")), (limit == 0 ? 0 : limit + 1));
+
+      if (limit != 0 &&
+          tmp.size() > limit)
+      {
+        tmp.resize(limit);
+        SetNextCursor(call.GetOutput(), internalIds[limit - 1]);
+      }
+
+      result.assign(tmp.begin(), tmp.end());
+    }
+    else if (call.HasArgument("limit") ||
+             call.HasArgument("since"))
     {
       if (!call.HasArgument("limit"))
       {
@@ -551,6 +749,40 @@ namespace Orthanc
 
   namespace
   {
+    // Returns "true" iff. the PNG images must be encoded favoring
+    // speed over size (new in Orthanc 1.11.2)
+    static bool IsPngSpeedProfile(const RestApiGetCall& call)
+    {
+      std::string profile;
+
+      if (call.HasArgument("png-compression"))
+      {
+        profile = call.GetArgument("png-compression", "");
+      }
+      else
+      {
+        OrthancConfiguration::ReaderLock lock;
+        profile = lock.GetConfiguration().GetStringParameter("PngCompression", "Default");
+      }
+
+      Toolbox::ToLowerCase(profile);
+
+      if (profile == "default")
+      {
+        return false;
+      }
+      else if (profile == "speed")
+      {
+        return true;
+      }
+      else
+      {
+        throw OrthancException(ErrorCode_BadRequest,
+                               "Bad profile for a PNG encoding (must be \"default\" or \"speed\"): " + profile);
+      }
+    }
+
+
     class ImageToEncode
     {
     private:
@@ -576,10 +808,22 @@ namespace Orthanc
         output.AnswerBuffer(answer_, format_);
       }
 
-      void EncodeUsingPng()
+      const std::string& GetAnswer() const
+      {
+        return answer_;
+      }
+
+      void EncodeUsingPng(bool speed)
       {
         format_ = MimeType_Png;
-        DicomImageDecoder::ExtractPngImage(answer_, image_, mode_, invert_);
+
+        PngWriter writer;
+        if (speed)
+        {
+          writer.SetSpeedProfile();
+        }
+
+        DicomImageDecoder::ExtractPngImage(answer_, image_, mode_, invert_, writer);
       }
 
       void EncodeUsingPam()
@@ -599,9 +843,13 @@ namespace Orthanc
     {
     private:
       ImageToEncode&  image_;
+      bool            speed_;
 
     public:
-      explicit EncodePng(ImageToEncode& image) : image_(image)
+      EncodePng(ImageToEncode& image,
+                const RestApiGetCall& call) :
+        image_(image),
+        speed_(IsPngSpeedProfile(call))
       {
       }
 
@@ -610,7 +858,7 @@ namespace Orthanc
       {
         assert(type == "image");
         assert(subtype == "png");
-        image_.EncodeUsingPng();
+        image_.EncodeUsingPng(speed_);
       }
     };
 
@@ -672,6 +920,29 @@ namespace Orthanc
         image_.EncodeUsingJpeg(quality_);
       }
     };
+
+    // Only records the result of the content negotiation, without
+    // encoding anything (new in Orthanc 1.11.2)
+    class RecordFormat : public HttpContentNegociation::IHandler
+    {
+    private:
+      MimeType&  target_;
+      MimeType   format_;
+
+    public:
+      RecordFormat(MimeType& target,
+                   MimeType format) :
+        target_(target),
+        format_(format)
+      {
+      }
+
+      virtual void Handle(const std::string& /* type */,
+                          const std::string& /* subtype */) ORTHANC_OVERRIDE
+      {
+        target_ = format_;
+      }
+    };
   }
 
 
@@ -679,6 +950,95 @@ namespace Orthanc
   {
     class IDecodedFrameHandler : public boost::noncopyable
     {
+    private:
+      std::string  cacheKey_;  // Empty if the rendered cache is disabled
+
+      // Computes the key of the frame in the cache of the rendered
+      // images, which depends on the DICOM file (to take overwritten
+      // instances into account), on the frame, on the kind of
+      // rendering, on the negotiated format and on the arguments.
+      bool LookupCacheKey(MimeType& format,
+                          ServerContext& context,
+                          const RestApiGetCall& call,
+                          const std::string& publicId,
+                          unsigned int frame)
+      {
+        static const char* const ARGUMENTS[] = {
+          "filter", "height", "quality", "smooth", "width", "window-center", "window-width"
+        };
+
+        HttpContentNegociation negociation;
+        RecordFormat png(format, MimeType_Png);
+        negociation.Register(MIME_PNG, png);
+
+        RecordFormat jpeg(format, MimeType_Jpeg);
+        negociation.Register(MIME_JPEG, jpeg);
+
+        RecordFormat pam(format, MimeType_Pam);
+        negociation.Register(MIME_PAM, pam);
+
+        FileInfo attachment;
+        int64_t revision;
+        if (!negociation.Apply(call.GetHttpHeaders()) ||
+            !context.GetIndex().LookupAttachment(attachment, revision, publicId, FileContentType_Dicom))
+        {
+          return false;
+        }
+
+        std::string parameters = (attachment.GetUuid() + "|" +
+                                  boost::lexical_cast<std::string>(frame) + "|" +
+                                  GetCacheName() + "|" +
+                                  EnumerationToString(format));
+
+        if (format == MimeType_Png &&
+            IsPngSpeedProfile(call))
+        {
+          // The "png-compression" argument is not part of "ARGUMENTS",
+          // as its default value is taken from the configuration
+          parameters += "|png-compression=speed";
+        }
+
+        for (size_t i = 0; i < sizeof(ARGUMENTS) / sizeof(const char*); i++)
+        {
+          if (call.HasArgument(ARGUMENTS[i]))
+          {
+            parameters += std::string("|") + ARGUMENTS[i] + "=" + call.GetArgument(ARGUMENTS[i], "");
+          }
+        }
+
+        cacheKey_ = RenderedImageCache::ComputeKey(publicId, parameters);
+        return true;
+      }
+
+    protected:
+      void DefaultHandler(RestApiGetCall& call,
+                          std::unique_ptr<ImageAccessor>& decoded,
+                          ImageExtractionMode mode,
+                          bool invert)
+      {
+        ImageToEncode image(decoded, mode, invert);
+
+        HttpContentNegociation negociation;
+        EncodePng png(image, call);
+        negociation.Register(MIME_PNG, png);
+
+        EncodeJpeg jpeg(image, call);
+        negociation.Register(MIME_JPEG, jpeg);
+
+        EncodePam pam(image);
+        negociation.Register(MIME_PAM, pam);
+
+        if (negociation.Apply(call.GetHttpHeaders()))
+        {
+          image.Answer(call.GetOutput());
+
+          if (!cacheKey_.empty())
+          {
+            OrthancRestApi::GetContext(call).GetRenderedCache().Add(cacheKey_, image.GetAnswer());
+          }
+        }
+      }
+
     public:
       virtual ~IDecodedFrameHandler()
       {
@@ -692,6 +1052,9 @@ namespace Orthanc
 
       virtual bool RequiresDicomTags() const = 0;
 
+      // Name of the kind of rendering, for the rendered cache
+      virtual std::string GetCacheName() const = 0;
+
       static void Apply(RestApiGetCall& call,
                         IDecodedFrameHandler& handler,
                         ImageExtractionMode mode /* for generation of documentation */,
@@ -748,7 +1111,10 @@ namespace Orthanc
               .SetHttpGetArgument("window-width",RestApiCallDocumentation::Type_Number, "Windowing width", false)
               .SetHttpGetArgument("width",RestApiCallDocumentation::Type_Number, "Width of the resized image", false)
               .SetHttpGetArgument("height",RestApiCallDocumentation::Type_Number, "Height of the resized image", false)
-              .SetHttpGetArgument("smooth",RestApiCallDocumentation::Type_Boolean, "Whether to smooth image on resize", false);
+              .SetHttpGetArgument("smooth",RestApiCallDocumentation::Type_Boolean, "Whether to smooth image on resize "
+                                  "(this is an alias for `filter=lanczos`)", false)
+              .SetHttpGetArgument("filter",RestApiCallDocumentation::Type_String, "Resampling filter on resize: "
+                                  "`nearest` (default), `box`, `bilinear` or `lanczos` (new in Orthanc 1.11.2)", false);
           }
           else
           {
@@ -776,6 +1142,9 @@ namespace Orthanc
             .SetTag("Instances")
             .SetUriArgument("id", "Orthanc identifier of the DICOM instance of interest")
             .SetHttpGetArgument("quality", RestApiCallDocumentation::Type_Number, "Quality for JPEG images (between 1 and 100, defaults to 90)", false)
+            .SetHttpGetArgument("png-compression", RestApiCallDocumentation::Type_String, "Compression profile for PNG images: "
+                                "`default` or `speed` (faster, but larger images). Defaults to the `PngCompression` "
+                                "configuration option (new in Orthanc 1.11.2)", false)
             .SetHttpGetArgument("returnUnsupportedImage", RestApiCallDocumentation::Type_Boolean, "Returns an unsupported.png placeholder image if unable to provide the image instead of returning a 415 HTTP error (defaults to false)", false)
             .SetHttpHeader("Accept", "Format of the resulting image. Can be `image/png` (default), `image/jpeg` or `image/x-portable-arbitrarymap`")
             .AddAnswerType(MimeType_Png, "PNG image")
@@ -806,6 +1175,19 @@ namespace Orthanc
         {
           std::string publicId = call.GetUriComponent("id", "");
 
+          if (context.GetRenderedCache().IsEnabled())
+          {
+            // New in Orthanc 1.11.2
+            MimeType format;
+            std::string content;
+            if (handler.LookupCacheKey(format, context, call, publicId, frame) &&
+                context.GetRenderedCache().Fetch(content, handler.cacheKey_))
+            {
+              call.GetOutput().AnswerBuffer(content, format);
+              return;
+            }
+          }
+
           decoded.reset(context.DecodeDicomFrame(publicId, frame));
 
           if (decoded.get() == NULL)
@@ -858,30 +1240,6 @@ namespace Orthanc
         }
 
       }
-
-
-      static void DefaultHandler(RestApiGetCall& call,
-                                 std::unique_ptr<ImageAccessor>& decoded,
-                                 ImageExtractionMode mode,
-                                 bool invert)
-      {
-        ImageToEncode image(decoded, mode, invert);
-
-        HttpContentNegociation negociation;
-        EncodePng png(image);
-        negociation.Register(MIME_PNG, png);
-
-        EncodeJpeg jpeg(image, call);
-        negociation.Register(MIME_JPEG, jpeg);
-
-        EncodePam pam(image);
-        negociation.Register(MIME_PAM, pam);
-
-        if (negociation.Apply(call.GetHttpHeaders()))
-        {
-          image.Answer(call.GetOutput());
-        }
-      }
     };
 
 
@@ -924,6 +1282,23 @@ namespace Orthanc
       {
         return mode_ == ImageExtractionMode_Preview;
       }
+
+      virtual std::string GetCacheName() const ORTHANC_OVERRIDE
+      {
+        switch (mode_)
+        {
+          case ImageExtractionMode_Preview:
+            return "preview";
+          case ImageExtractionMode_UInt8:
+            return "uint8";
+          case ImageExtractionMode_UInt16:
+            return "uint16";
+          case ImageExtractionMode_Int16:
+            return "int16";
+          default:
+            throw OrthancException(ErrorCode_ParameterOutOfRange);
+        }
+      }
     };
 
 
@@ -934,7 +1309,7 @@ namespace Orthanc
                                    double& windowCenter /* inout */,
                                    unsigned int& argWidth,
                                    unsigned int& argHeight,
-                                   bool& smooth,
+                                   ImageProcessing::ResamplingFilter& filter,
                                    const RestApiGetCall& call)
       {
         static const char* ARG_WINDOW_CENTER = "window-center";
@@ -942,6 +1317,7 @@ namespace Orthanc
         static const char* ARG_WIDTH = "width";
         static const char* ARG_HEIGHT = "height";
         static const char* ARG_SMOOTH = "smooth";
+        static const char* ARG_FILTER = "filter";
 
         if (call.HasArgument(ARG_WINDOW_WIDTH) &&
             !SerializationToolbox::ParseDouble(windowWidth, call.GetArgument(ARG_WINDOW_WIDTH, "")))
@@ -1004,12 +1380,47 @@ namespace Orthanc
           }
         }
 
-        smooth = false;
+        bool smooth = false;
 
         if (call.HasArgument(ARG_SMOOTH))
         {
           smooth = RestApiCall::ParseBoolean(call.GetArgument(ARG_SMOOTH, ""));
-        }        
+        }
+
+        if (call.HasArgument(ARG_FILTER))
+        {
+          // New in Orthanc 1.11.2
+          const std::string s = call.GetArgument(ARG_FILTER, "");
+          if (s == "nearest")
+          {
+            filter = ImageProcessing::ResamplingFilter_NearestNeighbor;
+          }
+          else if (s == "box")
+          {
+            filter = ImageProcessing::ResamplingFilter_Box;
+          }
+          else if (s == "bilinear")
+          {
+            filter = ImageProcessing::ResamplingFilter_Bilinear;
+          }
+          else if (s == "lanczos")
+          {
+            filter = ImageProcessing::ResamplingFilter_Lanczos3;
+          }
+          else
+          {
+            throw OrthancException(ErrorCode_ParameterOutOfRange,
+                                   "Bad value for argument: " + std::string(ARG_FILTER));
+          }
+        }
+        else if (smooth)
+        {
+          filter = ImageProcessing::ResamplingFilter_Lanczos3;
+        }
+        else
+        {
+          filter = ImageProcessing::ResamplingFilter_NearestNeighbor;
+        }
       }
                                 
       
@@ -1033,8 +1444,15 @@ namespace Orthanc
         dicom->GetDefaultWindowing(windowCenter, windowWidth, frame);
         
         unsigned int argWidth, argHeight;
-        bool smooth;
-        GetUserArguments(windowWidth, windowCenter, argWidth, argHeight, smooth, call);
+        ImageProcessing::ResamplingFilter filter;
+        GetUserArguments(windowWidth, windowCenter, argWidth, argHeight, filter, call);
+
+        unsigned int threadsCount;
+
+        {
+          OrthancConfiguration::ReaderLock lock;
+          threadsCount = lock.GetConfiguration().GetUnsignedIntegerParameter("RenderedResamplingThreads", 0);  // New in Orthanc 1.11.2
+        }
 
         unsigned int targetWidth = decoded->GetWidth();
         unsigned int targetHeight = decoded->GetHeight();
@@ -1075,15 +1493,7 @@ namespace Orthanc
           {
             std::unique_ptr<ImageAccessor> resized(
               new Image(decoded->GetFormat(), targetWidth, targetHeight, false));
-            
-            if (smooth &&
-                (targetWidth < decoded->GetWidth() ||
-                 targetHeight < decoded->GetHeight()))
-            {
-              ImageProcessing::SmoothGaussian5x5(*decoded, false /* be fast, don't round */);
-            }
-            
-            ImageProcessing::Resize(*resized, *decoded);
+            ImageProcessing::Resample(*resized, *decoded, filter, threadsCount);
             DefaultHandler(call, resized, ImageExtractionMode_Preview, false);
           }
         }
@@ -1121,15 +1531,7 @@ namespace Orthanc
           {
             std::unique_ptr<ImageAccessor> resized(
               new Image(PixelFormat_Grayscale8, targetWidth, targetHeight, false));
-            
-            if (smooth &&
-                (targetWidth < decoded->GetWidth() ||
-                 targetHeight < decoded->GetHeight()))
-            {
-              ImageProcessing::SmoothGaussian5x5(*rescaled, false /* be fast, don't round */);
-            }
-            
-            ImageProcessing::Resize(*resized, *rescaled);
+            ImageProcessing::Resample(*resized, *rescaled, filter, threadsCount);
             DefaultHandler(call, resized, ImageExtractionMode_UInt8, invert);
           }
         }
@@ -1139,6 +1541,11 @@ namespace Orthanc
       {
         return true;
       }
+
+      virtual std::string GetCacheName() const ORTHANC_OVERRIDE
+      {
+        return "rendered";
+      }
     };
   }
 
@@ -1505,8 +1912,11 @@ namespace Orthanc
     std::string raw;
     MimeType mime;
 
+    ServerContext& context = OrthancRestApi::GetContext(call);
+
+    if (!context.ReadRawFrame(raw, mime, publicId, frame))
     {
-      ServerContext::DicomCacheLocker locker(OrthancRestApi::GetContext(call), publicId);
+      ServerContext::DicomCacheLocker locker(context, publicId);
       locker.GetDicom().GetRawFrame(raw, mime, frame);
     }
 
@@ -2445,6 +2855,12 @@ namespace Orthanc
       {
         allowed = true;
       }
+      else if (contentType == FileContentType_Thumbnail)
+      {
+        // The thumbnail of a series is regenerated the next time the
+        // series becomes stable (new in Orthanc 1.11.2)
+        allowed = true;
+      }
       else
       {
         // It is forbidden to delete internal attachments, except for
@@ -2870,7 +3286,12 @@ namespace Orthanc
       
       virtual void MarkAsComplete() ORTHANC_OVERRIDE
       {
-        isComplete_ = true;  // Unused information as of Orthanc 1.5.0
+        isComplete_ = true;
+      }
+
+      bool IsComplete() const
+      {
+        return isComplete_;  // Only used by keyset pagination, new in Orthanc 1.11.2
       }
 
       virtual void Visit(const std::string& publicId,
@@ -2905,6 +3326,7 @@ namespace Orthanc
     static const char* const KEY_QUERY = "Query";
     static const char* const KEY_REQUESTED_TAGS = "RequestedTags";
     static const char* const KEY_SINCE = "Since";
+    static const char* const KEY_AFTER = "After";  // New in Orthanc 1.11.2
 
     if (call.IsDocumentation())
     {
@@ -2926,6 +3348,12 @@ namespace Orthanc
                          "Limit the number of reported resources", false)
         .SetRequestField(KEY_SINCE, RestApiCallDocumentation::Type_Number,
                          "Show only the resources since the provided index (in conjunction with `Limit`)", false)
+        .SetRequestField(KEY_AFTER, RestApiCallDocumentation::Type_String,
+                         "Keyset pagination: Opaque cursor that was reported in the `" +
+                         std::string(NEXT_CURSOR_HEADER) + "` HTTP header of the previous page, or empty "
+                         "string to read the first page (in conjunction with `Limit`, incompatible with `Since`)", false)
+        .SetAnswerHeader(NEXT_CURSOR_HEADER, "If `After` is provided, cursor to read the next page, "
+                         "absent if the last page was reached")
         .SetRequestField(KEY_REQUESTED_TAGS, RestApiCallDocumentation::Type_JsonListOfStrings,
                          "A list of DICOM tags to include in the response (applicable only if \"Expand\" is set to true).  "
                          "The tags requested tags are returned in the 'RequestedTags' field in the response.  "
@@ -2984,6 +3412,19 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadRequest, 
                              "Field \"" + std::string(KEY_REQUESTED_TAGS) + "\" should be an array");
     }
+    else if (request.isMember(KEY_AFTER) &&
+             request[KEY_AFTER].type() != Json::stringValue)
+    {
+      throw OrthancException(ErrorCode_BadRequest, 
+                             "Field \"" + std::string(KEY_AFTER) + "\" should be a string");
+    }
+    else if (request.isMember(KEY_AFTER) &&
+             request.isMember(KEY_SINCE))
+    {
+      throw OrthancException(ErrorCode_BadRequest, 
+                             "Fields \"" + std::string(KEY_SINCE) + "\" and \"" +
+                             std::string(KEY_AFTER) + "\" cannot be used together");
+    }
     else
     {
       bool expand = false;
@@ -3057,7 +3498,22 @@ namespace Orthanc
       }
 
       FindVisitor visitor(OrthancRestApi::GetDicomFormat(request, DicomToJsonFormat_Human));
-      context.Apply(visitor, query, level, since, limit);
+
+      if (request.isMember(KEY_AFTER))
+      {
+        int64_t next;
+        context.Apply(visitor, query, level, ParseCursor(request[KEY_AFTER].asString()), limit, next);
+
+        if (!visitor.IsComplete())
+        {
+          SetNextCursor(call.GetOutput(), next);
+        }
+      }
+      else
+      {
+        context.Apply(visitor, query, level, since, limit);
+      }
+
       visitor.Answer(call.GetOutput(), context, level, expand, requestedTags);
     }
   }
@@ -24,6 +24,7 @@
 #include "OrthancRestApi.h"
 
 #include "../../../OrthancFramework/Sources/DicomParsing/FromDcmtkBridge.h"
+#include "../../../OrthancFramework/Sources/HttpClient.h"
 #include "../../../OrthancFramework/Sources/MetricsRegistry.h"
 #include "../../Plugins/Engine/OrthancPlugins.h"
 #include "../../Plugins/Engine/PluginsManager.h"
@@ -857,6 +858,19 @@ namespace Orthanc
     registry.SetValue("orthanc_jobs_completed", jobsSuccess + jobsFailed);
     registry.SetValue("orthanc_jobs_success", jobsSuccess);
     registry.SetValue("orthanc_jobs_failed", jobsFailed);
+
+    uint64_t httpCreated, httpReused;
+    unsigned int httpIdle, httpActive;
+    HttpClient::GetConnectionPoolStatistics(httpCreated, httpReused, httpIdle, httpActive);
+    registry.SetValue("orthanc_http_client_handles_created", static_cast<float>(httpCreated));
+    registry.SetValue("orthanc_http_client_handles_reused", static_cast<float>(httpReused));
+    registry.SetValue("orthanc_http_client_handles_idle", httpIdle);
+    registry.SetValue("orthanc_http_client_handles_active", httpActive);
+
+    context.PublishStorageCacheMetrics();
+    context.PublishRenderedCacheMetrics();
+    context.PublishDeletionQueueMetrics();
+    context.PublishChangesMetrics();
     
     std::string s;
     registry.ExportPrometheusText(s);
@@ -0,0 +1,616 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "PrecompiledHeadersServer.h"
+#include "RenderedImageCache.h"
+
+#include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/MetricsRegistry.h"
+#include "../../OrthancFramework/Sources/OrthancException.h"
+#include "../../OrthancFramework/Sources/SystemToolbox.h"
+#include "../../OrthancFramework/Sources/Toolbox.h"
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+
+namespace Orthanc
+{
+  namespace
+  {
+    struct DiskEntry
+    {
+      std::time_t  time_;
+      std::string  key_;
+      uint64_t     size_;
+
+      DiskEntry(std::time_t time,
+                const std::string& key,
+                uint64_t size) :
+        time_(time),
+        key_(key),
+        size_(size)
+      {
+      }
+
+      bool operator< (const DiskEntry& other) const
+      {
+        return (time_ < other.time_ ||
+                (time_ == other.time_ && key_ < other.key_));
+      }
+    };
+  }
+
+
+  static std::string GetInstanceOfKey(const std::string& key)
+  {
+    size_t slash = key.find('/');
+    if (slash == std::string::npos)
+    {
+      throw OrthancException(ErrorCode_InternalError);
+    }
+    else
+    {
+      return key.substr(0, slash);
+    }
+  }
+
+
+  bool RenderedImageCache::Tier::Touch(const std::string& key)
+  {
+    if (index_.Contains(key))
+    {
+      index_.MakeMostRecent(key);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void RenderedImageCache::Tier::Add(const std::string& key,
+                                     uint64_t size)
+  {
+    uint64_t previous;
+    if (index_.Contains(key, previous))
+    {
+      assert(currentSize_ >= previous);
+      currentSize_ -= previous;
+    }
+
+    index_.AddOrMakeMostRecent(key, size);
+    instances_[GetInstanceOfKey(key)].insert(key);
+    currentSize_ += size;
+  }
+
+
+  bool RenderedImageCache::Tier::Remove(const std::string& key)
+  {
+    if (index_.Contains(key))
+    {
+      uint64_t size = index_.Invalidate(key);
+      assert(currentSize_ >= size);
+      currentSize_ -= size;
+
+      InstanceKeys::iterator found = instances_.find(GetInstanceOfKey(key));
+      if (found != instances_.end())
+      {
+        found->second.erase(key);
+        if (found->second.empty())
+        {
+          instances_.erase(found);
+        }
+      }
+
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  bool RenderedImageCache::Tier::RemoveOldestIfFull(std::string& key)
+  {
+    if (currentSize_ > maximumSize_ &&
+        !index_.IsEmpty())
+    {
+      key = index_.GetOldest();
+      Remove(key);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void RenderedImageCache::Tier::RemoveInstance(std::set<std::string>& keys,
+                                                const std::string& instanceId)
+  {
+    keys.clear();
+
+    InstanceKeys::iterator found = instances_.find(instanceId);
+    if (found != instances_.end())
+    {
+      keys.swap(found->second);
+      instances_.erase(found);
+
+      for (std::set<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+        uint64_t size = index_.Invalidate(*it);
+        assert(currentSize_ >= size);
+        currentSize_ -= size;
+      }
+    }
+  }
+
+
+  void RenderedImageCache::Tier::Clear()
+  {
+    while (!index_.IsEmpty())
+    {
+      index_.RemoveOldest();
+    }
+
+    instances_.clear();
+    currentSize_ = 0;
+  }
+
+
+  std::string RenderedImageCache::GetFolder(const std::string& instanceId) const
+  {
+    boost::filesystem::path path = directory_;
+    path /= instanceId.substr(0, 2);
+    path /= instanceId;
+
+    return path.string();
+  }
+
+
+  std::string RenderedImageCache::GetPath(const std::string& key) const
+  {
+    const std::string instanceId = GetInstanceOfKey(key);
+    const std::string hash = key.substr(instanceId.size() + 1);
+
+    boost::filesystem::path path = GetFolder(instanceId);
+    path /= hash;
+
+    return path.string();
+  }
+
+
+  void RenderedImageCache::RemoveFiles(const std::set<std::string>& keys)
+  {
+    std::set<std::string> instances;
+
+    for (std::set<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      instances.insert(GetInstanceOfKey(*it));
+
+      try
+      {
+        SystemToolbox::RemoveFile(GetPath(*it));
+      }
+      catch (OrthancException&)
+      {
+        // The file was already removed
+      }
+    }
+
+    /**
+     * Remove the folders of the instances that are now empty (this
+     * call fails if the folder is not empty). This is done inside the
+     * mutex, and skipped if "Add()" is writing to the folder, as
+     * "Add()" creates the folder inside the mutex as well.
+     **/
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (std::set<std::string>::const_iterator it = instances.begin(); it != instances.end(); ++it)
+    {
+      if (pendingWrites_.find(*it) == pendingWrites_.end())
+      {
+        boost::system::error_code error;
+        boost::filesystem::remove(GetFolder(*it), error);
+      }
+    }
+  }
+
+
+  RenderedImageCache::RenderedImageCache() :
+    memoryHits_(0),
+    diskHits_(0),
+    misses_(0)
+  {
+  }
+
+
+  void RenderedImageCache::SetMemorySize(uint64_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    memory_.SetMaximumSize(size);
+
+    std::string key;
+    while (memory_.RemoveOldestIfFull(key))
+    {
+      memoryContent_.erase(key);
+    }
+  }
+
+
+  void RenderedImageCache::SetDiskStorage(const std::string& directory,
+                                          uint64_t size)
+  {
+    namespace fs = boost::filesystem;
+
+    // Entries of the previous directory, sorted by modification time
+    std::vector<DiskEntry> entries;
+
+    if (size > 0)
+    {
+      SystemToolbox::MakeDirectory(directory);
+
+      const fs::path root(directory);
+
+      for (fs::recursive_directory_iterator current(root), end; current != end; ++current)
+      {
+        try
+        {
+          const fs::path path = current->path();
+
+          if (fs::is_regular_file(path))
+          {
+            const std::string hash = path.filename().string();
+            const std::string instanceId = path.parent_path().filename().string();
+            const std::string prefix = path.parent_path().parent_path().filename().string();
+
+            if (path.extension() == ".tmp")
+            {
+              // Leftover of an interrupted write
+              fs::remove(path);
+            }
+            else if (Toolbox::IsSHA1(hash) &&
+                     !instanceId.empty() &&
+                     instanceId.substr(0, 2) == prefix &&
+                     path.parent_path().parent_path().parent_path() == root)
+            {
+              entries.push_back(DiskEntry(fs::last_write_time(path), instanceId + "/" + hash,
+                                      fs::file_size(path)));
+            }
+          }
+        }
+        catch (fs::filesystem_error&)
+        {
+        }
+      }
+
+      std::sort(entries.begin(), entries.end());
+    }
+
+    std::set<std::string> evicted;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      disk_.Clear();
+      disk_.SetMaximumSize(size);
+      directory_ = directory;
+
+      // The files that are being written belong to the previous directory
+      for (std::map<std::string, PendingWrites>::iterator
+             it = pendingWrites_.begin(); it != pendingWrites_.end(); ++it)
+      {
+        it->second.invalidations_++;
+      }
+
+      for (size_t i = 0; i < entries.size(); i++)
+      {
+        disk_.Add(entries[i].key_, entries[i].size_);
+      }
+
+      std::string key;
+      while (disk_.RemoveOldestIfFull(key))
+      {
+        evicted.insert(key);
+      }
+    }
+
+    RemoveFiles(evicted);
+
+    if (size > 0)
+    {
+      LOG(WARNING) << "The cache of the rendered images is stored in directory \"" << directory
+                   << "\", and contains " << (entries.size() - evicted.size()) << " entries";
+    }
+  }
+
+
+  bool RenderedImageCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return (memory_.GetMaximumSize() > 0 ||
+            disk_.GetMaximumSize() > 0);
+  }
+
+
+  std::string RenderedImageCache::ComputeKey(const std::string& instanceId,
+                                             const std::string& parameters)
+  {
+    std::string hash;
+    Toolbox::ComputeSHA1(hash, parameters);
+    return instanceId + "/" + hash;
+  }
+
+
+  bool RenderedImageCache::Fetch(std::string& content,
+                                 const std::string& key)
+  {
+    std::string path;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (memory_.Touch(key))
+      {
+        std::map<std::string, std::string>::const_iterator found = memoryContent_.find(key);
+        assert(found != memoryContent_.end());
+        content = found->second;
+        memoryHits_++;
+
+        // Keep the copy of the entry on the disk tier alive as well
+        disk_.Touch(key);
+        return true;
+      }
+
+      if (disk_.Touch(key))
+      {
+        path = GetPath(key);
+      }
+      else
+      {
+        misses_++;
+        return false;
+      }
+    }
+
+    // Read the file outside of the mutex, as it might be slow
+    bool success;
+
+    try
+    {
+      SystemToolbox::ReadFile(content, path, false /* don't log */);
+      success = true;
+    }
+    catch (OrthancException&)
+    {
+      success = false;
+    }
+
+    if (success)
+    {
+      // The recency of the disk tier is reloaded from the
+      // modification times of the files after a restart
+      boost::system::error_code error;
+      boost::filesystem::last_write_time(path, std::time(NULL), error);
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (success)
+      {
+        diskHits_++;
+      }
+      else
+      {
+        // The file has disappeared from the disk
+        disk_.Remove(key);
+        misses_++;
+        return false;
+      }
+
+      // Promote the entry to the memory tier
+      if (content.size() <= memory_.GetMaximumSize() &&
+          memory_.GetMaximumSize() > 0)
+      {
+        memory_.Add(key, content.size());
+        memoryContent_[key] = content;
+
+        std::string evicted;
+        while (memory_.RemoveOldestIfFull(evicted))
+        {
+          memoryContent_.erase(evicted);
+        }
+      }
+    }
+
+    return true;
+  }
+
+
+  void RenderedImageCache::Add(const std::string& key,
+                               const std::string& content)
+  {
+    const std::string instanceId = GetInstanceOfKey(key);
+
+    std::string path;
+    uint64_t invalidations;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (content.size() <= memory_.GetMaximumSize() &&
+          memory_.GetMaximumSize() > 0)
+      {
+        memory_.Add(key, content.size());
+        memoryContent_[key] = content;
+
+        std::string evicted;
+        while (memory_.RemoveOldestIfFull(evicted))
+        {
+          memoryContent_.erase(evicted);
+        }
+      }
+
+      if (content.size() > disk_.GetMaximumSize() ||
+          disk_.GetMaximumSize() == 0)
+      {
+        return;
+      }
+
+      path = GetPath(key);
+
+      try
+      {
+        SystemToolbox::MakeDirectory(GetFolder(instanceId));
+      }
+      catch (OrthancException& e)
+      {
+        LOG(WARNING) << "Cannot write to the cache of the rendered images: " << e.What();
+        return;
+      }
+
+      // Prevents the removal of the folder while the file is written
+      PendingWrites& pending = pendingWrites_[instanceId];
+      pending.writers_++;
+      invalidations = pending.invalidations_;
+    }
+
+    // Write the file outside of the mutex. The content is first
+    // written to a temporary file that is atomically renamed, so
+    // that readers never see a partial file.
+    bool written = false;
+
+    try
+    {
+      const std::string tmp = path + "." + Toolbox::GenerateUuid() + ".tmp";
+      SystemToolbox::WriteFile(content, tmp);
+      boost::filesystem::rename(tmp, path);
+      written = true;
+    }
+    catch (OrthancException& e)
+    {
+      LOG(WARNING) << "Cannot write to the cache of the rendered images: " << e.What();
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      LOG(WARNING) << "Cannot write to the cache of the rendered images: " << e.what();
+    }
+
+    std::set<std::string> evicted;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      std::map<std::string, PendingWrites>::iterator pending = pendingWrites_.find(instanceId);
+      assert(pending != pendingWrites_.end() &&
+             pending->second.writers_ > 0);
+
+      // Only publish the file if the instance has not been
+      // invalidated while it was written, otherwise it is stale
+      const bool valid = (pending->second.invalidations_ == invalidations);
+
+      pending->second.writers_--;
+      if (pending->second.writers_ == 0)
+      {
+        pendingWrites_.erase(pending);
+      }
+
+      if (!written)
+      {
+        return;
+      }
+      else if (valid)
+      {
+        disk_.Add(key, content.size());
+
+        std::string oldest;
+        while (disk_.RemoveOldestIfFull(oldest))
+        {
+          evicted.insert(oldest);
+        }
+      }
+      else
+      {
+        evicted.insert(key);
+      }
+    }
+
+    RemoveFiles(evicted);
+  }
+
+
+  void RenderedImageCache::InvalidateInstance(const std::string& instanceId)
+  {
+    std::set<std::string> keys;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      memory_.RemoveInstance(keys, instanceId);
+      for (std::set<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+        memoryContent_.erase(*it);
+      }
+
+      disk_.RemoveInstance(keys, instanceId);
+
+      std::map<std::string, PendingWrites>::iterator pending = pendingWrites_.find(instanceId);
+      if (pending != pendingWrites_.end())
+      {
+        pending->second.invalidations_++;
+      }
+    }
+
+    RemoveFiles(keys);
+  }
+
+
+  void RenderedImageCache::PublishMetrics(MetricsRegistry& registry)
+  {
+    static const float MEGA_BYTES = 1024 * 1024;
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    registry.SetValue("orthanc_rendered_cache_hits_memory", static_cast<float>(memoryHits_));
+    registry.SetValue("orthanc_rendered_cache_hits_disk", static_cast<float>(diskHits_));
+    registry.SetValue("orthanc_rendered_cache_misses", static_cast<float>(misses_));
+    registry.SetValue("orthanc_rendered_cache_memory_size_mb", static_cast<float>(memory_.GetCurrentSize()) / MEGA_BYTES);
+    registry.SetValue("orthanc_rendered_cache_disk_size_mb", static_cast<float>(disk_.GetCurrentSize()) / MEGA_BYTES);
+  }
+
+
+  void RenderedImageCache::SignalChange(const ServerIndexChange& change)
+  {
+    if (change.GetChangeType() == ChangeType_Deleted &&
+        change.GetResourceType() == ResourceType_Instance)
+    {
+      InvalidateInstance(change.GetPublicId());
+    }
+  }
+}
@@ -0,0 +1,177 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include "../../OrthancFramework/Sources/Cache/LeastRecentlyUsedIndex.h"
+#include "IServerListener.h"
+
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <set>
+
+namespace Orthanc
+{
+  class MetricsRegistry;
+
+  /**
+   * Cache of the images that are rendered by the REST API (previews
+   * and "/rendered" routes), with an in-memory hot tier in front of
+   * an optional on-disk tier (new in Orthanc 1.11.2). Both tiers are
+   * bounded, with a least-recently-used eviction. The entries of one
+   * instance are invalidated together when the instance is deleted
+   * or stored again. This class is thread-safe.
+   **/
+  class RenderedImageCache : public IServerListener
+  {
+  private:
+    typedef std::map<std::string, std::set<std::string> >  InstanceKeys;
+
+    class Tier : public boost::noncopyable
+    {
+    private:
+      uint64_t                                       maximumSize_;
+      uint64_t                                       currentSize_;
+      LeastRecentlyUsedIndex<std::string, uint64_t>  index_;
+      InstanceKeys                                   instances_;
+
+    public:
+      Tier() :
+        maximumSize_(0),
+        currentSize_(0)
+      {
+      }
+
+      uint64_t GetMaximumSize() const
+      {
+        return maximumSize_;
+      }
+
+      uint64_t GetCurrentSize() const
+      {
+        return currentSize_;
+      }
+
+      void SetMaximumSize(uint64_t size)
+      {
+        maximumSize_ = size;
+      }
+
+      bool Touch(const std::string& key);
+
+      void Add(const std::string& key,
+               uint64_t size);
+
+      bool Remove(const std::string& key);
+
+      bool RemoveOldestIfFull(std::string& key);
+
+      void RemoveInstance(std::set<std::string>& keys,
+                          const std::string& instanceId);
+
+      void Clear();
+    };
+
+    // Files of one instance that are being written to the disk tier,
+    // and number of invalidations of the instance since then
+    struct PendingWrites
+    {
+      unsigned int  writers_;
+      uint64_t      invalidations_;
+
+      PendingWrites() :
+        writers_(0),
+        invalidations_(0)
+      {
+      }
+    };
+
+    boost::mutex                        mutex_;
+    Tier                                memory_;
+    std::map<std::string, std::string>  memoryContent_;
+    Tier                                disk_;
+    std::string                         directory_;
+    uint64_t                            memoryHits_;
+    uint64_t                            diskHits_;
+    uint64_t                            misses_;
+    std::map<std::string, PendingWrites>  pendingWrites_;
+
+    std::string GetFolder(const std::string& instanceId) const;
+
+    std::string GetPath(const std::string& key) const;
+
+    void RemoveFiles(const std::set<std::string>& keys);
+
+  public:
+    RenderedImageCache();
+
+    // Size in bytes, "0" disables the memory tier
+    void SetMemorySize(uint64_t size);
+
+    // Size in bytes, "0" disables the disk tier. The files that are
+    // already in the directory are reused.
+    void SetDiskStorage(const std::string& directory,
+                        uint64_t size);
+
+    bool IsEnabled();
+
+    // "parameters" must identify the DICOM file of the instance (to
+    // take overwritten instances into account), and all the arguments
+    // of the rendering, including the MIME type of the output
+    static std::string ComputeKey(const std::string& instanceId,
+                                  const std::string& parameters);
+
+    bool Fetch(std::string& content,
+               const std::string& key);
+
+    void Add(const std::string& key,
+             const std::string& content);
+
+    void InvalidateInstance(const std::string& instanceId);
+
+    void PublishMetrics(MetricsRegistry& registry);
+
+    virtual void SignalStoredInstance(const std::string& publicId,
+                                      const DicomInstanceToStore& /* instance */,
+                                      const Json::Value& /* simplifiedTags */) ORTHANC_OVERRIDE
+    {
+      InvalidateInstance(publicId);
+    }
+
+    virtual void SignalChange(const ServerIndexChange& change) ORTHANC_OVERRIDE;
+
+    virtual bool FilterIncomingInstance(const DicomInstanceToStore& /* instance */,
+                                        const Json::Value& /* simplified */) ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual bool FilterIncomingCStoreInstance(uint16_t& /* dimseStatus */,
+                                              const DicomInstanceToStore& /* instance */,
+                                              const Json::Value& /* simplified */) ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+  };
+}
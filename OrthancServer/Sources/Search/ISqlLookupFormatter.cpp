@@ -239,6 +239,7 @@ namespace Orthanc
 
 
   static void FormatJoin(std::string& target,
+                         const ISqlLookupFormatter& formatter,
                          const DatabaseConstraint& constraint,
                          size_t index)
   {
@@ -257,6 +258,10 @@ namespace Orthanc
     {
       target += "DicomIdentifiers ";
     }
+    else if (formatter.IsIndexedMainDicomTag(constraint.GetTag()))
+    {
+      target += "IndexedMainDicomTags ";
+    }
     else
     {
       target += "MainDicomTags ";
@@ -270,11 +275,12 @@ namespace Orthanc
   }
   
 
-  void ISqlLookupFormatter::Apply(std::string& sql,
-                                  ISqlLookupFormatter& formatter,
-                                  const std::vector<DatabaseConstraint>& lookup,
-                                  ResourceType queryLevel,
-                                  size_t limit)
+  static void ApplyInternal(std::string& sql,
+                            ISqlLookupFormatter& formatter,
+                            const std::vector<DatabaseConstraint>& lookup,
+                            ResourceType queryLevel,
+                            const int64_t* afterInternalId,  // Can be NULL
+                            size_t limit)
   {
     assert(ResourceType_Patient < ResourceType_Study &&
            ResourceType_Study < ResourceType_Series &&
@@ -314,7 +320,7 @@ namespace Orthanc
       if (FormatComparison(comparison, formatter, lookup[i], count, escapeBrackets))
       {
         std::string join;
-        FormatJoin(join, lookup[i], count);
+        FormatJoin(join, formatter, lookup[i], count);
         joins += join;
 
         if (!comparison.empty())
@@ -350,9 +356,37 @@ namespace Orthanc
     sql += (joins + " WHERE " + FormatLevel(queryLevel) + ".resourceType = " +
             formatter.FormatResourceType(queryLevel) + comparisons);
 
+    if (afterInternalId != NULL)
+    {
+      sql += (" AND " + FormatLevel(queryLevel) + ".internalId > " +
+              boost::lexical_cast<std::string>(*afterInternalId) +
+              " ORDER BY " + FormatLevel(queryLevel) + ".internalId");
+    }
+
     if (limit != 0)
     {
       sql += " LIMIT " + boost::lexical_cast<std::string>(limit);
     }
   }
+
+
+  void ISqlLookupFormatter::Apply(std::string& sql,
+                                  ISqlLookupFormatter& formatter,
+                                  const std::vector<DatabaseConstraint>& lookup,
+                                  ResourceType queryLevel,
+                                  size_t limit)
+  {
+    ApplyInternal(sql, formatter, lookup, queryLevel, NULL, limit);
+  }
+
+
+  void ISqlLookupFormatter::Apply(std::string& sql,
+                                  ISqlLookupFormatter& formatter,
+                                  const std::vector<DatabaseConstraint>& lookup,
+                                  ResourceType queryLevel,
+                                  int64_t afterInternalId,
+                                  size_t limit)
+  {
+    ApplyInternal(sql, formatter, lookup, queryLevel, &afterInternalId, limit);
+  }
 }
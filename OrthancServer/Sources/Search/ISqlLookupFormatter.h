@@ -29,11 +29,13 @@
 #endif
 
 #include <boost/noncopyable.hpp>
+#include <stdint.h>
 #include <vector>
 
 namespace Orthanc
 {
   class DatabaseConstraint;
+  class DicomTag;
   
   // This class is also used by the "orthanc-databases" project
   class ISqlLookupFormatter : public boost::noncopyable
@@ -56,10 +58,32 @@ namespace Orthanc
      **/
     virtual bool IsEscapeBrackets() const = 0;
 
+    /**
+     * Whether the values of this main DICOM tag are copied into the
+     * "IndexedMainDicomTags" table, that is indexed by value. New in
+     * Orthanc 1.11.2, only used by the built-in SQLite database.
+     **/
+    virtual bool IsIndexedMainDicomTag(const DicomTag& tag) const
+    {
+      return false;
+    }
+
+    static void Apply(std::string& sql,
+                      ISqlLookupFormatter& formatter,
+                      const std::vector<DatabaseConstraint>& lookup,
+                      ResourceType queryLevel,
+                      size_t limit);
+
+    /**
+     * Keyset pagination: Only keep the resources whose internal ID is
+     * strictly greater than "afterInternalId", sorted by increasing
+     * internal ID. New in Orthanc 1.11.2.
+     **/
     static void Apply(std::string& sql,
                       ISqlLookupFormatter& formatter,
                       const std::vector<DatabaseConstraint>& lookup,
                       ResourceType queryLevel,
+                      int64_t afterInternalId,
                       size_t limit);
   };
 }
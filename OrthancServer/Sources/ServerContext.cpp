@@ -25,6 +25,8 @@
 
 #include "../../OrthancFramework/Sources/Cache/SharedArchive.h"
 #include "../../OrthancFramework/Sources/DicomFormat/DicomElement.h"
+#include "../../OrthancFramework/Sources/DicomFormat/DicomFrameOffsetTable.h"
+#include "../../OrthancFramework/Sources/DicomFormat/DicomImageInformation.h"
 #include "../../OrthancFramework/Sources/DicomFormat/DicomStreamReader.h"
 #include "../../OrthancFramework/Sources/DicomParsing/DcmtkTranscoder.h"
 #include "../../OrthancFramework/Sources/DicomParsing/DicomModification.h"
@@ -98,6 +100,53 @@ namespace Orthanc
   }
 
 
+  static bool ComputeFrameOffsets(std::string& target,
+                                  const DicomInstanceToStore& dicom,
+                                  const DicomMap& summary,
+                                  DicomTransferSyntax transferSyntax,
+                                  uint64_t pixelDataOffset)
+  {
+    // The table is only useful if the instance contains several frames
+    uint32_t countFrames;
+    if (!summary.ParseUnsignedInteger32(countFrames, DICOM_TAG_NUMBER_OF_FRAMES) ||
+        countFrames <= 1 ||
+        transferSyntax == DicomTransferSyntax_BigEndianExplicit ||
+        transferSyntax == DicomTransferSyntax_DeflatedLittleEndianExplicit)
+    {
+      return false;
+    }
+
+    size_t frameSize = 0;
+    if (IsUncompressedTransferSyntax(transferSyntax))
+    {
+      try
+      {
+        DicomImageInformation info(summary);
+        frameSize = info.GetFrameSize();
+      }
+      catch (OrthancException&)
+      {
+        return false;
+      }
+    }
+
+    DicomFrameOffsetTable table;
+    if (table.Parse(dicom.GetBufferData(), dicom.GetBufferSize(), pixelDataOffset,
+                    transferSyntax == DicomTransferSyntax_LittleEndianImplicit, countFrames, frameSize))
+    {
+      table.Serialize(target);
+
+      // Do not clutter the database with huge metadata (e.g. for videos)
+      static const size_t MAX_SERIALIZED_SIZE = 256 * 1024;
+      return target.size() <= MAX_SERIALIZED_SIZE;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
   ServerContext::StoreResult::StoreResult() :
     status_(StoreStatus_Failure),
     cstoreStatusCode_(0)
@@ -116,30 +165,34 @@ namespace Orthanc
       {
         const ServerIndexChange& change = dynamic_cast<const ServerIndexChange&>(*obj.get());
 
-        boost::shared_lock<boost::shared_mutex> lock(that->listenersMutex_);
-        for (ServerListeners::iterator it = that->listeners_.begin(); 
-             it != that->listeners_.end(); ++it)
+        if (that->changesThreads_ == 0)
         {
-          try
+          boost::shared_lock<boost::shared_mutex> lock(that->listenersMutex_);
+          for (ServerListeners::iterator it = that->listeners_.begin(); 
+               it != that->listeners_.end(); ++it)
           {
-            try
-            {
-              it->GetListener().SignalChange(change);
-            }
-            catch (std::bad_alloc&)
-            {
-              LOG(ERROR) << "Not enough memory while signaling a change";
-            }
-            catch (...)
+            ChangesDispatcher::SignalChange(it->GetListener(), it->GetDescription(), change);
+          }
+        }
+        else
+        {
+          std::vector< boost::shared_ptr<ChangesDispatcher> > dispatchers;
+
+          {
+            boost::shared_lock<boost::shared_mutex> lock(that->listenersMutex_);
+            for (ServerListeners::iterator it = that->listeners_.begin(); 
+                 it != that->listeners_.end(); ++it)
             {
-              throw OrthancException(ErrorCode_InternalError);
+              dispatchers.push_back(that->GetChangesDispatcher(*it));
             }
           }
-          catch (OrthancException& e)
+
+          // "listenersMutex_" is released before enqueuing, as this
+          // might block if the queue of some listener is full, while
+          // the callbacks of this listener might need this mutex
+          for (size_t i = 0; i < dispatchers.size(); i++)
           {
-            LOG(ERROR) << "Error in the " << it->GetDescription() 
-                       << " callback while signaling a change: " << e.What()
-                       << " (code " << e.GetErrorCode() << ")";
+            dispatchers[i]->Enqueue(change);
           }
         }
       }
@@ -147,6 +200,75 @@ namespace Orthanc
   }
 
 
+  boost::shared_ptr<ChangesDispatcher> ServerContext::GetChangesDispatcher(ServerListener& listener)
+  {
+    boost::mutex::scoped_lock lock(changesDispatchersMutex_);
+
+    ChangesDispatchers::iterator found = changesDispatchers_.find(&listener.GetListener());
+    if (found == changesDispatchers_.end())
+    {
+      // The listeners that serialize their callbacks (Lua and the
+      // plugins) would not benefit from more threads, but would lose
+      // the global ordering of the changes
+      const unsigned int threads = (listener.HasConcurrentChanges() ? changesThreads_ : 1);
+
+      boost::shared_ptr<ChangesDispatcher> dispatcher(
+        new ChangesDispatcher(listener.GetListener(), listener.GetDescription(),
+                              threads, changesQueueSize_, changesOverflowPolicy_));
+      found = changesDispatchers_.insert(std::make_pair(&listener.GetListener(), dispatcher)).first;
+    }
+
+    return found->second;
+  }
+
+
+  boost::shared_ptr<ChangesDispatcher> ServerContext::DetachChangesDispatcher(IServerListener& listener)
+  {
+    boost::shared_ptr<ChangesDispatcher> dispatcher;
+
+    boost::mutex::scoped_lock lock(changesDispatchersMutex_);
+
+    ChangesDispatchers::iterator found = changesDispatchers_.find(&listener);
+    if (found != changesDispatchers_.end())
+    {
+      dispatcher = found->second;
+      changesDispatchers_.erase(found);
+    }
+
+    return dispatcher;
+  }
+
+
+  void ServerContext::ClearChangesDispatchers()
+  {
+    ChangesDispatchers dispatchers;
+
+    {
+      boost::mutex::scoped_lock lock(changesDispatchersMutex_);
+      dispatchers.swap(changesDispatchers_);
+    }
+
+    for (ChangesDispatchers::iterator it = dispatchers.begin(); it != dispatchers.end(); ++it)
+    {
+      it->second->Stop();
+    }
+  }
+
+
+  void ServerContext::PublishChangesMetrics()
+  {
+    metricsRegistry_->SetValue("orthanc_changes_pending", static_cast<float>(pendingChanges_.GetSize()));
+
+    boost::mutex::scoped_lock lock(changesDispatchersMutex_);
+
+    for (ChangesDispatchers::const_iterator it = changesDispatchers_.begin();
+         it != changesDispatchers_.end(); ++it)
+    {
+      it->second->PublishMetrics(*metricsRegistry_);
+    }
+  }
+
+
   void ServerContext::SaveJobsThread(ServerContext* that,
                                      unsigned int sleepDelay)
   {
@@ -292,11 +414,14 @@ namespace Orthanc
     area_(area),
     compressionEnabled_(false),
     storeMD5_(true),
+    dicomUntilPixelDataThreshold_(0),
     largeDicomThrottler_(1),
     dicomCache_(DICOM_CACHE_SIZE),
     mainLua_(*this),
     filterLua_(*this),
     luaListener_(*this),
+    thumbnailsGenerator_(*this),
+    deletionQueue_(*this),
     jobsEngine_(maxCompletedJobs),
 #if ORTHANC_ENABLE_PLUGINS == 1
     plugins_(NULL),
@@ -304,6 +429,9 @@ namespace Orthanc
     done_(false),
     haveJobsChanged_(false),
     isJobsEngineUnserialized_(false),
+    changesThreads_(0),
+    changesQueueSize_(0),
+    changesOverflowPolicy_(ChangesDispatcher::OverflowPolicy_Block),
     metricsRegistry_(new MetricsRegistry),
     isHttpServerSecure_(true),
     isExecuteLuaEnabled_(false),
@@ -331,6 +459,16 @@ namespace Orthanc
         saveJobs_ = lock.GetConfiguration().GetBooleanParameter("SaveJobs", true);
         metricsRegistry_->SetEnabled(lock.GetConfiguration().GetBooleanParameter("MetricsEnabled", true));
 
+        // New configuration options in Orthanc 1.11.2
+        changesThreads_ = lock.GetConfiguration().GetUnsignedIntegerParameter("ChangesListenerThreads", 0);
+        changesQueueSize_ = lock.GetConfiguration().GetUnsignedIntegerParameter("ChangesListenerQueueSize", 10000);
+        changesOverflowPolicy_ = ChangesDispatcher::StringToOverflowPolicy(
+          lock.GetConfiguration().GetStringParameter("ChangesListenerOverflow", "Block"));
+
+        // New configuration option in Orthanc 1.11.2
+        jobsEngine_.SetTimeSlice(lock.GetConfiguration().GetUnsignedIntegerParameter("JobsTimeSlice", 0));
+        jobsEngine_.SetMetricsRegistry(*metricsRegistry_);
+
         // New configuration options in Orthanc 1.5.1
         findStorageAccessMode_ = StringToFindStorageAccessMode(lock.GetConfiguration().GetStringParameter("StorageAccessOnFind", "Always"));
         limitFindInstances_ = lock.GetConfiguration().GetUnsignedIntegerParameter("LimitFindInstances", 0);
@@ -414,7 +552,9 @@ namespace Orthanc
 
       jobsEngine_.SetThreadSleep(unitTesting ? 20 : 200);
 
-      listeners_.push_back(ServerListener(luaListener_, "Lua"));
+      listeners_.push_back(ServerListener(luaListener_, "Lua", false));
+      listeners_.push_back(ServerListener(renderedCache_, "rendered cache", true));
+      listeners_.push_back(ServerListener(thumbnailsGenerator_, "thumbnails", true));
       changeThread_ = boost::thread(ChangeThread, this, (unitTesting ? 20 : 100));
     
       dynamic_cast<DcmtkTranscoder&>(*dcmtkTranscoder_).SetLossyQuality(lossyQuality);
@@ -454,11 +594,16 @@ namespace Orthanc
         changeThread_.join();
       }
 
+      ClearChangesDispatchers();
+
       if (saveJobsThread_.joinable())
       {
         saveJobsThread_.join();
       }
 
+      thumbnailsGenerator_.Stop();
+      deletionQueue_.Stop();
+
       jobsEngine_.GetRegistry().ResetObserver();
 
       if (isJobsEngineUnserialized_)
@@ -485,6 +630,32 @@ namespace Orthanc
   }
 
 
+  void ServerContext::SetDicomUntilPixelDataThreshold(uint64_t size)
+  {
+    if (size == 0)
+    {
+      LOG(INFO) << "The DICOM headers are only stored as separate attachments "
+                << "if the storage area cannot read ranges or if compression is enabled";
+    }
+    else
+    {
+      LOG(INFO) << "The DICOM headers are stored as separate attachments for DICOM files "
+                << "whose size is at least " << size << " bytes";
+    }
+
+    dicomUntilPixelDataThreshold_ = size;
+  }
+
+
+  bool ServerContext::IsDicomUntilPixelDataStored(size_t dicomSize) const
+  {
+    return (!area_.HasReadRange() ||
+            compressionEnabled_ ||
+            (dicomUntilPixelDataThreshold_ != 0 &&
+             static_cast<uint64_t>(dicomSize) >= dicomUntilPixelDataThreshold_));
+  }
+
+
   void ServerContext::RemoveFile(const std::string& fileUuid,
                                  FileContentType type)
   {
@@ -607,14 +778,29 @@ namespace Orthanc
 
       FileInfo dicomUntilPixelData;
       if (hasPixelDataOffset &&
-          (!area_.HasReadRange() ||
-           compressionEnabled_))
+          IsDicomUntilPixelDataStored(dicom.GetBufferSize()))
       {
         dicomUntilPixelData = accessor.Write(dicom.GetBufferData(), pixelDataOffset, 
                                              FileContentType_DicomUntilPixelData, compression, storeMD5_);
         attachments.push_back(dicomUntilPixelData);
       }
 
+      std::string frameOffsets;
+      if (hasPixelDataOffset &&
+          hasTransferSyntax &&
+          ComputeFrameOffsets(frameOffsets, dicom, summary, transferSyntax, pixelDataOffset))
+      {
+        // Index of the frames, to read them by range (new in Orthanc 1.11.2)
+        dicom.AddMetadata(ResourceType_Instance, MetadataType_Instance_FrameOffsets, frameOffsets);
+      }
+      else
+      {
+        // The metadata copied from a previous version of the instance
+        // (e.g. reconstruction, or transcoding to a compressed
+        // transfer syntax) would not match the new file
+        dicom.RemoveMetadata(ResourceType_Instance, MetadataType_Instance_FrameOffsets);
+      }
+
       typedef std::map<MetadataType, std::string>  InstanceMetadata;
       InstanceMetadata  instanceMetadata;
       result.SetStatus(index_.Store(
@@ -1066,13 +1252,9 @@ namespace Orthanc
             index_.OverwriteMetadata(instancePublicId, MetadataType_Instance_PixelDataOffset,
                                      boost::lexical_cast<std::string>(pixelDataOffset));
 
-            if (!area_.HasReadRange() ||
-                compressionEnabled_)
+            if (IsDicomUntilPixelDataStored(dicom.size()))
             {
-              int64_t newRevision;
-              AddAttachment(newRevision, instancePublicId, FileContentType_DicomUntilPixelData,
-                            dicom.empty() ? NULL: dicom.c_str(), pixelDataOffset,
-                            false /* no old revision */, -1 /* dummy revision */, "" /* dummy MD5 */);
+              AddDicomUntilPixelData(instancePublicId, dicom, pixelDataOffset);
             }
           }
         }
@@ -1102,19 +1284,57 @@ namespace Orthanc
     if (!ReadDicomUntilPixelData(dicom, instancePublicId))
     {
       ReadDicom(dicom, instancePublicId);
+
+      /**
+       * The header of this instance is not available as a standalone
+       * attachment. If it should have been (this notably happens if
+       * "DicomUntilPixelDataThreshold" was enabled after the instance
+       * was received), create the attachment now, so that the next
+       * calls don't have to read the full DICOM file again.
+       **/
+      uint64_t pixelDataOffset;
+      if (IsDicomUntilPixelDataStored(dicom.size()) &&
+          DicomStreamReader::LookupPixelDataOffset(pixelDataOffset, dicom) &&
+          pixelDataOffset < dicom.size())
+      {
+        try
+        {
+          AddDicomUntilPixelData(instancePublicId, dicom, pixelDataOffset);
+        }
+        catch (OrthancException& e)
+        {
+          // Not a fatal error, the full DICOM file was successfully read
+          LOG(WARNING) << "Cannot store the DICOM header of instance " << instancePublicId
+                       << " as a separate attachment: " << e.What();
+        }
+      }
     }
   }
 
   bool ServerContext::ReadDicomUntilPixelData(std::string& dicom,
                                               const std::string& instancePublicId)
   {
+    FileInfo attachment;
+    int64_t revision;  // Ignored
+
+    if (index_.LookupAttachment(attachment, revision, instancePublicId, FileContentType_DicomUntilPixelData))
+    {
+      /**
+       * The DICOM file truncated before its pixel data was stored as
+       * a separate attachment at ingest (new in Orthanc 1.11.2): This
+       * works even if the storage area cannot read ranges or if
+       * compression is enabled.
+       **/
+      StorageAccessor accessor(area_, &storageCache_, GetMetricsRegistry());
+      accessor.Read(dicom, attachment);
+      return true;
+    }
+
     if (!area_.HasReadRange())
     {
       return false;
     }
     
-    FileInfo attachment;
-    int64_t revision;  // Ignored
     if (!index_.LookupAttachment(attachment, revision, instancePublicId, FileContentType_Dicom))
     {
       throw OrthancException(ErrorCode_InternalError,
@@ -1147,6 +1367,88 @@ namespace Orthanc
 
     return false;
   }
+
+
+  bool ServerContext::ReadRawFrame(std::string& frame,
+                                   MimeType& mime,
+                                   const std::string& instancePublicId,
+                                   unsigned int frameIndex)
+  {
+    if (!area_.HasReadRange())
+    {
+      return false;
+    }
+
+    std::string s;
+    int64_t revision;  // Ignored
+    if (!index_.LookupMetadata(s, revision, instancePublicId, ResourceType_Instance,
+                               MetadataType_Instance_FrameOffsets))
+    {
+      return false;  // Instance received by a former version of Orthanc, or single-frame
+    }
+
+    DicomFrameOffsetTable table;
+    if (!table.Unserialize(s))
+    {
+      LOG(ERROR) << "Metadata \"FrameOffsets\" is corrupted for instance: " << instancePublicId;
+      return false;
+    }
+
+    if (frameIndex >= table.GetFramesCount())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    FileInfo attachment;
+    if (!index_.LookupAttachment(attachment, revision, instancePublicId, FileContentType_Dicom))
+    {
+      throw OrthancException(ErrorCode_InternalError,
+                             "Unable to read the DICOM file of instance " + instancePublicId);
+    }
+
+    uint64_t start, end;
+    table.GetFrameExtent(start, end, frameIndex);
+
+    if (attachment.GetCompressionType() != CompressionType_None ||
+        end > attachment.GetUncompressedSize())
+    {
+      return false;
+    }
+
+    // Read all the fragments of the frame at once, then strip the item headers
+    std::string extent;
+    StorageAccessor accessor(area_, &storageCache_, GetMetricsRegistry());
+    accessor.ReadRange(extent, attachment, start, end);
+    table.ExtractFrame(frame, extent.empty() ? NULL : extent.c_str(), extent.size(), frameIndex);
+
+    DicomTransferSyntax transferSyntax;
+    if (index_.LookupMetadata(s, revision, instancePublicId, ResourceType_Instance,
+                              MetadataType_Instance_TransferSyntax) &&
+        LookupTransferSyntax(transferSyntax, s))
+    {
+      switch (transferSyntax)
+      {
+        case DicomTransferSyntax_JPEGProcess1:
+          mime = MimeType_Jpeg;
+          break;
+
+        case DicomTransferSyntax_JPEG2000:
+        case DicomTransferSyntax_JPEG2000LosslessOnly:
+          mime = MimeType_Jpeg2000;
+          break;
+
+        default:
+          mime = MimeType_Binary;
+          break;
+      }
+    }
+    else
+    {
+      mime = MimeType_Binary;
+    }
+
+    return true;
+  }
   
 
   void ServerContext::ReadAttachment(std::string& result,
@@ -1260,6 +1562,43 @@ namespace Orthanc
   }
 
 
+  void ServerContext::AddDicomUntilPixelData(const std::string& instancePublicId,
+                                             const std::string& dicom,
+                                             uint64_t pixelDataOffset)
+  {
+    assert(pixelDataOffset <= dicom.size());
+
+    CompressionType compression = (compressionEnabled_ ? CompressionType_ZlibWithSize : CompressionType_None);
+
+    StorageAccessor accessor(area_, &storageCache_, GetMetricsRegistry());
+    FileInfo attachment = accessor.Write(dicom.empty() ? NULL : dicom.c_str(), pixelDataOffset,
+                                         FileContentType_DicomUntilPixelData, compression, storeMD5_);
+
+    try
+    {
+      /**
+       * This write happens while reading an instance that is already
+       * stored, and only duplicates a part of its DICOM file: The
+       * recycling is disabled (by setting the maximum storage size and
+       * the maximum number of patients to "0"), so that a read
+       * request never deletes patients from the store.
+       **/
+      int64_t newRevision;
+      if (index_.StatelessDatabaseOperations::AddAttachment(
+            newRevision, attachment, instancePublicId, 0 /* no recycling */, 0 /* no recycling */,
+            false /* no old revision */, -1 /* dummy revision */, "" /* dummy MD5 */) != StoreStatus_Success)
+      {
+        accessor.Remove(attachment);
+      }
+    }
+    catch (OrthancException&)
+    {
+      accessor.Remove(attachment);
+      throw;
+    }
+  }
+
+
   bool ServerContext::AddAttachment(int64_t& newRevision,
                                     const std::string& resourceId,
                                     FileContentType attachmentType,
@@ -1331,26 +1670,63 @@ namespace Orthanc
 #if ORTHANC_ENABLE_PLUGINS == 1
   void ServerContext::SetPlugins(OrthancPlugins& plugins)
   {
-    boost::unique_lock<boost::shared_mutex> lock(listenersMutex_);
+    boost::shared_ptr<ChangesDispatcher> previous;
 
-    plugins_ = &plugins;
+    {
+      boost::unique_lock<boost::shared_mutex> lock(listenersMutex_);
 
-    // TODO REFACTOR THIS
-    listeners_.clear();
-    listeners_.push_back(ServerListener(luaListener_, "Lua"));
-    listeners_.push_back(ServerListener(plugins, "plugin"));
+      if (plugins_ != NULL)
+      {
+        previous = DetachChangesDispatcher(*plugins_);
+      }
+
+      plugins_ = &plugins;
+
+      // TODO REFACTOR THIS
+      listeners_.clear();
+      listeners_.push_back(ServerListener(luaListener_, "Lua", false));
+      listeners_.push_back(ServerListener(renderedCache_, "rendered cache", true));
+      listeners_.push_back(ServerListener(thumbnailsGenerator_, "thumbnails", true));
+      listeners_.push_back(ServerListener(plugins, "plugin", false));
+    }
+
+    if (previous.get() != NULL)
+    {
+      // Wait for the pending callbacks of the previous plugins, which
+      // must be done without owning "listenersMutex_", as these
+      // callbacks might store instances
+      previous->Stop();
+    }
   }
 
 
   void ServerContext::ResetPlugins()
   {
-    boost::unique_lock<boost::shared_mutex> lock(listenersMutex_);
+    boost::shared_ptr<ChangesDispatcher> previous;
+
+    {
+      boost::unique_lock<boost::shared_mutex> lock(listenersMutex_);
+
+      if (plugins_ != NULL)
+      {
+        previous = DetachChangesDispatcher(*plugins_);
+      }
+
+      plugins_ = NULL;
 
-    plugins_ = NULL;
+      // TODO REFACTOR THIS
+      listeners_.clear();
+      listeners_.push_back(ServerListener(luaListener_, "Lua", false));
+      listeners_.push_back(ServerListener(renderedCache_, "rendered cache", true));
+      listeners_.push_back(ServerListener(thumbnailsGenerator_, "thumbnails", true));
+    }
 
-    // TODO REFACTOR THIS
-    listeners_.clear();
-    listeners_.push_back(ServerListener(luaListener_, "Lua"));
+    if (previous.get() != NULL)
+    {
+      // Wait for the pending callbacks of the plugins, without owning
+      // "listenersMutex_" (cf. "SetPlugins()")
+      previous->Stop();
+    }
   }
 
 
@@ -1391,16 +1767,144 @@ namespace Orthanc
   }
 
 
-  void ServerContext::Apply(ILookupVisitor& visitor,
-                            const DatabaseLookup& lookup,
-                            ResourceType queryLevel,
-                            size_t since,
-                            size_t limit)
+  bool ServerContext::ApplyToCandidate(ILookupVisitor& visitor,
+                                       const DatabaseLookup& fastLookup,
+                                       ResourceType queryLevel,
+                                       const std::string& resource,
+                                       const std::string& instance,
+                                       const DicomTagConstraint* dicomModalitiesConstraint,
+                                       bool visit)
+  {
+    // Optimization in Orthanc 1.5.1 - Don't read the full JSON from
+    // the disk if only "main DICOM tags" are to be returned
+
+    std::unique_ptr<Json::Value> dicomAsJson;
+
+    bool hasOnlyMainDicomTags;
+    DicomMap dicom;
+    DicomMap allMainDicomTagsFromDB;
+      
+    if (findStorageAccessMode_ == FindStorageAccessMode_DatabaseOnly ||
+        findStorageAccessMode_ == FindStorageAccessMode_DiskOnAnswer ||
+        fastLookup.HasOnlyMainDicomTags())
+    {
+      // Case (1): The main DICOM tags, as stored in the database,
+      // are sufficient to look for match
+
+      if (!GetIndex().GetAllMainDicomTags(allMainDicomTagsFromDB, instance))
+      {
+        // The instance has been removed during the execution of the
+        // lookup, ignore it
+        return false;
+      }
+
+      // New in Orthanc 1.6.0: Only keep the main DICOM tags at the
+      // level of interest for the query
+      switch (queryLevel)
+      {
+        // WARNING: Don't reorder cases below, and don't add "break"
+        case ResourceType_Instance:
+          dicom.MergeMainDicomTags(allMainDicomTagsFromDB, ResourceType_Instance);
+
+        case ResourceType_Series:
+          dicom.MergeMainDicomTags(allMainDicomTagsFromDB, ResourceType_Series);
+
+        case ResourceType_Study:
+          dicom.MergeMainDicomTags(allMainDicomTagsFromDB, ResourceType_Study);
+            
+        case ResourceType_Patient:
+          dicom.MergeMainDicomTags(allMainDicomTagsFromDB, ResourceType_Patient);
+          break;
+
+        default:
+          throw OrthancException(ErrorCode_InternalError);
+      }
+        
+      hasOnlyMainDicomTags = true;
+    }
+    else
+    {
+      // Case (2): Need to read the "DICOM-as-JSON" attachment from
+      // the storage area
+      dicomAsJson.reset(new Json::Value);
+      ReadDicomAsJson(*dicomAsJson, instance);
+
+      dicom.FromDicomAsJson(*dicomAsJson);
+
+      // This map contains the entire JSON, i.e. more than the main DICOM tags
+      hasOnlyMainDicomTags = false;   
+    }
+      
+    if (!fastLookup.IsMatch(dicom))
+    {
+      return false;
+    }
+
+    if (dicomModalitiesConstraint != NULL)
+    {
+      std::set<DicomTag> requestedTags;
+      requestedTags.insert(DICOM_TAG_MODALITIES_IN_STUDY);
+      ExpandedResource expanded;
+      ComputeStudyTags(expanded, *this, resource, requestedTags);
+
+      std::vector<std::string> modalities;
+      Toolbox::TokenizeString(modalities, expanded.tags_.GetValue(DICOM_TAG_MODALITIES_IN_STUDY).GetContent(), '\\');
+      bool hasAtLeastOneModalityMatching = false;
+      for (size_t m = 0; m < modalities.size(); m++)
+      {
+        hasAtLeastOneModalityMatching |= dicomModalitiesConstraint->IsMatch(modalities[m]);
+      }
+
+      if (!hasAtLeastOneModalityMatching)
+      {
+        return false;
+      }
+
+      // copy the value of ModalitiesInStudy such that it can be reused to build the answer
+      allMainDicomTagsFromDB.SetValue(DICOM_TAG_MODALITIES_IN_STUDY, expanded.tags_.GetValue(DICOM_TAG_MODALITIES_IN_STUDY));
+    }
+
+    if (visit)
+    {
+      if ((findStorageAccessMode_ == FindStorageAccessMode_DiskOnLookupAndAnswer ||
+           findStorageAccessMode_ == FindStorageAccessMode_DiskOnAnswer) &&
+          dicomAsJson.get() == NULL &&
+          visitor.IsDicomAsJsonNeeded())
+      {
+        dicomAsJson.reset(new Json::Value);
+        ReadDicomAsJson(*dicomAsJson, instance);
+      }
+
+      if (hasOnlyMainDicomTags)
+      {
+        // This is Case (1): The variable "dicom" only contains the main DICOM tags
+        visitor.Visit(resource, instance, allMainDicomTagsFromDB, dicomAsJson.get());
+      }
+      else
+      {
+        // Remove the non-main DICOM tags from "dicom" if Case (2)
+        // was used, for consistency with Case (1)
+
+        DicomMap mainDicomTags;
+        mainDicomTags.ExtractMainDicomTags(dicom);
+        visitor.Visit(resource, instance, mainDicomTags, dicomAsJson.get());            
+      }
+    }
+
+    return true;
+  }
+
+
+  void ServerContext::ApplyInternal(ILookupVisitor& visitor,
+                                    const DatabaseLookup& lookup,
+                                    ResourceType queryLevel,
+                                    int64_t* cursor,
+                                    size_t since,
+                                    size_t limit)
   {    
     unsigned int databaseLimit = (queryLevel == ResourceType_Instance ?
                                   limitFindInstances_ : limitFindResults_);
       
-    std::vector<std::string> resources, instances;
     const DicomTagConstraint* dicomModalitiesConstraint = NULL;
 
     bool hasModalitiesInStudyLookup = (queryLevel == ResourceType_Study &&
@@ -1414,158 +1918,114 @@ namespace Orthanc
     {
       fastLookup->RemoveConstraint(DICOM_TAG_MODALITIES_IN_STUDY);
     }
-
+    else
     {
-      const size_t lookupLimit = (databaseLimit == 0 ? 0 : databaseLimit + 1);      
-      GetIndex().ApplyLookupResources(resources, &instances, *fastLookup, queryLevel, lookupLimit);
+      dicomModalitiesConstraint = NULL;
     }
 
-    bool complete = (databaseLimit == 0 ||
-                     resources.size() <= databaseLimit);
-
-    LOG(INFO) << "Number of candidate resources after fast DB filtering on main DICOM tags: " << resources.size();
-
-    /**
-     * "resources" contains the Orthanc ID of the resource at level
-     * "queryLevel", "instances" contains one the Orthanc ID of one
-     * sample instance from this resource.
-     **/
-    assert(resources.size() == instances.size());
-
+    size_t countCandidates = 0;
     size_t countResults = 0;
     size_t skipped = 0;
+    bool complete = true;
 
-    const bool isDicomAsJsonNeeded = visitor.IsDicomAsJsonNeeded();
-    
-    for (size_t i = 0; i < instances.size(); i++)
+    for (;;)
     {
-      // Optimization in Orthanc 1.5.1 - Don't read the full JSON from
-      // the disk if only "main DICOM tags" are to be returned
+      std::vector<std::string> resources, instances;
+      std::vector<int64_t> internalIds;
 
-      std::unique_ptr<Json::Value> dicomAsJson;
+      /**
+       * With keyset pagination, the candidates are read by batches
+       * from the database, so that the memory usage doesn't depend
+       * on the number of resources that follow the cursor (new in
+       * Orthanc 1.11.2). The database plugins must run the full
+       * lookup to answer one batch: In this case, all the candidates
+       * are read at once to avoid running the lookup once per batch.
+       **/
+      size_t lookupLimit = (databaseLimit == 0 ? 0 : databaseLimit + 1 - countCandidates);
 
-      bool hasOnlyMainDicomTags;
-      DicomMap dicom;
-      DicomMap allMainDicomTagsFromDB;
-      
-      if (findStorageAccessMode_ == FindStorageAccessMode_DatabaseOnly ||
-          findStorageAccessMode_ == FindStorageAccessMode_DiskOnAnswer ||
-          fastLookup->HasOnlyMainDicomTags())
+      if (cursor != NULL &&
+          limit != 0 &&
+          GetIndex().HasKeysetPagination() &&
+          (lookupLimit == 0 || lookupLimit > limit + 1))
       {
-        // Case (1): The main DICOM tags, as stored in the database,
-        // are sufficient to look for match
-
-        if (!GetIndex().GetAllMainDicomTags(allMainDicomTagsFromDB, instances[i]))
-        {
-          // The instance has been removed during the execution of the
-          // lookup, ignore it
-          continue;
-        }
-
-        // New in Orthanc 1.6.0: Only keep the main DICOM tags at the
-        // level of interest for the query
-        switch (queryLevel)
-        {
-          // WARNING: Don't reorder cases below, and don't add "break"
-          case ResourceType_Instance:
-            dicom.MergeMainDicomTags(allMainDicomTagsFromDB, ResourceType_Instance);
-
-          case ResourceType_Series:
-            dicom.MergeMainDicomTags(allMainDicomTagsFromDB, ResourceType_Series);
-
-          case ResourceType_Study:
-            dicom.MergeMainDicomTags(allMainDicomTagsFromDB, ResourceType_Study);
-            
-          case ResourceType_Patient:
-            dicom.MergeMainDicomTags(allMainDicomTagsFromDB, ResourceType_Patient);
-            break;
+        lookupLimit = limit + 1;
+      }
 
-          default:
-            throw OrthancException(ErrorCode_InternalError);
-        }
-        
-        hasOnlyMainDicomTags = true;
+      if (cursor == NULL)
+      {
+        GetIndex().ApplyLookupResources(resources, &instances, *fastLookup, queryLevel, lookupLimit);
       }
       else
       {
-        // Case (2): Need to read the "DICOM-as-JSON" attachment from
-        // the storage area
-        dicomAsJson.reset(new Json::Value);
-        ReadDicomAsJson(*dicomAsJson, instances[i]);
+        GetIndex().ApplyLookupResources(resources, &instances, internalIds, *fastLookup, queryLevel, *cursor, lookupLimit);
+        assert(internalIds.size() == resources.size());
+      }
 
-        dicom.FromDicomAsJson(*dicomAsJson);
+      countCandidates += resources.size();
 
-        // This map contains the entire JSON, i.e. more than the main DICOM tags
-        hasOnlyMainDicomTags = false;   
-      }
-      
-      if (fastLookup->IsMatch(dicom))
-      {
-        bool isMatch = true;
+      LOG(INFO) << "Number of candidate resources after fast DB filtering on main DICOM tags: " << resources.size();
 
-        if (hasModalitiesInStudyLookup)
-        {
-          std::set<DicomTag> requestedTags;
-          requestedTags.insert(DICOM_TAG_MODALITIES_IN_STUDY);
-          ExpandedResource resource;
-          ComputeStudyTags(resource, *this, resources[i], requestedTags);
-
-          std::vector<std::string> modalities;
-          Toolbox::TokenizeString(modalities, resource.tags_.GetValue(DICOM_TAG_MODALITIES_IN_STUDY).GetContent(), '\\');
-          bool hasAtLeastOneModalityMatching = false;
-          for (size_t m = 0; m < modalities.size(); m++)
-          {
-            hasAtLeastOneModalityMatching |= dicomModalitiesConstraint->IsMatch(modalities[m]);
-          }
+      /**
+       * "resources" contains the Orthanc ID of the resource at level
+       * "queryLevel", "instances" contains one the Orthanc ID of one
+       * sample instance from this resource.
+       **/
+      assert(resources.size() == instances.size());
 
-          isMatch = isMatch && hasAtLeastOneModalityMatching;
-          // copy the value of ModalitiesInStudy such that it can be reused to build the answer
-          allMainDicomTagsFromDB.SetValue(DICOM_TAG_MODALITIES_IN_STUDY, resource.tags_.GetValue(DICOM_TAG_MODALITIES_IN_STUDY));
-        }
+      bool done = false;
 
-        if (isMatch)
+      for (size_t i = 0; i < instances.size() && !done; i++)
+      {
+        const bool visit = (skipped >= since &&
+                            (limit == 0 || countResults < limit));
+
+        if (ApplyToCandidate(visitor, *fastLookup, queryLevel, resources[i], instances[i],
+                             dicomModalitiesConstraint, visit))
         {
           if (skipped < since)
           {
             skipped++;
           }
           else if (limit != 0 &&
-                  countResults >= limit)
+                   countResults >= limit)
           {
-            // Too many results, don't mark as complete
+            // Too many results, don't mark as complete. The cursor
+            // is not advanced, as this resource was not visited.
             complete = false;
+            done = true;
             break;
           }
           else
           {
-            if ((findStorageAccessMode_ == FindStorageAccessMode_DiskOnLookupAndAnswer ||
-                findStorageAccessMode_ == FindStorageAccessMode_DiskOnAnswer) &&
-                dicomAsJson.get() == NULL &&
-                isDicomAsJsonNeeded)
-            {
-              dicomAsJson.reset(new Json::Value);
-              ReadDicomAsJson(*dicomAsJson, instances[i]);
-            }
-
-            if (hasOnlyMainDicomTags)
-            {
-              // This is Case (1): The variable "dicom" only contains the main DICOM tags
-              visitor.Visit(resources[i], instances[i], allMainDicomTagsFromDB, dicomAsJson.get());
-            }
-            else
-            {
-              // Remove the non-main DICOM tags from "dicom" if Case (2)
-              // was used, for consistency with Case (1)
-
-              DicomMap mainDicomTags;
-              mainDicomTags.ExtractMainDicomTags(dicom);
-              visitor.Visit(resources[i], instances[i], mainDicomTags, dicomAsJson.get());            
-            }
-              
             countResults ++;
           }
         }
+
+        if (cursor != NULL)
+        {
+          // The next page starts after the last examined candidate,
+          // be it a match or not
+          *cursor = internalIds[i];
+        }
+      }
+
+      if (databaseLimit != 0 &&
+          countCandidates > databaseLimit)
+      {
+        complete = false;
+        done = true;
+      }
+
+      if (done ||
+          cursor == NULL ||
+          lookupLimit == 0 ||
+          resources.size() < lookupLimit)
+      {
+        break;
       }
+
+      // Otherwise, read the next batch of candidates, "*cursor" being
+      // the internal ID of the last candidate of this batch
     }
 
     if (complete)
@@ -1576,6 +2036,28 @@ namespace Orthanc
     LOG(INFO) << "Number of matching resources: " << countResults;
   }
 
+
+  void ServerContext::Apply(ILookupVisitor& visitor,
+                            const DatabaseLookup& lookup,
+                            ResourceType queryLevel,
+                            size_t since,
+                            size_t limit)
+  {
+    ApplyInternal(visitor, lookup, queryLevel, NULL, since, limit);
+  }
+
+
+  void ServerContext::Apply(ILookupVisitor& visitor,
+                            const DatabaseLookup& lookup,
+                            ResourceType queryLevel,
+                            int64_t after,
+                            size_t limit,
+                            int64_t& next)
+  {
+    next = after;
+    ApplyInternal(visitor, lookup, queryLevel, &next, 0 /* since */, limit);
+  }
+
   bool ServerContext::LookupOrReconstructMetadata(std::string& target,
                                                   const std::string& publicId,
                                                   ResourceType level,
@@ -25,8 +25,12 @@
 #include "IServerListener.h"
 #include "LuaScripting.h"
 #include "OrthancHttpHandler.h"
+#include "RenderedImageCache.h"
 #include "ServerIndex.h"
+#include "ChangesDispatcher.h"
+#include "DeletionQueue.h"
 #include "ServerJobs/IStorageCommitmentFactory.h"
+#include "ThumbnailsGenerator.h"
 
 #include "../../OrthancFramework/Sources/DicomFormat/DicomElement.h"
 #include "../../OrthancFramework/Sources/DicomParsing/DicomModification.h"
@@ -39,6 +43,7 @@
 namespace Orthanc
 {
   class DicomInstanceToStore;
+  class DicomTagConstraint;
   class IStorageArea;
   class JobsEngine;
   class MetricsRegistry;
@@ -61,7 +66,8 @@ namespace Orthanc
     public IDicomTranscoder,
     private JobsRegistry::IObserver
   {
-    friend class ServerIndex;  // To access "RemoveFile()"
+    friend class ServerIndex;    // To access "RemoveFile()"
+    friend class DeletionQueue;  // To access "RemoveFile()"
     
   public:
     class ILookupVisitor : public boost::noncopyable
@@ -157,12 +163,17 @@ namespace Orthanc
     private:
       IServerListener *listener_;
       std::string      description_;
+      bool             concurrentChanges_;
 
     public:
+      // "concurrentChanges" must be "false" if the listener handles
+      // the changes one at a time (e.g. it owns a global mutex)
       ServerListener(IServerListener& listener,
-                     const std::string& description) :
+                     const std::string& description,
+                     bool concurrentChanges) :
         listener_(&listener),
-        description_(description)
+        description_(description),
+        concurrentChanges_(concurrentChanges)
       {
       }
 
@@ -175,10 +186,17 @@ namespace Orthanc
       {
         return description_;
       }
+
+      bool HasConcurrentChanges() const
+      {
+        return concurrentChanges_;
+      }
     };
 
     typedef std::list<ServerListener>  ServerListeners;
 
+    typedef std::map<IServerListener*, boost::shared_ptr<ChangesDispatcher> >  ChangesDispatchers;
+
 
     static void ChangeThread(ServerContext* that,
                              unsigned int sleepDelay);
@@ -188,6 +206,13 @@ namespace Orthanc
 
     void SaveJobsEngine();
 
+    boost::shared_ptr<ChangesDispatcher> GetChangesDispatcher(ServerListener& listener);
+
+    // The result is empty if the listener has no dispatcher
+    boost::shared_ptr<ChangesDispatcher> DetachChangesDispatcher(IServerListener& listener);
+
+    void ClearChangesDispatchers();
+
     virtual void SignalJobSubmitted(const std::string& jobId) ORTHANC_OVERRIDE;
 
     virtual void SignalJobSuccess(const std::string& jobId) ORTHANC_OVERRIDE;
@@ -200,13 +225,17 @@ namespace Orthanc
 
     bool compressionEnabled_;
     bool storeMD5_;
+    uint64_t dicomUntilPixelDataThreshold_;  // New in Orthanc 1.11.2
 
     Semaphore largeDicomThrottler_;  // New in Orthanc 1.9.0 (notably for very large DICOM files in WSI)
     ParsedDicomCache  dicomCache_;
+    RenderedImageCache  renderedCache_;  // New in Orthanc 1.11.2
 
     LuaScripting mainLua_;
     LuaScripting filterLua_;
     LuaServerListener  luaListener_;
+    ThumbnailsGenerator  thumbnailsGenerator_;  // New in Orthanc 1.11.2
+    DeletionQueue  deletionQueue_;  // New in Orthanc 1.11.2
     std::unique_ptr<SharedArchive>  mediaArchive_;
     
     // The "JobsEngine" must be *after* "LuaScripting", as
@@ -228,6 +257,16 @@ namespace Orthanc
     bool isJobsEngineUnserialized_;
     SharedMessageQueue  pendingChanges_;
     boost::thread  changeThread_;
+
+    // New in Orthanc 1.11.2: If "changesThreads_" is not zero, each
+    // listener receives the changes from its own worker threads. The
+    // queue "pendingChanges_" is not bounded: If "Block" is the
+    // overflow policy, it grows as long as some listener is late.
+    unsigned int  changesThreads_;
+    size_t  changesQueueSize_;
+    ChangesDispatcher::OverflowPolicy  changesOverflowPolicy_;
+    boost::mutex  changesDispatchersMutex_;
+    ChangesDispatchers  changesDispatchers_;
     boost::thread  saveJobsThread_;
         
     std::unique_ptr<SharedArchive>  queryRetrieveArchive_;
@@ -266,6 +305,33 @@ namespace Orthanc
 
     void PublishDicomCacheMetrics();
 
+    // Returns "true" iff. the candidate resource matches the lookup,
+    // in which case it is reported to the visitor if "visit" is "true"
+    bool ApplyToCandidate(ILookupVisitor& visitor,
+                          const DatabaseLookup& fastLookup,
+                          ResourceType queryLevel,
+                          const std::string& resource,
+                          const std::string& instance,
+                          const DicomTagConstraint* dicomModalitiesConstraint,  // Can be NULL
+                          bool visit);
+
+    void ApplyInternal(ILookupVisitor& visitor,
+                       const DatabaseLookup& lookup,
+                       ResourceType queryLevel,
+                       int64_t* cursor,  // Can be NULL
+                       size_t since,
+                       size_t limit);
+
+    // Whether the DICOM file truncated before its pixel data must be
+    // stored as a separate "dicom-until-pixel-data" attachment
+    bool IsDicomUntilPixelDataStored(size_t dicomSize) const;
+
+    // Lazy creation of the "dicom-until-pixel-data" attachment of an
+    // instance that is already stored, while reading it
+    void AddDicomUntilPixelData(const std::string& instancePublicId,
+                                const std::string& dicom,
+                                uint64_t pixelDataOffset);
+
     // This method must only be called from "ServerIndex"!
     void RemoveFile(const std::string& fileUuid,
                     FileContentType type);
@@ -316,8 +382,61 @@ namespace Orthanc
       return storageCache_.SetMaximumSize(size);
     }
 
+    // New in Orthanc 1.11.2
+    void SetStorageCacheShardsCount(size_t count)
+    {
+      storageCache_.SetShardsCount(count);
+    }
+
+    // New in Orthanc 1.11.2
+    void PublishStorageCacheMetrics()
+    {
+      storageCache_.PublishMetrics(*metricsRegistry_);
+    }
+
+    // New in Orthanc 1.11.2
+    RenderedImageCache& GetRenderedCache()
+    {
+      return renderedCache_;
+    }
+
+    // New in Orthanc 1.11.2
+    void PublishRenderedCacheMetrics()
+    {
+      renderedCache_.PublishMetrics(*metricsRegistry_);
+    }
+
+    // New in Orthanc 1.11.2
+    ThumbnailsGenerator& GetThumbnailsGenerator()
+    {
+      return thumbnailsGenerator_;
+    }
+
+    // New in Orthanc 1.11.2
+    DeletionQueue& GetDeletionQueue()
+    {
+      return deletionQueue_;
+    }
+
+    // New in Orthanc 1.11.2
+    void PublishDeletionQueueMetrics()
+    {
+      deletionQueue_.PublishMetrics(*metricsRegistry_);
+    }
+
+    // New in Orthanc 1.11.2
+    void PublishChangesMetrics();
+
     void SetCompressionEnabled(bool enabled);
 
+    // New in Orthanc 1.11.2
+    void SetDicomUntilPixelDataThreshold(uint64_t size);
+
+    uint64_t GetDicomUntilPixelDataThreshold() const
+    {
+      return dicomUntilPixelDataThreshold_;
+    }
+
     bool IsCompressionEnabled() const
     {
       return compressionEnabled_;
@@ -365,6 +484,14 @@ namespace Orthanc
     bool ReadDicomUntilPixelData(std::string& dicom,
                                  const std::string& instancePublicId);
 
+    // Reads one frame by ranges, using the "FrameOffsets" metadata
+    // (new in Orthanc 1.11.2). Returns "false" if the frame must be
+    // extracted by parsing the full DICOM file.
+    bool ReadRawFrame(std::string& frame,
+                      MimeType& mime,
+                      const std::string& instancePublicId,
+                      unsigned int frameIndex);
+
     // This method is for low-level operations on "/instances/.../attachments/..."
     void ReadAttachment(std::string& result,
                         int64_t& revision,
@@ -424,6 +551,17 @@ namespace Orthanc
                size_t since,
                size_t limit);
 
+    // Keyset pagination: Only visit the resources whose internal ID
+    // is greater than "after". On exit, "next" contains the cursor of
+    // the next page, which is only meaningful if the visitor was not
+    // marked as complete (new in Orthanc 1.11.2)
+    void Apply(ILookupVisitor& visitor,
+               const DatabaseLookup& lookup,
+               ResourceType queryLevel,
+               int64_t after,
+               size_t limit,
+               int64_t& next);
+
     bool LookupOrReconstructMetadata(std::string& target,
                                      const std::string& publicId,
                                      ResourceType level,
@@ -62,10 +62,12 @@ namespace Orthanc
     dictMetadataType_.Add(MetadataType_Instance_PixelDataOffset, "PixelDataOffset");
     dictMetadataType_.Add(MetadataType_MainDicomTagsSignature, "MainDicomTagsSignature");
     dictMetadataType_.Add(MetadataType_MainDicomSequences, "MainDicomSequences");
+    dictMetadataType_.Add(MetadataType_Instance_FrameOffsets, "FrameOffsets");
 
     dictContentType_.Add(FileContentType_Dicom, "dicom");
     dictContentType_.Add(FileContentType_DicomAsJson, "dicom-as-json");
     dictContentType_.Add(FileContentType_DicomUntilPixelData, "dicom-until-pixel-data");
+    dictContentType_.Add(FileContentType_Thumbnail, "thumbnail");
   }
 
   void RegisterUserMetadata(int metadata,
@@ -174,6 +176,9 @@ namespace Orthanc
       case FileContentType_DicomAsJson:
         return MIME_JSON_UTF8;
 
+      case FileContentType_Thumbnail:
+        return EnumerationToString(MimeType_Jpeg);
+
       default:
         return EnumerationToString(MimeType_Binary);
     }
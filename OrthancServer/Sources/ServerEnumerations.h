@@ -153,6 +153,7 @@ namespace Orthanc
     MetadataType_Instance_PixelDataOffset = 14,  // New in Orthanc 1.9.0
     MetadataType_MainDicomTagsSignature = 15,    // New in Orthanc 1.11.0
     MetadataType_MainDicomSequences = 16,        // New in Orthanc 1.11.1
+    MetadataType_Instance_FrameOffsets = 17,     // New in Orthanc 1.11.2
     
     // Make sure that the value "65535" can be stored into this enumeration
     MetadataType_StartUser = 1024,
@@ -75,10 +75,12 @@ namespace Orthanc
     std::list<ServerIndexChange> pendingChanges_;
     uint64_t sizeOfFilesToRemove_;
     uint64_t sizeOfAddedAttachments_;
+    bool filesToRemoveArePending_;
 
     void Reset()
     {
       sizeOfFilesToRemove_ = 0;
+      filesToRemoveArePending_ = false;
       hasRemainingLevel_ = false;
       remainingType_ = ResourceType_Instance;  // dummy initialization
       pendingFilesToRemove_.clear();
@@ -88,6 +90,23 @@ namespace Orthanc
 
     void CommitFilesToRemove()
     {
+      if (filesToRemoveArePending_)
+      {
+        // Since Orthanc 1.11.2, the files are possibly removed in the
+        // background by the deletion queue of the server context
+        DeletionQueue::Files files;
+
+        for (std::list<FileToRemove>::const_iterator 
+               it = pendingFilesToRemove_.begin();
+             it != pendingFilesToRemove_.end(); ++it)
+        {
+          files.push_back(std::make_pair(it->GetUuid(), it->GetContentType()));
+        }
+
+        context_.GetDeletionQueue().Enqueue(files);
+        return;
+      }
+
       for (std::list<FileToRemove>::const_iterator 
              it = pendingFilesToRemove_.begin();
            it != pendingFilesToRemove_.end(); ++it)
@@ -172,6 +191,29 @@ namespace Orthanc
       sizeOfAddedAttachments_ += compressedSize;
     }
 
+    virtual void PrepareCommit(IDatabaseWrapper::ITransaction& transaction) ORTHANC_OVERRIDE
+    {
+      /**
+       * If the deletion queue is running, the files to be removed are
+       * recorded in the same transaction as the one that deletes
+       * their attachments. This way, no file is leaked if Orthanc
+       * stops between the commit and the actual removal of the files
+       * (new in Orthanc 1.11.2).
+       **/
+      if (!pendingFilesToRemove_.empty() &&
+          context_.GetDeletionQueue().IsRunning())
+      {
+        for (std::list<FileToRemove>::const_iterator 
+               it = pendingFilesToRemove_.begin();
+             it != pendingFilesToRemove_.end(); ++it)
+        {
+          transaction.AddPendingDeletion(it->GetUuid(), it->GetContentType());
+        }
+
+        filesToRemoveArePending_ = true;
+      }
+    }
+
     virtual bool LookupRemainingLevel(std::string& remainingPublicId /* out */,
                                       ResourceType& remainingLevel   /* out */) ORTHANC_OVERRIDE
     {
@@ -987,6 +987,18 @@ namespace Orthanc
       }
     }
 
+    void SetCompressionThreads(unsigned int threadsCount)
+    {
+      if (zip_.get() == NULL)
+      {
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+      else
+      {
+        zip_->SetCompressionThreads(threadsCount);
+      }
+    }
+
     void CancelStream()
     {
       if (zip_.get() == NULL)
@@ -1094,7 +1106,8 @@ namespace Orthanc
     archiveSize_(0),
     transcode_(false),
     transferSyntax_(DicomTransferSyntax_LittleEndianImplicit),
-    loaderThreads_(0)
+    loaderThreads_(0),
+    compressionThreads_(0)
   {
   }
 
@@ -1183,6 +1196,19 @@ namespace Orthanc
   }
 
 
+  void ArchiveJob::SetCompressionThreads(unsigned int compressionThreads)
+  {
+    if (writer_.get() != NULL)   // Already started
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      compressionThreads_ = compressionThreads;
+    }
+  }
+
+
   void ArchiveJob::Reset()
   {
     throw OrthancException(ErrorCode_BadSequenceOfCalls,
@@ -1225,6 +1251,7 @@ namespace Orthanc
           
           writer_.reset(new ZipWriterIterator(context_, *instanceLoader_, *archive_, isMedia_, enableExtendedSopClass_));
           writer_->SetOutputFile(asynchronousTarget_->GetPath());
+          writer_->SetCompressionThreads(compressionThreads_);
         }
       }
       else
@@ -1233,6 +1260,7 @@ namespace Orthanc
     
         writer_.reset(new ZipWriterIterator(context_, *instanceLoader_, *archive_, isMedia_, enableExtendedSopClass_));
         writer_->AcquireOutputStream(synchronousTarget_.release());
+        writer_->SetCompressionThreads(compressionThreads_);
       }
 
       instancesCount_ = writer_->GetInstancesCount();
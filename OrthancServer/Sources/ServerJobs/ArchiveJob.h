@@ -71,6 +71,9 @@ namespace Orthanc
     // New in Orthanc 1.10.0
     unsigned int         loaderThreads_;
 
+    // New in Orthanc 1.11.2
+    unsigned int         compressionThreads_;
+
     void FinalizeTarget();
     
   public:
@@ -95,6 +98,8 @@ namespace Orthanc
 
     void SetLoaderThreads(unsigned int loaderThreads);
 
+    void SetCompressionThreads(unsigned int compressionThreads);
+
     virtual void Reset() ORTHANC_OVERRIDE;
 
     virtual void Start() ORTHANC_OVERRIDE;
@@ -30,9 +30,170 @@
 #include "../ServerContext.h"
 #include "../StorageCommitmentReports.h"
 
+#include <boost/thread.hpp>
+
 
 namespace Orthanc
 {
+  // C-STORE of one instance through one of the parallel associations
+  class DicomModalityStoreJob::StoreTask : public boost::noncopyable
+  {
+  private:
+    std::string                        instance_;
+    bool                               success_;
+    std::string                        sopClassUid_;
+    std::string                        sopInstanceUid_;
+    std::unique_ptr<OrthancException>  error_;
+
+  public:
+    explicit StoreTask(const std::string& instance) :
+      instance_(instance),
+      success_(false)
+    {
+    }
+
+    // Invoked from a separate thread: Exceptions must not escape
+    void Execute(DicomModalityStoreJob& that,
+                 DicomStoreUserConnection& connection)
+    {
+      try
+      {
+        success_ = that.SendInstance(sopClassUid_, sopInstanceUid_, connection, instance_);
+      }
+      catch (OrthancException& e)
+      {
+        error_.reset(new OrthancException(e));
+      }
+      catch (...)
+      {
+        error_.reset(new OrthancException(ErrorCode_InternalError));
+      }
+    }
+
+    const std::string& GetInstance() const
+    {
+      return instance_;
+    }
+
+    bool IsSuccess() const
+    {
+      return success_;
+    }
+
+    const std::string& GetSopClassUid() const
+    {
+      return sopClassUid_;
+    }
+
+    const std::string& GetSopInstanceUid() const
+    {
+      return sopInstanceUid_;
+    }
+
+    bool HasError() const
+    {
+      return error_.get() != NULL;
+    }
+
+    const OrthancException& GetError() const
+    {
+      assert(HasError());
+      return *error_;
+    }
+  };
+
+
+  // One of the parallel associations, together with the thread that
+  // sends the instances through it
+  class DicomModalityStoreJob::StoreWorker : public boost::noncopyable
+  {
+  private:
+    DicomModalityStoreJob&     that_;
+    DicomStoreUserConnection   connection_;
+    boost::mutex               mutex_;
+    boost::condition_variable  changed_;
+    StoreTask*                 task_;   // NULL iff idle
+    bool                       stop_;
+    boost::thread              thread_;
+
+    static void Worker(StoreWorker* worker)
+    {
+      for (;;)
+      {
+        StoreTask* task = NULL;
+
+        {
+          boost::mutex::scoped_lock lock(worker->mutex_);
+
+          while (!worker->stop_ &&
+                 worker->task_ == NULL)
+          {
+            worker->changed_.wait(lock);
+          }
+
+          if (worker->stop_)
+          {
+            return;
+          }
+
+          task = worker->task_;
+        }
+
+        task->Execute(worker->that_, worker->connection_);
+
+        {
+          boost::mutex::scoped_lock lock(worker->mutex_);
+          worker->task_ = NULL;
+          worker->changed_.notify_all();
+        }
+      }
+    }
+
+  public:
+    StoreWorker(DicomModalityStoreJob& that,
+                const DicomAssociationParameters& parameters) :
+      that_(that),
+      connection_(parameters),
+      task_(NULL),
+      stop_(false)
+    {
+      thread_ = boost::thread(Worker, this);
+    }
+
+    ~StoreWorker()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        stop_ = true;
+        changed_.notify_all();
+      }
+
+      if (thread_.joinable())
+      {
+        thread_.join();
+      }
+    }
+
+    void Submit(StoreTask& task)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      assert(task_ == NULL);
+      task_ = &task;
+      changed_.notify_all();
+    }
+
+    void Wait()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (task_ != NULL)
+      {
+        changed_.wait(lock);
+      }
+    }
+  };
+
+
   void DicomModalityStoreJob::OpenConnection()
   {
     if (connection_.get() == NULL)
@@ -42,11 +203,25 @@ namespace Orthanc
   }
 
 
-  bool DicomModalityStoreJob::HandleInstance(const std::string& instance)
+  void DicomModalityStoreJob::CloseConnections()
   {
-    assert(IsStarted());
-    OpenConnection();
+    connection_.reset(NULL);
 
+    for (size_t i = 0; i < parallelWorkers_.size(); i++)
+    {
+      assert(parallelWorkers_[i] != NULL);
+      delete parallelWorkers_[i];
+    }
+
+    parallelWorkers_.clear();
+  }
+
+
+  bool DicomModalityStoreJob::SendInstance(std::string& sopClassUid,
+                                           std::string& sopInstanceUid,
+                                           DicomStoreUserConnection& connection,
+                                           const std::string& instance)
+  {
     LOG(INFO) << "Sending instance " << instance << " to modality \"" 
               << parameters_.GetRemoteModality().GetApplicationEntityTitle() << "\"";
 
@@ -62,10 +237,15 @@ namespace Orthanc
       return false;
     }
 
-    std::string sopClassUid, sopInstanceUid;
-    context_.StoreWithTranscoding(sopClassUid, sopInstanceUid, *connection_, dicom,
+    context_.StoreWithTranscoding(sopClassUid, sopInstanceUid, connection, dicom,
                                   HasMoveOriginator(), moveOriginatorAet_, moveOriginatorId_);
+    return true;
+  }
+
 
+  void DicomModalityStoreJob::CommitInstance(const std::string& sopClassUid,
+                                             const std::string& sopInstanceUid)
+  {
     if (storageCommitment_)
     {
       sopClassUids_.push_back(sopClassUid);
@@ -80,7 +260,7 @@ namespace Orthanc
       if (sopClassUids_.size() == GetInstancesCount())
       {
         assert(IsStarted());
-        connection_.reset(NULL);
+        CloseConnections();
         
         const std::string& remoteAet = parameters_.GetRemoteModality().GetApplicationEntityTitle();
         
@@ -97,11 +277,114 @@ namespace Orthanc
         DicomAssociation::RequestStorageCommitment(parameters_, transactionUid_, a, b);
       }
     }
+  }
+
+
+  bool DicomModalityStoreJob::HandleInstance(const std::string& instance)
+  {
+    assert(IsStarted());
+    OpenConnection();
+
+    std::string sopClassUid, sopInstanceUid;
+    if (!SendInstance(sopClassUid, sopInstanceUid, *connection_, instance))
+    {
+      return false;
+    }
+
+    CommitInstance(sopClassUid, sopInstanceUid);
 
     //boost::this_thread::sleep(boost::posix_time::milliseconds(500));
 
     return true;
   }
+
+
+  JobStepResult DicomModalityStoreJob::StepParallel(size_t associationsCount)
+  {
+    /**
+     * Each step sends the next "associationsCount" instances
+     * concurrently, each of them through its own association. The
+     * outcomes are then processed in the order of the instances, as
+     * if "HandleInstance()" had been called on each of them.
+     **/
+
+    const size_t start = GetPosition();
+    const size_t end = std::min(start + associationsCount, GetInstancesCount());
+    assert(start < end);
+
+    OpenConnection();
+
+    while (parallelWorkers_.size() + 1 < end - start)
+    {
+      parallelWorkers_.push_back(new StoreWorker(*this, parameters_));
+    }
+
+    std::vector< boost::shared_ptr<StoreTask> > tasks(end - start);
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+      tasks[i].reset(new StoreTask(GetInstance(start + i)));
+    }
+
+    // The job thread sends the first instance through the main association
+    for (size_t i = 1; i < tasks.size(); i++)
+    {
+      parallelWorkers_[i - 1]->Submit(*tasks[i]);
+    }
+
+    tasks[0]->Execute(*this, *connection_);
+
+    for (size_t i = 1; i < tasks.size(); i++)
+    {
+      parallelWorkers_[i - 1]->Wait();
+    }
+
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+      if (tasks[i]->HasError())
+      {
+        if (IsPermissive())
+        {
+          LOG(WARNING) << "Ignoring an error in a permissive job: " << tasks[i]->GetError().What();
+        }
+        else
+        {
+          return JobStepResult::Failure(tasks[i]->GetError());
+        }
+      }
+      else if (!tasks[i]->IsSuccess())
+      {
+        AddFailedInstance(tasks[i]->GetInstance());
+
+        if (!IsPermissive())
+        {
+          return JobStepResult::Failure(ErrorCode_InternalError, NULL);
+        }
+      }
+      else
+      {
+        CommitInstance(tasks[i]->GetSopClassUid(), tasks[i]->GetSopInstanceUid());
+      }
+    }
+
+    return AdvancePosition(tasks.size());
+  }
+
+
+  JobStepResult DicomModalityStoreJob::Step(const std::string& jobId)
+  {
+    const uint32_t associationsCount = parameters_.GetRemoteModality().GetStoreAssociations();
+
+    if (associationsCount > 1 &&
+        IsStarted() &&
+        GetPosition() < GetInstancesCount())
+    {
+      return StepParallel(associationsCount);
+    }
+    else
+    {
+      return SetOfInstancesJob::Step(jobId);
+    }
+  }
     
 
   bool DicomModalityStoreJob::HandleTrailingStep()
@@ -203,9 +486,15 @@ namespace Orthanc
     }
   }
 
+  DicomModalityStoreJob::~DicomModalityStoreJob()
+  {
+    CloseConnections();
+  }
+
+
   void DicomModalityStoreJob::Stop(JobStopReason reason)   // For pausing jobs
   {
-    connection_.reset(NULL);
+    CloseConnections();
   }
 
 
@@ -27,6 +27,7 @@
 #include "../../../OrthancFramework/Sources/DicomNetworking/DicomStoreUserConnection.h"
 
 #include <list>
+#include <vector>
 
 namespace Orthanc
 {
@@ -35,6 +36,9 @@ namespace Orthanc
   class DicomModalityStoreJob : public SetOfInstancesJob
   {
   private:
+    class StoreTask;
+    class StoreWorker;
+
     ServerContext&                             context_;
     DicomAssociationParameters                 parameters_;
     std::string                                moveOriginatorAet_;
@@ -42,6 +46,11 @@ namespace Orthanc
     std::unique_ptr<DicomStoreUserConnection>  connection_;
     bool                                       storageCommitment_;
 
+    // Additional associations, each with its own thread, if the
+    // remote modality accepts several parallel associations. They
+    // are kept across the steps (new in Orthanc 1.11.2)
+    std::vector<StoreWorker*>                  parallelWorkers_;
+
     // For storage commitment
     std::string             transactionUid_;
     std::list<std::string>  sopInstanceUids_;
@@ -49,8 +58,20 @@ namespace Orthanc
 
     void OpenConnection();
 
+    void CloseConnections();
+
     void ResetStorageCommitment();
 
+    bool SendInstance(std::string& sopClassUid,
+                      std::string& sopInstanceUid,
+                      DicomStoreUserConnection& connection,
+                      const std::string& instance);
+
+    void CommitInstance(const std::string& sopClassUid,
+                        const std::string& sopInstanceUid);
+
+    JobStepResult StepParallel(size_t associationsCount);
+
   protected:
     virtual bool HandleInstance(const std::string& instance) ORTHANC_OVERRIDE;
     
@@ -62,6 +83,8 @@ namespace Orthanc
     DicomModalityStoreJob(ServerContext& context,
                           const Json::Value& serialized);
 
+    virtual ~DicomModalityStoreJob();
+
     const DicomAssociationParameters& GetParameters() const
     {
       return parameters_;
@@ -87,6 +110,8 @@ namespace Orthanc
 
     virtual void Stop(JobStopReason reason) ORTHANC_OVERRIDE;
 
+    virtual JobStepResult Step(const std::string& jobId) ORTHANC_OVERRIDE;
+
     virtual void GetJobType(std::string& target) ORTHANC_OVERRIDE
     {
       target = "DicomModalityStore";
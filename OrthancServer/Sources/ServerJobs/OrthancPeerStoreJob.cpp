@@ -24,70 +24,537 @@
 #include "OrthancPeerStoreJob.h"
 
 #include "../../../OrthancFramework/Sources/Compression/GzipCompressor.h"
+#include "../../../OrthancFramework/Sources/Compression/ZipWriter.h"
+#include "../../../OrthancFramework/Sources/DicomFormat/DicomInstanceHasher.h"
 #include "../../../OrthancFramework/Sources/Logging.h"
 #include "../../../OrthancFramework/Sources/SerializationToolbox.h"
+#include "../OrthancConfiguration.h"
 #include "../ServerContext.h"
 
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
 #include <dcmtk/dcmdata/dcfilefo.h>
 
 
 namespace Orthanc
 {
-  bool OrthancPeerStoreJob::HandleInstance(const std::string& instance)
+  /**
+   * Sends the instances of one step of a batched job, as ZIP
+   * archives. Each thread packs the next instances of the step into
+   * a ZIP archive until the limits of the batch are reached, posts
+   * the archive to the peer, and repeats until all the instances of
+   * the step have been handled. The answer of the peer, that lists
+   * the status of each stored file, is mapped back to the instances.
+   **/
+  class OrthancPeerStoreJob::BatchSender : public boost::noncopyable
   {
-    //boost::this_thread::sleep(boost::posix_time::milliseconds(500));
+  public:
+    enum Status
+    {
+      Status_Pending,
+      Status_Sent,
+      Status_Removed,
+      Status_Error
+    };
+
+  private:
+    OrthancPeerStoreJob&  job_;
+    size_t                start_;
+    boost::mutex          mutex_;
+    size_t                next_;
+    std::vector<Status>   status_;
+    std::vector< boost::shared_ptr<OrthancException> >  errors_;
+    uint64_t              size_;
+
+    bool NextInstance(size_t& index)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
 
-    if (client_.get() == NULL)
+      if (next_ < status_.size())
+      {
+        index = next_;
+        next_++;
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    // Prevents the threads from taking further instances
+    void StopInstances()
     {
-      client_.reset(new HttpClient(peer_, "instances"));
-      client_->SetMethod(HttpMethod_Post);
+      boost::mutex::scoped_lock lock(mutex_);
+      next_ = status_.size();
+    }
 
-      if (compress_)
+    void SetStatus(size_t index,
+                   Status status,
+                   const OrthancException* error)
+    {
+      boost::shared_ptr<OrthancException> e;
+      if (error != NULL)
       {
-        client_->AddHeader("Expect", "");
-        client_->AddHeader("Content-Encoding", "gzip");
+        e.reset(new OrthancException(*error));
       }
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      assert(index < status_.size());
+      status_[index] = status;
+      errors_[index] = e;
     }
-      
-    LOG(INFO) << "Sending instance " << instance << " to peer \"" 
-              << peer_.GetUrl() << "\"";
 
-    // Lifetime of "body" must exceed the call to "client_->Apply()" because of "SetExternalBody()"
-    std::string body;
+    void SetStatus(const std::vector<size_t>& batch,
+                   Status status,
+                   const OrthancException* error)
+    {
+      for (size_t i = 0; i < batch.size(); i++)
+      {
+        SetStatus(batch[i], status, error);
+      }
+    }
+
+    void AddSize(uint64_t size)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      size_ += size;
+    }
+
+    // Status of one file in the answer of "/instances"
+    static bool IsStored(const Json::Value& item)
+    {
+      if (item.type() == Json::objectValue &&
+          item.isMember("Status") &&
+          item["Status"].type() == Json::stringValue)
+      {
+        const std::string status = item["Status"].asString();
+        return (status == EnumerationToString(StoreStatus_Success) ||
+                status == EnumerationToString(StoreStatus_AlreadyStored));
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    void HandleAnswer(const std::vector<size_t>& batch,
+                      const std::vector<std::string>& remoteIds,
+                      const Json::Value& answer)
+    {
+      assert(batch.size() == remoteIds.size());
+
+      if (answer.type() != Json::arrayValue)
+      {
+        throw OrthancException(ErrorCode_NetworkProtocol,
+                               "Unexpected answer from peer \"" + job_.peer_.GetUrl() + "\" to a ZIP archive");
+      }
+
+      /**
+       * The peer only reports the files that it could parse, and
+       * doesn't report the Orthanc identifier of the files that it
+       * failed to store. As the Orthanc identifiers are computed from
+       * the DICOM identifiers, the instances are matched using the
+       * identifier they will receive on the peer.
+       **/
+      std::set<std::string> stored;
+
+      for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+      {
+        if (IsStored(answer[i]) &&
+            answer[i].isMember("ID") &&
+            answer[i]["ID"].type() == Json::stringValue)
+        {
+          stored.insert(answer[i]["ID"].asString());
+        }
+      }
+
+      for (size_t i = 0; i < batch.size(); i++)
+      {
+        if (stored.find(remoteIds[i]) != stored.end())
+        {
+          SetStatus(batch[i], Status_Sent, NULL);
+        }
+        else
+        {
+          OrthancException e(ErrorCode_NetworkProtocol,
+                             "Peer \"" + job_.peer_.GetUrl() + "\" has not stored instance: " +
+                             job_.GetInstance(start_ + batch[i]));
+          SetStatus(batch[i], Status_Error, &e);
+        }
+      }
+    }
+
+    // Fallback if the peer has rejected a ZIP archive as a whole, so
+    // that only the faulty instances are reported as errors
+    void SendOneByOne(const std::vector<size_t>& batch)
+    {
+      HttpClient client(job_.peer_, "instances");
+      client.SetMethod(HttpMethod_Post);
+
+      for (size_t i = 0; i < batch.size(); i++)
+      {
+        const std::string& instance = job_.GetInstance(start_ + batch[i]);
+
+        try
+        {
+          // Lifetime of "dicom" must exceed the call to "client.Apply()" because of "SetExternalBody()"
+          std::string dicom, remoteId;
+          if (job_.ReadInstance(dicom, remoteId, instance))
+          {
+            client.SetExternalBody(dicom);
+
+            Json::Value answer;
+            if (client.Apply(answer) &&
+                IsStored(answer))
+            {
+              SetStatus(batch[i], Status_Sent, NULL);
+              AddSize(dicom.size());
+            }
+            else
+            {
+              throw OrthancException(ErrorCode_NetworkProtocol,
+                                     "Peer \"" + job_.peer_.GetUrl() + "\" has not stored instance: " + instance);
+            }
+          }
+          else
+          {
+            SetStatus(batch[i], Status_Removed, NULL);
+          }
+        }
+        catch (OrthancException& e)
+        {
+          SetStatus(batch[i], Status_Error, &e);
+        }
+        catch (...)
+        {
+          OrthancException e(ErrorCode_InternalError);
+          SetStatus(batch[i], Status_Error, &e);
+        }
+      }
+    }
+
+    void SendBatches(HttpClient& client)
+    {
+      for (;;)
+      {
+        std::vector<size_t> batch;
+        std::vector<std::string> remoteIds;
+
+        try
+        {
+          // Lifetime of "zip" must exceed the call to "client.Apply()" because of "SetExternalBody()"
+          std::string zip;
+
+          {
+            ZipWriter writer;
+            writer.SetCompressionLevel(job_.compress_ ? job_.compressionLevel_ : 0);
+            writer.SetMemoryOutput(zip, job_.batchSize_ >= static_cast<uint64_t>(1024) * 1024 * 1024);
+            writer.Open();
+
+            uint64_t size = 0;
+            size_t index;
+
+            while (batch.size() < job_.batchInstances_ &&
+                   size < job_.batchSize_ &&
+                   NextInstance(index))
+            {
+              const std::string& instance = job_.GetInstance(start_ + index);
+
+              // The instance is added to the batch before being read,
+              // so that it is reported if an exception occurs
+              batch.push_back(index);
+
+              std::string dicom, remoteId;
+              if (job_.ReadInstance(dicom, remoteId, instance))
+              {
+                remoteIds.push_back(remoteId);
+                writer.OpenFile((instance + ".dcm").c_str());
+                writer.Write(dicom);
+                size += dicom.size();
+              }
+              else
+              {
+                batch.pop_back();
+                SetStatus(index, Status_Removed, NULL);
+              }
+            }
+
+            writer.Close();
+          }
+
+          if (batch.empty())
+          {
+            return;  // No more instance in this step
+          }
+
+          LOG(INFO) << "Sending a batch of " << batch.size() << " instances ("
+                    << zip.size() << " bytes) to peer \"" << job_.peer_.GetUrl() << "\"";
+
+          client.SetExternalBody(zip);
+
+          Json::Value answer;
+          if (client.Apply(answer))
+          {
+            HandleAnswer(batch, remoteIds, answer);
+            AddSize(zip.size());
+          }
+          else if (batch.size() > 1)
+          {
+            // The peer has answered with an HTTP error, which might
+            // be caused by one single instance
+            LOG(INFO) << "Peer \"" << job_.peer_.GetUrl() << "\" has rejected a batch of " << batch.size()
+                      << " instances (HTTP status " << client.GetLastStatus() << "), sending them one by one";
+            SendOneByOne(batch);
+          }
+          else
+          {
+            throw OrthancException(ErrorCode_NetworkProtocol,
+                                   "Cannot send a ZIP archive to peer \"" + job_.peer_.GetUrl() +
+                                   "\": Make sure that the version of the remote Orthanc server is >= 1.8.2");
+          }
+        }
+        catch (OrthancException& e)
+        {
+          SetStatus(batch, Status_Error, &e);
+        }
+        catch (...)
+        {
+          OrthancException e(ErrorCode_InternalError);
+          SetStatus(batch, Status_Error, &e);
+        }
+      }
+    }
+
+    void SendBatches()
+    {
+      boost::shared_ptr<HttpClient> client(job_.AcquireBatchClient());
+
+      try
+      {
+        SendBatches(*client);
+      }
+      catch (...)
+      {
+        job_.ReleaseBatchClient(client);
+        throw;
+      }
+
+      job_.ReleaseBatchClient(client);
+    }
+
+    static void Worker(BatchSender* that)
+    {
+      // The instances that are not taken by a failing worker are sent
+      // by the other threads, including the job thread
+      try
+      {
+        that->SendBatches();
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Error in a thread sending batches to an Orthanc peer: " << e.What();
+      }
+      catch (...)
+      {
+        LOG(ERROR) << "Native exception in a thread sending batches to an Orthanc peer";
+      }
+    }
+
+  public:
+    BatchSender(OrthancPeerStoreJob& job,
+                size_t start,
+                size_t end) :
+      job_(job),
+      start_(start),
+      next_(0),
+      status_(end - start, Status_Pending),
+      errors_(end - start),
+      size_(0)
+    {
+      assert(start < end);
+    }
+
+    void Run(unsigned int threadsCount)
+    {
+      // The job thread takes part in the sending
+      boost::thread_group threads;
+
+      try
+      {
+        for (unsigned int i = 1; i < threadsCount; i++)
+        {
+          threads.create_thread(boost::bind(Worker, this));
+        }
+      }
+      catch (...)
+      {
+        StopInstances();
+        threads.join_all();
+        throw;
+      }
+
+      try
+      {
+        SendBatches();
+      }
+      catch (...)
+      {
+        // The workers must be finished before unwinding, as they
+        // access this object that lives on the stack of the caller
+        StopInstances();
+        threads.join_all();
+        throw;
+      }
+
+      threads.join_all();
+    }
+
+    size_t GetCount() const
+    {
+      return status_.size();
+    }
+
+    Status GetStatus(size_t index) const
+    {
+      assert(index < status_.size());
+      return status_[index];
+    }
+
+    const OrthancException& GetError(size_t index) const
+    {
+      assert(index < errors_.size() &&
+             errors_[index].get() != NULL);
+      return *errors_[index];
+    }
+
+    const std::string& GetInstance(size_t index) const
+    {
+      return job_.GetInstance(start_ + index);
+    }
 
+    uint64_t GetSize() const
+    {
+      return size_;
+    }
+  };
+
+
+  boost::shared_ptr<HttpClient> OrthancPeerStoreJob::AcquireBatchClient()
+  {
+    {
+      boost::mutex::scoped_lock lock(batchClientsMutex_);
+
+      if (!batchClients_.empty())
+      {
+        boost::shared_ptr<HttpClient> client = batchClients_.front();
+        batchClients_.pop_front();
+        return client;
+      }
+    }
+
+    boost::shared_ptr<HttpClient> client(new HttpClient(peer_, "instances"));
+    client->SetMethod(HttpMethod_Post);
+    client->AddHeader("Content-Type", EnumerationToString(MimeType_Zip));
+    client->AddHeader("Expect", "");  // Avoid the round trip of "100-continue"
+    return client;
+  }
+
+
+  void OrthancPeerStoreJob::ReleaseBatchClient(const boost::shared_ptr<HttpClient>& client)
+  {
+    boost::mutex::scoped_lock lock(batchClientsMutex_);
+    batchClients_.push_back(client);
+  }
+
+
+  bool OrthancPeerStoreJob::ReadInstance(std::string& dicom,
+                                         std::string& remoteId,
+                                         const std::string& instance)
+  {
     try
     {
+      remoteId = instance;
+
       if (transcode_)
       {
-        std::string dicom;
-        context_.ReadDicom(dicom, instance);
+        std::string source;
+        context_.ReadDicom(source, instance);
 
         std::set<DicomTransferSyntax> syntaxes;
         syntaxes.insert(transferSyntax_);
         
-        IDicomTranscoder::DicomImage source, transcoded;
-        source.SetExternalBuffer(dicom);
+        IDicomTranscoder::DicomImage image, transcoded;
+        image.SetExternalBuffer(source);
 
-        if (context_.Transcode(transcoded, source, syntaxes, true))
+        if (context_.Transcode(transcoded, image, syntaxes, true))
         {
-          body.assign(reinterpret_cast<const char*>(transcoded.GetBufferData()),
-                      transcoded.GetBufferSize());
+          dicom.assign(reinterpret_cast<const char*>(transcoded.GetBufferData()),
+                       transcoded.GetBufferSize());
+
+          // Lossy transcoding can assign a new SOP Instance UID,
+          // which changes the Orthanc identifier on the peer
+          try
+          {
+            if (transcoded.GetParsed().getDataset() != NULL)
+            {
+              DicomMap summary;
+              OrthancConfiguration::DefaultExtractDicomSummary(summary, *transcoded.GetParsed().getDataset());
+              remoteId = DicomInstanceHasher(summary).HashInstance();
+            }
+          }
+          catch (OrthancException&)
+          {
+            // Keep the local identifier
+          }
         }
         else
         {
-          body.swap(dicom);
+          dicom.swap(source);
         }
       }
       else
       {
-        context_.ReadDicom(body, instance);
+        context_.ReadDicom(dicom, instance);
       }
+
+      return true;
     }
     catch (OrthancException& e)
     {
       LOG(WARNING) << "An instance was removed after the job was issued: " << instance;
       return false;
     }
+  }
+
+
+  bool OrthancPeerStoreJob::HandleInstance(const std::string& instance)
+  {
+    //boost::this_thread::sleep(boost::posix_time::milliseconds(500));
+
+    if (client_.get() == NULL)
+    {
+      client_.reset(new HttpClient(peer_, "instances"));
+      client_->SetMethod(HttpMethod_Post);
+
+      if (compress_)
+      {
+        client_->AddHeader("Expect", "");
+        client_->AddHeader("Content-Encoding", "gzip");
+      }
+    }
+      
+    LOG(INFO) << "Sending instance " << instance << " to peer \"" 
+              << peer_.GetUrl() << "\"";
+
+    // Lifetime of "body" must exceed the call to "client_->Apply()" because of "SetExternalBody()"
+    std::string body, remoteId;
+
+    if (!ReadInstance(body, remoteId, instance))
+    {
+      return false;
+    }
 
     // Lifetime of "compressedBody" must exceed the call to "client_->Apply()" because of "SetExternalBody()"
     std::string compressedBody;
@@ -95,7 +562,7 @@ namespace Orthanc
     if (compress_)
     {
       GzipCompressor compressor;
-      compressor.SetCompressionLevel(9);  // Max compression level
+      compressor.SetCompressionLevel(compressionLevel_);
       IBufferCompressor::Compress(compressedBody, compressor, body);
 
       client_->SetExternalBody(compressedBody);
@@ -132,6 +599,75 @@ namespace Orthanc
   }
 
 
+  JobStepResult OrthancPeerStoreJob::StepBatches()
+  {
+    /**
+     * Each step handles the instances of "batchThreads_" full
+     * batches. The outcomes are then processed in the order of the
+     * instances, as if "HandleInstance()" had been called on each of
+     * them.
+     **/
+
+    const size_t start = GetPosition();
+    const size_t end = std::min(start + static_cast<size_t>(batchInstances_) * batchThreads_,
+                                GetInstancesCount());
+
+    BatchSender sender(*this, start, end);
+    sender.Run(batchThreads_);
+
+    size_ += sender.GetSize();
+
+    for (size_t i = 0; i < sender.GetCount(); i++)
+    {
+      switch (sender.GetStatus(i))
+      {
+        case BatchSender::Status_Sent:
+          break;
+
+        case BatchSender::Status_Removed:
+          AddFailedInstance(sender.GetInstance(i));
+
+          if (!IsPermissive())
+          {
+            return JobStepResult::Failure(ErrorCode_InternalError, NULL);
+          }
+          break;
+
+        case BatchSender::Status_Error:
+          if (IsPermissive())
+          {
+            LOG(WARNING) << "Ignoring an error in a permissive job: " << sender.GetError(i).What();
+          }
+          else
+          {
+            return JobStepResult::Failure(sender.GetError(i));
+          }
+          break;
+
+        default:
+          throw OrthancException(ErrorCode_InternalError);
+      }
+    }
+
+    return AdvancePosition(sender.GetCount());
+  }
+
+
+  JobStepResult OrthancPeerStoreJob::Step(const std::string& jobId)
+  {
+    if (IsBatched() &&
+        IsStarted() &&
+        GetPosition() < GetInstancesCount())
+    {
+      return StepBatches();
+    }
+    else
+    {
+      return SetOfInstancesJob::Step(jobId);
+    }
+  }
+
+
   void OrthancPeerStoreJob::SetPeer(const WebServiceParameters& peer)
   {
     if (IsStarted())
@@ -213,9 +749,77 @@ namespace Orthanc
   }
 
 
+  void OrthancPeerStoreJob::SetCompressionLevel(uint8_t level)
+  {
+    if (IsStarted())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else if (level > 9)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "The compression level must be between 0 and 9");
+    }
+    else
+    {
+      compressionLevel_ = level;
+    }
+  }
+
+
+  void OrthancPeerStoreJob::SetBatchInstances(unsigned int count)
+  {
+    if (IsStarted())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      batchInstances_ = count;
+    }
+  }
+
+
+  void OrthancPeerStoreJob::SetBatchSize(uint64_t size)
+  {
+    if (IsStarted())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else if (size == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      batchSize_ = size;
+    }
+  }
+
+
+  void OrthancPeerStoreJob::SetBatchThreads(unsigned int threads)
+  {
+    if (IsStarted())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else if (threads == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      batchThreads_ = threads;
+    }
+  }
+
+
   void OrthancPeerStoreJob::Stop(JobStopReason reason)   // For pausing jobs
   {
     client_.reset(NULL);
+
+    boost::mutex::scoped_lock lock(batchClientsMutex_);
+    batchClients_.clear();
   }
 
 
@@ -229,6 +833,12 @@ namespace Orthanc
                     false /* don't include passwords */);
     value["Peer"] = v;
     value["Compress"] = compress_;
+
+    if (IsBatched())
+    {
+      value["BatchInstances"] = batchInstances_;
+      value["BatchThreads"] = batchThreads_;
+    }
     
     if (transcode_)
     {
@@ -245,11 +855,19 @@ namespace Orthanc
   static const char* TRANSCODE = "Transcode";
   static const char* COMPRESS = "Compress";
   static const char* SIZE = "Size";
+  static const char* COMPRESSION_LEVEL = "CompressionLevel";
+  static const char* BATCH_INSTANCES = "BatchInstances";
+  static const char* BATCH_SIZE = "BatchSize";
+  static const char* BATCH_THREADS = "BatchThreads";
 
   OrthancPeerStoreJob::OrthancPeerStoreJob(ServerContext& context,
                                            const Json::Value& serialized) :
     SetOfInstancesJob(serialized),
-    context_(context)
+    context_(context),
+    compressionLevel_(9),
+    batchInstances_(0),
+    batchSize_(64 * 1024 * 1024),
+    batchThreads_(1)
   {
     assert(serialized.type() == Json::objectValue);
     peer_ = WebServiceParameters(serialized[PEER]);
@@ -281,6 +899,19 @@ namespace Orthanc
     {
       size_ = 0;
     }
+
+    // New in Orthanc 1.11.2
+    if (serialized.isMember(COMPRESSION_LEVEL))
+    {
+      SetCompressionLevel(static_cast<uint8_t>(SerializationToolbox::ReadUnsignedInteger(serialized, COMPRESSION_LEVEL)));
+    }
+
+    if (serialized.isMember(BATCH_INSTANCES))
+    {
+      SetBatchInstances(SerializationToolbox::ReadUnsignedInteger(serialized, BATCH_INSTANCES));
+      SetBatchSize(boost::lexical_cast<uint64_t>(SerializationToolbox::ReadString(serialized, BATCH_SIZE)));
+      SetBatchThreads(SerializationToolbox::ReadUnsignedInteger(serialized, BATCH_THREADS));
+    }
   }
 
 
@@ -304,6 +935,10 @@ namespace Orthanc
 
       target[COMPRESS] = compress_;
       target[SIZE] = boost::lexical_cast<std::string>(size_);
+      target[COMPRESSION_LEVEL] = compressionLevel_;
+      target[BATCH_INSTANCES] = batchInstances_;
+      target[BATCH_SIZE] = boost::lexical_cast<std::string>(batchSize_);
+      target[BATCH_THREADS] = batchThreads_;
       
       return true;
     }
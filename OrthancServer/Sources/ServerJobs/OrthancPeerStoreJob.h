@@ -26,6 +26,9 @@
 #include "../../../OrthancFramework/Sources/JobsEngine/SetOfInstancesJob.h"
 #include "../../../OrthancFramework/Sources/HttpClient.h"
 
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
 #include <stdint.h>
 
 
@@ -36,6 +39,8 @@ namespace Orthanc
   class OrthancPeerStoreJob : public SetOfInstancesJob
   {
   private:
+    class BatchSender;
+
     ServerContext&               context_;
     WebServiceParameters         peer_;
     std::unique_ptr<HttpClient>  client_;
@@ -43,6 +48,29 @@ namespace Orthanc
     DicomTransferSyntax          transferSyntax_;
     bool                         compress_;
     uint64_t                     size_;
+    uint8_t                      compressionLevel_;
+
+    // Batched mode (new in Orthanc 1.11.2)
+    unsigned int                 batchInstances_;
+    uint64_t                     batchSize_;
+    unsigned int                 batchThreads_;
+
+    // The HTTP clients of the sending threads are kept across the
+    // steps, in order to reuse their connections to the peer
+    boost::mutex                                 batchClientsMutex_;
+    std::list< boost::shared_ptr<HttpClient> >   batchClients_;
+
+    // "remoteId" receives the Orthanc identifier of the instance, as
+    // it will be computed by the peer
+    bool ReadInstance(std::string& dicom,
+                      std::string& remoteId,
+                      const std::string& instance);
+
+    boost::shared_ptr<HttpClient> AcquireBatchClient();
+
+    void ReleaseBatchClient(const boost::shared_ptr<HttpClient>& client);
+
+    JobStepResult StepBatches();
 
   protected:
     virtual bool HandleInstance(const std::string& instance) ORTHANC_OVERRIDE;
@@ -55,7 +83,11 @@ namespace Orthanc
       transcode_(false),
       transferSyntax_(DicomTransferSyntax_LittleEndianExplicit),  // Dummy value
       compress_(false),
-      size_(0)
+      size_(0),
+      compressionLevel_(9),  // Max compression level
+      batchInstances_(0),    // By default, one request per instance
+      batchSize_(64 * 1024 * 1024),
+      batchThreads_(1)
     {
     }
 
@@ -89,8 +121,52 @@ namespace Orthanc
 
     void SetCompress(bool compress);
 
+    // Between 0 and 9 (new in Orthanc 1.11.2)
+    void SetCompressionLevel(uint8_t level);
+
+    uint8_t GetCompressionLevel() const
+    {
+      return compressionLevel_;
+    }
+
+    /**
+     * If the number of instances per batch is above 1, the instances
+     * are packed into ZIP archives that are sent to the "/instances"
+     * route of the peer (which requires Orthanc >= 1.8.2 on the
+     * peer). A batch is sent as soon as it contains "count" instances
+     * or "size" bytes of DICOM data. "threads" batches are sent
+     * concurrently. (new in Orthanc 1.11.2)
+     **/
+    void SetBatchInstances(unsigned int count);
+
+    unsigned int GetBatchInstances() const
+    {
+      return batchInstances_;
+    }
+
+    void SetBatchSize(uint64_t size);
+
+    uint64_t GetBatchSize() const
+    {
+      return batchSize_;
+    }
+
+    void SetBatchThreads(unsigned int threads);
+
+    unsigned int GetBatchThreads() const
+    {
+      return batchThreads_;
+    }
+
+    bool IsBatched() const
+    {
+      return batchInstances_ > 1;
+    }
+
     virtual void Stop(JobStopReason reason) ORTHANC_OVERRIDE;   // For pausing jobs
 
+    virtual JobStepResult Step(const std::string& jobId) ORTHANC_OVERRIDE;
+
     virtual void GetJobType(std::string& target) ORTHANC_OVERRIDE
     {
       target = "OrthancPeerStore";
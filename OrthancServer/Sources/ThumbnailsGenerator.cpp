@@ -0,0 +1,326 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "PrecompiledHeadersServer.h"
+#include "ThumbnailsGenerator.h"
+
+#include "../../OrthancFramework/Sources/Images/Image.h"
+#include "../../OrthancFramework/Sources/Images/ImageProcessing.h"
+#include "../../OrthancFramework/Sources/Images/JpegWriter.h"
+#include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/OrthancException.h"
+#include "ServerContext.h"
+#include "SliceOrdering.h"
+
+#include <boost/math/special_functions/round.hpp>
+
+
+namespace Orthanc
+{
+  void ThumbnailsGenerator::Worker(ThumbnailsGenerator* that)
+  {
+    assert(that != NULL);
+
+    while (that->running_)
+    {
+      std::unique_ptr<IDynamicObject> obj(that->queue_.Dequeue(100));
+      if (obj.get() != NULL)
+      {
+        const std::string& seriesId = dynamic_cast<const SingleValueObject<std::string>&>(*obj).GetValue();
+
+        try
+        {
+          that->Generate(seriesId);
+        }
+        catch (OrthancException& e)
+        {
+          LOG(WARNING) << "Cannot generate the thumbnail of series " << seriesId << ": " << e.What();
+        }
+        catch (std::bad_alloc&)
+        {
+          LOG(ERROR) << "Not enough memory to generate the thumbnail of series " << seriesId;
+        }
+        catch (...)
+        {
+          LOG(ERROR) << "Native exception while generating the thumbnail of series " << seriesId;
+        }
+      }
+    }
+  }
+
+
+  ThumbnailsGenerator::ThumbnailsGenerator(ServerContext& context) :
+    context_(context),
+    running_(false),
+    size_(128),
+    quality_(90)
+  {
+  }
+
+
+  ThumbnailsGenerator::~ThumbnailsGenerator()
+  {
+    if (running_)
+    {
+      LOG(ERROR) << "INTERNAL ERROR: ThumbnailsGenerator::Stop() should be invoked manually to avoid mess in the destruction order!";
+      Stop();
+    }
+  }
+
+
+  void ThumbnailsGenerator::SetSize(unsigned int size)
+  {
+    if (size == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else if (running_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      size_ = size;
+    }
+  }
+
+
+  void ThumbnailsGenerator::SetQuality(uint8_t quality)
+  {
+    if (quality == 0 ||
+        quality > 100)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else if (running_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      quality_ = quality;
+    }
+  }
+
+
+  void ThumbnailsGenerator::Start(unsigned int threadsCount)
+  {
+    if (running_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (threadsCount > 0)
+    {
+      LOG(WARNING) << "Starting " << threadsCount << " thread(s) to generate the thumbnails of the series";
+
+      running_ = true;
+      workers_.resize(threadsCount);
+
+      for (size_t i = 0; i < workers_.size(); i++)
+      {
+        workers_[i] = new boost::thread(Worker, this);
+      }
+    }
+  }
+
+
+  void ThumbnailsGenerator::Stop()
+  {
+    if (running_)
+    {
+      LOG(INFO) << "Stopping the threads that generate the thumbnails of the series";
+      running_ = false;
+
+      for (size_t i = 0; i < workers_.size(); i++)
+      {
+        assert(workers_[i] != NULL);
+
+        if (workers_[i]->joinable())
+        {
+          workers_[i]->join();
+        }
+
+        delete workers_[i];
+      }
+
+      workers_.clear();
+      queue_.Clear();
+    }
+  }
+
+
+  void ThumbnailsGenerator::Generate(const std::string& seriesId)
+  {
+    std::string instanceId;
+    unsigned int frame;
+
+    {
+      SliceOrdering ordering(context_.GetIndex(), seriesId);
+
+      if (ordering.GetInstancesCount() == 0)
+      {
+        return;
+      }
+
+      // Pick the middle slice of the series. For series made of a
+      // single multi-frame instance, pick its middle frame.
+      const size_t index = ordering.GetInstancesCount() / 2;
+      instanceId = ordering.GetInstanceId(index);
+
+      if (ordering.GetInstancesCount() == 1)
+      {
+        frame = ordering.GetFramesCount(0) / 2;
+      }
+      else
+      {
+        frame = 0;
+      }
+    }
+
+    std::unique_ptr<ImageAccessor> decoded(context_.DecodeDicomFrame(instanceId, frame));
+    if (decoded.get() == NULL)
+    {
+      throw OrthancException(ErrorCode_NotImplemented,
+                             "Cannot decode DICOM instance with ID: " + instanceId);
+    }
+
+    bool invert;
+
+    {
+      ServerContext::DicomCacheLocker locker(context_, instanceId);
+
+      PhotometricInterpretation photometric;
+      invert = (locker.GetDicom().LookupPhotometricInterpretation(photometric) &&
+                photometric == PhotometricInterpretation_Monochrome1);
+    }
+
+    std::string jpeg;
+    RenderThumbnail(jpeg, *decoded, invert, size_, quality_);
+
+    int64_t newRevision;
+    context_.AddAttachment(newRevision, seriesId, FileContentType_Thumbnail, jpeg.empty() ? NULL : jpeg.c_str(),
+                           jpeg.size(), false /* no old revision */, -1 /* dummy revision */, "" /* dummy MD5 */);
+
+    LOG(INFO) << "Generated the thumbnail of series " << seriesId << " from instance " << instanceId;
+  }
+
+
+  void ThumbnailsGenerator::RenderThumbnail(std::string& jpeg,
+                                            const ImageAccessor& decoded,
+                                            bool invert,
+                                            unsigned int size,
+                                            uint8_t quality)
+  {
+    if (decoded.GetWidth() == 0 ||
+        decoded.GetHeight() == 0 ||
+        size == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    unsigned int targetWidth = decoded.GetWidth();
+    unsigned int targetHeight = decoded.GetHeight();
+
+    if (targetWidth > size ||
+        targetHeight > size)
+    {
+      const float ratio = std::min(static_cast<float>(size) / static_cast<float>(decoded.GetWidth()),
+                                   static_cast<float>(size) / static_cast<float>(decoded.GetHeight()));
+      targetWidth = std::max(1, boost::math::iround(ratio * static_cast<float>(decoded.GetWidth())));
+      targetHeight = std::max(1, boost::math::iround(ratio * static_cast<float>(decoded.GetHeight())));
+    }
+
+    std::unique_ptr<ImageAccessor> thumbnail;
+
+    switch (decoded.GetFormat())
+    {
+      case PixelFormat_Grayscale8:
+      case PixelFormat_Grayscale16:
+      case PixelFormat_SignedGrayscale16:
+      case PixelFormat_Float32:
+      {
+        // Resize in the original pixel format, then stretch the full
+        // dynamic range of the thumbnail to [0,255], as in "/preview"
+        Image resized(decoded.GetFormat(), targetWidth, targetHeight, false);
+        ImageProcessing::Resample(resized, decoded, ImageProcessing::ResamplingFilter_Lanczos3, 1);
+
+        Image converted(PixelFormat_Float32, targetWidth, targetHeight, false);
+        ImageProcessing::Convert(converted, resized);
+
+        float minValue, maxValue;
+        ImageProcessing::GetMinMaxFloatValue(minValue, maxValue, converted);
+
+        thumbnail.reset(new Image(PixelFormat_Grayscale8, targetWidth, targetHeight, false));
+
+        if (maxValue > minValue)
+        {
+          ImageProcessing::ShiftScale(*thumbnail, converted, -minValue, 255.0f / (maxValue - minValue), false);
+        }
+        else
+        {
+          ImageProcessing::Set(*thumbnail, 0);
+        }
+
+        if (invert)
+        {
+          ImageProcessing::Invert(*thumbnail);
+        }
+
+        break;
+      }
+
+      case PixelFormat_RGB24:
+        thumbnail.reset(new Image(PixelFormat_RGB24, targetWidth, targetHeight, false));
+        ImageProcessing::Resample(*thumbnail, decoded, ImageProcessing::ResamplingFilter_Lanczos3, 1);
+        break;
+
+      default:
+      {
+        // Other color formats: Convert to RGB24 before resizing
+        Image color(PixelFormat_RGB24, decoded.GetWidth(), decoded.GetHeight(), false);
+        ImageProcessing::Convert(color, decoded);
+
+        thumbnail.reset(new Image(PixelFormat_RGB24, targetWidth, targetHeight, false));
+        ImageProcessing::Resample(*thumbnail, color, ImageProcessing::ResamplingFilter_Lanczos3, 1);
+        break;
+      }
+    }
+
+    JpegWriter writer;
+    writer.SetQuality(quality);
+    IImageWriter::WriteToMemory(writer, jpeg, *thumbnail);
+  }
+
+
+  void ThumbnailsGenerator::SignalChange(const ServerIndexChange& change)
+  {
+    if (running_ &&
+        change.GetChangeType() == ChangeType_StableSeries &&
+        change.GetResourceType() == ResourceType_Series)
+    {
+      queue_.Enqueue(new SingleValueObject<std::string>(change.GetPublicId()));
+    }
+  }
+}
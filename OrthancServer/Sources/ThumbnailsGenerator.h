@@ -0,0 +1,120 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2022 Osimis S.A., Belgium
+ * Copyright (C) 2021-2022 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include "IServerListener.h"
+
+#include "../../OrthancFramework/Sources/Images/ImageAccessor.h"
+#include "../../OrthancFramework/Sources/MultiThreading/SharedMessageQueue.h"
+
+#include <boost/thread.hpp>
+
+namespace Orthanc
+{
+  class ServerContext;
+
+  /**
+   * Ingest stage that generates a JPEG thumbnail of each series once
+   * it becomes stable, using a pool of worker threads (new in Orthanc
+   * 1.11.2). The thumbnail renders the middle slice of the series,
+   * and is stored as the "thumbnail" attachment of the series.
+   **/
+  class ThumbnailsGenerator : public IServerListener
+  {
+  private:
+    ServerContext&               context_;
+    SharedMessageQueue           queue_;
+    bool                         running_;
+    std::vector<boost::thread*>  workers_;
+    unsigned int                 size_;
+    uint8_t                      quality_;
+
+    static void Worker(ThumbnailsGenerator* that);
+
+  public:
+    explicit ThumbnailsGenerator(ServerContext& context);
+
+    virtual ~ThumbnailsGenerator();
+
+    // Maximum width and height of the thumbnails
+    void SetSize(unsigned int size);
+
+    unsigned int GetSize() const
+    {
+      return size_;
+    }
+
+    void SetQuality(uint8_t quality);
+
+    uint8_t GetQuality() const
+    {
+      return quality_;
+    }
+
+    void Start(unsigned int threadsCount);
+
+    void Stop();
+
+    bool IsRunning() const
+    {
+      return running_;
+    }
+
+    size_t GetPendingCount()
+    {
+      return queue_.GetSize();
+    }
+
+    // Synchronously generates and stores the thumbnail of one series
+    void Generate(const std::string& seriesId);
+
+    static void RenderThumbnail(std::string& jpeg,
+                                const ImageAccessor& decoded,
+                                bool invert,
+                                unsigned int size,
+                                uint8_t quality);
+
+    virtual void SignalStoredInstance(const std::string& /* publicId */,
+                                      const DicomInstanceToStore& /* instance */,
+                                      const Json::Value& /* simplifiedTags */) ORTHANC_OVERRIDE
+    {
+    }
+
+    virtual void SignalChange(const ServerIndexChange& change) ORTHANC_OVERRIDE;
+
+    virtual bool FilterIncomingInstance(const DicomInstanceToStore& /* instance */,
+                                        const Json::Value& /* simplified */) ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual bool FilterIncomingCStoreInstance(uint16_t& /* dimseStatus */,
+                                              const DicomInstanceToStore& /* instance */,
+                                              const Json::Value& /* simplified */) ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+  };
+}
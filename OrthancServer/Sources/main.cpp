@@ -217,6 +217,7 @@ public:
       OrthancConfiguration::ReaderLock lock;
       result->SetMaxResults(lock.GetConfiguration().GetUnsignedIntegerParameter("LimitFindResults", 0));
       result->SetMaxInstances(lock.GetConfiguration().GetUnsignedIntegerParameter("LimitFindInstances", 0));
+      result->SetThreadsCount(lock.GetConfiguration().GetUnsignedIntegerParameter("DicomFindThreads", 0));  // New in Orthanc 1.11.2
     }
 
     if (result->GetMaxResults() == 0)
@@ -1031,6 +1032,7 @@ static bool StartHttpServer(ServerContext& context,
       httpServer.SetHttpCompressionEnabled(lock.GetConfiguration().GetBooleanParameter("HttpCompressionEnabled", true));
       httpServer.SetTcpNoDelay(lock.GetConfiguration().GetBooleanParameter("TcpNoDelay", true));
       httpServer.SetRequestTimeout(lock.GetConfiguration().GetUnsignedIntegerParameter("HttpRequestTimeout", 30));
+      httpServer.SetRequestBodyChunkSize(lock.GetConfiguration().GetUnsignedIntegerParameter("HttpRequestChunkSize", 1024) * 1024);
 
       // Let's assume that the HTTP server is secure
       context.SetHttpServerSecure(true);
@@ -1508,6 +1510,9 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
     HttpClient::SetDefaultTimeout(lock.GetConfiguration().GetUnsignedIntegerParameter("HttpTimeout", 0));
     
     HttpClient::SetDefaultProxy(lock.GetConfiguration().GetStringParameter("HttpProxy", ""));
+
+    HttpClient::SetConnectionPoolSize(lock.GetConfiguration().GetUnsignedIntegerParameter("HttpConnectionPoolSize", 4));
+    HttpClient::SetHttp2Enabled(lock.GetConfiguration().GetBooleanParameter("HttpVersion2", false));
     
     DicomAssociationParameters::SetDefaultTimeout(lock.GetConfiguration().GetUnsignedIntegerParameter("DicomScuTimeout", 10));
 
@@ -1540,6 +1545,10 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
     context.SetCompressionEnabled(lock.GetConfiguration().GetBooleanParameter("StorageCompression", false));
     context.SetStoreMD5ForAttachments(lock.GetConfiguration().GetBooleanParameter("StoreMD5ForAttachments", true));
 
+    // New option in Orthanc 1.11.2
+    context.SetDicomUntilPixelDataThreshold(static_cast<uint64_t>(
+      lock.GetConfiguration().GetUnsignedIntegerParameter("DicomUntilPixelDataThreshold", 0)) * 1024 * 1024);
+
     // New option in Orthanc 1.4.2
     context.SetOverwriteInstances(lock.GetConfiguration().GetBooleanParameter("OverwriteInstances", false));
 
@@ -1562,6 +1571,10 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
       context.GetIndex().SetMaximumStorageSize(0);
     }
 
+    // New option in Orthanc 1.11.2
+    context.SetStorageCacheShardsCount(
+      lock.GetConfiguration().GetUnsignedIntegerParameter("StorageCacheShards", 1));
+
     try
     {
       uint64_t size = lock.GetConfiguration().GetUnsignedIntegerParameter("MaximumStorageCacheSize", 128);
@@ -1571,6 +1584,61 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
     {
       context.SetMaximumStorageCacheSize(128);
     }
+
+    // New options in Orthanc 1.11.2
+    context.GetIndex().SetGroupCommit(
+      lock.GetConfiguration().GetUnsignedIntegerParameter("StoreGroupCommitSize", 0),
+      lock.GetConfiguration().GetUnsignedIntegerParameter("StoreGroupCommitWindow", 5));
+
+    {
+      // New options in Orthanc 1.11.2
+      const uint64_t memorySize = lock.GetConfiguration().GetUnsignedIntegerParameter("RenderedCacheMemorySize", 0);
+      const uint64_t diskSize = lock.GetConfiguration().GetUnsignedIntegerParameter("RenderedCacheDiskSize", 0);
+
+      context.GetRenderedCache().SetMemorySize(memorySize * 1024 * 1024);
+
+      if (diskSize > 0)
+      {
+        const std::string directory = lock.GetConfiguration().GetStringParameter("RenderedCacheDirectory", "");
+        if (directory.empty())
+        {
+          throw OrthancException(ErrorCode_ParameterOutOfRange,
+                                 "The configuration option \"RenderedCacheDirectory\" must be set "
+                                 "if \"RenderedCacheDiskSize\" is not zero");
+        }
+
+        context.GetRenderedCache().SetDiskStorage(
+          lock.GetConfiguration().InterpretStringParameterAsPath(directory), diskSize * 1024 * 1024);
+      }
+    }
+
+    {
+      // New options in Orthanc 1.11.2
+      const unsigned int quality = lock.GetConfiguration().GetUnsignedIntegerParameter("ThumbnailsQuality", 90);
+      if (quality == 0 ||
+          quality > 100)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange,
+                               "The configuration option \"ThumbnailsQuality\" must be between 1 and 100");
+      }
+
+      context.GetThumbnailsGenerator().SetSize(
+        lock.GetConfiguration().GetUnsignedIntegerParameter("ThumbnailsSize", 128));
+      context.GetThumbnailsGenerator().SetQuality(static_cast<uint8_t>(quality));
+      context.GetThumbnailsGenerator().Start(
+        lock.GetConfiguration().GetUnsignedIntegerParameter("ThumbnailsThreads", 0));
+    }
+
+    {
+      // New options in Orthanc 1.11.2. The pending removals are
+      // stored in the index, so that they are resumed on the next
+      // startup, even if the asynchronous deletions have been
+      // disabled in between.
+      context.GetDeletionQueue().SetRate(
+        lock.GetConfiguration().GetUnsignedIntegerParameter("AsynchronousDeletionRate", 0));
+      context.GetDeletionQueue().Start(
+        lock.GetConfiguration().GetUnsignedIntegerParameter("AsynchronousDeletionThreads", 0));
+    }
   }
 
   {
@@ -24,17 +24,29 @@
 #include <gtest/gtest.h>
 
 #include "../../OrthancFramework/Sources/Compatibility.h"
+#include "../../OrthancFramework/Sources/Compression/ZipWriter.h"
 #include "../../OrthancFramework/Sources/FileStorage/FilesystemStorage.h"
 #include "../../OrthancFramework/Sources/FileStorage/MemoryStorageArea.h"
+#include "../../OrthancFramework/Sources/HttpServer/StringHttpOutput.h"
 #include "../../OrthancFramework/Sources/Images/Image.h"
+#include "../../OrthancFramework/Sources/Images/ImageProcessing.h"
+#include "../../OrthancFramework/Sources/Images/JpegReader.h"
 #include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/SQLite/Connection.h"
 
+#include "../Sources/Database/Compatibility/ISetResourcesContent.h"
 #include "../Sources/Database/SQLiteDatabaseWrapper.h"
 #include "../Sources/OrthancConfiguration.h"
+#include "../Sources/OrthancFindRequestHandler.h"
+#include "../Sources/OrthancRestApi/OrthancRestApi.h"
 #include "../Sources/Search/DatabaseLookup.h"
 #include "../Sources/ServerContext.h"
 #include "../Sources/ServerToolbox.h"
 
+#include <boost/bind/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 #include <ctype.h>
 #include <algorithm>
 
@@ -1038,3 +1050,1544 @@ TEST(ServerIndex, DicomUntilPixelData)
     }
   }
 }
+
+
+TEST(ServerIndex, DicomUntilPixelDataThreshold)
+{
+  Image image(PixelFormat_Grayscale8, 16, 16, false);
+  ImageProcessing::Set(image, 128);
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    const bool small = (i == 0);
+
+    MemoryStorageArea storage;
+    SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+    db.Open();
+    ServerContext context(db, storage, true /* running unit tests */, 10);
+    context.SetupJobsEngine(true, false);
+    context.SetCompressionEnabled(false);
+    context.SetDicomUntilPixelDataThreshold(small ? 1 : 1024 * 1024 * 1024);
+
+    ParsedDicomFile dicom(true);
+    dicom.EmbedImage(image);
+
+    std::string id;
+    std::string buffer;
+
+    {
+      std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromParsedDicomFile(dicom));
+      buffer.assign(reinterpret_cast<const char*>(toStore->GetBufferData()), toStore->GetBufferSize());
+      toStore->SetOrigin(DicomInstanceOrigin::FromPlugins());
+      ServerContext::StoreResult result = context.Store(id, *toStore, StoreInstanceMode_Default);
+      ASSERT_EQ(StoreStatus_Success, result.GetStatus());
+    }
+
+    std::set<FileContentType> attachments;
+    context.GetIndex().ListAvailableAttachments(attachments, id, ResourceType_Instance);
+
+    if (small)
+    {
+      ASSERT_EQ(2u, attachments.size());
+      ASSERT_TRUE(attachments.find(FileContentType_DicomUntilPixelData) != attachments.end());
+    }
+    else
+    {
+      ASSERT_EQ(1u, attachments.size());
+    }
+
+    std::string s;
+    int64_t revision;
+    ASSERT_TRUE(context.GetIndex().LookupMetadata(s, revision, id, ResourceType_Instance,
+                                                  MetadataType_Instance_PixelDataOffset));
+    const size_t pixelDataOffset = boost::lexical_cast<size_t>(s);
+
+    // In both cases, only the header is read
+    std::string header;
+    context.ReadDicomForHeader(header, id);
+    ASSERT_EQ(pixelDataOffset, header.size());
+    ASSERT_EQ(0, memcmp(buffer.c_str(), header.c_str(), header.size()));
+
+    context.Stop();
+    db.Close();
+  }
+}
+
+
+
+TEST(ServerIndex, DeletionQueue)
+{
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+  context.SetCompressionEnabled(false);
+  context.GetDeletionQueue().Start(2);
+
+  std::string id;
+
+  {
+    ParsedDicomFile dicom(true);
+    std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromParsedDicomFile(dicom));
+    toStore->SetOrigin(DicomInstanceOrigin::FromPlugins());
+    ServerContext::StoreResult result = context.Store(id, *toStore, StoreInstanceMode_Default);
+    ASSERT_EQ(StoreStatus_Success, result.GetStatus());
+  }
+
+  FileInfo info;
+  int64_t revision;
+  ASSERT_TRUE(context.GetIndex().LookupAttachment(info, revision, id, FileContentType_Dicom));
+
+  const std::string uuid = info.GetUuid();
+
+  {
+    std::unique_ptr<IMemoryBuffer> buffer(storage.Read(uuid, FileContentType_Dicom));
+  }
+
+  Json::Value remainingAncestor;
+  ASSERT_TRUE(context.DeleteResource(remainingAncestor, id, ResourceType_Instance));
+  ASSERT_FALSE(context.GetIndex().LookupAttachment(info, revision, id, FileContentType_Dicom));
+
+  std::map<std::string, FileContentType> pending;
+
+  {
+    // The file was recorded as pending in the same transaction as
+    // the deletion, unless it is already removed
+    context.GetIndex().GetPendingDeletions(pending);
+
+    bool exists = true;
+    try
+    {
+      std::unique_ptr<IMemoryBuffer> buffer(storage.Read(uuid, FileContentType_Dicom));
+    }
+    catch (OrthancException&)
+    {
+      exists = false;
+    }
+
+    ASSERT_TRUE(!exists || pending.find(uuid) != pending.end());
+  }
+
+  // Wait for the background removal of the file
+  bool removed = false;
+  for (unsigned int i = 0; i < 100 && !removed; i++)
+  {
+    try
+    {
+      std::unique_ptr<IMemoryBuffer> buffer(storage.Read(uuid, FileContentType_Dicom));
+      boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    }
+    catch (OrthancException&)
+    {
+      removed = true;
+    }
+  }
+
+  ASSERT_TRUE(removed);
+  ASSERT_EQ(0u, context.GetDeletionQueue().GetPendingCount());
+
+  context.GetDeletionQueue().Stop();  // Flushes the removed files to the index
+  context.GetIndex().GetPendingDeletions(pending);
+  ASSERT_TRUE(pending.empty());
+
+  context.Stop();
+  db.Close();
+}
+
+
+namespace
+{
+  // Counts the committed transactions. The transactions that create
+  // the "poisoned" patient fail, and the first commit can be delayed
+  // so that the other writers queue up behind it.
+  class GroupCommitMonitor : public boost::noncopyable
+  {
+  private:
+    boost::mutex  mutex_;
+    std::string   poisonedPatient_;
+    unsigned int  firstCommitDelay_;
+    unsigned int  commits_;
+    unsigned int  failures_;
+
+  public:
+    GroupCommitMonitor(const std::string& poisonedPatient,
+                       unsigned int firstCommitDelay) :
+      poisonedPatient_(poisonedPatient),
+      firstCommitDelay_(firstCommitDelay),
+      commits_(0),
+      failures_(0)
+    {
+    }
+
+    const std::string& GetPoisonedPatient() const
+    {
+      return poisonedPatient_;
+    }
+
+    void PrepareCommit(bool poisoned)
+    {
+      unsigned int delay;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (poisoned)
+        {
+          failures_++;
+          throw OrthancException(ErrorCode_InternalError, "Poisoned transaction");
+        }
+
+        delay = firstCommitDelay_;
+        firstCommitDelay_ = 0;
+      }
+
+      if (delay != 0)
+      {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(delay));
+      }
+    }
+
+    void Commit()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      commits_++;
+    }
+
+    unsigned int GetCommits()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return commits_;
+    }
+
+    unsigned int GetFailures()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return failures_;
+    }
+  };
+
+
+  class GroupCommitContextFactory : public StatelessDatabaseOperations::ITransactionContextFactory
+  {
+  private:
+    class Context : public StatelessDatabaseOperations::ITransactionContext
+    {
+    private:
+      GroupCommitMonitor&  monitor_;
+      bool                 poisoned_;
+
+    public:
+      explicit Context(GroupCommitMonitor& monitor) :
+        monitor_(monitor),
+        poisoned_(false)
+      {
+      }
+
+      virtual void SignalRemainingAncestor(ResourceType parentType,
+                                           const std::string& publicId) ORTHANC_OVERRIDE
+      {
+      }
+
+      virtual void SignalAttachmentDeleted(const FileInfo& info) ORTHANC_OVERRIDE
+      {
+      }
+
+      virtual void SignalResourceDeleted(ResourceType type,
+                                         const std::string& publicId) ORTHANC_OVERRIDE
+      {
+      }
+
+      virtual void Commit() ORTHANC_OVERRIDE
+      {
+        monitor_.Commit();
+      }
+
+      virtual int64_t GetCompressedSizeDelta() ORTHANC_OVERRIDE
+      {
+        return 0;
+      }
+
+      virtual bool IsUnstableResource(int64_t id) ORTHANC_OVERRIDE
+      {
+        return false;
+      }
+
+      virtual bool LookupRemainingLevel(std::string& remainingPublicId,
+                                        ResourceType& remainingLevel) ORTHANC_OVERRIDE
+      {
+        return false;
+      }
+
+      virtual void MarkAsUnstable(int64_t id,
+                                  Orthanc::ResourceType type,
+                                  const std::string& publicId) ORTHANC_OVERRIDE
+      {
+      }
+
+      virtual void SignalAttachmentsAdded(uint64_t compressedSize) ORTHANC_OVERRIDE
+      {
+      }
+
+      virtual void SignalChange(const ServerIndexChange& change) ORTHANC_OVERRIDE
+      {
+        if (change.GetChangeType() == ChangeType_NewPatient &&
+            change.GetPublicId() == monitor_.GetPoisonedPatient())
+        {
+          poisoned_ = true;
+        }
+      }
+
+      virtual void PrepareCommit(IDatabaseWrapper::ITransaction& transaction) ORTHANC_OVERRIDE
+      {
+        monitor_.PrepareCommit(poisoned_);
+      }
+    };
+
+    GroupCommitMonitor&  monitor_;
+
+  public:
+    explicit GroupCommitContextFactory(GroupCommitMonitor& monitor) :
+      monitor_(monitor)
+    {
+    }
+
+    virtual StatelessDatabaseOperations::ITransactionContext* Create() ORTHANC_OVERRIDE
+    {
+      return new Context(monitor_);
+    }
+  };
+
+
+  void CreateGroupCommitInstance(DicomMap& summary,
+                                 const std::string& patient)
+  {
+    summary.SetValue(DICOM_TAG_PATIENT_ID, patient, false);
+    summary.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study-" + patient, false);
+    summary.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series-" + patient, false);
+    summary.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance-" + patient, false);
+  }
+
+
+  void StoreGroupCommitInstance(StatelessDatabaseOperations* database,
+                                std::string patient,
+                                bool* success)
+  {
+    try
+    {
+      DicomMap summary;
+      CreateGroupCommitInstance(summary, patient);
+
+      std::map<MetadataType, std::string> instanceMetadata;
+      *success = (database->Store(instanceMetadata, summary,
+                                  StatelessDatabaseOperations::Attachments(),
+                                  StatelessDatabaseOperations::MetadataMap(),
+                                  DicomInstanceOrigin::FromPlugins(), false /* don't overwrite */,
+                                  false /* no transfer syntax */, DicomTransferSyntax_LittleEndianExplicit,
+                                  false /* no pixel data offset */, 0, 0 /* no storage limit */,
+                                  0 /* no patient limit */, false) == StoreStatus_Success);
+    }
+    catch (OrthancException&)
+    {
+      *success = false;
+    }
+  }
+
+
+  uint64_t CountGroupCommitPatients(StatelessDatabaseOperations& database)
+  {
+    uint64_t diskSize, uncompressedSize, countPatients, countStudies, countSeries, countInstances;
+    database.GetGlobalStatistics(diskSize, uncompressedSize, countPatients,
+                                 countStudies, countSeries, countInstances);
+    return countPatients;
+  }
+}
+
+
+TEST(StatelessDatabaseOperations, GroupCommit)
+{
+  static const size_t COUNT = 8;
+
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+
+  {
+    // The concurrent writers that queue up behind the first commit
+    // are grouped into fewer transactions
+    GroupCommitMonitor monitor("", 200);
+    StatelessDatabaseOperations database(db);
+    database.SetTransactionContextFactory(new GroupCommitContextFactory(monitor));
+    database.SetGroupCommit(COUNT, 100);
+
+    bool success[COUNT];
+    boost::thread_group threads;
+
+    for (size_t i = 0; i < COUNT; i++)
+    {
+      threads.create_thread(boost::bind(StoreGroupCommitInstance, &database,
+                                        "batch-" + boost::lexical_cast<std::string>(i), &success[i]));
+    }
+
+    threads.join_all();
+
+    for (size_t i = 0; i < COUNT; i++)
+    {
+      ASSERT_TRUE(success[i]);
+    }
+
+    ASSERT_LT(monitor.GetCommits(), COUNT);
+    ASSERT_EQ(0u, monitor.GetFailures());
+    ASSERT_EQ(COUNT, CountGroupCommitPatients(database));
+  }
+
+  {
+    // A lone writer doesn't wait for the time window
+    GroupCommitMonitor monitor("", 0);
+    StatelessDatabaseOperations database(db);
+    database.SetTransactionContextFactory(new GroupCommitContextFactory(monitor));
+    database.SetGroupCommit(COUNT, 10000);
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    bool success = false;
+    StoreGroupCommitInstance(&database, "lone", &success);
+    ASSERT_TRUE(success);
+
+    const boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+    ASSERT_LT((end - start).total_milliseconds(), 5000);
+    ASSERT_EQ(1u, monitor.GetCommits());
+  }
+
+  {
+    // If one operation of a batch fails, the other operations of the
+    // batch are applied one by one
+    DicomMap poisoned;
+    CreateGroupCommitInstance(poisoned, "poisoned");
+
+    GroupCommitMonitor monitor(DicomInstanceHasher(poisoned).HashPatient(), 200);
+    StatelessDatabaseOperations database(db);
+    database.SetTransactionContextFactory(new GroupCommitContextFactory(monitor));
+    database.SetGroupCommit(COUNT, 100);
+
+    const uint64_t before = CountGroupCommitPatients(database);
+
+    bool first = false;
+    boost::thread blocker(StoreGroupCommitInstance, &database, std::string("replay-first"), &first);
+
+    // Queue up the next writers behind the delayed first commit
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+
+    bool success[3];
+    boost::thread_group threads;
+    threads.create_thread(boost::bind(StoreGroupCommitInstance, &database, std::string("replay-1"), &success[0]));
+    threads.create_thread(boost::bind(StoreGroupCommitInstance, &database, std::string("poisoned"), &success[1]));
+    threads.create_thread(boost::bind(StoreGroupCommitInstance, &database, std::string("replay-2"), &success[2]));
+
+    threads.join_all();
+    blocker.join();
+
+    ASSERT_TRUE(first);
+    ASSERT_TRUE(success[0]);
+    ASSERT_FALSE(success[1]);
+    ASSERT_TRUE(success[2]);
+
+    // The poisoned operation has failed both in the batch, and alone
+    ASSERT_EQ(2u, monitor.GetFailures());
+    ASSERT_EQ(before + 3u, CountGroupCommitPatients(database));
+  }
+
+  db.Close();
+}
+
+
+static ErrorCode HandleFind(DicomFindAnswers& answers,
+                            OrthancFindRequestHandler& handler,
+                            const DicomMap& query)
+{
+  try
+  {
+    std::list<DicomTag> sequencesToReturn;
+    handler.Handle(answers, query, sequencesToReturn, "127.0.0.1", "FINDSCU", "ORTHANC", ModalityManufacturer_Generic);
+    return ErrorCode_Success;
+  }
+  catch (OrthancException& e)
+  {
+    return e.GetErrorCode();
+  }
+}
+
+
+TEST(OrthancFindRequestHandler, Threads)
+{
+  static const size_t COUNT = 20;
+
+  {
+    RemoteModalityParameters remote;
+    remote.SetApplicationEntityTitle("FINDSCU");
+
+    OrthancConfiguration::WriterLock lock;
+    lock.GetConfiguration().UpdateModality("findscu", remote);
+  }
+
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+  context.SetMaximumStorageCacheSize(0);  // Read the files from the storage area
+
+  std::vector<std::string> instances;
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    const std::string id = boost::lexical_cast<std::string>(i);
+
+    DicomMap instance;
+    instance.SetValue(DICOM_TAG_PATIENT_ID, "patient-" + id, false);
+    instance.SetValue(DICOM_TAG_PATIENT_NAME, "NAME^" + id, false);
+    instance.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study-" + id, false);
+    instance.SetValue(DICOM_TAG_STUDY_DESCRIPTION, "description-" + id, false);
+    instance.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series-" + id, false);
+    instance.SetValue(DICOM_TAG_MODALITY, (i % 2 == 0 ? "CT" : "MR"), false);
+    instance.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance-" + id, false);
+    instance.SetValue(DICOM_TAG_SOP_CLASS_UID, "1.2.840.10008.5.1.4.1.1.1", false);  // CR image
+    instance.SetValue(DicomTag(0x0008, 0x1010), "station-" + id, false);  // Station Name, not a main DICOM tag
+
+    ParsedDicomFile dicom(instance, GetDefaultDicomEncoding(), false /* be strict */);
+    std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromParsedDicomFile(dicom));
+    toStore->SetOrigin(DicomInstanceOrigin::FromPlugins());
+
+    std::string instanceId;
+    ASSERT_EQ(StoreStatus_Success, context.Store(instanceId, *toStore, StoreInstanceMode_Default).GetStatus());
+    instances.push_back(instanceId);
+  }
+
+  DicomMap query;
+  query.SetValue(DICOM_TAG_QUERY_RETRIEVE_LEVEL, "STUDY", false);
+  query.SetValue(DICOM_TAG_PATIENT_ID, "", false);
+  query.SetValue(DICOM_TAG_PATIENT_NAME, "", false);
+  query.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "", false);
+  query.SetValue(DICOM_TAG_STUDY_DESCRIPTION, "", false);
+  query.SetValue(DICOM_TAG_MODALITIES_IN_STUDY, "", false);
+  query.SetValue(DICOM_TAG_NUMBER_OF_STUDY_RELATED_INSTANCES, "", false);
+  query.SetValue(DicomTag(0x0008, 0x1010), "", false);
+
+  OrthancFindRequestHandler handler(context);
+
+  Json::Value sequential;
+
+  {
+    DicomFindAnswers answers(false);
+    ASSERT_EQ(ErrorCode_Success, HandleFind(answers, handler, query));
+    ASSERT_TRUE(answers.IsComplete());
+    ASSERT_EQ(COUNT, answers.GetSize());
+    answers.ToJson(sequential, DicomToJsonFormat_Short);
+  }
+
+  // The answers of the parallel expansion are the same, in the same
+  // order, whatever the number of threads
+  for (unsigned int threads = 2; threads <= 8; threads *= 2)
+  {
+    handler.SetThreadsCount(threads);
+
+    DicomFindAnswers answers(false);
+    ASSERT_EQ(ErrorCode_Success, HandleFind(answers, handler, query));
+    ASSERT_TRUE(answers.IsComplete());
+    ASSERT_EQ(COUNT, answers.GetSize());
+
+    Json::Value parallel;
+    answers.ToJson(parallel, DicomToJsonFormat_Short);
+    ASSERT_EQ(sequential, parallel);
+  }
+
+  // An answer whose DICOM file has disappeared is reported with the
+  // same error in both cases
+  {
+    FileInfo info;
+    int64_t revision;
+    ASSERT_TRUE(context.GetIndex().LookupAttachment(info, revision, instances[COUNT / 2], FileContentType_Dicom));
+    storage.Remove(info.GetUuid(), FileContentType_Dicom);
+
+    if (context.GetIndex().LookupAttachment(info, revision, instances[COUNT / 2], FileContentType_DicomUntilPixelData))
+    {
+      storage.Remove(info.GetUuid(), FileContentType_DicomUntilPixelData);
+    }
+  }
+
+  handler.SetThreadsCount(0);
+
+  ErrorCode sequentialError;
+
+  {
+    DicomFindAnswers answers(false);
+    sequentialError = HandleFind(answers, handler, query);
+    ASSERT_NE(ErrorCode_Success, sequentialError);
+  }
+
+  handler.SetThreadsCount(4);
+
+  {
+    DicomFindAnswers answers(false);
+    ASSERT_EQ(sequentialError, HandleFind(answers, handler, query));
+  }
+
+  context.Stop();
+  db.Close();
+
+  {
+    OrthancConfiguration::WriterLock lock;
+    lock.GetConfiguration().RemoveModality("findscu");
+  }
+}
+
+
+static void UploadThroughChunks(Json::Value& answer,
+                               ServerContext& context,
+                               const std::string& body,
+                               const std::string& contentType)
+{
+  // Mimics "HttpServer", that streams the body of "POST /instances"
+  UriComponents uri;
+  uri.push_back("instances");
+
+  HttpToolbox::Arguments headers;
+  if (!contentType.empty())
+  {
+    headers["content-type"] = contentType;
+  }
+
+  std::unique_ptr<IHttpHandler::IChunkedRequestReader> reader;
+  ASSERT_TRUE(context.GetHttpHandler().CreateChunkedRequestReader(
+                reader, RequestOrigin_RestApi, "127.0.0.1", "", HttpMethod_Post, uri, headers));
+  ASSERT_TRUE(reader.get() != NULL);
+
+  static const size_t CHUNK_SIZE = 64 * 1024;
+  for (size_t pos = 0; pos < body.size(); pos += CHUNK_SIZE)
+  {
+    reader->AddBodyChunk(body.c_str() + pos, std::min(CHUNK_SIZE, body.size() - pos));
+  }
+
+  StringHttpOutput stream;
+
+  {
+    HttpOutput output(stream, false /* no keep-alive */);
+    reader->Execute(output);
+  }
+
+  ASSERT_EQ(HttpStatus_200_Ok, stream.GetStatus());
+
+  std::string s;
+  stream.GetBody(s);
+  ASSERT_TRUE(Toolbox::ReadJson(answer, s));
+}
+
+
+static void CreateUploadedInstance(std::string& target,
+                                   const std::string& patientId,
+                                   unsigned int height)
+{
+  Image image(PixelFormat_Grayscale8, 1024, height, false);
+  ImageProcessing::Set(image, 128);
+
+  ParsedDicomFile dicom(true);
+  dicom.ReplacePlainString(DICOM_TAG_PATIENT_ID, patientId);
+  dicom.EmbedImage(image);
+  dicom.SaveToMemoryBuffer(target);
+}
+
+
+TEST(OrthancRestApi, UploadDicomFileReader)
+{
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+  context.SetCompressionEnabled(false);
+
+  {
+    // The default value of "HttpRequestChunkSize" is 1MB: A 16KB
+    // body is kept in RAM, whereas a 1.5MB body is spilled to a
+    // temporary file
+    OrthancRestApi api(context, false);
+    context.GetHttpHandler().Register(api, true);
+
+    std::string small, large;
+    CreateUploadedInstance(small, "small", 16);
+    CreateUploadedInstance(large, "large", 1536);
+    ASSERT_GT(large.size(), 1024u * 1024u);
+
+    Json::Value answer;
+
+    // Small body kept in RAM
+    UploadThroughChunks(answer, context, small, "application/dicom");
+    ASSERT_EQ(Json::objectValue, answer.type());
+    ASSERT_EQ("Success", answer["Status"].asString());
+    const std::string smallId = answer["ID"].asString();
+
+    // Large body spilled to a temporary file, then parsed as DICOM
+    UploadThroughChunks(answer, context, large, "application/dicom");
+    ASSERT_EQ(Json::objectValue, answer.type());
+    ASSERT_EQ("Success", answer["Status"].asString());
+    const std::string largeId = answer["ID"].asString();
+    ASSERT_NE(smallId, largeId);
+
+    {
+      // Large ZIP archive, read back from the temporary file
+      std::string zip;
+
+      {
+        ZipWriter writer;
+        writer.SetCompressionLevel(0);
+        writer.SetMemoryOutput(zip, false);
+        writer.Open();
+        writer.OpenFile("small.dcm");
+        writer.Write(small);
+        writer.OpenFile("large.dcm");
+        writer.Write(large);
+        writer.OpenFile("readme.txt");
+        writer.Write("Not a DICOM file");
+        writer.Close();
+      }
+
+      ASSERT_GT(zip.size(), 1024u * 1024u);
+
+      UploadThroughChunks(answer, context, zip, "application/zip");
+      ASSERT_EQ(Json::arrayValue, answer.type());
+      ASSERT_EQ(2u, answer.size());
+      ASSERT_EQ("AlreadyStored", answer[0]["Status"].asString());
+      ASSERT_EQ(smallId, answer[0]["ID"].asString());
+      ASSERT_EQ("AlreadyStored", answer[1]["Status"].asString());
+      ASSERT_EQ(largeId, answer[1]["ID"].asString());
+    }
+
+    {
+      // "multipart/related" body, whose parts are stored one by one,
+      // except if they are not of type "application/dicom"
+      std::string other;
+      CreateUploadedInstance(other, "other", 16);
+
+      const std::string boundary = "123456789abcdefghijklmnopqrstuvwxyz";
+      const std::string body = ("--" + boundary + "\r\n" +
+                                "Content-Type: application/dicom\r\n\r\n" + other + "\r\n" +
+                                "--" + boundary + "\r\n" +
+                                "Content-Type: text/plain\r\n\r\n" + small + "\r\n" +
+                                "--" + boundary + "\r\n" +
+                                "Content-Type: application/dicom\r\n\r\n" + large + "\r\n" +
+                                "--" + boundary + "--\r\n");
+
+      UploadThroughChunks(answer, context, body, "multipart/related; type=\"application/dicom\"; boundary=" + boundary);
+      ASSERT_EQ(Json::arrayValue, answer.type());
+      ASSERT_EQ(2u, answer.size());
+      ASSERT_EQ("Success", answer[0]["Status"].asString());
+      ASSERT_NE(smallId, answer[0]["ID"].asString());
+      ASSERT_NE(largeId, answer[0]["ID"].asString());
+      ASSERT_EQ("AlreadyStored", answer[1]["Status"].asString());
+      ASSERT_EQ(largeId, answer[1]["ID"].asString());
+    }
+
+    std::list<std::string> instances;
+    context.GetIndex().GetAllUuids(instances, ResourceType_Instance);
+    ASSERT_EQ(3u, instances.size());
+  }
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(SQLiteDatabaseWrapper, ReadConnections)
+{
+  const std::string path = "UnitTestsStorage/index-read-connections";
+  SystemToolbox::RemoveFile(path);
+  SystemToolbox::RemoveFile(path + "-wal");
+  SystemToolbox::RemoveFile(path + "-shm");
+
+  {
+    SQLiteDatabaseWrapper memory;
+    memory.SetReadConnectionsCount(2);
+    ASSERT_EQ(0u, memory.GetReadConnectionsCount());  // Not available for in-memory databases
+  }
+
+  SystemToolbox::MakeDirectory("UnitTestsStorage");
+  SQLiteDatabaseWrapper db(path);
+  db.SetReadConnectionsCount(2);
+  db.Open();
+  ASSERT_THROW(db.SetReadConnectionsCount(3), OrthancException);
+
+  TestDatabaseListener listener;
+
+  {
+    std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> t(
+      dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db.StartTransaction(TransactionType_ReadWrite, listener)));
+    t->CreateResource("patient1", ResourceType_Patient);
+    t->Commit(0);
+  }
+
+  {
+    std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> writer(
+      dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db.StartTransaction(TransactionType_ReadWrite, listener)));
+    writer->CreateResource("patient2", ResourceType_Patient);
+
+    // Two read-only transactions can run concurrently with the
+    // read-write transaction, and do not see its uncommitted changes
+    std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> reader1(
+      dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db.StartTransaction(TransactionType_ReadOnly, listener)));
+    std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> reader2(
+      dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db.StartTransaction(TransactionType_ReadOnly, listener)));
+    ASSERT_EQ(1, reader1->GetTableRecordCount("Resources"));
+    ASSERT_EQ(1, reader2->GetTableRecordCount("Resources"));
+
+    writer->Commit(0);
+    writer.reset();
+
+    // Each read-only transaction works on a snapshot of the database
+    ASSERT_EQ(1, reader1->GetTableRecordCount("Resources"));
+    reader1->Commit(0);
+    reader2->Rollback();
+  }
+
+  {
+    std::unique_ptr<IDatabaseWrapper::ITransaction> reader(db.StartTransaction(TransactionType_ReadOnly, listener));
+
+    int64_t id;
+    ResourceType type;
+    ASSERT_TRUE(reader->LookupResource(id, type, "patient2"));
+    ASSERT_EQ(ResourceType_Patient, type);
+    ASSERT_THROW(reader->Commit(1), OrthancException);
+  }
+
+  db.Close();
+}
+
+
+static void LookupStudyDate(std::list<std::string>& result,
+                            IDatabaseWrapper::ITransaction& transaction,
+                            ConstraintType type,
+                            const std::string& value)
+{
+  std::vector<std::string> values;
+  values.push_back(value);
+
+  std::vector<DatabaseConstraint> lookup;
+  lookup.push_back(DatabaseConstraint(ResourceType_Study, DICOM_TAG_STUDY_DATE, false /* not an identifier */,
+                                      type, values, true, true));
+
+  result.clear();
+  transaction.ApplyLookupResources(result, NULL, lookup, ResourceType_Study, 0 /* no limit */);
+}
+
+
+TEST(SQLiteDatabaseWrapper, IndexedMainDicomTags)
+{
+  const std::string path = "UnitTestsStorage/index-indexed-tags";
+  SystemToolbox::RemoveFile(path);
+  SystemToolbox::RemoveFile(path + "-wal");
+  SystemToolbox::RemoveFile(path + "-shm");
+  SystemToolbox::MakeDirectory("UnitTestsStorage");
+
+  TestDatabaseListener listener;
+
+  {
+    std::set<DicomTag> tags;
+    tags.insert(DicomTag(0x0010, 0x9999));
+
+    SQLiteDatabaseWrapper db(path);
+    ASSERT_THROW(db.SetIndexedMainDicomTags(tags), OrthancException);  // Not a main DICOM tag
+
+    tags.clear();
+    tags.insert(DICOM_TAG_STUDY_DATE);
+    db.SetIndexedMainDicomTags(tags);
+    db.Open();
+    ASSERT_THROW(db.SetIndexedMainDicomTags(tags), OrthancException);
+
+    {
+      std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> t(
+        dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db.StartTransaction(TransactionType_ReadWrite, listener)));
+      // Go through the same interface as "ResourcesContent::Store()"
+      Compatibility::ISetResourcesContent& content = dynamic_cast<Compatibility::ISetResourcesContent&>(*t);
+
+      const char* dates[] = { "20211231", "20220115", "20220301", "20230101" };
+      for (size_t i = 0; i < 4; i++)
+      {
+        int64_t study = t->CreateResource("study" + boost::lexical_cast<std::string>(i), ResourceType_Study);
+        content.SetMainDicomTag(study, DICOM_TAG_STUDY_DATE, dates[i]);
+        content.SetMainDicomTag(study, DICOM_TAG_STUDY_DESCRIPTION, "Hello");
+      }
+
+      ASSERT_EQ(8, t->GetTableRecordCount("MainDicomTags"));
+      ASSERT_EQ(4, t->GetTableRecordCount("IndexedMainDicomTags"));
+
+      std::list<std::string> s;
+      LookupStudyDate(s, *t, ConstraintType_GreaterOrEqual, "20220101");
+      ASSERT_EQ(3u, s.size());
+      LookupStudyDate(s, *t, ConstraintType_SmallerOrEqual, "20220115");
+      ASSERT_EQ(2u, s.size());
+      LookupStudyDate(s, *t, ConstraintType_Equal, "20220301");
+      ASSERT_EQ(1u, s.size());
+      ASSERT_EQ("study2", s.front());
+      LookupStudyDate(s, *t, ConstraintType_Wildcard, "2022*");
+      ASSERT_EQ(2u, s.size());
+
+      t->Commit(0);
+    }
+
+    db.Close();
+  }
+
+  {
+    // Simulate a write by a version of Orthanc that does not know
+    // about the "IndexedMainDicomTags" table
+    SQLite::Connection connection;
+    connection.Open(path);
+    connection.Execute("INSERT INTO Resources VALUES(NULL, 2, 'study4', NULL)");
+    connection.Execute("INSERT INTO MainDicomTags SELECT internalId, 8, 32, '20220201' "
+                       "FROM Resources WHERE publicId='study4'");
+  }
+
+  {
+    // The SQLite triggers have indexed the foreign write
+    std::set<DicomTag> tags;
+    tags.insert(DICOM_TAG_STUDY_DATE);
+
+    SQLiteDatabaseWrapper db(path);
+    db.SetIndexedMainDicomTags(tags);
+    db.Open();
+
+    {
+      std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> t(
+        dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db.StartTransaction(TransactionType_ReadOnly, listener)));
+      ASSERT_EQ(5, t->GetTableRecordCount("IndexedMainDicomTags"));
+
+      std::list<std::string> s;
+      LookupStudyDate(s, *t, ConstraintType_GreaterOrEqual, "20220101");
+      ASSERT_EQ(4u, s.size());
+      t->Commit(0);
+    }
+
+    db.Close();
+  }
+
+  {
+    // Changing the list of the indexed tags reindexes the database
+    std::set<DicomTag> tags;
+    tags.insert(DICOM_TAG_STUDY_DATE);
+    tags.insert(DICOM_TAG_STUDY_DESCRIPTION);
+
+    SQLiteDatabaseWrapper db(path);
+    db.SetIndexedMainDicomTags(tags);
+    db.Open();
+
+    {
+      std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> t(
+        dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db.StartTransaction(TransactionType_ReadWrite, listener)));
+      ASSERT_EQ(9, t->GetTableRecordCount("IndexedMainDicomTags"));
+
+      std::list<std::string> s;
+      LookupStudyDate(s, *t, ConstraintType_GreaterOrEqual, "20220101");
+      ASSERT_EQ(4u, s.size());
+
+      int64_t id;
+      ResourceType type;
+      IDatabaseWrapper::ITransaction& transaction = *t;
+      ASSERT_TRUE(transaction.LookupResource(id, type, "study3"));
+      transaction.DeleteResource(id);
+      ASSERT_EQ(7, t->GetTableRecordCount("IndexedMainDicomTags"));
+      t->Commit(0);
+    }
+
+    db.Close();
+  }
+
+  {
+    // Back to no indexed tag
+    SQLiteDatabaseWrapper db(path);
+    db.Open();
+
+    {
+      std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> t(
+        dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db.StartTransaction(TransactionType_ReadOnly, listener)));
+      ASSERT_EQ(0, t->GetTableRecordCount("IndexedMainDicomTags"));
+
+      std::list<std::string> s;
+      LookupStudyDate(s, *t, ConstraintType_GreaterOrEqual, "20220101");
+      ASSERT_EQ(3u, s.size());
+      t->Commit(0);
+    }
+
+    db.Close();
+  }
+}
+
+
+TEST(SQLiteDatabaseWrapper, KeysetPagination)
+{
+  SQLiteDatabaseWrapper db;
+  db.Open();
+  ASSERT_TRUE(db.HasKeysetPagination());
+
+  TestDatabaseListener listener;
+
+  std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> t(
+    dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db.StartTransaction(TransactionType_ReadWrite, listener)));
+
+  std::vector<int64_t> ids;
+  for (unsigned int i = 0; i < 5; i++)
+  {
+    ids.push_back(t->CreateResource("patient" + boost::lexical_cast<std::string>(i), ResourceType_Patient));
+  }
+
+  t->CreateResource("study", ResourceType_Study);
+
+  const std::vector<DatabaseConstraint> lookup;  // No constraint
+
+  std::list<std::string> s;
+  std::list<int64_t> internalIds;
+  t->ApplyLookupResources(s, NULL, internalIds, lookup, ResourceType_Patient, ids[1], 2);
+  ASSERT_EQ(2u, s.size());
+  ASSERT_EQ("patient2", s.front());
+  ASSERT_EQ("patient3", s.back());
+  ASSERT_EQ(2u, internalIds.size());
+  ASSERT_EQ(ids[2], internalIds.front());
+  ASSERT_EQ(ids[3], internalIds.back());
+
+  // The cursor doesn't need to correspond to an existing resource
+  t->DeleteResource(ids[3]);
+  t->ApplyLookupResources(s, NULL, internalIds, lookup, ResourceType_Patient, ids[3], 2);
+  ASSERT_EQ(1u, s.size());
+  ASSERT_EQ("patient4", s.front());
+  ASSERT_EQ(ids[4], internalIds.front());
+
+  t->ApplyLookupResources(s, NULL, internalIds, lookup, ResourceType_Patient, ids[4], 2);
+  ASSERT_TRUE(s.empty());
+
+  t->ApplyLookupResources(s, NULL, internalIds, lookup, ResourceType_Patient, 0, 0 /* no limit */);
+  ASSERT_EQ(4u, s.size());
+  ASSERT_EQ(4u, internalIds.size());
+  ASSERT_EQ("patient0", s.front());
+  ASSERT_EQ("patient4", s.back());
+
+  std::vector<std::string> values;
+  values.push_back("patient");  // Matches no patient ID
+  std::vector<DatabaseConstraint> lookup2;
+  lookup2.push_back(DatabaseConstraint(ResourceType_Patient, DICOM_TAG_PATIENT_ID, true /* identifier */,
+                                       ConstraintType_Equal, values, true, true));
+
+  t->ApplyLookupResources(s, NULL, internalIds, lookup2, ResourceType_Patient, 0, 0 /* no limit */);
+  ASSERT_TRUE(s.empty());
+
+  t->Commit(0);
+}
+
+
+namespace
+{
+  class ReadConnectionsBenchmark : public boost::noncopyable
+  {
+  private:
+    SQLiteDatabaseWrapper&  db_;
+    bool                    done_;
+    unsigned int            countResources_;
+    boost::mutex            mutex_;
+    uint64_t                countReads_;
+    uint64_t                countWrites_;
+
+    static void Reader(ReadConnectionsBenchmark* that)
+    {
+      TestDatabaseListener listener;
+      uint64_t count = 0;
+
+      while (!that->done_)
+      {
+        std::unique_ptr<IDatabaseWrapper::ITransaction> t(that->db_.StartTransaction(TransactionType_ReadOnly, listener));
+
+        int64_t id;
+        ResourceType type;
+        if (!t->LookupResource(id, type, "patient" + boost::lexical_cast<std::string>(count % that->countResources_)))
+        {
+          throw OrthancException(ErrorCode_InternalError);
+        }
+
+        std::list<std::string> patients;
+        t->GetAllPublicIds(patients, ResourceType_Patient, count % that->countResources_, 10);
+        t->Commit(0);
+        count++;
+      }
+
+      boost::mutex::scoped_lock lock(that->mutex_);
+      that->countReads_ += count;
+    }
+
+    static void Writer(ReadConnectionsBenchmark* that)
+    {
+      TestDatabaseListener listener;
+      uint64_t count = 0;
+
+      while (!that->done_)
+      {
+        std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> t(
+          dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(that->db_.StartTransaction(TransactionType_ReadWrite, listener)));
+        t->CreateResource("new" + boost::lexical_cast<std::string>(count), ResourceType_Patient);
+        t->Commit(0);
+        count++;
+      }
+
+      boost::mutex::scoped_lock lock(that->mutex_);
+      that->countWrites_ += count;
+    }
+
+  public:
+    ReadConnectionsBenchmark(SQLiteDatabaseWrapper& db,
+                             unsigned int countResources) :
+      db_(db),
+      done_(false),
+      countResources_(countResources),
+      countReads_(0),
+      countWrites_(0)
+    {
+      TestDatabaseListener listener;
+      std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> t(
+        dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(db_.StartTransaction(TransactionType_ReadWrite, listener)));
+
+      for (unsigned int i = 0; i < countResources; i++)
+      {
+        t->CreateResource("patient" + boost::lexical_cast<std::string>(i), ResourceType_Patient);
+      }
+
+      t->Commit(0);
+    }
+
+    void Run(unsigned int countReaders,
+             unsigned int durationMs)
+    {
+      std::vector<boost::thread*> threads;
+      threads.push_back(new boost::thread(Writer, this));
+
+      for (unsigned int i = 0; i < countReaders; i++)
+      {
+        threads.push_back(new boost::thread(Reader, this));
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(durationMs));
+      done_ = true;
+
+      for (size_t i = 0; i < threads.size(); i++)
+      {
+        threads[i]->join();
+        delete threads[i];
+      }
+    }
+
+    uint64_t GetCountReads() const
+    {
+      return countReads_;
+    }
+
+    uint64_t GetCountWrites() const
+    {
+      return countWrites_;
+    }
+  };
+}
+
+
+TEST(SQLiteDatabaseWrapper, DISABLED_ReadConnectionsBenchmark)
+{
+  // Mixed load: 1 writer thread, and 8 reader threads during 5 seconds
+  static const unsigned int READERS = 8;
+  static const unsigned int DURATION = 5000;
+
+  SystemToolbox::MakeDirectory("UnitTestsStorage");
+
+  for (unsigned int readConnections = 0; readConnections <= READERS; readConnections += READERS / 2)
+  {
+    const std::string path = "UnitTestsStorage/index-benchmark";
+    SystemToolbox::RemoveFile(path);
+    SystemToolbox::RemoveFile(path + "-wal");
+    SystemToolbox::RemoveFile(path + "-shm");
+
+    SQLiteDatabaseWrapper db(path);
+    db.SetReadConnectionsCount(readConnections);
+    db.Open();
+
+    {
+      ReadConnectionsBenchmark benchmark(db, 10000);
+      benchmark.Run(READERS, DURATION);
+
+      LOG(WARNING) << "Read connections: " << readConnections << " => "
+                   << (benchmark.GetCountReads() * 1000 / DURATION) << " reads/s, "
+                   << (benchmark.GetCountWrites() * 1000 / DURATION) << " writes/s";
+    }
+
+    db.Close();
+  }
+}
+
+
+TEST(RenderedImageCache, Memory)
+{
+  RenderedImageCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  const std::string a1 = RenderedImageCache::ComputeKey("a", "1");
+  const std::string a2 = RenderedImageCache::ComputeKey("a", "2");
+  const std::string b1 = RenderedImageCache::ComputeKey("b", "1");
+  ASSERT_NE(a1, a2);
+  ASSERT_EQ(0u, a1.find("a/"));
+
+  std::string s;
+  cache.Add(a1, "hello");
+  ASSERT_FALSE(cache.Fetch(s, a1));  // The cache is disabled
+
+  cache.SetMemorySize(10);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  cache.Add(a1, "hello");
+  cache.Add(a2, "world");
+  ASSERT_TRUE(cache.Fetch(s, a1));  ASSERT_EQ("hello", s);
+  ASSERT_TRUE(cache.Fetch(s, a2));  ASSERT_EQ("world", s);
+
+  cache.Add(b1, "!");  // Evicts "a1", the least recently used entry
+  ASSERT_FALSE(cache.Fetch(s, a1));
+  ASSERT_TRUE(cache.Fetch(s, a2));
+  ASSERT_TRUE(cache.Fetch(s, b1));  ASSERT_EQ("!", s);
+
+  cache.Add(a1, "too large entry");
+  ASSERT_FALSE(cache.Fetch(s, a1));
+
+  cache.InvalidateInstance("a");
+  ASSERT_FALSE(cache.Fetch(s, a2));
+  ASSERT_TRUE(cache.Fetch(s, b1));
+
+  cache.SignalChange(ServerIndexChange(ChangeType_Deleted, ResourceType_Series, "b"));
+  ASSERT_TRUE(cache.Fetch(s, b1));
+  cache.SignalChange(ServerIndexChange(ChangeType_Deleted, ResourceType_Instance, "b"));
+  ASSERT_FALSE(cache.Fetch(s, b1));
+
+  cache.SetMemorySize(0);
+  ASSERT_FALSE(cache.IsEnabled());
+}
+
+
+TEST(RenderedImageCache, Disk)
+{
+  const std::string directory = "UnitTestsStorage/rendered";
+
+  const std::string a1 = RenderedImageCache::ComputeKey("a", "1");
+  const std::string a2 = RenderedImageCache::ComputeKey("a", "2");
+  const std::string b1 = RenderedImageCache::ComputeKey("b", "1");
+
+  {
+    RenderedImageCache cache;
+    cache.SetDiskStorage(directory, 10);
+    cache.InvalidateInstance("a");
+    cache.InvalidateInstance("b");
+    ASSERT_TRUE(cache.IsEnabled());
+
+    std::string s;
+    cache.Add(a1, "hello");
+    cache.Add(a2, "world");
+    ASSERT_TRUE(cache.Fetch(s, a1));  ASSERT_EQ("hello", s);
+    ASSERT_TRUE(cache.Fetch(s, a2));  ASSERT_EQ("world", s);
+
+    cache.Add(b1, "!");  // Evicts "a1"
+    ASSERT_FALSE(cache.Fetch(s, a1));
+    ASSERT_TRUE(cache.Fetch(s, b1));
+  }
+
+  {
+    // The content of the directory is reused after a restart
+    RenderedImageCache cache;
+    cache.SetDiskStorage(directory, 10);
+
+    std::string s;
+    ASSERT_FALSE(cache.Fetch(s, a1));
+    ASSERT_TRUE(cache.Fetch(s, a2));  ASSERT_EQ("world", s);
+    ASSERT_TRUE(cache.Fetch(s, b1));  ASSERT_EQ("!", s);
+
+    cache.InvalidateInstance("a");
+    ASSERT_FALSE(cache.Fetch(s, a2));
+    ASSERT_TRUE(cache.Fetch(s, b1));
+  }
+
+  {
+    // The maximum size is enforced when reopening the directory
+    RenderedImageCache cache;
+    cache.SetDiskStorage(directory, 0);
+    ASSERT_FALSE(cache.IsEnabled());
+
+    std::string s;
+    ASSERT_FALSE(cache.Fetch(s, b1));
+
+    cache.SetDiskStorage(directory, 10);
+    cache.Add(a1, "0123456789");  // Evicts "b1"
+
+    cache.SetDiskStorage(directory, 5);  // Evicts "a1"
+    ASSERT_FALSE(cache.Fetch(s, a1));
+    ASSERT_FALSE(cache.Fetch(s, b1));
+
+    cache.SetDiskStorage(directory, 10);
+    ASSERT_FALSE(cache.Fetch(s, a1));
+    ASSERT_FALSE(cache.Fetch(s, b1));
+  }
+
+  {
+    // The reads from the disk tier are persisted across restarts
+    RenderedImageCache cache;
+    cache.SetDiskStorage(directory, 10);
+    cache.InvalidateInstance("a");
+    cache.Add(a1, "hello");
+    cache.Add(a2, "world");
+  }
+
+  {
+    // Pretend that "a1" was written before "a2"
+    const std::time_t now = std::time(NULL);
+    boost::filesystem::last_write_time(directory + "/a/a/" + a1.substr(2), now - 200);
+    boost::filesystem::last_write_time(directory + "/a/a/" + a2.substr(2), now - 100);
+
+    RenderedImageCache cache;
+    cache.SetDiskStorage(directory, 10);
+
+    std::string s;
+    ASSERT_TRUE(cache.Fetch(s, a1));  ASSERT_EQ("hello", s);
+  }
+
+  {
+    RenderedImageCache cache;
+    cache.SetDiskStorage(directory, 5);  // Evicts "a2", that was read less recently
+
+    std::string s;
+    ASSERT_TRUE(cache.Fetch(s, a1));  ASSERT_EQ("hello", s);
+    ASSERT_FALSE(cache.Fetch(s, a2));
+  }
+}
+
+
+TEST(ThumbnailsGenerator, Render)
+{
+  {
+    Image image(PixelFormat_Grayscale16, 300, 200, false);
+    for (unsigned int y = 0; y < image.GetHeight(); y++)
+    {
+      uint16_t* p = reinterpret_cast<uint16_t*>(image.GetRow(y));
+      for (unsigned int x = 0; x < image.GetWidth(); x++)
+      {
+        p[x] = 1000 + x * 10;
+      }
+    }
+
+    std::string jpeg;
+    ThumbnailsGenerator::RenderThumbnail(jpeg, image, false, 100, 90);
+
+    JpegReader reader;
+    reader.ReadFromMemory(jpeg);
+    ASSERT_EQ(PixelFormat_Grayscale8, reader.GetFormat());
+    ASSERT_EQ(100u, reader.GetWidth());
+    ASSERT_EQ(67u, reader.GetHeight());
+
+    // The full dynamic range is stretched to [0,255]
+    const uint8_t* row = reinterpret_cast<const uint8_t*>(reader.GetConstRow(33));
+    ASSERT_GE(5, row[0]);
+    ASSERT_LE(250, row[99]);
+  }
+
+  {
+    // MONOCHROME1 image with a constant value
+    Image image(PixelFormat_SignedGrayscale16, 10, 20, false);
+    ImageProcessing::Set(image, -100);
+
+    std::string jpeg;
+    ThumbnailsGenerator::RenderThumbnail(jpeg, image, true, 100, 90);
+
+    JpegReader reader;
+    reader.ReadFromMemory(jpeg);
+    ASSERT_EQ(10u, reader.GetWidth());
+    ASSERT_EQ(20u, reader.GetHeight());
+
+    int64_t a, b;
+    ImageProcessing::GetMinMaxIntegerValue(a, b, reader);
+    ASSERT_LE(250, a);
+  }
+
+  {
+    Image image(PixelFormat_RGB24, 64, 256, false);
+    ImageProcessing::Set(image, 255, 0, 0, 255);
+
+    std::string jpeg;
+    ThumbnailsGenerator::RenderThumbnail(jpeg, image, false, 32, 90);
+
+    JpegReader reader;
+    reader.ReadFromMemory(jpeg);
+    ASSERT_EQ(PixelFormat_RGB24, reader.GetFormat());
+    ASSERT_EQ(8u, reader.GetWidth());
+    ASSERT_EQ(32u, reader.GetHeight());
+  }
+}
+
+
+namespace
+{
+  class ChangesRecorder : public IServerListener
+  {
+  private:
+    boost::mutex                                    mutex_;
+    std::map<std::string, std::vector<int64_t> >    received_;
+    bool                                            blocked_;
+    bool                                            entered_;
+
+  public:
+    ChangesRecorder() :
+      blocked_(false),
+      entered_(false)
+    {
+    }
+
+    void SetBlocked(bool blocked)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      blocked_ = blocked;
+    }
+
+    bool HasEntered()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return entered_;
+    }
+
+    size_t GetReceivedCount()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      size_t count = 0;
+      for (std::map<std::string, std::vector<int64_t> >::const_iterator
+             it = received_.begin(); it != received_.end(); ++it)
+      {
+        count += it->second.size();
+      }
+
+      return count;
+    }
+
+    bool IsOrdered()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (std::map<std::string, std::vector<int64_t> >::const_iterator
+             it = received_.begin(); it != received_.end(); ++it)
+      {
+        for (size_t i = 1; i < it->second.size(); i++)
+        {
+          if (it->second[i - 1] >= it->second[i])
+          {
+            return false;
+          }
+        }
+      }
+
+      return true;
+    }
+
+    virtual void SignalStoredInstance(const std::string& /* publicId */,
+                                      const DicomInstanceToStore& /* instance */,
+                                      const Json::Value& /* simplifiedTags */) ORTHANC_OVERRIDE
+    {
+    }
+
+    virtual void SignalChange(const ServerIndexChange& change) ORTHANC_OVERRIDE
+    {
+      for (;;)
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          entered_ = true;
+
+          if (!blocked_)
+          {
+            received_[change.GetPublicId()].push_back(change.GetSeq());
+            return;
+          }
+        }
+
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      }
+    }
+
+    virtual bool FilterIncomingInstance(const DicomInstanceToStore& /* instance */,
+                                        const Json::Value& /* simplified */) ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual bool FilterIncomingCStoreInstance(uint16_t& /* dimseStatus */,
+                                              const DicomInstanceToStore& /* instance */,
+                                              const Json::Value& /* simplified */) ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+  };
+}
+
+
+static void WaitChangesDelivered(ChangesDispatcher& dispatcher)
+{
+  for (unsigned int i = 0; i < 500 && dispatcher.GetPendingCount() != 0; i++)
+  {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+}
+
+
+TEST(ChangesDispatcher, Ordering)
+{
+  ChangesRecorder recorder;
+  ChangesDispatcher dispatcher(recorder, "test", 4, 0, ChangesDispatcher::OverflowPolicy_Block);
+
+  for (int64_t seq = 0; seq < 1000; seq++)
+  {
+    const std::string id = "resource" + boost::lexical_cast<std::string>(seq % 7);
+    dispatcher.Enqueue(ServerIndexChange(seq, ChangeType_NewInstance, ResourceType_Instance, id, "20221017T120000"));
+  }
+
+  WaitChangesDelivered(dispatcher);
+  ASSERT_EQ(0u, dispatcher.GetPendingCount());
+  ASSERT_EQ(0u, dispatcher.GetDroppedCount());
+  ASSERT_EQ(0u, dispatcher.GetLagMilliseconds());
+  ASSERT_EQ(1000u, recorder.GetReceivedCount());
+  ASSERT_TRUE(recorder.IsOrdered());
+}
+
+
+TEST(ChangesDispatcher, Overflow)
+{
+  ChangesRecorder recorder;
+  recorder.SetBlocked(true);
+
+  ChangesDispatcher dispatcher(recorder, "test", 1, 2, ChangesDispatcher::OverflowPolicy_DropOldest);
+  dispatcher.Enqueue(ServerIndexChange(0, ChangeType_NewInstance, ResourceType_Instance, "a", "20221017T120000"));
+
+  while (!recorder.HasEntered())
+  {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  }
+
+  // The first change is being delivered, only the 2 last changes are kept in the queue
+  for (int64_t seq = 1; seq < 10; seq++)
+  {
+    dispatcher.Enqueue(ServerIndexChange(seq, ChangeType_NewInstance, ResourceType_Instance, "a", "20221017T120000"));
+  }
+
+  ASSERT_EQ(3u, dispatcher.GetPendingCount());
+  ASSERT_EQ(7u, dispatcher.GetDroppedCount());
+
+  recorder.SetBlocked(false);
+  WaitChangesDelivered(dispatcher);
+
+  ASSERT_EQ(3u, recorder.GetReceivedCount());
+  ASSERT_TRUE(recorder.IsOrdered());
+  ASSERT_EQ(7u, dispatcher.GetDroppedCount());
+
+  dispatcher.Stop();
+  dispatcher.Enqueue(ServerIndexChange(10, ChangeType_NewInstance, ResourceType_Instance, "a", "20221017T120000"));
+  ASSERT_EQ(0u, dispatcher.GetPendingCount());
+}
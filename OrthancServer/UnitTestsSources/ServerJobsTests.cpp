@@ -804,6 +804,37 @@ TEST_F(OrthancJobsSerialization, Jobs)
     ASSERT_FALSE(tmp.GetPeer().IsPkcs11Enabled());
     ASSERT_TRUE(tmp.IsTranscode());
     ASSERT_EQ(DicomTransferSyntax_JPEGProcess1, tmp.GetTransferSyntax());
+    ASSERT_FALSE(tmp.IsBatched());
+    ASSERT_EQ(9u, tmp.GetCompressionLevel());
+  }
+
+  {
+    OrthancPeerStoreJob job(GetContext());
+    ASSERT_THROW(job.SetCompressionLevel(10), OrthancException);
+    ASSERT_THROW(job.SetBatchSize(0), OrthancException);
+    ASSERT_THROW(job.SetBatchThreads(0), OrthancException);
+    job.SetCompress(true);
+    job.SetCompressionLevel(1);
+    job.SetBatchInstances(100);
+    job.SetBatchSize(static_cast<uint64_t>(5) * 1024 * 1024 * 1024);
+    job.SetBatchThreads(4);
+    ASSERT_TRUE(job.IsBatched());
+
+    ASSERT_TRUE(CheckIdempotentSetOfInstances(unserializer, job));
+    ASSERT_TRUE(job.Serialize(s));
+  }
+
+  {
+    std::unique_ptr<IJob> job;
+    job.reset(unserializer.UnserializeJob(s));
+
+    OrthancPeerStoreJob& tmp = dynamic_cast<OrthancPeerStoreJob&>(*job);
+    ASSERT_TRUE(tmp.IsCompress());
+    ASSERT_EQ(1u, tmp.GetCompressionLevel());
+    ASSERT_TRUE(tmp.IsBatched());
+    ASSERT_EQ(100u, tmp.GetBatchInstances());
+    ASSERT_EQ(static_cast<uint64_t>(5) * 1024 * 1024 * 1024, tmp.GetBatchSize());
+    ASSERT_EQ(4u, tmp.GetBatchThreads());
   }
 
   // ResourceModificationJob
@@ -1220,6 +1251,79 @@ TEST_F(OrthancJobsSerialization, DicomAssociationParameters)
 }
 
 
+TEST_F(OrthancJobsSerialization, DicomModalityStoreJobParallel)
+{
+  std::string id;
+  ASSERT_TRUE(CreateInstance(id));
+
+  // No modality listens on this port: Sending "id" fails with a
+  // network error, whereas "nope*" are reported as removed instances
+  RemoteModalityParameters remote;
+  remote.SetApplicationEntityTitle("NOPE");
+  remote.SetHost("127.0.0.1");
+  remote.SetPortNumber(1);
+  remote.SetStoreAssociations(3);
+
+  {
+    // The outcome of the first instance prevails
+    DicomModalityStoreJob job(GetContext());
+    job.SetRemoteModality(remote);
+    job.SetTimeout(1);
+    job.AddInstance(id);
+    job.AddInstance("nope");
+    job.Start();
+
+    JobStepResult result = job.Step("jobId");
+    ASSERT_EQ(JobStepCode_Failure, result.GetCode());
+    ASSERT_NE(ErrorCode_InternalError, result.GetFailureCode());
+    ASSERT_FALSE(job.IsFailedInstance("nope"));
+    ASSERT_EQ(0u, job.GetPosition());
+  }
+
+  {
+    DicomModalityStoreJob job(GetContext());
+    job.SetRemoteModality(remote);
+    job.SetTimeout(1);
+    job.AddInstance("nope");
+    job.AddInstance(id);
+    job.Start();
+
+    JobStepResult result = job.Step("jobId");
+    ASSERT_EQ(JobStepCode_Failure, result.GetCode());
+    ASSERT_EQ(ErrorCode_InternalError, result.GetFailureCode());
+    ASSERT_TRUE(job.IsFailedInstance("nope"));
+    ASSERT_EQ(0u, job.GetPosition());
+  }
+
+  {
+    DicomModalityStoreJob job(GetContext());
+    job.SetRemoteModality(remote);
+    job.SetTimeout(1);
+    job.SetPermissive(true);
+    job.AddInstance("nope1");
+    job.AddInstance(id);
+    job.AddInstance("nope2");
+    job.AddInstance("nope3");
+    job.Start();
+
+    // The associations and their threads are reused by the second step
+    ASSERT_EQ(JobStepCode_Continue, job.Step("jobId").GetCode());
+    ASSERT_EQ(3u, job.GetPosition());
+    ASSERT_EQ(2u, job.GetFailedInstances().size());
+    ASSERT_TRUE(job.IsFailedInstance("nope1"));
+    ASSERT_FALSE(job.IsFailedInstance(id));
+    ASSERT_TRUE(job.IsFailedInstance("nope2"));
+
+    ASSERT_EQ(JobStepCode_Success, job.Step("jobId").GetCode());
+    ASSERT_EQ(4u, job.GetPosition());
+    ASSERT_EQ(3u, job.GetFailedInstances().size());
+    ASSERT_TRUE(job.IsFailedInstance("nope3"));
+
+    job.Stop(JobStopReason_Success);
+  }
+}
+
+
 TEST_F(OrthancJobsSerialization, DicomMoveScuJob)
 {
   Json::Value command = Json::objectValue;